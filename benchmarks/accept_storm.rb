@@ -0,0 +1,104 @@
+# Measures how many connections a server accepts per second while a storm
+# of clients connects, sends a line and hangs up, with different
+# EM.start_server_with_options listener options.
+#
+#   ruby -Ilib benchmarks/accept_storm.rb [connections]
+#
+# The server and the storm run in separate processes.
+
+require 'eventmachine'
+require 'rbconfig'
+require 'json'
+
+PORT = (ENV['STORM_PORT'] ||= (20_000 + rand(10_000)).to_s).to_i
+STORM_CONCURRENCY = 500
+
+CONFIGS = {
+  'default'      => {},
+  'backlog'      => { backlog: 4096 },
+  'defer_accept' => { backlog: 4096, defer_accept: 5 },
+  'fastopen'     => { backlog: 4096, defer_accept: 5, fastopen: 256 },
+}
+
+module Server
+  def receive_data(data)
+    close_connection
+  end
+end
+
+# Connects, sends a line, and waits for the server to hang up.
+module StormClient
+  def initialize(storm)
+    @storm = storm
+  end
+
+  def post_init
+    send_data "hello\n"
+  end
+
+  def unbind
+    @storm[:finished] += 1
+    @storm[:next].call
+  end
+end
+
+def run_server(options)
+  EM.run { EM.start_server_with_options '127.0.0.1', PORT, JSON.parse(options, symbolize_names: true), Server }
+end
+
+def run_storm(count)
+  storm = { started: 0, finished: 0 }
+  EM.set_descriptor_table_size(STORM_CONCURRENCY * 2)
+  EM.run do
+    storm[:next] = proc do
+      if storm[:started] < count
+        storm[:started] += 1
+        EM.connect '127.0.0.1', PORT, StormClient, storm
+      elsif storm[:finished] == count
+        EM.stop
+      end
+    end
+    STORM_CONCURRENCY.times { storm[:next].call }
+  end
+end
+
+def spawn_self(*args)
+  Process.spawn(RbConfig.ruby, '-I', File.expand_path('../lib', __dir__), __FILE__, *args.map(&:to_s))
+end
+
+def wait_for_server
+  50.times do
+    begin
+      TCPSocket.new('127.0.0.1', PORT).close
+      return
+    rescue Errno::ECONNREFUSED
+      sleep 0.1
+    end
+  end
+  abort "server didn't start"
+end
+
+def measure(name, options, connections)
+  server = spawn_self('--server', options.to_json)
+  wait_for_server
+
+  started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  Process.wait(spawn_self('--storm', connections))
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+
+  Process.kill(:TERM, server)
+  Process.wait(server)
+
+  format("%-14s %8.2fs %12.0f", name, elapsed, connections / elapsed)
+end
+
+case ARGV[0]
+when '--server' then run_server(ARGV[1])
+when '--storm' then run_storm(ARGV[1].to_i)
+else
+  connections = (ARGV[0] || 20_000).to_i
+
+  puts "#{connections} connections, #{STORM_CONCURRENCY} at a time"
+  puts "", format("%-14s %9s %12s", 'options', 'storm', 'accepted/s')
+  CONFIGS.each { |name, options| puts measure(name, options, connections) }
+end
@@ -0,0 +1,34 @@
+# Compares EventMachine::Tokenizer (native) with EventMachine::PureRubyTokenizer
+# over a stream of lines fed in network-sized chunks.
+#
+#   ruby -Ilib benchmarks/buftok.rb [megabytes]
+
+require 'eventmachine'
+require 'benchmark'
+
+abort "EventMachine::Tokenizer is unavailable (pure-Ruby or Java reactor?)" unless defined?(EventMachine::Tokenizer)
+
+MEGABYTES = (ARGV[0] || 32).to_i
+CHUNK_SIZE = 16 * 1024
+
+def chunks_for(line_size)
+  line = ('x' * (line_size - 2)) << "\r\n"
+  stream = line * ((MEGABYTES * 1024 * 1024) / line.bytesize)
+  (0...stream.bytesize).step(CHUNK_SIZE).map { |i| stream.byteslice(i, CHUNK_SIZE) }
+end
+
+puts "#{MEGABYTES}MB per run, fed in #{CHUNK_SIZE} byte chunks"
+
+[16, 80, 512, 4096, 65536].each do |line_size|
+  chunks = chunks_for(line_size)
+  puts "", "line size #{line_size}:"
+
+  Benchmark.bm(22) do |bm|
+    [EventMachine::PureRubyTokenizer, EventMachine::Tokenizer].each do |klass|
+      bm.report(klass.name.split('::').last) do
+        tokenizer = klass.new("\r\n")
+        chunks.each { |chunk| tokenizer.extract(chunk) }
+      end
+    end
+  end
+end
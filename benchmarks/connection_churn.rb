@@ -0,0 +1,141 @@
+# Measures what connections cost the reactor: the memory each idle
+# connection holds on the server, and how many connections a second can be
+# opened and closed again.
+#
+#   ruby -Ilib benchmarks/connection_churn.rb [idle connections] [churn connections]
+#
+# The idle server runs in its own process, so that only its memory is
+# counted; the churn runs both ends in this one.
+
+require 'eventmachine'
+require 'rbconfig'
+
+PORT = (ENV['CHURN_PORT'] ||= (20_000 + rand(10_000)).to_s).to_i
+CONCURRENCY = 200
+
+module Idle
+end
+
+# Reports the server's resident memory each time it's asked.
+module Reporter
+  def receive_data(data)
+    send_data "#{rss}\n"
+  end
+end
+
+def rss
+  File.read('/proc/self/statm').split[1].to_i * 4096
+end
+
+def run_idle_server(count)
+  EM.set_descriptor_table_size(count + 100)
+  EM.run do
+    EM.start_server '127.0.0.1', PORT, Idle
+    EM.start_server '127.0.0.1', PORT + 1, Reporter
+  end
+end
+
+# Asks the server for its memory, then yields it.
+module Probe
+  def initialize(reply)
+    @reply = reply
+  end
+
+  def post_init
+    send_data "?\n"
+  end
+
+  def receive_data(data)
+    close_connection
+    @reply.call data.to_i
+  end
+end
+
+def wait_for_server
+  50.times do
+    begin
+      TCPSocket.new('127.0.0.1', PORT + 1).close
+      return
+    rescue Errno::ECONNREFUSED
+      sleep 0.1
+    end
+  end
+  abort "server didn't start"
+end
+
+def measure_idle(count)
+  server = Process.spawn(RbConfig.ruby, '-I', File.expand_path('../lib', __dir__), __FILE__, '--idle-server', count.to_s)
+  wait_for_server
+
+  before, after = nil, nil
+  EM.set_descriptor_table_size(count + 100)
+  EM.run do
+    EM.connect '127.0.0.1', PORT + 1, Probe, proc { |b|
+      before = b
+      opened = 0
+      open_some = proc do
+        CONCURRENCY.times do
+          break if opened == count
+          EM.connect '127.0.0.1', PORT, Idle
+          opened += 1
+        end
+        if opened < count
+          EM.next_tick(open_some)
+        else
+          EM.add_timer(1) { EM.connect '127.0.0.1', PORT + 1, Probe, proc { |a| after = a; EM.stop } }
+        end
+      end
+      open_some.call
+    }
+  end
+
+  Process.kill(:TERM, server)
+  Process.wait(server)
+  (after - before).to_f / count
+end
+
+module Server
+  def post_init
+    close_connection
+  end
+end
+
+module Churner
+  def initialize(churn)
+    @churn = churn
+  end
+
+  def unbind
+    @churn[:finished] += 1
+    @churn[:next].call
+  end
+end
+
+def measure_churn(count)
+  churn = { started: 0, finished: 0 }
+  started = nil
+  EM.run do
+    EM.start_server '127.0.0.1', PORT + 2, Server
+    started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    churn[:next] = proc do
+      if churn[:started] < count
+        churn[:started] += 1
+        EM.connect '127.0.0.1', PORT + 2, Churner, churn
+      elsif churn[:finished] == count
+        EM.stop
+      end
+    end
+    CONCURRENCY.times { churn[:next].call }
+  end
+  count / (Process.clock_gettime(Process::CLOCK_MONOTONIC) - started)
+end
+
+if ARGV[0] == '--idle-server'
+  run_idle_server(ARGV[1].to_i)
+else
+  idle = (ARGV[0] || 5000).to_i
+  churn = (ARGV[1] || 50_000).to_i
+
+  puts format("%-28s %10.0f", "bytes per idle connection", measure_idle(idle))
+  puts format("%-28s %10.0f", "connections opened/closed/s", measure_churn(churn))
+end
@@ -0,0 +1,61 @@
+# Compares the native EventMachine::HttpResponseParser with
+# EventMachine::PureRubyHttpResponseParser on pipelined keep-alive responses
+# fed in network-sized chunks.
+#
+#   ruby -Ilib benchmarks/http_response_parser.rb [megabytes]
+
+require 'eventmachine'
+require 'benchmark'
+
+abort "the native HttpResponseParser is unavailable (pure-Ruby or Java reactor?)" if EventMachine::HttpResponseParser == EventMachine::PureRubyHttpResponseParser
+
+MEGABYTES = (ARGV[0] || 32).to_i
+CHUNK_SIZE = 16 * 1024
+
+def response(headers, body, chunked = false)
+  head = "HTTP/1.1 200 OK\r\n" + headers.map { |n, v| "#{n}: #{v}\r\n" }.join
+  if chunked
+    head + "Transfer-Encoding: chunked\r\n\r\n" + body.bytesize.to_s(16) + "\r\n" + body + "\r\n0\r\n\r\n"
+  else
+    head + "Content-Length: #{body.bytesize}\r\n\r\n" + body
+  end
+end
+
+TYPICAL_HEADERS = [
+  ['Date', 'Sat, 17 Oct 2026 12:00:00 GMT'],
+  ['Server', 'nginx'],
+  ['Content-Type', 'application/json; charset=utf-8'],
+  ['Connection', 'keep-alive'],
+  ['Cache-Control', 'no-cache'],
+  ['X-Request-Id', 'f0e1d2c3-b4a5-9687-7869-5a4b3c2d1e0f'],
+]
+
+LARGE_HEADERS = TYPICAL_HEADERS + (1..40).map { |i| ["X-Trace-#{i}", 'a' * 120] } +
+  [['Set-Cookie', 'session=' + ('c' * 2000)]]
+
+SCENARIOS = {
+  'typical, 200 byte body'     => response(TYPICAL_HEADERS, '{"ok":true}' * 18),
+  'typical, chunked 2K body'   => response(TYPICAL_HEADERS, 'x' * 2048, true),
+  'large headers, 200 bytes'   => response(LARGE_HEADERS, '{"ok":true}' * 18),
+  'typical, 64K body'          => response(TYPICAL_HEADERS, 'x' * 65536),
+}
+
+puts "#{MEGABYTES}MB of pipelined responses per run, fed in #{CHUNK_SIZE} byte chunks"
+
+SCENARIOS.each do |title, one|
+  count = (MEGABYTES * 1024 * 1024) / one.bytesize
+  stream = one * count
+  chunks = (0...stream.bytesize).step(CHUNK_SIZE).map { |i| stream.byteslice(i, CHUNK_SIZE) }
+  puts "", "#{title} (#{one.bytesize} bytes each, #{count} responses):"
+
+  Benchmark.bm(26) do |bm|
+    [EventMachine::PureRubyHttpResponseParser, EventMachine::HttpResponseParser].each do |klass|
+      bm.report(klass.name.split('::').last) do
+        parser = klass.new
+        parsed = 0
+        chunks.each { |chunk| parsed += parser.parse(chunk).size }
+        raise "parsed #{parsed} of #{count}" unless parsed == count
+      end
+    end
+  end
+end
@@ -0,0 +1,153 @@
+# Measures echo latency on established TLS connections while a storm of new
+# clients handshakes with the same server, with handshakes on the reactor
+# thread and on EM.set_tls_handshake_threads threads.
+#
+#   ruby -Ilib benchmarks/tls_handshake_storm.rb [handshakes] [threads ...]
+#
+# The server, the storm and the latency probes run in separate processes.
+
+require 'eventmachine'
+require 'rbconfig'
+
+CERT_FILE = File.expand_path('../tests/client.crt', __dir__)
+PRIVATE_KEY_FILE = File.expand_path('../tests/client.key', __dir__)
+PORT = (ENV['STORM_PORT'] ||= (20_000 + rand(10_000)).to_s).to_i
+PROBES = 10
+PROBE_INTERVAL = 0.01
+STORM_CONCURRENCY = 200
+
+module EchoServer
+  def post_init
+    start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE
+  end
+
+  def receive_data(data)
+    send_data data
+  end
+end
+
+# Connects, handshakes and hangs up, then makes way for the next one.
+module StormClient
+  def initialize(storm)
+    @storm = storm
+  end
+
+  def post_init
+    start_tls
+  end
+
+  def ssl_handshake_completed
+    close_connection
+  end
+
+  def unbind
+    @storm[:finished] += 1
+    @storm[:next].call
+  end
+end
+
+# Sends a ping every PROBE_INTERVAL, unless the last one is still
+# outstanding, and records how long the echo took.
+module Probe
+  def initialize(rtts, ready)
+    @rtts, @ready = rtts, ready
+  end
+
+  def post_init
+    start_tls
+  end
+
+  def ssl_handshake_completed
+    @ready.call
+  end
+
+  def ping
+    return if @sent
+    @sent = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    send_data 'x' * 64
+  end
+
+  def receive_data(data)
+    @rtts << Process.clock_gettime(Process::CLOCK_MONOTONIC) - @sent if @sent
+    @sent = nil
+  end
+end
+
+def run_server(threads)
+  EM.set_tls_handshake_threads threads
+  EM.run { EM.start_server '127.0.0.1', PORT, EchoServer }
+end
+
+def run_storm(count)
+  storm = { started: 0, finished: 0 }
+  EM.run do
+    storm[:next] = proc do
+      if storm[:started] < count
+        storm[:started] += 1
+        EM.connect '127.0.0.1', PORT, StormClient, storm
+      elsif storm[:finished] == count
+        EM.stop
+      end
+    end
+    STORM_CONCURRENCY.times { storm[:next].call }
+  end
+end
+
+def spawn_self(*args)
+  Process.spawn(RbConfig.ruby, '-I', File.expand_path('../lib', __dir__), __FILE__, *args.map(&:to_s))
+end
+
+def wait_for_server
+  50.times do
+    begin
+      TCPSocket.new('127.0.0.1', PORT).close
+      return
+    rescue Errno::ECONNREFUSED
+      sleep 0.1
+    end
+  end
+  abort "server didn't start"
+end
+
+def measure(threads, handshakes)
+  server = spawn_self('--server', threads)
+  wait_for_server
+
+  rtts, storm, elapsed = [], nil, nil
+  EM.run do
+    ready = 0
+    probes = Array.new(PROBES) do
+      EM.connect '127.0.0.1', PORT, Probe, rtts, proc {
+        next unless (ready += 1) == PROBES
+        started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+        storm = spawn_self('--storm', handshakes)
+        EM.add_periodic_timer(PROBE_INTERVAL) { probes.each(&:ping) }
+        EM.add_periodic_timer(0.05) do
+          if Process.wait(storm, Process::WNOHANG)
+            elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+            EM.stop
+          end
+        end
+      }
+    end
+  end
+
+  Process.kill(:TERM, server)
+  Process.wait(server)
+
+  rtts.sort!
+  pct = ->(p) { rtts[((rtts.size - 1) * p).round] * 1000 }
+  format("%-8d %8.2fs %8d %9.3f %9.3f %9.3f", threads, elapsed, rtts.size, pct[0.5], pct[0.99], rtts.last * 1000)
+end
+
+case ARGV[0]
+when '--server' then run_server(ARGV[1].to_i)
+when '--storm' then run_storm(ARGV[1].to_i)
+else
+  handshakes = (ARGV[0] || 5000).to_i
+  thread_counts = ARGV[1..-1].empty? ? [0, 4] : ARGV[1..-1].map(&:to_i)
+
+  puts "#{handshakes} handshakes, #{STORM_CONCURRENCY} at a time; #{PROBES} established connections echoing every #{(PROBE_INTERVAL * 1000).round}ms"
+  puts "", format("%-8s %9s %8s %9s %9s %9s", 'threads', 'storm', 'echoes', 'p50 ms', 'p99 ms', 'max ms')
+  thread_counts.each { |threads| puts measure(threads, handshakes) }
+end
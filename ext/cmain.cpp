@@ -136,6 +136,112 @@ extern "C" const uintptr_t evma_connect_to_unix_server (const char *server)
 	return EventMachine->ConnectToUnixServer (server);
 }
 
+/*****************
+evma_pool_connect
+*****************/
+
+extern "C" const uintptr_t evma_pool_connect (const char *key, const char *server, int port)
+{
+	ensure_eventmachine("evma_pool_connect");
+	return EventMachine->PooledConnect (key, server, port);
+}
+
+/*****************
+evma_pool_release
+*****************/
+
+extern "C" int evma_pool_release (const uintptr_t binding)
+{
+	ensure_eventmachine("evma_pool_release");
+	return EventMachine->ReleaseToPool (binding) ? 1 : 0;
+}
+
+/******************************
+evma_get_pool_connection_state
+******************************/
+
+extern "C" int evma_get_pool_connection_state (const uintptr_t binding)
+{
+	// 0 for a new connection, 1 for one out of the pool, 2 for one still waiting.
+	ensure_eventmachine("evma_get_pool_connection_state");
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (!cd)
+		throw std::runtime_error ("invalid binding to get_pool_connection_state");
+	if (cd->IsPoolWaiting())
+		return 2;
+	return cd->IsReused() ? 1 : 0;
+}
+
+/********************
+evma_set_pool_limits
+********************/
+
+extern "C" void evma_set_pool_limits (int max_per_host, float idle_timeout)
+{
+	ConnectionPool_t::SetLimits (max_per_host, (idle_timeout > 0) ? (uint64_t)(idle_timeout * 1000000) : 0);
+}
+
+/*******************
+evma_get_pool_stats
+*******************/
+
+extern "C" void evma_get_pool_stats (ConnectionPoolStats_t *stats)
+{
+	memset (stats, 0, sizeof(*stats));
+	if (EventMachine && EventMachine->GetConnectionPool())
+		EventMachine->GetConnectionPool()->GetStats (stats);
+}
+
+/***********************
+evma_connect_with_retry
+***********************/
+
+extern "C" const uintptr_t evma_connect_with_retry (const char *server, int port)
+{
+	ensure_eventmachine("evma_connect_with_retry");
+	return EventMachine->ConnectWithRedial (server, port);
+}
+
+/**********************
+evma_connect_fast_open
+**********************/
+
+extern "C" const uintptr_t evma_connect_fast_open (const char *server, int port)
+{
+	ensure_eventmachine("evma_connect_fast_open");
+	return EventMachine->ConnectToServer (NULL, 0, server, port, true);
+}
+
+/*************************
+evma_set_reconnect_policy
+*************************/
+
+extern "C" void evma_set_reconnect_policy (float base_delay, float max_delay, float jitter, int max_attempts, int breaker_threshold, float breaker_timeout)
+{
+	ReconnectPolicy_t &policy = CircuitBreakers_t::Policy;
+	policy.BaseDelay = (base_delay > 0) ? (uint64_t)(base_delay * 1000000) : 0;
+	policy.MaxDelay = (max_delay > 0) ? (uint64_t)(max_delay * 1000000) : 0;
+	policy.Jitter = (jitter < 0) ? 0 : ((jitter > 1) ? 1 : jitter);
+	policy.MaxAttempts = (max_attempts > 0) ? max_attempts : 0;
+	policy.BreakerThreshold = (breaker_threshold > 0) ? breaker_threshold : 0;
+	policy.BreakerTimeout = (breaker_timeout > 0) ? (uint64_t)(breaker_timeout * 1000000) : 0;
+}
+
+/************************
+evma_get_redial_attempts
+************************/
+
+extern "C" int evma_get_redial_attempts (const uintptr_t binding)
+{
+	ensure_eventmachine("evma_get_redial_attempts");
+	#ifdef OS_UNIX
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (cd)
+		return cd->GetRedialAttempts();
+	#endif
+	return 0;
+}
+
 /**************
 evma_attach_fd
 **************/
@@ -283,10 +389,57 @@ extern "C" int evma_num_close_scheduled ()
 evma_create_tcp_server
 **********************/
 
-extern "C" const uintptr_t evma_create_tcp_server (const char *address, int port)
+extern "C" const uintptr_t evma_create_tcp_server (const char *address, int port, const ListenerOptions_t *options)
 {
+	// options may be NULL for the defaults.
 	ensure_eventmachine("evma_create_tcp_server");
-	return EventMachine->CreateTcpServer (address, port);
+	return EventMachine->CreateTcpServer (address, port, options);
+}
+
+/*************************
+evma_set_admission_limits
+*************************/
+
+extern "C" void evma_set_admission_limits (const uintptr_t binding, const AdmissionLimits_t *limits)
+{
+	// limits may be NULL to lift them.
+	ensure_eventmachine("evma_set_admission_limits");
+	AcceptorDescriptor *ad = dynamic_cast <AcceptorDescriptor*> (Bindable_t::GetObject (binding));
+	if (!ad)
+		throw std::runtime_error ("invalid binding to set_admission_limits");
+	ad->SetAdmissionLimits (limits);
+}
+
+/************************
+evma_get_admission_stats
+************************/
+
+extern "C" void evma_get_admission_stats (const uintptr_t binding, AdmissionStats_t *stats)
+{
+	ensure_eventmachine("evma_get_admission_stats");
+	AcceptorDescriptor *ad = dynamic_cast <AcceptorDescriptor*> (Bindable_t::GetObject (binding));
+	if (!ad)
+		throw std::runtime_error ("invalid binding to get_admission_stats");
+	ad->GetAdmissionStats (stats);
+}
+
+/********************
+evma_set_rate_limits
+********************/
+
+extern "C" void evma_set_rate_limits (const uintptr_t binding, const RateLimits_t *limits)
+{
+	// On a connection, or a listener for all of its connections together. NULL lifts them.
+	ensure_eventmachine("evma_set_rate_limits");
+	EventableDescriptor *ed = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (binding));
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (ed);
+	AcceptorDescriptor *ad = dynamic_cast <AcceptorDescriptor*> (ed);
+	if (cd)
+		cd->SetRateLimits (limits);
+	else if (ad)
+		ad->SetRateLimits (limits);
+	else
+		throw std::runtime_error ("invalid binding to set_rate_limits");
 }
 
 /******************************
@@ -416,6 +569,12 @@ extern "C" void evma_close_connection (const uintptr_t binding, int after_writin
 {
 	ensure_eventmachine("evma_close_connection");
 	EventableDescriptor *ed = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (binding));
+	#ifdef OS_UNIX
+	// Closed from Ruby, it stays closed.
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (ed);
+	if (cd)
+		cd->CancelRedial();
+	#endif
 	if (ed)
 		ed->ScheduleClose (after_writing ? true : false);
 }
@@ -480,12 +639,12 @@ extern "C" void evma_start_tls (const uintptr_t binding)
 evma_set_tls_parms
 ******************/
 
-extern "C" void evma_set_tls_parms (const uintptr_t binding, const char *privatekey_filename, const char *privatekey, const char *privatekeypass, const char *certchain_filename, const char *cert, int verify_peer, int fail_if_no_peer_cert, const char *sni_hostname, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int ssl_version)
+extern "C" void evma_set_tls_parms (const uintptr_t binding, const char *privatekey_filename, const char *privatekey, const char *privatekeypass, const char *certchain_filename, const char *cert, int verify_peer, int fail_if_no_peer_cert, const char *sni_hostname, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int ssl_version, int ktls, int dynamic_records)
 {
 	ensure_eventmachine("evma_set_tls_parms");
 	EventableDescriptor *ed = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (binding));
 	if (ed)
-		ed->SetTlsParms (privatekey_filename, privatekey, privatekeypass, certchain_filename, cert, (verify_peer == 1 ? true : false), (fail_if_no_peer_cert == 1 ? true : false), sni_hostname, cipherlist, ecdh_curve, dhparam, ssl_version);
+		ed->SetTlsParms (privatekey_filename, privatekey, privatekeypass, certchain_filename, cert, (verify_peer == 1 ? true : false), (fail_if_no_peer_cert == 1 ? true : false), sni_hostname, cipherlist, ecdh_curve, dhparam, ssl_version, (ktls == 1 ? true : false), (dynamic_records == 1 ? true : false));
 }
 
 /******************
@@ -577,6 +736,83 @@ extern "C" void evma_accept_ssl_peer (const uintptr_t binding)
 }
 #endif
 
+/********************
+evma_get_ktls_status
+********************/
+
+#ifdef WITH_SSL
+extern "C" int evma_get_ktls_status (const uintptr_t binding)
+{
+	ensure_eventmachine("evma_get_ktls_status");
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (cd)
+		return cd->GetKtlsStatus();
+	return -1;
+}
+#endif
+
+/*******************
+evma_get_tls_memory
+*******************/
+
+#ifdef WITH_SSL
+extern "C" int evma_get_tls_memory (const uintptr_t binding)
+{
+	ensure_eventmachine("evma_get_tls_memory");
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (cd)
+		return cd->GetTlsMemory();
+	return -1;
+}
+#endif
+
+/******************
+evma_is_tls_shrunk
+******************/
+
+#ifdef WITH_SSL
+extern "C" int evma_is_tls_shrunk (const uintptr_t binding)
+{
+	ensure_eventmachine("evma_is_tls_shrunk");
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (cd)
+		return cd->IsTlsShrunk();
+	return -1;
+}
+#endif
+
+/************************
+evma_set_tls_ticket_keys
+************************/
+
+#ifdef WITH_SSL
+extern "C" void evma_set_tls_ticket_keys (const char *keys, int length)
+{
+	SslContext_t::SetTicketKeys (keys, length);
+}
+#endif
+
+/*************************
+evma_set_tls_session_cache
+*************************/
+
+#ifdef WITH_SSL
+extern "C" void evma_set_tls_session_cache (int size, int timeout)
+{
+	SslContext_t::SetSessionCacheLimits (size, timeout);
+}
+#endif
+
+/******************
+evma_get_tls_stats
+******************/
+
+extern "C" void evma_get_tls_stats (TlsStats_t *stats)
+{
+	ensure_eventmachine("evma_get_tls_stats");
+	*stats = EventMachine->TlsStats;
+}
+
 /*****************
 evma_get_peername
 *****************/
@@ -785,6 +1021,186 @@ extern "C" int evma_get_simultaneous_accept_count()
 }
 
 
+/**********************************
+evma_get/set_tls_handshake_threads
+**********************************/
+
+extern "C" void evma_set_tls_handshake_threads (int count)
+{
+	EventMachine_t::SetTlsHandshakeThreads (count);
+}
+
+extern "C" int evma_get_tls_handshake_threads()
+{
+	return EventMachine_t::GetTlsHandshakeThreads();
+}
+
+
+/*******************************
+evma_get/set_resolver_threads
+*******************************/
+
+extern "C" void evma_set_resolver_threads (int count)
+{
+	EventMachine_t::SetResolverThreads (count);
+}
+
+extern "C" int evma_get_resolver_threads()
+{
+	return EventMachine_t::GetResolverThreads();
+}
+
+
+/*************************************
+evma_get/set_connection_attempt_delay
+*************************************/
+
+extern "C" void evma_set_connection_attempt_delay (float seconds)
+{
+	EventMachine_t::SetConnectAttemptDelay ((seconds > 0) ? (uint64_t)(seconds * 1000000) : 0);
+}
+
+extern "C" float evma_get_connection_attempt_delay()
+{
+	return EventMachine_t::GetConnectAttemptDelay() / 1000000.0;
+}
+
+
+/**************************
+evma_get/set_dns_cache_ttl
+**************************/
+
+extern "C" void evma_set_dns_cache_ttl (float seconds)
+{
+	#ifdef OS_UNIX
+	DnsCache_t::SetTtl ((seconds > 0) ? (uint64_t)(seconds * 1000000) : 0);
+	#endif
+}
+
+extern "C" float evma_get_dns_cache_ttl()
+{
+	#ifdef OS_UNIX
+	return DnsCache_t::GetTtl() / 1000000.0;
+	#else
+	return 0;
+	#endif
+}
+
+
+/*****************************
+evma_get/set_dns_negative_ttl
+*****************************/
+
+extern "C" void evma_set_dns_negative_ttl (float seconds)
+{
+	#ifdef OS_UNIX
+	DnsCache_t::SetNegativeTtl ((seconds > 0) ? (uint64_t)(seconds * 1000000) : 0);
+	#endif
+}
+
+extern "C" float evma_get_dns_negative_ttl()
+{
+	#ifdef OS_UNIX
+	return DnsCache_t::GetNegativeTtl() / 1000000.0;
+	#else
+	return 0;
+	#endif
+}
+
+
+/************************
+evma_get_dns_cache_stats
+************************/
+
+extern "C" void evma_get_dns_cache_stats (DnsCacheStats_t *stats)
+{
+	memset (stats, 0, sizeof(*stats));
+	#ifdef OS_UNIX
+	DnsCache_t::GetStats (stats);
+	#endif
+}
+
+
+/*********************
+evma_dns_cache_lookup
+*********************/
+
+extern "C" int evma_dns_cache_lookup (const char *host, struct sockaddr_storage *addrs, int max)
+{
+	/* Returns how many addresses are cached for host (filling in at most
+	 * max of them), 0 if it's cached as not existing, or -1 if it isn't
+	 * cached.
+	 */
+	#ifdef OS_UNIX
+	std::vector<struct sockaddr_storage> found;
+	int count = DnsCache_t::Peek (host, found);
+	for (int i = 0; i < count && i < max; i++)
+		addrs[i] = found[i];
+	return count;
+	#else
+	return -1;
+	#endif
+}
+
+
+/********************
+evma_dns_cache_store
+********************/
+
+extern "C" void evma_dns_cache_store (const char *host, const struct sockaddr_storage *addrs, int count, float ttl)
+{
+	#ifdef OS_UNIX
+	if (ttl > 0)
+		DnsCache_t::Insert (host, std::vector<struct sockaddr_storage> (addrs, addrs + count), (uint64_t)(ttl * 1000000));
+	#endif
+}
+
+
+/****************************
+evma_get/set_tls_idle_shrink
+****************************/
+
+extern "C" void evma_set_tls_idle_shrink (float seconds)
+{
+	EventMachine_t::SetTlsIdleShrink ((seconds > 0) ? (uint64_t)(seconds * 1000000) : 0);
+}
+
+extern "C" float evma_get_tls_idle_shrink()
+{
+	return ((float)EventMachine_t::GetTlsIdleShrink() / 1000000);
+}
+
+
+/************************
+evma_preload_tls_context
+************************/
+
+extern "C" void evma_preload_tls_context (const char *privatekey_filename, const char *privatekey, const char *privatekeypass, const char *certchain_filename, const char *cert, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int ssl_version)
+{
+	ensure_eventmachine("evma_preload_tls_context");
+	#ifdef WITH_SSL
+	SslContext_t::Preload (privatekey_filename, privatekey, privatekeypass, certchain_filename, cert, cipherlist, ecdh_curve, dhparam, ssl_version);
+	#else
+	throw std::runtime_error ("TLS is not available");
+	#endif
+}
+
+
+/************************
+evma_reload_tls_contexts
+************************/
+
+extern "C" int evma_reload_tls_contexts (const char *filename)
+{
+	ensure_eventmachine("evma_reload_tls_contexts");
+	#ifdef WITH_SSL
+	return SslContext_t::Reload (filename);
+	#else
+	return 0;
+	#endif
+}
+
+
 /******************
 evma_setuid_string
 ******************/
@@ -998,6 +1414,32 @@ extern "C" unsigned long evma_proxied_bytes (const uintptr_t from)
 }
 
 
+/*********************
+evma_set_line_framing
+*********************/
+
+extern "C" void evma_set_line_framing (const uintptr_t binding, const char *delimiter, int delimiter_length, size_t max_length)
+{
+	ensure_eventmachine("evma_set_line_framing");
+	EventableDescriptor *ed = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (binding));
+	if (ed)
+		ed->SetLineFraming (delimiter, delimiter_length, max_length);
+}
+
+
+/***********************
+evma_set_length_framing
+***********************/
+
+extern "C" void evma_set_length_framing (const uintptr_t binding, int width, int big_endian, int offset, int adjustment, int strip, size_t max_frame_size)
+{
+	ensure_eventmachine("evma_set_length_framing");
+	EventableDescriptor *ed = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (binding));
+	if (ed)
+		ed->SetLengthFraming (width, big_endian ? true : false, offset, adjustment, strip, max_frame_size);
+}
+
+
 /***************************
 evma_get_last_activity_time
 ****************************/
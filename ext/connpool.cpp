@@ -0,0 +1,271 @@
+/*****************************************************************************
+
+$Id$
+
+File:     connpool.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#include "project.h"
+
+
+int ConnectionPool_t::MaxPerHost = 0;
+uint64_t ConnectionPool_t::IdleTimeout = 30000000; // 30 seconds
+
+
+/**********************************
+ConnectionPool_t::ConnectionPool_t
+**********************************/
+
+ConnectionPool_t::ConnectionPool_t (EventMachine_t *em):
+	MyEventMachine (em),
+	Created (0),
+	Reused (0),
+	Discarded (0)
+{
+}
+
+
+/***************************
+ConnectionPool_t::SetLimits
+***************************/
+
+void ConnectionPool_t::SetLimits (int max_per_host, uint64_t idle_timeout)
+{
+	// No limit with max_per_host zero, and no idle timeout with idle_timeout zero.
+	MaxPerHost = (max_per_host > 0) ? max_per_host : 0;
+	IdleTimeout = idle_timeout;
+}
+
+
+/*************************
+ConnectionPool_t::Connect
+*************************/
+
+const uintptr_t ConnectionPool_t::Connect (const char *key, const char *server, int port)
+{
+	std::string k (key);
+	Host_t &host = Hosts[k];
+
+	ConnectionDescriptor *cd = _TakeIdle (host);
+	if (cd) {
+		host.Active++;
+		Reused++;
+		return cd->GetBinding();
+	}
+
+	if (!MaxPerHost || (host.Active < MaxPerHost))
+		return _NewConnection (k, host, server, port);
+
+	// The key has all the connections it may have, and none is idle.
+	SOCKET sd = EmConnectSocket (AF_INET, false);
+	if (sd == INVALID_SOCKET) {
+		char buf [200];
+		snprintf (buf, sizeof(buf)-1, "unable to create new socket: %s", strerror(errno));
+		throw std::runtime_error (buf);
+	}
+
+	cd = new ConnectionDescriptor (sd, MyEventMachine);
+	cd->SetResolving (true);
+	cd->SetConnectPending (true);
+	cd->SetPoolKey (k, true);
+	MyEventMachine->Add (cd);
+
+	host.Waiters.push_back (Waiter_t (cd->GetBinding(), server, port));
+	return cd->GetBinding();
+}
+
+
+/*************************
+ConnectionPool_t::Release
+*************************/
+
+bool ConnectionPool_t::Release (const uintptr_t binding)
+{
+	/* Parks a connection that was made through the pool, and hands it
+	 * straight on if anything's waiting for its key. False if it can't
+	 * be parked; it's still Ruby's then, to close.
+	 */
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (!cd || !cd->GetPoolKey() || cd->IsPoolWaiting() || cd->IsParked())
+		return false;
+
+	std::string key = *cd->GetPoolKey();
+	if (!cd->Park (IdleTimeout))
+		return false;
+
+	Host_t &host = Hosts[key];
+	host.Active--;
+	host.Idle.push_back (binding);
+	_Serve (key);
+	return true;
+}
+
+
+/************************
+ConnectionPool_t::Closed
+************************/
+
+void ConnectionPool_t::Closed (ConnectionDescriptor *cd)
+{
+	// Called as a connection with a pool key goes away, for whatever reason.
+	std::string key = *cd->GetPoolKey();
+	std::map<std::string, Host_t>::iterator i = Hosts.find (key);
+	if (i == Hosts.end())
+		return;
+
+	Host_t &host = i->second;
+	uintptr_t binding = cd->GetBinding();
+
+	if (cd->IsPoolWaiting()) {
+		for (std::deque<Waiter_t>::iterator w = host.Waiters.begin(); w != host.Waiters.end(); ++w) {
+			if (w->Binding == binding) {
+				host.Waiters.erase (w);
+				break;
+			}
+		}
+	}
+	else if (cd->IsParked()) {
+		std::vector<uintptr_t>::iterator j = std::find (host.Idle.begin(), host.Idle.end(), binding);
+		if (j != host.Idle.end())
+			host.Idle.erase (j);
+		Discarded++;
+	}
+	else {
+		// Makes room for a waiter to connect afresh.
+		host.Active--;
+		_Serve (key);
+	}
+
+	_Forget (key);
+}
+
+
+/**************************
+ConnectionPool_t::GetStats
+**************************/
+
+void ConnectionPool_t::GetStats (ConnectionPoolStats_t *stats)
+{
+	stats->Idle = 0;
+	stats->Active = 0;
+	stats->Waiting = 0;
+	for (std::map<std::string, Host_t>::iterator i = Hosts.begin(); i != Hosts.end(); ++i) {
+		stats->Idle += i->second.Idle.size();
+		stats->Active += i->second.Active;
+		stats->Waiting += i->second.Waiters.size();
+	}
+	stats->Created = Created;
+	stats->Reused = Reused;
+	stats->Discarded = Discarded;
+}
+
+
+/***************************
+ConnectionPool_t::_TakeIdle
+***************************/
+
+ConnectionDescriptor *ConnectionPool_t::_TakeIdle (Host_t &host)
+{
+	/* The most recently parked connection first, as the one likeliest
+	 * to still be open at the far end. One that turns out not to be is
+	 * closed, and counted as discarded when it goes.
+	 */
+	while (!host.Idle.empty()) {
+		uintptr_t binding = host.Idle.back();
+		host.Idle.pop_back();
+		ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+		if (cd && cd->Reuse())
+			return cd;
+	}
+	return NULL;
+}
+
+
+/********************************
+ConnectionPool_t::_NewConnection
+********************************/
+
+const uintptr_t ConnectionPool_t::_NewConnection (const std::string &key, Host_t &host, const char *server, int port)
+{
+	const uintptr_t binding = MyEventMachine->ConnectToServer (NULL, 0, server, port);
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (cd)
+		cd->SetPoolKey (key, false);
+	host.Active++;
+	Created++;
+	return binding;
+}
+
+
+/************************
+ConnectionPool_t::_Serve
+************************/
+
+void ConnectionPool_t::_Serve (const std::string &key)
+{
+	/* Gives waiters for key an idle connection, or a new one if there's
+	 * room for it. Handing over calls into Ruby, which can connect or
+	 * release in turn, so the host is looked up afresh every time round.
+	 */
+	for (;;) {
+		std::map<std::string, Host_t>::iterator i = Hosts.find (key);
+		if ((i == Hosts.end()) || i->second.Waiters.empty())
+			return;
+		Host_t &host = i->second;
+
+		Waiter_t w = host.Waiters.front();
+		ConnectionDescriptor *waiter = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (w.Binding));
+		if (!waiter || waiter->IsCloseScheduled()) {
+			host.Waiters.pop_front();
+			continue;
+		}
+
+		ConnectionDescriptor *cd = _TakeIdle (host);
+		if (cd) {
+			host.Active++;
+			Reused++;
+		}
+		else if (MaxPerHost && (host.Active >= MaxPerHost))
+			return;
+
+		host.Waiters.pop_front();
+		if (!cd) {
+			try {
+				cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (_NewConnection (key, host, w.Server.c_str(), w.Port)));
+			}
+			catch (std::runtime_error e) {
+			}
+		}
+		if (cd)
+			waiter->HandOver (cd);
+		else {
+			waiter->SetUnbindReasonCode (EHOSTUNREACH);
+			waiter->ScheduleClose (false);
+		}
+	}
+}
+
+
+/*************************
+ConnectionPool_t::_Forget
+*************************/
+
+void ConnectionPool_t::_Forget (const std::string &key)
+{
+	std::map<std::string, Host_t>::iterator i = Hosts.find (key);
+	if ((i != Hosts.end()) && !i->second.Active && i->second.Idle.empty() && i->second.Waiters.empty())
+		Hosts.erase (i);
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************
+
+$Id$
+
+File:     connpool.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#ifndef __ConnectionPool__H_
+#define __ConnectionPool__H_
+
+
+/****************************
+struct ConnectionPoolStats_t
+****************************/
+
+struct ConnectionPoolStats_t
+{
+	int Idle;
+	int Active;
+	int Waiting;
+	uint64_t Created;
+	uint64_t Reused;
+	// Idle connections closed because the server went away, or they timed out.
+	uint64_t Discarded;
+};
+
+
+/**********************
+class ConnectionPool_t
+**********************/
+
+class ConnectionPool_t
+{
+	/* Outbound connections that Ruby is done with, kept open for the next
+	 * connect to the same key: host and port, and whatever the caller adds
+	 * to tell TLS settings apart. An idle connection is polled as usual,
+	 * and is closed without telling Ruby, which has forgotten it, when it
+	 * turns readable (the server hung up, or sent something no one asked
+	 * for) or has been idle for IdleTimeout. It's probed again before it's
+	 * handed out, and then reported complete like a fresh connect.
+	 *
+	 * With MaxPerHost set, a connect to a key that already has that many
+	 * open waits, kept out of the poller like a connection whose name is
+	 * being looked up, until one is released, which it's handed, or closes,
+	 * which makes room for it to connect afresh. Either way Ruby is told
+	 * to move its handler across (EM_CONNECTION_REBOUND). The wait counts
+	 * towards the pending-connect timeout.
+	 */
+
+	public:
+		ConnectionPool_t (EventMachine_t*);
+
+		static int GetMaxPerHost() { return MaxPerHost; }
+		static uint64_t GetIdleTimeout() { return IdleTimeout; }
+		static void SetLimits (int max_per_host, uint64_t idle_timeout);
+
+		const uintptr_t Connect (const char *key, const char *server, int port);
+		bool Release (const uintptr_t binding);
+		void Closed (ConnectionDescriptor*);
+		void GetStats (ConnectionPoolStats_t*);
+
+	private:
+		struct Waiter_t {
+			Waiter_t (const uintptr_t b, const char *s, int p): Binding(b), Server(s), Port(p) {}
+			uintptr_t Binding;
+			std::string Server;
+			int Port;
+		};
+
+		struct Host_t {
+			Host_t(): Active(0) {}
+			int Active;
+			std::vector<uintptr_t> Idle;
+			std::deque<Waiter_t> Waiters;
+		};
+
+		ConnectionDescriptor *_TakeIdle (Host_t&);
+		const uintptr_t _NewConnection (const std::string &key, Host_t&, const char *server, int port);
+		void _Serve (const std::string &key);
+		void _Forget (const std::string &key);
+
+		EventMachine_t *MyEventMachine;
+		std::map<std::string, Host_t> Hosts;
+		uint64_t Created;
+		uint64_t Reused;
+		uint64_t Discarded;
+
+		static int MaxPerHost;
+		static uint64_t IdleTimeout;
+};
+
+
+#endif // __ConnectionPool__H_
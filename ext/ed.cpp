@@ -74,18 +74,18 @@ EventableDescriptor::EventableDescriptor (SOCKET sd, EventMachine_t *em):
 	MySocket (sd),
 	bAttached (false),
 	bWatchOnly (false),
+	bPaused (false),
+	MyEventMachine (em),
 	EventCallback (NULL),
+	NextHeartbeat (0),
+	InactivityTimeout (0),
+	PendingConnectTimeout(20000000),
 	bCallbackUnbind (true),
 	UnbindReasonCode (0),
 	ProxyTarget(NULL),
 	ProxiedFrom(NULL),
 	ProxiedBytes(0),
-	MaxOutboundBufSize(0),
-	MyEventMachine (em),
-	PendingConnectTimeout(20000000),
-	InactivityTimeout (0),
-	NextHeartbeat (0),
-	bPaused (false)
+	MaxOutboundBufSize(0)
 {
 	/* There are three ways to close a socket, all of which should
 	 * automatically signal to the event machine that this object
@@ -264,6 +264,20 @@ bool EventableDescriptor::IsCloseScheduled()
 }
 
 
+/*********************************
+EventableDescriptor::_CancelClose
+*********************************/
+
+void EventableDescriptor::_CancelClose()
+{
+	// For a descriptor that starts over instead of going; see Redial.
+	if (IsCloseScheduled())
+		MyEventMachine->NumCloseScheduled--;
+	bCloseNow = false;
+	bCloseAfterWriting = false;
+}
+
+
 /***********************************
 EventableDescriptor::EnableKeepalive
 ***********************************/
@@ -461,7 +475,7 @@ void EventableDescriptor::_GenericInboundDispatch(const char *buf, unsigned long
 				StopProxy();
 				(*EventCallback)(GetBinding(), EM_PROXY_COMPLETED, NULL, 0);
 				if (proxied < size) {
-					(*EventCallback)(GetBinding(), EM_CONNECTION_READ, buf + proxied, size - proxied);
+					_DeliverInboundData (buf + proxied, size - proxied);
 				}
 			}
 		} else {
@@ -469,11 +483,21 @@ void EventableDescriptor::_GenericInboundDispatch(const char *buf, unsigned long
 			ProxiedBytes += size;
 		}
 	} else {
-		(*EventCallback)(GetBinding(), EM_CONNECTION_READ, buf, size);
+		_DeliverInboundData (buf, size);
 	}
 }
 
 
+/****************************************
+EventableDescriptor::_DeliverInboundData
+****************************************/
+
+void EventableDescriptor::_DeliverInboundData (const char *buf, unsigned long size)
+{
+	(*EventCallback)(GetBinding(), EM_CONNECTION_READ, buf, size);
+}
+
+
 /*********************************
 EventableDescriptor::_GenericGetPeername
 *********************************/
@@ -555,6 +579,12 @@ uint64_t EventableDescriptor::GetNextHeartbeat()
 			if (time_til_next == 0 || PendingConnectTimeout < time_til_next)
 				time_til_next = PendingConnectTimeout;
 		}
+		uint64_t shrink = GetTimeTilIdleShrink();
+		if (shrink && (time_til_next == 0 || shrink < time_til_next))
+			time_til_next = shrink;
+		uint64_t attempt = GetTimeTilConnectAttempt();
+		if (attempt && (time_til_next == 0 || attempt < time_til_next))
+			time_til_next = attempt;
 		if (time_til_next == 0)
 			return 0;
 		NextHeartbeat = time_til_next + MyEventMachine->GetRealTime();
@@ -570,22 +600,44 @@ ConnectionDescriptor::ConnectionDescriptor
 
 ConnectionDescriptor::ConnectionDescriptor (SOCKET sd, EventMachine_t *em):
 	EventableDescriptor (sd, em),
+	OutboundDataSize (0),
 	bConnectPending (false),
+	bResolving (false),
+	bFastOpen (false),
 	bNotifyReadable (false),
 	bNotifyWritable (false),
 	bReadAttemptedAfterClose (false),
 	bWriteAttemptedAfterClose (false),
-	OutboundDataSize (0),
+	bIsServer (false),
+	#ifdef HAVE_KQUEUE
+	bGotExtraKqueueEvent(false),
+	#endif
+	LineTokenizer (NULL),
+	LengthFramer (NULL),
 	#ifdef WITH_SSL
 	SslBox (NULL),
+	TlsParms (NULL),
+	TlsStartedAt (0),
 	bHandshakeSignaled (false),
 	bSslVerifyPeer (false),
 	bSslPeerAccepted(false),
+	bHandshakeOffloaded (false),
+	PlaintextBuffer (NULL),
+	PlaintextLength (0),
 	#endif
-	#ifdef HAVE_KQUEUE
-	bGotExtraKqueueEvent(false),
+	#ifdef OS_UNIX
+	Race (NULL),
+	RedialState (NULL),
 	#endif
-	bIsServer (false)
+	PoolKey (NULL),
+	bParked (false),
+	bPoolWaiting (false),
+	bReused (false),
+	Acceptor (0),
+	ReadBucket (NULL),
+	WriteBucket (NULL),
+	bReadThrottled (false),
+	bWriteThrottled (false)
 {
 	// 22Jan09: Moved ArmKqueueWriter into SetConnectPending() to fix assertion failure in _WriteOutboundData()
 	//  5May09: Moved EPOLLOUT into SetConnectPending() so it doesn't happen for attached read pipes
@@ -601,11 +653,92 @@ ConnectionDescriptor::~ConnectionDescriptor()
 	// Run down any stranded outbound data.
 	for (size_t i=0; i < OutboundPages.size(); i++)
 		OutboundPages[i].Free();
+	MyEventMachine->AdjustOutboundBytes (-OutboundDataSize);
+
+	if (Acceptor) {
+		AcceptorDescriptor *ad = dynamic_cast <AcceptorDescriptor*> (Bindable_t::GetObject (Acceptor));
+		if (ad)
+			ad->ConnectionClosed();
+	}
 
 	#ifdef WITH_SSL
+	if (SslBox && !bHandshakeSignaled)
+		MyEventMachine->TlsStats.FailedHandshakes++;
+	if (SslBox && !bHandshakeOffloaded)
+		_CollectTlsStats();
+
+	// A box in the middle of an offloaded handshake is left to the pool.
+	#ifdef OS_UNIX
+	if (bHandshakeOffloaded && MyEventMachine->GetHandshakePool()->Release (SslBox))
+		SslBox = NULL;
+	#endif
 	if (SslBox)
 		delete SslBox;
+	delete TlsParms;
+	free (PlaintextBuffer);
+	#endif
+
+	delete LineTokenizer;
+	delete LengthFramer;
+
+	#ifdef OS_UNIX
+	_CancelConnectAttempts();
+	delete Race;
+	delete RedialState;
 	#endif
+
+	if (bReadThrottled || bWriteThrottled)
+		MyEventMachine->RemoveThrottled (this);
+	delete ReadBucket;
+	delete WriteBucket;
+
+	if (PoolKey) {
+		ConnectionPool_t *pool = MyEventMachine->GetConnectionPool();
+		if (pool)
+			pool->Closed (this);
+		delete PoolKey;
+	}
+}
+
+
+/*********************************
+ConnectionDescriptor::operator new
+*********************************/
+
+void *ConnectionDescriptor::FreeList = NULL;
+int ConnectionDescriptor::FreeCount = 0;
+
+void *ConnectionDescriptor::operator new (size_t size)
+{
+	/* Descriptors that went away are kept on a freelist, up to MaxFree of
+	 * them, threaded through their first word, and handed out again before
+	 * asking the allocator. Only the reactor thread makes and deletes them.
+	 */
+	if ((size == sizeof(ConnectionDescriptor)) && FreeList) {
+		void *p = FreeList;
+		FreeList = *(void**)p;
+		FreeCount--;
+		return p;
+	}
+	return ::operator new (size);
+}
+
+
+/************************************
+ConnectionDescriptor::operator delete
+************************************/
+
+void ConnectionDescriptor::operator delete (void *p, size_t size)
+{
+	if (!p)
+		return;
+	if ((size == sizeof(ConnectionDescriptor)) && (FreeCount < MaxFree)) {
+		*(void**)p = FreeList;
+		FreeList = p;
+		FreeCount++;
+		return;
+	}
+	::operator delete (p);
 }
 
 
@@ -623,6 +756,10 @@ void ConnectionDescriptor::_UpdateEvents(bool read, bool write)
 	if (MySocket == INVALID_SOCKET)
 		return;
 
+	// Not in the poller until its address is known.
+	if (bResolving)
+		return;
+
 	if (!read && !write)
 		return;
 
@@ -668,6 +805,368 @@ void ConnectionDescriptor::SetConnectPending(bool f)
 }
 
 
+/**************************************
+ConnectionDescriptor::StartConnectRace
+**************************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::StartConnectRace (const std::vector<struct sockaddr_storage> &addrs)
+{
+	/* Happy Eyeballs (RFC 8305). Connects to addrs one after another,
+	 * alternating address families starting with the preferred one's, and
+	 * gives each attempt the connect-attempt delay before starting the next
+	 * one alongside it. An attempt that fails starts the next one at once.
+	 * The first attempt to connect wins: its socket is swapped in under
+	 * ours, which is polled from then on like any pending connect, so
+	 * Ruby sees one connection and one completion. The others are closed.
+	 * If every attempt fails the connection is unbound with the last error.
+	 * Meanwhile the connection stays out of the poller, as it does while
+	 * its name is looked up, and its pending-connect timeout covers the
+	 * whole race.
+	 */
+	std::deque<struct sockaddr_storage> preferred, other;
+	for (size_t i = 0; i < addrs.size(); i++) {
+		if (addrs[i].ss_family == addrs[0].ss_family)
+			preferred.push_back (addrs[i]);
+		else
+			other.push_back (addrs[i]);
+	}
+
+	if (!Race)
+		Race = new ConnectRace_t;
+	Race->Addrs.clear();
+	while (!preferred.empty() || !other.empty()) {
+		if (!preferred.empty()) {
+			Race->Addrs.push_back (preferred.front());
+			preferred.pop_front();
+		}
+		if (!other.empty()) {
+			Race->Addrs.push_back (other.front());
+			other.pop_front();
+		}
+	}
+
+	Race->Error = EHOSTUNREACH;
+	_StartNextAttempt();
+}
+#endif
+
+
+/***************************************
+ConnectionDescriptor::_StartNextAttempt
+***************************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::_StartNextAttempt()
+{
+	Race->NextAttempt = 0;
+
+	while (!Race->Addrs.empty()) {
+		struct sockaddr_storage addr = Race->Addrs.front();
+		Race->Addrs.pop_front();
+		socklen_t addr_len = (addr.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+		// No Fast Open: its connects succeed before the handshake, which would win every race.
+		SOCKET sd = EmConnectSocket (addr.ss_family, false);
+		if (sd == INVALID_SOCKET) {
+			Race->Error = errno;
+			continue;
+		}
+
+		// A route that doesn't exist fails here, and the next address is tried straight away.
+		if ((connect (sd, (struct sockaddr *)&addr, addr_len) == 0) || (errno == EINPROGRESS)) {
+			ConnectAttemptDescriptor *ad = new ConnectAttemptDescriptor (sd, MyEventMachine, GetBinding());
+			MyEventMachine->Add (ad);
+			Race->Attempts.push_back (ad->GetBinding());
+			if (!Race->Addrs.empty())
+				Race->NextAttempt = MyEventMachine->GetRealTime() + EventMachine_t::GetConnectAttemptDelay();
+			break;
+		}
+
+		Race->Error = errno;
+		close (sd);
+	}
+
+	MyEventMachine->QueueHeartbeat (this);
+
+	if (Race->Attempts.empty()) {
+		UnbindReasonCode = Race->Error;
+		ScheduleClose (false);
+	}
+}
+#endif
+
+
+/********************************************
+ConnectionDescriptor::ConnectAttemptFinished
+********************************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::ConnectAttemptFinished (EventableDescriptor *ad, int error)
+{
+	if (!Race)
+		return;
+	std::vector<uintptr_t>::iterator it = std::find (Race->Attempts.begin(), Race->Attempts.end(), ad->GetBinding());
+	if (it == Race->Attempts.end())
+		return;
+	Race->Attempts.erase (it);
+
+	if (error) {
+		Race->Error = error;
+		if (!Race->Addrs.empty() || Race->Attempts.empty())
+			_StartNextAttempt();
+		return;
+	}
+
+	// dup2 swaps the winner's socket in under our number.
+	SOCKET sd = MyEventMachine->DetachFD (ad);
+	if (dup2 (sd, MySocket) < 0)
+		error = errno;
+	else
+		SetFdCloexec (MySocket);
+	close (sd);
+
+	_CancelConnectAttempts();
+	delete Race;
+	Race = NULL;
+	bResolving = false;
+
+	if (error) {
+		UnbindReasonCode = error;
+		ScheduleClose (false);
+		return;
+	}
+
+	MyEventMachine->StartPolling (this);
+	SetConnectPending (true);
+}
+#endif
+
+
+/********************************************
+ConnectionDescriptor::_CancelConnectAttempts
+********************************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::_CancelConnectAttempts()
+{
+	if (!Race)
+		return;
+	for (size_t i = 0; i < Race->Attempts.size(); i++) {
+		EventableDescriptor *ad = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (Race->Attempts[i]));
+		if (ad)
+			ad->ScheduleClose (false);
+	}
+	Race->Attempts.clear();
+}
+#endif
+
+
+/**********************************************
+ConnectionDescriptor::GetTimeTilConnectAttempt
+**********************************************/
+
+#ifdef OS_UNIX
+uint64_t ConnectionDescriptor::GetTimeTilConnectAttempt()
+{
+	uint64_t at = 0;
+	if (Race && Race->NextAttempt)
+		at = Race->NextAttempt;
+	else if (RedialState && RedialState->At)
+		at = RedialState->At;
+	if (!at)
+		return 0;
+	uint64_t now = MyEventMachine->GetRealTime();
+	return (at > now) ? (at - now) : 1;
+}
+#endif
+
+
+/**************************************************
+ConnectionDescriptor::RedialState_t::RedialState_t
+**************************************************/
+
+#ifdef OS_UNIX
+ConnectionDescriptor::RedialState_t::RedialState_t (const char *s, int p):
+	Server (s),
+	Port (p),
+	Attempts (0),
+	Connected (false),
+	Reason (0),
+	At (0)
+{
+	std::ostringstream target;
+	target << s << ":" << p;
+	Target = target.str();
+}
+#endif
+
+
+/*******************************
+ConnectionDescriptor::SetRedial
+*******************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::SetRedial (const char *server, int port)
+{
+	delete RedialState;
+	RedialState = new RedialState_t (server, port);
+}
+#endif
+
+
+/**********************************
+ConnectionDescriptor::CancelRedial
+**********************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::CancelRedial()
+{
+	// Closed on purpose, so it goes when it closes.
+	delete RedialState;
+	RedialState = NULL;
+}
+#endif
+
+
+/****************************
+ConnectionDescriptor::Redial
+****************************/
+
+#ifdef OS_UNIX
+bool ConnectionDescriptor::Redial()
+{
+	/* Called as a connection made with a reconnect policy is about to be
+	 * deleted. A connect that failed counts against its server's circuit
+	 * breaker. Unless the reactor is stopping or the attempts have run
+	 * out, the connection then starts over under the same binding, as
+	 * though just made: nothing queued, nothing buffered, no TLS, and out
+	 * of the poller like one whose name is being looked up, until its
+	 * backoff delay is up (see _Dial). Nothing here calls into Ruby, which
+	 * is told later, by AnnounceRedial, instead of getting an unbind.
+	 */
+	if (!RedialState)
+		return false;
+
+	uint64_t now = MyEventMachine->GetRealTime();
+	if (!RedialState->Connected)
+		MyEventMachine->GetCircuitBreakers()->Report (RedialState->Target, now, false, UnbindReasonCode);
+	RedialState->Connected = false;
+
+	if (MyEventMachine->Stopping() || bAttached || bWatchOnly || ProxyTarget || ProxiedFrom)
+		return false;
+	#ifdef WITH_SSL
+	if (bHandshakeOffloaded)
+		return false;
+	#endif
+	if (CircuitBreakers_t::Policy.MaxAttempts && (RedialState->Attempts >= CircuitBreakers_t::Policy.MaxAttempts))
+		return false;
+
+	// Numbered afresh under the same binding. The family is fixed up once it's resolved.
+	SOCKET sd = EmConnectSocket (AF_INET, bFastOpen);
+	if (sd == INVALID_SOCKET)
+		return false;
+
+	int reason = UnbindReasonCode;
+	_CancelClose();
+	Close();
+	MySocket = sd;
+
+	for (size_t i = 0; i < OutboundPages.size(); i++)
+		OutboundPages[i].Free();
+	while (!OutboundPages.empty())
+		OutboundPages.pop_front();
+	MyEventMachine->AdjustOutboundBytes (-OutboundDataSize);
+	OutboundDataSize = 0;
+
+	if (LineTokenizer)
+		LineTokenizer->Clear();
+	if (LengthFramer)
+		LengthFramer->Clear();
+
+	#ifdef WITH_SSL
+	if (SslBox) {
+		if (!bHandshakeSignaled)
+			MyEventMachine->TlsStats.FailedHandshakes++;
+		_CollectTlsStats();
+		delete SslBox;
+		SslBox = NULL;
+	}
+	bHandshakeSignaled = false;
+	free (PlaintextBuffer);
+	PlaintextBuffer = NULL;
+	PlaintextLength = 0;
+	HeldPlaintext.clear();
+	#endif
+
+	_CancelConnectAttempts();
+	delete Race;
+	Race = NULL;
+
+	bPaused = false;
+	bReadAttemptedAfterClose = false;
+	bWriteAttemptedAfterClose = false;
+	#ifdef HAVE_KQUEUE
+	bGotExtraKqueueEvent = false;
+	#endif
+	UnbindReasonCode = 0;
+	bResolving = true;
+	bConnectPending = true;
+
+	RedialState->At = now + CircuitBreakers_t::GetDelay (RedialState->Attempts++);
+	MyEventMachine->QueueHeartbeat (this);
+
+	RedialState->Reason = reason;
+	return true;
+}
+#endif
+
+
+/************************************
+ConnectionDescriptor::AnnounceRedial
+************************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::AnnounceRedial()
+{
+	// Not if Ruby closed it for good in the meantime; it gets an unbind.
+	if (RedialState && EventCallback)
+		(*EventCallback)(GetBinding(), EM_CONNECTION_RECONNECTING, NULL, RedialState->Reason);
+}
+#endif
+
+
+/***************************
+ConnectionDescriptor::_Dial
+***************************/
+
+#ifdef OS_UNIX
+void ConnectionDescriptor::_Dial()
+{
+	/* The backoff delay is up. Unless the server's breaker is open, in
+	 * which case the connection fails at once with the error that opened
+	 * it, its name is looked up again and it connects as ConnectToServer
+	 * would. Its pending-connect timeout runs from now.
+	 */
+	RedialState->At = 0;
+	CreatedAt = MyEventMachine->GetCurrentLoopTime();
+
+	int error = 0;
+	if (!MyEventMachine->GetCircuitBreakers()->Allows (RedialState->Target, MyEventMachine->GetRealTime(), &error)) {
+		CancelRedial();
+		UnbindReasonCode = error;
+		ScheduleClose (false);
+		return;
+	}
+
+	#ifdef WITH_SSL
+	SetTlsPeerName (RedialState->Server.c_str(), RedialState->Port);
+	#endif
+	MyEventMachine->ResolveAndConnect (GetBinding(), RedialState->Server.c_str(), RedialState->Port);
+}
+#endif
+
+
 /**********************************
 ConnectionDescriptor::SetAttached
 ***********************************/
@@ -765,28 +1264,16 @@ int ConnectionDescriptor::SendOutboundData (const char *data, unsigned long leng
 		ProxiedFrom->Pause();
 
 	#ifdef WITH_SSL
-	if (SslBox) {
-		if (length > 0) {
-			unsigned long writed = 0;
-			char *p = (char*)data;
-
-			while (writed < length) {
-				int to_write = SSLBOX_INPUT_CHUNKSIZE;
-				int remaining = length - writed;
-
-				if (remaining < SSLBOX_INPUT_CHUNKSIZE)
-					to_write = remaining;
-
-				int w = SslBox->PutPlaintext (p, to_write);
-				if (w < 0) {
-					ScheduleClose (false);
-				}else
-					_DispatchCiphertext();
+	if ((bHandshakeOffloaded || (SslBox && !SslBox->IsOnSocket())) && IsCloseScheduled())
+		return 0;
 
-				p += to_write;
-				writed += to_write;
-			}
-		}
+	if (bHandshakeOffloaded) {
+		// The SslBox is off on a handshake thread; see FinishOffloadedHandshake.
+		HeldPlaintext.append (data, length);
+		return 1;
+	}
+	else if (SslBox && !SslBox->IsOnSocket()) {
+		_EncryptOutboundData (data, length);
 		// TODO: What's the correct return value?
 		return 1; // That's a wild guess, almost certainly wrong.
 	}
@@ -796,19 +1283,71 @@ int ConnectionDescriptor::SendOutboundData (const char *data, unsigned long leng
 }
 
 
-
 /******************************************
-ConnectionDescriptor::_SendRawOutboundData
+ConnectionDescriptor::_EncryptOutboundData
 ******************************************/
 
-int ConnectionDescriptor::_SendRawOutboundData (const char *data, unsigned long length)
+#ifdef WITH_SSL
+void ConnectionDescriptor::_EncryptOutboundData (const char *data, unsigned long length)
 {
-	/* This internal method is called to schedule bytes that
-	 * will be sent out to the remote peer.
-	 * It's not directly accessed by the caller, who hits ::SendOutboundData,
-	 * which may or may not filter or encrypt the caller's data before
-	 * sending it here.
-	 */
+	unsigned long writed = 0;
+	char *p = (char*)data;
+
+	while (writed < length) {
+		int to_write = SSLBOX_INPUT_CHUNKSIZE;
+		int remaining = length - writed;
+
+		if (remaining < SSLBOX_INPUT_CHUNKSIZE)
+			to_write = remaining;
+
+		SslBox->NoteWriteTime (MyEventMachine->GetCurrentLoopTime());
+		int w = SslBox->PutPlaintext (p, to_write);
+		if (w < 0) {
+			ScheduleClose (false);
+		}else
+			_DispatchCiphertext();
+
+		p += to_write;
+		writed += to_write;
+	}
+}
+#endif
+
+
+/*****************************************
+ConnectionDescriptor::GetOutboundDataSize
+*****************************************/
+
+#ifdef WITH_SSL
+int ConnectionDescriptor::GetOutboundDataSize()
+{
+	/* Counts the plaintext that isn't ciphertext yet, held while the
+	 * handshake is on a thread or queued in the SslBox until it's done, so
+	 * that a close after writing waits for it and a proxy feeding this
+	 * connection is held back by it. A handshake thread leaves the SslBox's
+	 * queue alone, so it can be looked at while one has the box.
+	 */
+	int size = OutboundDataSize + (int) HeldPlaintext.size();
+	if (SslBox)
+		size += (int) SslBox->GetQueuedPlaintextSize();
+	return size;
+}
+#endif
+
+
+
+/******************************************
+ConnectionDescriptor::_SendRawOutboundData
+******************************************/
+
+int ConnectionDescriptor::_SendRawOutboundData (const char *data, unsigned long length)
+{
+	/* This internal method is called to schedule bytes that
+	 * will be sent out to the remote peer.
+	 * It's not directly accessed by the caller, who hits ::SendOutboundData,
+	 * which may or may not filter or encrypt the caller's data before
+	 * sending it here.
+	 */
 
 	// Highly naive and incomplete implementation.
 	// There's no throttle for runaways (which should abort only this connection
@@ -832,11 +1371,42 @@ int ConnectionDescriptor::_SendRawOutboundData (const char *data, unsigned long
 	buffer [length] = 0;
 	OutboundPages.push_back (OutboundPage (buffer, length));
 	OutboundDataSize += length;
+	MyEventMachine->AdjustOutboundBytes (length);
+
+	_UpdateEvents(false, true);
+
+	return length;
+}
+
+
+
+/******************************************
+ConnectionDescriptor::_SendRawOutboundPage
+******************************************/
+
+#ifdef WITH_SSL
+int ConnectionDescriptor::_SendRawOutboundPage (char *buffer, unsigned long length)
+{
+	/* Like _SendRawOutboundData, but queues a page of ciphertext the SslBox
+	 * has already allocated (with room for a guard byte) instead of a copy.
+	 * Unlike it, it takes pages after a close after writing, which may still
+	 * be finishing the handshake or encrypting what was sent before it;
+	 * SendOutboundData turns away anything newer.
+	 */
+	if (IsCloseNow() || (length == 0)) {
+		free (buffer);
+		return 0;
+	}
+
+	OutboundPages.push_back (OutboundPage (buffer, length));
+	OutboundDataSize += length;
+	MyEventMachine->AdjustOutboundBytes (length);
 
 	_UpdateEvents(false, true);
 
 	return length;
 }
+#endif
 
 
 
@@ -860,12 +1430,16 @@ bool ConnectionDescriptor::SelectForRead()
 	 * is known to be in a connected state.
 	 */
 
-	if (bPaused)
+	if (bPaused || bReadThrottled)
 		return false;
 	else if (bConnectPending)
 		return false;
 	else if (bWatchOnly)
 		return bNotifyReadable ? true : false;
+	#ifdef WITH_SSL
+	else if (bHandshakeOffloaded)
+		return false;
+	#endif
 	else
 		return true;
 }
@@ -885,12 +1459,21 @@ bool ConnectionDescriptor::SelectForWrite()
 
 	if (bPaused)
 		return false;
+	else if (bResolving)
+		return false;
 	else if (bConnectPending)
 		return true;
 	else if (bWatchOnly)
 		return bNotifyWritable ? true : false;
+	else if (bWriteThrottled)
+		return false;
+	#ifdef WITH_SSL
+	else if (SslBox && SslBox->IsOnSocket())
+		return SslBox->WantsWrite() || (SslBox->IsHandshakeCompleted() && (OutboundDataSize > 0));
+	#endif
 	else
-		return (GetOutboundDataSize() > 0);
+		// Not what's held for an offloaded handshake, which has nothing to go out yet.
+		return (OutboundDataSize > 0);
 }
 
 /***************************
@@ -928,6 +1511,146 @@ ConnectionDescriptor::Read
 **************************/
 
 void ConnectionDescriptor::Read()
+{
+	Read (NULL);
+}
+
+
+/***********************************
+ConnectionDescriptor::SetRateLimits
+***********************************/
+
+void ConnectionDescriptor::SetRateLimits (const RateLimits_t *limits)
+{
+	/* Buckets start full. New limits take effect at once; a connection
+	 * they throttle stops being polled for that direction until the
+	 * reactor, which refills every throttled connection once per timer
+	 * quantum, finds it has something to spend again.
+	 */
+	uint64_t now = MyEventMachine->GetCurrentLoopTime();
+	delete ReadBucket;
+	delete WriteBucket;
+	ReadBucket = (limits && limits->ReadRate) ? new TokenBucket_t (limits->ReadRate, limits->Burst, now) : NULL;
+	WriteBucket = (limits && limits->WriteRate) ? new TokenBucket_t (limits->WriteRate, limits->Burst, now) : NULL;
+
+	if ((bReadThrottled || bWriteThrottled) && !RefillBuckets (now))
+		MyEventMachine->RemoveThrottled (this);
+}
+
+
+/***********************************
+ConnectionDescriptor::RefillBuckets
+***********************************/
+
+bool ConnectionDescriptor::RefillBuckets (uint64_t now)
+{
+	// Lifts the throttles there's budget for again. True while either is still on.
+	if (bReadThrottled && _GetBudget (true, 1))
+		bReadThrottled = false;
+	if (bWriteThrottled && _GetBudget (false, 1))
+		bWriteThrottled = false;
+	_UpdateEvents();
+	return bReadThrottled || bWriteThrottled;
+}
+
+
+/************************************
+ConnectionDescriptor::_IsRateLimited
+************************************/
+
+bool ConnectionDescriptor::_IsRateLimited()
+{
+	return ReadBucket || WriteBucket || (Acceptor && MyEventMachine->HasRateLimitedListeners());
+}
+
+
+/********************************
+ConnectionDescriptor::_GetBudget
+********************************/
+
+size_t ConnectionDescriptor::_GetBudget (bool read, size_t want)
+{
+	/* Up to want bytes, as many as both our own bucket and the one
+	 * shared through the listener that accepted us allow. None throttles
+	 * that direction.
+	 */
+	uint64_t now = MyEventMachine->GetCurrentLoopTime();
+	TokenBucket_t *own = read ? ReadBucket : WriteBucket;
+	if (own) {
+		own->Refill (now);
+		want = own->GetBudget (want);
+	}
+
+	AcceptorDescriptor *ad = NULL;
+	if (want && Acceptor && MyEventMachine->HasRateLimitedListeners())
+		ad = dynamic_cast <AcceptorDescriptor*> (Bindable_t::GetObject (Acceptor));
+	TokenBucket_t *shared = ad ? (read ? ad->GetReadBucket() : ad->GetWriteBucket()) : NULL;
+	if (shared) {
+		shared->Refill (now);
+		want = shared->GetBudget (want);
+	}
+
+	if (!want) {
+		if (!bReadThrottled && !bWriteThrottled)
+			MyEventMachine->AddThrottled (this);
+		if (read)
+			bReadThrottled = true;
+		else
+			bWriteThrottled = true;
+		_UpdateEvents();
+	}
+	return want;
+}
+
+
+/****************************
+ConnectionDescriptor::_Spend
+****************************/
+
+void ConnectionDescriptor::_Spend (bool read, size_t n)
+{
+	TokenBucket_t *own = read ? ReadBucket : WriteBucket;
+	if (own)
+		own->Spend (n);
+
+	AcceptorDescriptor *ad = NULL;
+	if (Acceptor && MyEventMachine->HasRateLimitedListeners())
+		ad = dynamic_cast <AcceptorDescriptor*> (Bindable_t::GetObject (Acceptor));
+	TokenBucket_t *shared = ad ? (read ? ad->GetReadBucket() : ad->GetWriteBucket()) : NULL;
+	if (shared)
+		shared->Spend (n);
+
+	// Emptied, it stops being polled now rather than on the next try.
+	if ((own && own->IsEmpty()) || (shared && shared->IsEmpty()))
+		_GetBudget (read, 1);
+}
+
+
+/************************************
+ConnectionDescriptor::IsPrefetchable
+************************************/
+
+bool ConnectionDescriptor::IsPrefetchable()
+{
+	/* Only plain connected sockets that we own can have their first read
+	 * done ahead of dispatch. Attached and watched descriptors belong to
+	 * user code, which may detach them from a callback before we get to
+	 * them, and a pending connect has no data to read yet.
+	 */
+	#ifdef WITH_SSL
+	if (SslBox && (SslBox->IsOnSocket() || bHandshakeOffloaded))
+		return false;
+	#endif
+	// Nor can one whose reads are cut to its rate limit.
+	return (MySocket != INVALID_SOCKET) && !bWatchOnly && !bAttached && !bConnectPending && !bParked && !_IsRateLimited();
+}
+
+
+/**************************
+ConnectionDescriptor::Read
+**************************/
+
+void ConnectionDescriptor::Read (const PrefetchedRead_t *prefetched)
 {
 	/* Read and dispatch data on a socket that has selected readable.
 	 * It's theoretically possible to get and dispatch incoming data on
@@ -966,10 +1689,27 @@ void ConnectionDescriptor::Read()
 		return;
 	}
 
+	// No one's listening to a connection in the pool. Either the server
+	// hung up or it's sending what no request asked for; it can't be reused.
+	if (bParked) {
+		ScheduleClose (false);
+		return;
+	}
+
+	#ifdef WITH_SSL
+	if (SslBox && SslBox->IsOnSocket()) {
+		_ReadSocketTls();
+		return;
+	}
+	if (bHandshakeOffloaded)
+		return;
+	#endif
+
 	LastActivity = MyEventMachine->GetCurrentLoopTime();
 
 	int total_bytes_read = 0;
 	char readbuffer [16 * 1024 + 1];
+	bool limited = _IsRateLimited();
 
 	for (int i=0; i < 10; i++) {
 		// Don't read just one buffer and then move on. This is faster
@@ -978,18 +1718,35 @@ void ConnectionDescriptor::Read()
 		// NOTICE, we're reading one less than the buffer size.
 		// That's so we can put a guard byte at the end of what we send
 		// to user code.
-		
+		// If the reactor already did the first read for us outside the GVL,
+		// consume its result in place of the first read(2).
+
+		char *buffer = readbuffer;
+		size_t want = sizeof(readbuffer) - 1;
+		if (limited && !prefetched && !(want = _GetBudget (true, want)))
+			break;
 
-		int r = read (sd, readbuffer, sizeof(readbuffer) - 1);
+		int r, e;
+		if (prefetched) {
+			buffer = prefetched->Buffer;
+			r = prefetched->Result;
+			e = prefetched->Error;
+			prefetched = NULL;
+		}
+		else {
+			r = read (sd, readbuffer, want);
 #ifdef OS_WIN32
-		int e = WSAGetLastError();
+			e = WSAGetLastError();
 #else
-		int e = errno;
+			e = errno;
 #endif
+		}
 		//cerr << "<R:" << r << ">";
 
 		if (r > 0) {
 			total_bytes_read += r;
+			if (limited)
+				_Spend (true, r);
 
 			// Add a null-terminator at the the end of the buffer
 			// that we will send to the callback.
@@ -997,10 +1754,14 @@ void ConnectionDescriptor::Read()
 			// to be able to depend on this behavior, so they will have
 			// the option to do some things faster. Additionally it's
 			// a security guard against buffer overflows.
-			readbuffer [r] = 0;
-			_DispatchInboundData (readbuffer, r);
-			if (bPaused)
+			buffer [r] = 0;
+			_DispatchInboundData (buffer, r);
+			if (bPaused || bReadThrottled)
 				break;
+			#ifdef WITH_SSL
+			if (bHandshakeOffloaded)
+				break;
+			#endif
 		}
 		else if (r == 0) {
 			break;
@@ -1026,9 +1787,15 @@ void ConnectionDescriptor::Read()
 	}
 
 
-	if (total_bytes_read == 0) {
+	#ifdef WITH_SSL
+	if (SslBox)
+		_FlushPlaintext();
+	#endif
+
+	if ((total_bytes_read == 0) && !bReadThrottled) {
 		// If we read no data on a socket that selected readable,
 		// it generally means the other end closed the connection gracefully.
+		// (Unless it had none of its rate limit left to read it with.)
 		ScheduleClose (false);
 		//bCloseNow = true;
 	}
@@ -1046,46 +1813,407 @@ void ConnectionDescriptor::_DispatchInboundData (const char *buffer, unsigned lo
 {
 	if (SslBox) {
 		SslBox->PutCiphertext (buffer, size);
+		if (!_OffloadHandshake())
+			_DecryptInboundData();
+	}
+	else {
+		_GenericInboundDispatch(buffer, size);
+	}
+}
+#else
+void ConnectionDescriptor::_DispatchInboundData (const char *buffer, unsigned long size)
+{
+	_GenericInboundDispatch(buffer, size);
+}
+#endif
+
+
+/*****************************************
+ConnectionDescriptor::_DecryptInboundData
+*****************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::_DecryptInboundData()
+{
+	/* Plaintext is collected across the reads ::Read makes, and handed
+	 * to the application by _FlushPlaintext when it's done or when the
+	 * buffer has no room left for a full record.
+	 */
+	int s;
+	do {
+		if (PlaintextBuffer && (SSLBOX_PLAINTEXT_BUFFER_SIZE - PlaintextLength < SSLBOX_RECORD_SIZE))
+			_FlushPlaintext();
+		if (!PlaintextBuffer) {
+			PlaintextBuffer = (char *) malloc (SSLBOX_PLAINTEXT_BUFFER_SIZE + 1);
+			if (!PlaintextBuffer)
+				throw std::runtime_error ("no allocation for inbound data");
+		}
 
-		int s;
-		char B [2048];
-		while ((s = SslBox->GetPlaintext (B, sizeof(B) - 1)) > 0) {
+		s = SslBox->GetPlaintext (PlaintextBuffer + PlaintextLength, SSLBOX_PLAINTEXT_BUFFER_SIZE - PlaintextLength);
+		if (s > 0) {
 			_CheckHandshakeStatus();
-			B [s] = 0;
-			_GenericInboundDispatch(B, s);
+			PlaintextLength += s;
 		}
+	} while (s > 0);
+	SslBox->KeepCiphertext();
 
-		// If our SSL handshake had a problem, shut down the connection.
-		if (s == -2) {
-			#ifndef EPROTO // OpenBSD does not have EPROTO
-			#define EPROTO EINTR
-			#endif
-			#ifdef OS_UNIX
-			UnbindReasonCode = EPROTO;
-			#endif
-			#ifdef OS_WIN32
-			UnbindReasonCode = WSAECONNABORTED;
-			#endif
-			ScheduleClose(false);
-			return;
+	// If our SSL handshake had a problem, shut down the connection.
+	if (s == -2) {
+		#ifndef EPROTO // OpenBSD does not have EPROTO
+		#define EPROTO EINTR
+		#endif
+		#ifdef OS_UNIX
+		UnbindReasonCode = EPROTO;
+		#endif
+		#ifdef OS_WIN32
+		UnbindReasonCode = WSAECONNABORTED;
+		#endif
+		ScheduleClose(false);
+		return;
+	}
+
+	_CheckHandshakeStatus();
+	_DispatchCiphertext();
+}
+#endif
+
+
+/***************************************
+ConnectionDescriptor::_OffloadHandshake
+***************************************/
+
+#ifdef WITH_SSL
+bool ConnectionDescriptor::_OffloadHandshake()
+{
+	/* Server handshakes go to the reactor's handshake threads, if it has
+	 * any, unless verifying the peer would have them call into Ruby. The
+	 * box keeps its own copy of the ciphertext, and reads stop until
+	 * FinishOffloadedHandshake.
+	 */
+	#ifdef OS_UNIX
+	if (!SslBox->IsServer() || SslBox->IsHandshakeCompleted() || bSslVerifyPeer)
+		return false;
+
+	SslHandshakePool_t *pool = MyEventMachine->GetHandshakePool();
+	if (!pool)
+		return false;
+
+	SslBox->KeepCiphertext();
+	bHandshakeOffloaded = true;
+	pool->Submit (SslBox, GetBinding());
+	_UpdateEvents (true, false);
+	return true;
+	#else
+	return false;
+	#endif
+}
+#endif
+
+
+/**********************************************
+ConnectionDescriptor::FinishOffloadedHandshake
+**********************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::FinishOffloadedHandshake (int result)
+{
+	// Called on the reactor by SslHandshakePool_t::RunCompletions.
+	bHandshakeOffloaded = false;
+	_UpdateEvents (true, false);
+
+	if (result == -2) {
+		_CloseSocketTls (result);
+		return;
+	}
+
+	// Sends what the handshake wrote, and decrypts anything that came in
+	// behind it.
+	_DecryptInboundData();
+	_FlushPlaintext();
+
+	// Sent before any close after writing, so not turned away by it.
+	if (!HeldPlaintext.empty()) {
+		std::string held;
+		held.swap (HeldPlaintext);
+		_EncryptOutboundData (held.data(), held.size());
+	}
+}
+#endif
+
+
+/*************************************
+ConnectionDescriptor::_FlushPlaintext
+*************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::_FlushPlaintext()
+{
+	if (!PlaintextBuffer)
+		return;
+
+	// Let go of the buffer first, in case the callback sends data.
+	char *buffer = PlaintextBuffer;
+	int length = PlaintextLength;
+	PlaintextBuffer = NULL;
+	PlaintextLength = 0;
+
+	if (length > 0) {
+		buffer [length] = 0;
+		_GenericInboundDispatch (buffer, length);
+	}
+	free (buffer);
+}
+#endif
+
+
+/************************************
+ConnectionDescriptor::_ReadSocketTls
+************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::_ReadSocketTls()
+{
+	/* Counterpart of ::Read for connections whose SslBox owns the socket
+	 * (see StartTls). Plaintext comes back from SSL_read, decrypted by the
+	 * kernel when kTLS is on, and the handshake moves along as data for it
+	 * arrives. A TLS record fits in readbuffer, so nothing is left behind
+	 * in OpenSSL when we stop.
+	 */
+	LastActivity = MyEventMachine->GetCurrentLoopTime();
+
+	char readbuffer [16 * 1024 + 1];
+	bool limited = _IsRateLimited();
+
+	for (int i=0; i < 10; i++) {
+		// A record is read whole, so the limit can only be checked between them.
+		if (limited && !_GetBudget (true, 1))
+			break;
+
+		int r = SslBox->ReadSocket (readbuffer, sizeof(readbuffer) - 1);
+		_CheckHandshakeStatus();
+
+		if (r > 0) {
+			if (limited)
+				_Spend (true, r);
+			readbuffer [r] = 0;
+			_GenericInboundDispatch (readbuffer, r);
+			if (bPaused || bReadThrottled || IsCloseScheduled())
+				break;
 		}
+		else {
+			if (r < 0)
+				_CloseSocketTls (r);
+			break;
+		}
+	}
+
+	_UpdateEvents (false, true);
+	_CollectTlsStats();
+}
+
+
+/*************************************
+ConnectionDescriptor::_WriteSocketTls
+*************************************/
 
+void ConnectionDescriptor::_WriteSocketTls()
+{
+	/* Counterpart of _WriteOutboundData for connections whose SslBox owns
+	 * the socket. OutboundPages hold plaintext, written with SSL_write
+	 * (straight to the kernel when kTLS is on) once the handshake is done.
+	 */
+	LastActivity = MyEventMachine->GetCurrentLoopTime();
+
+	// Without pages to write, this also clears a want-write left by SSL_read.
+	int w = 0;
+	if (!SslBox->IsHandshakeCompleted() || OutboundPages.empty()) {
+		w = SslBox->WriteSocket (NULL, 0);
 		_CheckHandshakeStatus();
-		_DispatchCiphertext();
 	}
-	else {
-		_GenericInboundDispatch(buffer, size);
+
+	bool limited = _IsRateLimited();
+	while ((w >= 0) && SslBox->IsHandshakeCompleted() && !OutboundPages.empty()) {
+		OutboundPage *op = &(OutboundPages[0]);
+		size_t len = op->Length - op->Offset;
+		if (limited && !(len = _GetBudget (false, len)))
+			break;
+		w = SslBox->WriteSocket (op->Buffer + op->Offset, len);
+		if (w <= 0)
+			break;
+
+		if (limited)
+			_Spend (false, w);
+		OutboundDataSize -= w;
+		MyEventMachine->AdjustOutboundBytes (-w);
+		op->Offset += w;
+		if (op->Offset == op->Length) {
+			op->Free();
+			OutboundPages.pop_front();
+		}
 	}
+
+	if (ProxiedFrom && MaxOutboundBufSize && (unsigned int)GetOutboundDataSize() < MaxOutboundBufSize && ProxiedFrom->IsPaused())
+		ProxiedFrom->Resume();
+
+	_UpdateEvents (false, true);
+	_CollectTlsStats();
+
+	if (w < 0)
+		_CloseSocketTls (w);
 }
-#else
-void ConnectionDescriptor::_DispatchInboundData (const char *buffer, unsigned long size)
+
+
+/*************************************
+ConnectionDescriptor::_CloseSocketTls
+*************************************/
+
+void ConnectionDescriptor::_CloseSocketTls (int reason)
 {
-	_GenericInboundDispatch(buffer, size);
+	// -1 is the peer closing, -2 a TLS error (see SslBox_t::ReadSocket
+	// and SslBox_t::Handshake).
+	if (reason == -2) {
+		#ifdef OS_UNIX
+		UnbindReasonCode = EPROTO;
+		#endif
+		#ifdef OS_WIN32
+		UnbindReasonCode = WSAECONNABORTED;
+		#endif
+	}
+	ScheduleClose (false);
 }
 #endif
 
 
 
+/*****************************************
+ConnectionDescriptor::_DeliverInboundData
+*****************************************/
+
+void ConnectionDescriptor::_DeliverInboundData (const char *buffer, unsigned long size)
+{
+	if (LineTokenizer)
+		LineTokenizer->Append (buffer, size);
+	else if (LengthFramer)
+		LengthFramer->Append (buffer, size);
+	else {
+		EventableDescriptor::_DeliverInboundData (buffer, size);
+		return;
+	}
+
+	_DispatchFrames();
+}
+
+
+/*************************************
+ConnectionDescriptor::_DispatchFrames
+*************************************/
+
+void ConnectionDescriptor::_DispatchFrames()
+{
+	/* A callback may switch framing off or to the other mode (carrying
+	 * the buffered bytes across), so look at both afresh every time round.
+	 */
+	const char *data;
+	size_t length;
+	while (true) {
+		if (LineTokenizer && LineTokenizer->Next (&data, &length))
+			(*EventCallback)(GetBinding(), EM_CONNECTION_LINE, data, length);
+		else if (LengthFramer && LengthFramer->Next (&data, &length))
+			(*EventCallback)(GetBinding(), EM_CONNECTION_FRAME, data, length);
+		else
+			break;
+	}
+
+	if ((LineTokenizer && LineTokenizer->IsOverflowed()) || (LengthFramer && LengthFramer->IsOverflowed())) {
+		#ifdef OS_UNIX
+		UnbindReasonCode = EMSGSIZE;
+		#endif
+		#ifdef OS_WIN32
+		UnbindReasonCode = WSAEMSGSIZE;
+		#endif
+		ScheduleClose (false);
+	}
+}
+
+
+/************************************
+ConnectionDescriptor::_SwitchFraming
+************************************/
+
+void ConnectionDescriptor::_SwitchFraming (Tokenizer_t *tokenizer, Framer_t *framer)
+{
+	/* Installs the given framing (at most one of the two, or neither) and
+	 * hands it whatever the previous one had buffered. With no framing
+	 * left, the leftovers are dispatched as ordinary data, so no bytes are
+	 * lost across the switch.
+	 */
+	Tokenizer_t *old_tokenizer = LineTokenizer;
+	Framer_t *old_framer = LengthFramer;
+
+	const char *data = NULL;
+	size_t length = 0;
+	if (old_tokenizer)
+		old_tokenizer->Flush (&data, &length);
+	else if (old_framer)
+		old_framer->Flush (&data, &length);
+
+	LineTokenizer = tokenizer;
+	LengthFramer = framer;
+
+	if (length > 0) {
+		if (tokenizer)
+			tokenizer->Append (data, length);
+		else if (framer)
+			framer->Append (data, length);
+		else if (EventCallback)
+			(*EventCallback)(GetBinding(), EM_CONNECTION_READ, data, length);
+	}
+
+	delete old_tokenizer;
+	delete old_framer;
+}
+
+
+/************************************
+ConnectionDescriptor::SetLineFraming
+************************************/
+
+void ConnectionDescriptor::SetLineFraming (const char *delimiter, size_t delimiter_length, size_t max_length)
+{
+	/* With a delimiter, inbound data is split natively and each complete
+	 * line (without its delimiter) is dispatched as EM_CONNECTION_LINE.
+	 * Without one, line framing is switched off.
+	 */
+	if (delimiter && delimiter_length) {
+		if (LineTokenizer) {
+			LineTokenizer->SetDelimiter (delimiter, delimiter_length);
+			LineTokenizer->SetMaxLength (max_length);
+		}
+		else
+			_SwitchFraming (new Tokenizer_t (delimiter, delimiter_length, max_length), NULL);
+	}
+	else if (LineTokenizer)
+		_SwitchFraming (NULL, NULL);
+}
+
+
+/**************************************
+ConnectionDescriptor::SetLengthFraming
+**************************************/
+
+void ConnectionDescriptor::SetLengthFraming (int width, bool big_endian, int offset, int adjustment, int strip, size_t max_frame_size)
+{
+	/* With a nonzero width, inbound data is split into frames described by
+	 * a length field (see Framer_t), each dispatched as EM_CONNECTION_FRAME.
+	 * A zero width switches length framing off.
+	 */
+	if (width)
+		_SwitchFraming (NULL, new Framer_t (width, big_endian, offset, adjustment, strip, max_frame_size));
+	else if (LengthFramer)
+		_SwitchFraming (NULL, NULL);
+}
+
+
 /*******************************************
 ConnectionDescriptor::_CheckHandshakeStatus
 *******************************************/
@@ -1095,6 +2223,18 @@ void ConnectionDescriptor::_CheckHandshakeStatus()
 	#ifdef WITH_SSL
 	if (SslBox && (!bHandshakeSignaled) && SslBox->IsHandshakeCompleted()) {
 		bHandshakeSignaled = true;
+		TlsStats_t &stats = MyEventMachine->TlsStats;
+		if (SslBox->IsSessionReused())
+			stats.ResumedHandshakes++;
+		else
+			stats.FullHandshakes++;
+
+		uint64_t took = (MyEventMachine->GetRealTime() - TlsStartedAt) / 1000;
+		int bucket = 0;
+		while ((bucket < TLS_HANDSHAKE_TIME_BUCKETS - 1) && (took >= ((uint64_t)1 << bucket)))
+			bucket++;
+		stats.HandshakeTimes [bucket]++;
+
 		if (EventCallback)
 			(*EventCallback)(GetBinding(), EM_SSL_HANDSHAKE_COMPLETED, NULL, 0);
 	}
@@ -1132,12 +2272,26 @@ void ConnectionDescriptor::Write()
 		int o = getsockopt (GetSocket(), SOL_SOCKET, SO_ERROR, (char*)&error, &len);
 		#endif
 		if ((o == 0) && (error == 0)) {
+			#ifdef OS_UNIX
+			if (RedialState) {
+				RedialState->Attempts = 0;
+				RedialState->Connected = true;
+				MyEventMachine->GetCircuitBreakers()->Report (RedialState->Target, MyEventMachine->GetRealTime(), true, 0);
+			}
+			#endif
+
 			if (EventCallback)
 				(*EventCallback)(GetBinding(), EM_CONNECTION_COMPLETED, "", 0);
 
 			// 5May09: Moved epoll/kqueue read/write arming into SetConnectPending, so it can be called
 			// from EventMachine_t::AttachFD as well.
 			SetConnectPending (false);
+
+			#ifdef WITH_SSL
+			// A client's handshake is timed from here if TLS started early.
+			if (SslBox && !bHandshakeSignaled)
+				TlsStartedAt = MyEventMachine->GetRealTime();
+			#endif
 		}
 		else {
 			if (o == 0)
@@ -1158,6 +2312,13 @@ void ConnectionDescriptor::Write()
 
 		assert(!bWatchOnly);
 
+		#ifdef WITH_SSL
+		if (SslBox && SslBox->IsOnSocket()) {
+			_WriteSocketTls();
+			return;
+		}
+		#endif
+
 		/* 5May09: Kqueue bugs on OSX cause one extra writable event to fire even though we're using
 		   EV_ONESHOT. We ignore this extra event once, but only the first time. If it happens again,
 		   we should fall through to the assert(nbytes>0) failure to catch any EM bugs which might cause
@@ -1208,6 +2369,14 @@ void ConnectionDescriptor::_WriteOutboundData()
 	LastActivity = MyEventMachine->GetCurrentLoopTime();
 	size_t nbytes = 0;
 
+	// Over its rate limit, the data waits for the reactor to refill the bucket.
+	bool limited = _IsRateLimited();
+	size_t budget = limited ? _GetBudget (false, OutboundDataSize) : (size_t) OutboundDataSize;
+	if (limited && !budget) {
+		_UpdateEvents (false, true);
+		return;
+	}
+
 	#ifdef HAVE_WRITEV
 	int iovcnt = OutboundPages.size();
 	// Max of 16 outbound pages at a time
@@ -1225,22 +2394,28 @@ void ConnectionDescriptor::_WriteOutboundData()
 		iov[i].iov_base = (void *)(op->Buffer + op->Offset);
 		#endif
 		iov[i].iov_len	= op->Length - op->Offset;
+		if (nbytes + iov[i].iov_len >= budget) {
+			iov[i].iov_len = budget - nbytes;
+			iovcnt = i + 1;
+		}
 
 		nbytes += iov[i].iov_len;
 	}
 	#else
 	char output_buffer [16 * 1024];
+	if (budget > sizeof(output_buffer))
+		budget = sizeof(output_buffer);
 
-	while ((OutboundPages.size() > 0) && (nbytes < sizeof(output_buffer))) {
+	while ((OutboundPages.size() > 0) && (nbytes < budget)) {
 		OutboundPage *op = &(OutboundPages[0]);
-		if ((nbytes + op->Length - op->Offset) < sizeof (output_buffer)) {
+		if ((nbytes + op->Length - op->Offset) < budget) {
 			memcpy (output_buffer + nbytes, op->Buffer + op->Offset, op->Length - op->Offset);
 			nbytes += (op->Length - op->Offset);
 			op->Free();
 			OutboundPages.pop_front();
 		}
 		else {
-			int len = sizeof(output_buffer) - nbytes;
+			int len = budget - nbytes;
 			memcpy (output_buffer + nbytes, op->Buffer + op->Offset, len);
 			op->Offset += len;
 			nbytes += len;
@@ -1274,6 +2449,9 @@ void ConnectionDescriptor::_WriteOutboundData()
 
 	assert (bytes_written >= 0);
 	OutboundDataSize -= bytes_written;
+	MyEventMachine->AdjustOutboundBytes (-bytes_written);
+	if (limited && bytes_written)
+		_Spend (false, bytes_written);
 
 	if (ProxiedFrom && MaxOutboundBufSize && (unsigned int)GetOutboundDataSize() < MaxOutboundBufSize && ProxiedFrom->IsPaused())
 		ProxiedFrom->Resume();
@@ -1281,24 +2459,25 @@ void ConnectionDescriptor::_WriteOutboundData()
 	#ifdef HAVE_WRITEV
 	if (!err) {
 		unsigned int sent = bytes_written;
-		std::deque<OutboundPage>::iterator op = OutboundPages.begin();
 
 		for (int i = 0; i < iovcnt; i++) {
-			if (iov[i].iov_len <= sent) {
+			// Shouldn't be possible run out of pages before the loop ends
+			assert(!OutboundPages.empty());
+			OutboundPage *op = &(OutboundPages.front());
+			// Not iov_len, which the rate limit may have cut short.
+			size_t left = op->Length - op->Offset;
+
+			if (left <= sent) {
 				// Sent this page in full, free it.
 				op->Free();
 				OutboundPages.pop_front();
 
-				sent -= iov[i].iov_len;
+				sent -= left;
 			} else {
 				// Sent part (or none) of this page, increment offset to send the remainder
 				op->Offset += sent;
 				break;
 			}
-
-			// Shouldn't be possible run out of pages before the loop ends
-			assert(op != OutboundPages.end());
-			*op++;
 		}
 	}
 	#else
@@ -1367,14 +2546,160 @@ void ConnectionDescriptor::StartTls()
 	if (SslBox)
 		throw std::runtime_error ("SSL/TLS already running on connection");
 
-	SslBox = new SslBox_t (bIsServer, PrivateKeyFilename, PrivateKey, PrivateKeyPass, CertChainFilename, Cert, bSslVerifyPeer, bSslFailIfNoPeerCert, SniHostName, CipherList, EcdhCurve, DhParam, Protocols, GetBinding());
-	_DispatchCiphertext();
+	/* For kernel TLS, OpenSSL has to own the socket, so it can't be used
+	 * for data queued before TLS started, which must go out in the clear.
+	 */
+	TlsParms_t *parms = _GetTlsParms();
+	SOCKET sd = INVALID_SOCKET;
+	if (parms->bKtls && OutboundPages.empty())
+		sd = GetSocket();
+
+	SslBox = new SslBox_t (bIsServer, parms->PrivateKeyFilename, parms->PrivateKey, parms->PrivateKeyPass, parms->CertChainFilename, parms->Cert, bSslVerifyPeer, parms->bFailIfNoPeerCert, parms->SniHostName, parms->TlsPeerName, parms->CipherList, parms->EcdhCurve, parms->DhParam, parms->Protocols, parms->bDynamicRecords, sd, GetBinding());
+	delete TlsParms;
+	TlsParms = NULL;
+
+	MyEventMachine->TlsStats.StartedHandshakes++;
+	TlsStartedAt = MyEventMachine->GetRealTime();
+
+	if (EventMachine_t::GetTlsIdleShrink())
+		MyEventMachine->QueueHeartbeat (this);
+
+	if (SslBox->IsOnSocket())
+		_UpdateEvents (false, true);
+	else
+		_DispatchCiphertext();
+
+}
+#else
+void ConnectionDescriptor::StartTls()
+{
+	throw std::runtime_error ("Encryption not available on this event-machine");
+}
+#endif
+
+
+/************************************
+ConnectionDescriptor::SetTlsPeerName
+************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::SetTlsPeerName (const char *host, int port)
+{
+	/* Outbound connections are named by the host and port they were made
+	 * to, which (with the SNI hostname) key the client TLS session store.
+	 */
+	std::ostringstream name;
+	name << host << " " << port;
+	_GetTlsParms()->TlsPeerName = name.str();
+}
+#endif
+
+
+/**********************************
+ConnectionDescriptor::_GetTlsParms
+**********************************/
+
+#ifdef WITH_SSL
+TlsParms_t *ConnectionDescriptor::_GetTlsParms()
+{
+	if (!TlsParms)
+		TlsParms = new TlsParms_t();
+	return TlsParms;
+}
+#endif
+
+
+/**********************************
+ConnectionDescriptor::GetTlsMemory
+**********************************/
+
+#ifdef WITH_SSL
+int ConnectionDescriptor::GetTlsMemory()
+{
+	/* Bytes held for the connection's TLS, or -1 if it hasn't started.
+	 * While a handshake thread has the box, only the box itself is counted.
+	 */
+	if (!SslBox)
+		return -1;
+
+	size_t size = HeldPlaintext.capacity();
+	size += bHandshakeOffloaded ? sizeof (SslBox_t) : SslBox->GetMemoryUsage();
+	if (PlaintextBuffer)
+		size += SSLBOX_PLAINTEXT_BUFFER_SIZE + 1;
+	return (int) size;
+}
+#endif
+
+
+/*********************************
+ConnectionDescriptor::IsTlsShrunk
+*********************************/
+
+#ifdef WITH_SSL
+int ConnectionDescriptor::IsTlsShrunk()
+{
+	// 1 if an idle shrink let the TLS buffers go and they haven't been
+	// needed since, 0 if not, or -1 if TLS hasn't started.
+	if (!SslBox || bHandshakeOffloaded)
+		return -1;
+	return SslBox->IsShrunk() ? 1 : 0;
+}
+#endif
+
+
+/******************************************
+ConnectionDescriptor::GetTimeTilIdleShrink
+******************************************/
+
+#ifdef WITH_SSL
+uint64_t ConnectionDescriptor::GetTimeTilIdleShrink()
+{
+	/* Connections with TLS get a heartbeat when they've been idle long
+	 * enough to shrink, and after that, every so often to see whether
+	 * they've been busy again.
+	 */
+	uint64_t shrink_after = EventMachine_t::GetTlsIdleShrink();
+	if (!SslBox || !shrink_after)
+		return 0;
+	if (SslBox->IsShrunk() || bHandshakeOffloaded || bConnectPending)
+		return shrink_after;
+
+	uint64_t idle = MyEventMachine->GetCurrentLoopTime() - LastActivity;
+	return (idle < shrink_after) ? (shrink_after - idle) : 1;
+}
+#endif
+
+
+/************************************
+ConnectionDescriptor::_ShrinkIdleTls
+************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::_ShrinkIdleTls()
+{
+	uint64_t shrink_after = EventMachine_t::GetTlsIdleShrink();
+	if (!SslBox || !shrink_after || bHandshakeOffloaded || SslBox->IsShrunk())
+		return;
 
+	uint64_t skew = MyEventMachine->GetTimerQuantum();
+	if ((skew + MyEventMachine->GetCurrentLoopTime() - LastActivity) >= shrink_after) {
+		SslBox->Shrink();
+		std::string().swap (HeldPlaintext);
+	}
 }
-#else
-void ConnectionDescriptor::StartTls()
+#endif
+
+
+/***********************************
+ConnectionDescriptor::GetKtlsStatus
+***********************************/
+
+#ifdef WITH_SSL
+int ConnectionDescriptor::GetKtlsStatus()
 {
-	throw std::runtime_error ("Encryption not available on this event-machine");
+	if (!SslBox || bHandshakeOffloaded)
+		return -1;
+	return SslBox->GetKtlsStatus();
 }
 #endif
 
@@ -1384,35 +2709,38 @@ ConnectionDescriptor::SetTlsParms
 *********************************/
 
 #ifdef WITH_SSL
-void ConnectionDescriptor::SetTlsParms (const char *privkey_filename, const char *privkey, const char *privkeypass, const char *certchain_filename, const char *cert, bool verify_peer, bool fail_if_no_peer_cert, const char *sni_hostname, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int protocols)
+void ConnectionDescriptor::SetTlsParms (const char *privkey_filename, const char *privkey, const char *privkeypass, const char *certchain_filename, const char *cert, bool verify_peer, bool fail_if_no_peer_cert, const char *sni_hostname, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int protocols, bool ktls, bool dynamic_records)
 {
 	if (SslBox)
 		throw std::runtime_error ("call SetTlsParms before calling StartTls");
+	TlsParms_t *parms = _GetTlsParms();
 	if (privkey_filename && *privkey_filename)
-		PrivateKeyFilename = privkey_filename;
+		parms->PrivateKeyFilename = privkey_filename;
 	if (privkey && *privkey)
-		PrivateKey = privkey;
+		parms->PrivateKey = privkey;
 	if (privkeypass && *privkeypass)
-		PrivateKeyPass = privkeypass;
+		parms->PrivateKeyPass = privkeypass;
 	if (certchain_filename && *certchain_filename)
-		CertChainFilename = certchain_filename;
+		parms->CertChainFilename = certchain_filename;
 	if (cert && *cert)
-		Cert = cert;
+		parms->Cert = cert;
 	bSslVerifyPeer     = verify_peer;
-	bSslFailIfNoPeerCert = fail_if_no_peer_cert;
+	parms->bFailIfNoPeerCert = fail_if_no_peer_cert;
 
 	if (sni_hostname && *sni_hostname)
-		SniHostName = sni_hostname;
+		parms->SniHostName = sni_hostname;
 	if (cipherlist && *cipherlist)
-		CipherList = cipherlist;
+		parms->CipherList = cipherlist;
 	if (ecdh_curve && *ecdh_curve)
-		EcdhCurve = ecdh_curve;
+		parms->EcdhCurve = ecdh_curve;
 	if (dhparam && *dhparam)
-		DhParam = dhparam;
-	Protocols = protocols;
+		parms->DhParam = dhparam;
+	parms->Protocols = protocols;
+	parms->bKtls = ktls;
+	parms->bDynamicRecords = dynamic_records;
 }
 #else
-void ConnectionDescriptor::SetTlsParms (const char *privkey_filename UNUSED, const char *privkey UNUSED, const char *privkeypass UNUSED, const char *certchain_filename UNUSED, const char *cert UNUSED, bool verify_peer UNUSED, bool fail_if_no_peer_cert UNUSED, const char *sni_hostname UNUSED, const char *cipherlist UNUSED, const char *ecdh_curve UNUSED, const char *dhparam UNUSED, int protocols UNUSED)
+void ConnectionDescriptor::SetTlsParms (const char *privkey_filename UNUSED, const char *privkey UNUSED, const char *privkeypass UNUSED, const char *certchain_filename UNUSED, const char *cert UNUSED, bool verify_peer UNUSED, bool fail_if_no_peer_cert UNUSED, const char *sni_hostname UNUSED, const char *cipherlist UNUSED, const char *ecdh_curve UNUSED, const char *dhparam UNUSED, int protocols UNUSED, bool ktls UNUSED, bool dynamic_records UNUSED)
 {
 	throw std::runtime_error ("Encryption not available on this event-machine");
 }
@@ -1426,7 +2754,7 @@ ConnectionDescriptor::GetPeerCert
 #ifdef WITH_SSL
 X509 *ConnectionDescriptor::GetPeerCert()
 {
-	if (!SslBox)
+	if (!SslBox || bHandshakeOffloaded)
 		throw std::runtime_error ("SSL/TLS not running on this connection");
 	return SslBox->GetPeerCert();
 }
@@ -1440,7 +2768,7 @@ ConnectionDescriptor::GetCipherBits
 #ifdef WITH_SSL
 int ConnectionDescriptor::GetCipherBits()
 {
-	if (!SslBox)
+	if (!SslBox || bHandshakeOffloaded)
 		throw std::runtime_error ("SSL/TLS not running on this connection");
 	return SslBox->GetCipherBits();
 }
@@ -1454,7 +2782,7 @@ ConnectionDescriptor::GetCipherName
 #ifdef WITH_SSL
 const char *ConnectionDescriptor::GetCipherName()
 {
-	if (!SslBox)
+	if (!SslBox || bHandshakeOffloaded)
 		throw std::runtime_error ("SSL/TLS not running on this connection");
 	return SslBox->GetCipherName();
 }
@@ -1468,7 +2796,7 @@ ConnectionDescriptor::GetCipherProtocol
 #ifdef WITH_SSL
 const char *ConnectionDescriptor::GetCipherProtocol()
 {
-	if (!SslBox)
+	if (!SslBox || bHandshakeOffloaded)
 		throw std::runtime_error ("SSL/TLS not running on this connection");
 	return SslBox->GetCipherProtocol();
 }
@@ -1482,7 +2810,7 @@ ConnectionDescriptor::GetSNIHostname
 #ifdef WITH_SSL
 const char *ConnectionDescriptor::GetSNIHostname()
 {
-	if (!SslBox)
+	if (!SslBox || bHandshakeOffloaded)
 		throw std::runtime_error ("SSL/TLS not running on this connection");
 	return SslBox->GetSNIHostname();
 }
@@ -1528,17 +2856,16 @@ void ConnectionDescriptor::_DispatchCiphertext()
 	assert (SslBox);
 
 
-	char BigBuf [SSLBOX_OUTPUT_CHUNKSIZE];
 	bool did_work;
 
 	do {
 		did_work = false;
 
-		// try to drain ciphertext
-		while (SslBox->CanGetCiphertext()) {
-			int r = SslBox->GetCiphertext (BigBuf, sizeof(BigBuf));
-			assert (r > 0);
-			_SendRawOutboundData (BigBuf, r);
+		// try to drain ciphertext, queueing the SslBox's pages as they are
+		char *page;
+		int length;
+		while ((page = SslBox->TakeCiphertext (&length))) {
+			_SendRawOutboundPage (page, length);
 			did_work = true;
 		}
 
@@ -1578,6 +2905,32 @@ void ConnectionDescriptor::_DispatchCiphertext()
 
 	} while (did_work);
 
+	_CollectTlsStats();
+}
+#endif
+
+
+/**************************************
+ConnectionDescriptor::_CollectTlsStats
+**************************************/
+
+#ifdef WITH_SSL
+void ConnectionDescriptor::_CollectTlsStats()
+{
+	// Adds what the SslBox counted since the last time to the reactor's stats.
+	SslCounters_t counters;
+	SslBox->TakeCounters (&counters);
+
+	TlsStats_t &stats = MyEventMachine->TlsStats;
+	stats.BytesEncrypted += counters.BytesEncrypted;
+	stats.BytesDecrypted += counters.BytesDecrypted;
+	stats.RecordsSent += counters.RecordsSent;
+	stats.RecordsReceived += counters.RecordsReceived;
+	stats.ReadTime += counters.ReadTime;
+	stats.WriteTime += counters.WriteTime;
+	stats.HandshakeTime += counters.HandshakeTime;
+	stats.ContextsCreated += counters.ContextsCreated;
+	stats.ContextsReused += counters.ContextsReused;
 }
 #endif
 
@@ -1598,6 +2951,18 @@ void ConnectionDescriptor::Heartbeat()
 	 */
 	uint64_t skew = MyEventMachine->GetTimerQuantum();
 
+	#ifdef OS_UNIX
+	if (Race && Race->NextAttempt && (MyEventMachine->GetCurrentLoopTime() >= Race->NextAttempt))
+		_StartNextAttempt();
+
+	// Waiting to reconnect doesn't count towards the pending-connect timeout.
+	if (RedialState && RedialState->At) {
+		if (MyEventMachine->GetCurrentLoopTime() >= RedialState->At)
+			_Dial();
+		return;
+	}
+	#endif
+
 	/* Only allow a certain amount of time to go by while waiting
 	 * for a pending connect. If it expires, then kill the socket.
 	 * For a connected socket, close it if its inactivity timer
@@ -1617,8 +2982,198 @@ void ConnectionDescriptor::Heartbeat()
 			ScheduleClose (false);
 			//bCloseNow = true;
 		}
+		#ifdef WITH_SSL
+		else
+			_ShrinkIdleTls();
+		#endif
+	}
+}
+
+
+/********************************
+ConnectionDescriptor::SetPoolKey
+********************************/
+
+void ConnectionDescriptor::SetPoolKey (const std::string &key, bool waiting)
+{
+	if (PoolKey)
+		*PoolKey = key;
+	else
+		PoolKey = new std::string (key);
+	bPoolWaiting = waiting;
+}
+
+
+/**************************
+ConnectionDescriptor::Park
+**************************/
+
+bool ConnectionDescriptor::Park (uint64_t idle_timeout)
+{
+	/* Puts a connection Ruby is done with into the pool. Only one that's
+	 * fully established and quiet in both directions can go: nothing
+	 * queued to send, nothing half-framed, no TLS handshake or plaintext
+	 * outstanding, and nothing arrived from the server. Whatever framing
+	 * was set goes, so the next user gets a plain byte stream, and its
+	 * unbind is no longer reported.
+	 */
+	if (IsCloseScheduled() || bConnectPending || bResolving || bWatchOnly || bAttached)
+		return false;
+	if (ProxyTarget || ProxiedFrom || (OutboundDataSize > 0))
+		return false;
+	if ((LineTokenizer && LineTokenizer->GetBufferedSize()) || (LengthFramer && LengthFramer->GetBufferedSize()))
+		return false;
+	#ifdef WITH_SSL
+	if (SslBox && (!bHandshakeSignaled || bHandshakeOffloaded || PlaintextLength || !HeldPlaintext.empty()))
+		return false;
+	#endif
+	if (!_IsHealthy())
+		return false;
+
+	_SwitchFraming (NULL, NULL);
+	Resume();
+
+	bParked = true;
+	bCallbackUnbind = false;
+	InactivityTimeout = idle_timeout;
+	LastActivity = MyEventMachine->GetCurrentLoopTime();
+	MyEventMachine->QueueHeartbeat (this);
+	return true;
+}
+
+
+/***************************
+ConnectionDescriptor::Reuse
+***************************/
+
+bool ConnectionDescriptor::Reuse()
+{
+	/* Takes a connection out of the pool for a new user, after making
+	 * sure the server hasn't closed it in the meantime. It goes back to
+	 * pending-connect, so the first writable event reports it complete
+	 * exactly as it would a fresh one; nothing goes over the wire.
+	 */
+	if (IsCloseScheduled())
+		return false;
+	if (!_IsHealthy()) {
+		ScheduleClose (false);
+		return false;
+	}
+
+	bParked = false;
+	bReused = true;
+	bCallbackUnbind = true;
+	InactivityTimeout = 0;
+	CreatedAt = MyEventMachine->GetCurrentLoopTime();
+	SetConnectPending (true);
+	return true;
+}
+
+
+/******************************
+ConnectionDescriptor::HandOver
+******************************/
+
+void ConnectionDescriptor::HandOver (ConnectionDescriptor *to)
+{
+	/* A connection that waited for room in the pool has been given another
+	 * one. Its Ruby handler moves across first, since it may start TLS
+	 * there, and then whatever was sent or set on it meanwhile follows.
+	 * It goes away without an unbind.
+	 */
+	delete PoolKey;
+	PoolKey = NULL;
+	bPoolWaiting = false;
+	bCallbackUnbind = false;
+	ScheduleClose (false);
+
+	if (EventCallback)
+		(*EventCallback)(GetBinding(), EM_CONNECTION_REBOUND, NULL, to->GetBinding());
+
+	if (LineTokenizer || LengthFramer) {
+		to->_SwitchFraming (LineTokenizer, LengthFramer);
+		LineTokenizer = NULL;
+		LengthFramer = NULL;
 	}
+	to->InactivityTimeout = InactivityTimeout;
+	to->PendingConnectTimeout = PendingConnectTimeout;
+	to->MaxOutboundBufSize = MaxOutboundBufSize;
+	MyEventMachine->QueueHeartbeat (to);
+
+	for (size_t i = 0; i < OutboundPages.size(); i++)
+		to->SendOutboundData (OutboundPages[i].Buffer + OutboundPages[i].Offset, OutboundPages[i].Length - OutboundPages[i].Offset);
+}
+
+
+/********************************
+ConnectionDescriptor::_IsHealthy
+********************************/
+
+bool ConnectionDescriptor::_IsHealthy()
+{
+	// An idle connection has nothing to read. Readable means the server
+	// closed it (or reset it, or sent something unasked), so it can't be reused.
+	if (MySocket == INVALID_SOCKET)
+		return false;
+
+	char c;
+	int r = recv (MySocket, &c, 1, MSG_PEEK);
+	if (r >= 0)
+		return false;
+	#ifdef OS_WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+	#else
+	return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+	#endif
+}
+
+
+/**************************************************
+ConnectAttemptDescriptor::ConnectAttemptDescriptor
+**************************************************/
+
+#ifdef OS_UNIX
+ConnectAttemptDescriptor::ConnectAttemptDescriptor (SOCKET sd, EventMachine_t *parent_em, const uintptr_t owner):
+	EventableDescriptor (sd, parent_em),
+	Owner (owner),
+	bFinished (false)
+{
+	bCallbackUnbind = false;
+
+	#ifdef HAVE_EPOLL
+	EpollEvent.events = EPOLLOUT;
+	#endif
+	#ifdef HAVE_KQUEUE
+	MyEventMachine->ArmKqueueWriter (this);
+	#endif
+}
+#endif
+
+
+/*******************************
+ConnectAttemptDescriptor::Write
+*******************************/
+
+#ifdef OS_UNIX
+void ConnectAttemptDescriptor::Write()
+{
+	// Writable once the connect has gone one way or the other.
+	if (bFinished)
+		return;
+	bFinished = true;
+
+	int error = 0;
+	socklen_t len = sizeof(error);
+	if (getsockopt (MySocket, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+		error = errno;
+
+	ScheduleClose (false);
+
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (Owner));
+	if (cd && !cd->IsCloseScheduled())
+		cd->ConnectAttemptFinished (this, error);
 }
+#endif
 
 
 /****************************************
@@ -1673,7 +3228,16 @@ AcceptorDescriptor::AcceptorDescriptor
 **************************************/
 
 AcceptorDescriptor::AcceptorDescriptor (SOCKET sd, EventMachine_t *parent_em):
-	EventableDescriptor (sd, parent_em)
+	EventableDescriptor (sd, parent_em),
+	bOptionsInherited (false),
+	Limits (NULL),
+	Connections (0),
+	Shedding (0),
+	bHeldBack (false),
+	Sheds (0),
+	Rejected (0),
+	ReadBucket (NULL),
+	WriteBucket (NULL)
 {
 	#ifdef HAVE_EPOLL
 	EpollEvent.events = EPOLLIN;
@@ -1690,6 +3254,13 @@ AcceptorDescriptor::~AcceptorDescriptor
 
 AcceptorDescriptor::~AcceptorDescriptor()
 {
+	if (Limits)
+		MyEventMachine->RemoveLimitedAcceptor (this);
+	delete Limits;
+	if (ReadBucket || WriteBucket)
+		MyEventMachine->AdjustRateLimitedListeners (-1);
+	delete ReadBucket;
+	delete WriteBucket;
 }
 
 /****************************************
@@ -1728,19 +3299,40 @@ void AcceptorDescriptor::Read()
 
 
 	struct sockaddr_in6 pin;
-	socklen_t addrlen = sizeof (pin);
+	socklen_t addrlen;
 	int accept_count = EventMachine_t::GetSimultaneousAcceptCount();
 
+	#if defined(HAVE_CONST_SOCK_CLOEXEC) && defined(HAVE_CONST_SOCK_NONBLOCK) && defined(HAVE_ACCEPT4)
+	// Cleared for good if the kernel turns accept4 down.
+	static bool use_accept4 = true;
+	#endif
+
 	for (int i=0; i < accept_count; i++) {
-#if defined(HAVE_CONST_SOCK_CLOEXEC) && defined(HAVE_ACCEPT4)
-		SOCKET sd = accept4 (GetSocket(), (struct sockaddr*)&pin, &addrlen, SOCK_CLOEXEC);
-		if (sd == INVALID_SOCKET) {
-			// We may be running in a kernel where
-			// SOCK_CLOEXEC is not supported - fall back:
-			sd = accept (GetSocket(), (struct sockaddr*)&pin, &addrlen);
+		// Past a limit, leave the rest in the kernel's queue or turn them away.
+		if (Limits && !Shedding) {
+			int reason = _OverLimit (100);
+			if (reason)
+				_StartShedding (reason);
+		}
+		if (Shedding && !Limits->bReject)
+			break;
+
+		addrlen = sizeof (pin);
+		bool flags_set = false;
+		SOCKET sd = INVALID_SOCKET;
+#if defined(HAVE_CONST_SOCK_CLOEXEC) && defined(HAVE_CONST_SOCK_NONBLOCK) && defined(HAVE_ACCEPT4)
+		if (use_accept4) {
+			// One call instead of an accept and four fcntls.
+			sd = accept4 (GetSocket(), (struct sockaddr*)&pin, &addrlen, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (sd != INVALID_SOCKET)
+				flags_set = true;
+			else if ((errno == EINVAL) || (errno == ENOSYS))
+				use_accept4 = false;
 		}
+		if (!use_accept4)
+			sd = accept (GetSocket(), (struct sockaddr*)&pin, &addrlen);
 #else
-		SOCKET sd = accept (GetSocket(), (struct sockaddr*)&pin, &addrlen);
+		sd = accept (GetSocket(), (struct sockaddr*)&pin, &addrlen);
 #endif
 		if (sd == INVALID_SOCKET) {
 			// This breaks the loop when we've accepted everything on the kernel queue,
@@ -1753,7 +3345,7 @@ void AcceptorDescriptor::Read()
 		// Set the newly-accepted socket non-blocking and to close on exec.
 		// On Windows, this may fail because, weirdly, Windows inherits the non-blocking
 		// attribute that we applied to the acceptor socket into the accepted one.
-		if (!SetFdCloexec(sd) || !SetSocketNonblocking (sd)) {
+		if (!flags_set && (!SetFdCloexec(sd) || !SetSocketNonblocking (sd))) {
 		//int val = fcntl (sd, F_GETFL, 0);
 		//if (fcntl (sd, F_SETFL, val | O_NONBLOCK) == -1) {
 			shutdown (sd, 1);
@@ -1761,15 +3353,25 @@ void AcceptorDescriptor::Read()
 			continue;
 		}
 
-		// Disable slow-start (Nagle algorithm). Eventually make this configurable.
-		int one = 1;
-		setsockopt (sd, IPPROTO_TCP, TCP_NODELAY, (char*) &one, sizeof(one));
+		if (Shedding) {
+			_Reject (sd);
+			continue;
+		}
+
+		// Disable slow-start (Nagle algorithm), unless the listener was
+		// set up so that accepted sockets already have it disabled (or not).
+		if (!bOptionsInherited) {
+			int one = 1;
+			setsockopt (sd, IPPROTO_TCP, TCP_NODELAY, (char*) &one, sizeof(one));
+		}
 
 
 		ConnectionDescriptor *cd = new ConnectionDescriptor (sd, MyEventMachine);
 		if (!cd)
 			throw std::runtime_error ("no newly accepted connection");
 		cd->SetServerMode();
+		cd->SetAcceptor (GetBinding());
+		Connections++;
 		if (EventCallback) {
 			(*EventCallback) (GetBinding(), EM_CONNECTION_ACCEPTED, NULL, cd->GetBinding());
 		}
@@ -1815,6 +3417,221 @@ void AcceptorDescriptor::Heartbeat()
 }
 
 
+/**************************************
+AcceptorDescriptor::SetAdmissionLimits
+**************************************/
+
+void AcceptorDescriptor::SetAdmissionLimits (const AdmissionLimits_t *limits)
+{
+	if (limits) {
+		if (!Limits) {
+			Limits = new AdmissionLimits_t;
+			MyEventMachine->AddLimitedAcceptor (this);
+		}
+		*Limits = *limits;
+		if (Shedding && !_OverLimit (Limits->ResumePercent))
+			_StopShedding();
+		else
+			_UpdatePolling();
+	}
+	else if (Limits) {
+		if (Shedding)
+			_StopShedding();
+		MyEventMachine->RemoveLimitedAcceptor (this);
+		delete Limits;
+		Limits = NULL;
+	}
+}
+
+
+/*********************************
+AcceptorDescriptor::SetRateLimits
+*********************************/
+
+void AcceptorDescriptor::SetRateLimits (const RateLimits_t *limits)
+{
+	/* Buckets that every connection this listener accepts draws from, as
+	 * well as from its own. Connections look them up through the
+	 * listener's binding, so the reactor counts listeners that have them,
+	 * and connections spare themselves the lookup while there are none.
+	 */
+	uint64_t now = MyEventMachine->GetCurrentLoopTime();
+	bool had = ReadBucket || WriteBucket;
+	delete ReadBucket;
+	delete WriteBucket;
+	ReadBucket = (limits && limits->ReadRate) ? new TokenBucket_t (limits->ReadRate, limits->Burst, now) : NULL;
+	WriteBucket = (limits && limits->WriteRate) ? new TokenBucket_t (limits->WriteRate, limits->Burst, now) : NULL;
+
+	bool has = ReadBucket || WriteBucket;
+	if (has != had)
+		MyEventMachine->AdjustRateLimitedListeners (has ? 1 : -1);
+}
+
+
+/*************************************
+AcceptorDescriptor::GetAdmissionStats
+*************************************/
+
+void AcceptorDescriptor::GetAdmissionStats (AdmissionStats_t *stats)
+{
+	stats->Connections = Connections;
+	stats->Shedding = Shedding;
+	stats->Sheds = Sheds;
+	stats->Rejected = Rejected;
+	stats->LoopLag = MyEventMachine->GetLoopLag();
+	stats->OutboundBytes = MyEventMachine->GetOutboundBytes();
+}
+
+
+/**********************************
+AcceptorDescriptor::CheckAdmission
+**********************************/
+
+void AcceptorDescriptor::CheckAdmission()
+{
+	/* Once per pass. Starting to shed here as well as in Read means a
+	 * listener pauses before the next burst of connections reaches it,
+	 * not after.
+	 */
+	if (!Limits)
+		return;
+	if (Shedding) {
+		if (!_OverLimit (Limits->ResumePercent))
+			_StopShedding();
+	}
+	else {
+		int reason = _OverLimit (100);
+		if (reason)
+			_StartShedding (reason);
+	}
+}
+
+
+/******************************
+AcceptorDescriptor::_OverLimit
+******************************/
+
+int AcceptorDescriptor::_OverLimit (int percent)
+{
+	// Which measure has reached percent of its limit, if any.
+	if (Limits->MaxConnections && ((uint64_t)Connections * 100 >= (uint64_t)Limits->MaxConnections * percent))
+		return EM_SHED_CONNECTIONS;
+	if (Limits->MaxLoopLag && (MyEventMachine->GetLoopLag() * 100 >= Limits->MaxLoopLag * percent))
+		return EM_SHED_LOOP_LAG;
+	if (Limits->MaxOutboundBytes && (MyEventMachine->GetOutboundBytes() * 100 >= Limits->MaxOutboundBytes * percent))
+		return EM_SHED_OUTBOUND_BYTES;
+	return 0;
+}
+
+
+/**********************************
+AcceptorDescriptor::_StartShedding
+**********************************/
+
+void AcceptorDescriptor::_StartShedding (int reason)
+{
+	Shedding = reason;
+	Sheds++;
+	_UpdatePolling();
+
+	if (EventCallback)
+		(*EventCallback) (GetBinding(), EM_SHEDDING_STARTED, NULL, reason);
+}
+
+
+/*********************************
+AcceptorDescriptor::_StopShedding
+*********************************/
+
+void AcceptorDescriptor::_StopShedding()
+{
+	Shedding = 0;
+	_UpdatePolling();
+
+	if (EventCallback)
+		(*EventCallback) (GetBinding(), EM_SHEDDING_STOPPED, NULL, 0);
+}
+
+
+/*************************
+AcceptorDescriptor::Pause
+*************************/
+
+bool AcceptorDescriptor::Pause()
+{
+	bool old = bPaused;
+	bPaused = true;
+	_UpdatePolling();
+	return old == false;
+}
+
+
+/**************************
+AcceptorDescriptor::Resume
+**************************/
+
+bool AcceptorDescriptor::Resume()
+{
+	bool old = bPaused;
+	bPaused = false;
+	_UpdatePolling();
+	return old == true;
+}
+
+
+/**********************************
+AcceptorDescriptor::_UpdatePolling
+**********************************/
+
+void AcceptorDescriptor::_UpdatePolling()
+{
+	// A listener that leaves connections queued stops polling while it sheds.
+	bool held = bPaused || (Shedding && Limits && !Limits->bReject);
+	if (held == bHeldBack)
+		return;
+	bHeldBack = held;
+
+	#ifdef HAVE_EPOLL
+	EpollEvent.events = bHeldBack ? 0 : EPOLLIN;
+	MyEventMachine->Modify (this);
+	#endif
+	#ifdef HAVE_KQUEUE
+	if (bHeldBack)
+		MyEventMachine->DisarmKqueueReader (this);
+	else
+		MyEventMachine->ArmKqueueReader (this);
+	#endif
+}
+
+
+/***************************
+AcceptorDescriptor::_Reject
+***************************/
+
+void AcceptorDescriptor::_Reject (SOCKET sd)
+{
+	/* Turns a connection away without the application hearing of it. What
+	 * the client has sent already is read first, since closing a socket
+	 * with unread data resets it and the client could lose the response.
+	 * The response is sent if it fits in the socket buffer, which a short
+	 * one does.
+	 */
+	char buffer [4096];
+	for (int i = 0; i < 4; i++) {
+		if (recv (sd, buffer, sizeof(buffer), 0) <= 0)
+			break;
+	}
+
+	const std::string &response = Limits->RejectResponse;
+	if (!response.empty())
+		(void) send (sd, response.data(), response.size(), 0);
+
+	shutdown (sd, 1);
+	close (sd);
+	Rejected++;
+}
+
+
 /**************************************
 DatagramDescriptor::DatagramDescriptor
 **************************************/
@@ -22,12 +22,49 @@ See the file COPYING for complete licensing information.
 
 
 class EventMachine_t; // forward reference
+class Tokenizer_t; // forward reference
+class Framer_t; // forward reference
+class TokenBucket_t; // forward reference
+struct RateLimits_t; // forward reference
 #ifdef WITH_SSL
 class SslBox_t; // forward reference
 #endif
 
 bool SetSocketNonblocking (SOCKET);
 bool SetFdCloexec (int);
+SOCKET EmSocket (int, int, int);
+SOCKET EmConnectSocket (int, bool);
+
+#ifdef WITH_SSL
+/******************
+struct TlsParms_t
+******************/
+
+struct TlsParms_t
+{
+	/* What a connection was given for starting TLS, kept on the side until
+	 * StartTls builds the SslBox from it, after which it's freed: a server
+	 * with many idle TLS connections shouldn't carry their key and
+	 * certificate strings around.
+	 */
+	TlsParms_t(): Protocols (0), bFailIfNoPeerCert (false), bKtls (false), bDynamicRecords (false) {}
+
+	std::string CertChainFilename;
+	std::string Cert;
+	std::string PrivateKeyFilename;
+	std::string PrivateKey;
+	std::string PrivateKeyPass;
+	std::string CipherList;
+	std::string EcdhCurve;
+	std::string DhParam;
+	std::string SniHostName;
+	std::string TlsPeerName;
+	int Protocols;
+	bool bFailIfNoPeerCert;
+	bool bKtls;
+	bool bDynamicRecords;
+};
+#endif
 
 /*************************
 class EventableDescriptor
@@ -60,7 +97,12 @@ class EventableDescriptor: public Bindable_t
 
 		virtual void ScheduleClose (bool after_writing);
 		bool IsCloseScheduled();
+		bool IsCloseNow() {return bCloseNow;}
 		virtual void HandleError(){ ScheduleClose (false); }
+		// Asked before a descriptor that closed is deleted: true if it's starting over instead.
+		// Ruby hears of it from AnnounceRedial, once it's safe to call into.
+		virtual bool Redial() { return false; }
+		virtual void AnnounceRedial() {}
 
 		int EnableKeepalive(int idle, int intvl, int cnt);
 		int DisableKeepalive();
@@ -72,7 +114,7 @@ class EventableDescriptor: public Bindable_t
 		virtual bool GetSubprocessPid (pid_t*) {return false;}
 
 		virtual void StartTls() {}
-		virtual void SetTlsParms (const char *, const char *, const char *, const char *, const char *, bool, bool, const char *, const char *, const char *, const char *, int) {}
+		virtual void SetTlsParms (const char *, const char *, const char *, const char *, const char *, bool, bool, const char *, const char *, const char *, const char *, int, bool, bool) {}
 
 		#ifdef WITH_SSL
 		virtual X509 *GetPeerCert() {return NULL;}
@@ -108,19 +150,43 @@ class EventableDescriptor: public Bindable_t
 		void SetUnbindReasonCode(int code){ UnbindReasonCode = code; }
 		virtual int ReportErrorStatus(){ return 0; }
 		virtual bool IsConnectPending(){ return false; }
+		virtual bool IsResolving(){ return false; }
 		virtual uint64_t GetNextHeartbeat();
+		virtual uint64_t GetTimeTilIdleShrink() {return 0;}
+		virtual uint64_t GetTimeTilConnectAttempt() {return 0;}
+
+		virtual void SetLineFraming (const char*, size_t, size_t) {}
+		virtual void SetLengthFraming (int, bool, int, int, int, size_t) {}
 
 	private:
 		bool bCloseNow;
 		bool bCloseAfterWriting;
 
 	protected:
+		// What the reactor looks at for every descriptor, every time round.
 		SOCKET MySocket;
 		bool bAttached;
 		bool bWatchOnly;
+		bool bPaused;
+
+		#ifdef HAVE_EPOLL
+		struct epoll_event EpollEvent;
+		#endif
+
+		#ifdef HAVE_KQUEUE
+		bool bKqueueArmWrite;
+		#endif
 
+		EventMachine_t *MyEventMachine;
 		EMCallback EventCallback;
+		uint64_t LastActivity;
+		uint64_t NextHeartbeat;
+		uint64_t InactivityTimeout;
+		uint64_t PendingConnectTimeout;
+
+		void _CancelClose();
 		void _GenericInboundDispatch (const char *buffer, unsigned long size);
+		virtual void _DeliverInboundData (const char *buffer, unsigned long size);
 		bool _GenericGetPeername (struct sockaddr*, socklen_t*);
 		bool _GenericGetSockname (struct sockaddr*, socklen_t*);
 
@@ -134,21 +200,6 @@ class EventableDescriptor: public Bindable_t
 		unsigned long ProxiedBytes;
 
 		unsigned long MaxOutboundBufSize;
-
-		#ifdef HAVE_EPOLL
-		struct epoll_event EpollEvent;
-		#endif
-
-		#ifdef HAVE_KQUEUE
-		bool bKqueueArmWrite;
-		#endif
-
-		EventMachine_t *MyEventMachine;
-		uint64_t PendingConnectTimeout;
-		uint64_t InactivityTimeout;
-		uint64_t LastActivity;
-		uint64_t NextHeartbeat;
-		bool bPaused;
 };
 
 
@@ -185,9 +236,28 @@ class ConnectionDescriptor: public EventableDescriptor
 		ConnectionDescriptor (SOCKET, EventMachine_t*);
 		virtual ~ConnectionDescriptor();
 
+		// Servers make and drop so many of these that they're recycled.
+		static void *operator new (size_t);
+		static void operator delete (void*, size_t);
+
 		int SendOutboundData (const char*, unsigned long);
 
 		void SetConnectPending (bool f);
+		void SetResolving (bool f) { bResolving = f; }
+		// Whether the sockets it connects on ask for TCP Fast Open.
+		void SetFastOpen (bool f) { bFastOpen = f; }
+		bool IsFastOpen() { return bFastOpen; }
+		#ifdef OS_UNIX
+		void StartConnectRace (const std::vector<struct sockaddr_storage>&);
+		void ConnectAttemptFinished (EventableDescriptor*, int);
+		virtual uint64_t GetTimeTilConnectAttempt();
+		// Reconnecting under the CircuitBreakers_t::Policy.
+		void SetRedial (const char *server, int port);
+		void CancelRedial();
+		int GetRedialAttempts() { return RedialState ? RedialState->Attempts : 0; }
+		virtual bool Redial();
+		virtual void AnnounceRedial();
+		#endif
 		virtual void ScheduleClose (bool after_writing);
 		virtual void HandleError();
 
@@ -206,14 +276,22 @@ class ConnectionDescriptor: public EventableDescriptor
 		virtual void Write();
 		virtual void Heartbeat();
 
+		// Batched reads performed by the reactor outside the GVL.
+		bool IsPrefetchable();
+		void Read (const PrefetchedRead_t*);
+
 		virtual bool SelectForRead();
 		virtual bool SelectForWrite();
 
 		// Do we have any data to write? This is used by ShouldDelete.
+		#ifdef WITH_SSL
+		virtual int GetOutboundDataSize();
+		#else
 		virtual int GetOutboundDataSize() {return OutboundDataSize;}
+		#endif
 
 		virtual void StartTls();
-		virtual void SetTlsParms (const char *, const char *,  const char *, const char *, const char *, bool, bool, const char *, const char *, const char *, const char *, int);
+		virtual void SetTlsParms (const char *, const char *,  const char *, const char *, const char *, bool, bool, const char *, const char *, const char *, const char *, int, bool, bool);
 
 		#ifdef WITH_SSL
 		virtual X509 *GetPeerCert();
@@ -223,18 +301,46 @@ class ConnectionDescriptor: public EventableDescriptor
 		virtual const char *GetSNIHostname();
 		virtual bool VerifySslPeer(const char*);
 		virtual void AcceptSslPeer();
+		void SetTlsPeerName (const char*, int);
+		int GetKtlsStatus();
+		int GetTlsMemory();
+		int IsTlsShrunk();
+		void FinishOffloadedHandshake (int);
 		#endif
 
+		// Outbound connections kept for reuse by the ConnectionPool_t.
+		void SetPoolKey (const std::string&, bool waiting);
+		const std::string *GetPoolKey() { return PoolKey; }
+		bool IsParked() { return bParked; }
+		bool IsPoolWaiting() { return bPoolWaiting; }
+		bool IsReused() { return bReused; }
+		bool Park (uint64_t idle_timeout);
+		bool Reuse();
+		void HandOver (ConnectionDescriptor*);
+
+		// Token buckets for the bytes read and written. NULL lifts the limits.
+		void SetRateLimits (const RateLimits_t*);
+		bool RefillBuckets (uint64_t now);
+
 		void SetServerMode() {bIsServer = true;}
+		// The listener that accepted us, which counts its open connections.
+		void SetAcceptor (const uintptr_t binding) {Acceptor = binding;}
 
 		virtual bool GetPeername (struct sockaddr* s, socklen_t* len) { return _GenericGetPeername (s, len); }
 		virtual bool GetSockname (struct sockaddr* s, socklen_t* len) { return _GenericGetSockname (s, len); }
 
 		virtual uint64_t GetCommInactivityTimeout();
 		virtual int SetCommInactivityTimeout (uint64_t value);
+		#ifdef WITH_SSL
+		virtual uint64_t GetTimeTilIdleShrink();
+		#endif
 
 		virtual int ReportErrorStatus();
 		virtual bool IsConnectPending(){ return bConnectPending; }
+		virtual bool IsResolving(){ return bResolving; }
+
+		virtual void SetLineFraming (const char*, size_t, size_t);
+		virtual void SetLengthFraming (int, bool, int, int, int, size_t);
 
 	protected:
 		struct OutboundPage {
@@ -246,51 +352,147 @@ class ConnectionDescriptor: public EventableDescriptor
 		};
 
 	protected:
-		bool bConnectPending;
+		// Touched on every read and write.
+		int OutboundDataSize;
+		PageQueue_t<OutboundPage> OutboundPages;
 
+		bool bConnectPending;
+		bool bResolving;
+		bool bFastOpen;
 		bool bNotifyReadable;
 		bool bNotifyWritable;
-
 		bool bReadAttemptedAfterClose;
 		bool bWriteAttemptedAfterClose;
+		bool bIsServer;
+		#ifdef HAVE_KQUEUE
+		bool bGotExtraKqueueEvent;
+		#endif
 
-		std::deque<OutboundPage> OutboundPages;
-		int OutboundDataSize;
+		Tokenizer_t *LineTokenizer;
+		Framer_t *LengthFramer;
 
 		#ifdef WITH_SSL
 		SslBox_t *SslBox;
-		std::string CertChainFilename;
-		std::string Cert;
-		std::string PrivateKeyFilename;
-		std::string PrivateKey;
-		std::string PrivateKeyPass;
-		std::string CipherList;
-		std::string EcdhCurve;
-		std::string DhParam;
-		int Protocols;
+		TlsParms_t *TlsParms;
+		uint64_t TlsStartedAt;
 		bool bHandshakeSignaled;
 		bool bSslVerifyPeer;
-		bool bSslFailIfNoPeerCert;
-		std::string SniHostName;
 		bool bSslPeerAccepted;
+		bool bHandshakeOffloaded;
+		char *PlaintextBuffer;
+		int PlaintextLength;
+		std::string HeldPlaintext;
 		#endif
 
-		#ifdef HAVE_KQUEUE
-		bool bGotExtraKqueueEvent;
+		#ifdef OS_UNIX
+		// Only connects to a host name that has to be raced have one.
+		struct ConnectRace_t {
+			ConnectRace_t(): NextAttempt(0), Error(0) {}
+			std::deque<struct sockaddr_storage> Addrs;
+			std::vector<uintptr_t> Attempts;
+			uint64_t NextAttempt;
+			int Error;
+		};
+		ConnectRace_t *Race;
+
+		// Only connections made with a reconnect policy have one.
+		struct RedialState_t {
+			RedialState_t (const char *s, int p);
+			std::string Server;
+			int Port;
+			std::string Target;
+			int Attempts;
+			bool Connected;
+			int Reason;
+			uint64_t At;
+		};
+		RedialState_t *RedialState;
 		#endif
 
-		bool bIsServer;
+		// Only connections made through the pool have a key.
+		std::string *PoolKey;
+		bool bParked;
+		bool bPoolWaiting;
+		bool bReused;
+
+		uintptr_t Acceptor;
+
+		TokenBucket_t *ReadBucket;
+		TokenBucket_t *WriteBucket;
+		bool bReadThrottled;
+		bool bWriteThrottled;
+
+		virtual void _DeliverInboundData (const char *buffer, unsigned long size);
+		void _DispatchFrames();
+		void _SwitchFraming (Tokenizer_t*, Framer_t*);
 
 	private:
 		void _UpdateEvents();
 		void _UpdateEvents(bool, bool);
 		void _WriteOutboundData();
 		void _DispatchInboundData (const char *buffer, unsigned long size);
+		bool _OffloadHandshake();
+		void _DecryptInboundData();
 		void _DispatchCiphertext();
+		void _EncryptOutboundData (const char *data, unsigned long length);
+		void _FlushPlaintext();
 		int _SendRawOutboundData (const char *buffer, unsigned long size);
+		int _SendRawOutboundPage (char *buffer, unsigned long size);
 		void _CheckHandshakeStatus();
+		void _ReadSocketTls();
+		void _WriteSocketTls();
+		void _CloseSocketTls (int);
+		TlsParms_t *_GetTlsParms();
+		void _CollectTlsStats();
+		void _ShrinkIdleTls();
+		#ifdef OS_UNIX
+		void _StartNextAttempt();
+		void _CancelConnectAttempts();
+		void _Dial();
+		#endif
+		bool _IsHealthy();
+		bool _IsRateLimited();
+		size_t _GetBudget (bool read, size_t want);
+		void _Spend (bool read, size_t n);
+
+		static void *FreeList;
+		static int FreeCount;
+		enum { MaxFree = 1024 };
+};
 
+
+/******************************
+class ConnectAttemptDescriptor
+******************************/
+
+#ifdef OS_UNIX
+class ConnectAttemptDescriptor: public EventableDescriptor
+{
+	/* One of the sockets a ConnectionDescriptor races connects on. It tells
+	 * the connection how its connect went, and goes away either way: a
+	 * winner's socket is taken over by the connection first. It never calls
+	 * back to Ruby, which only knows the connection.
+	 */
+	public:
+		ConnectAttemptDescriptor (SOCKET, EventMachine_t*, const uintptr_t owner);
+		virtual ~ConnectAttemptDescriptor() {}
+
+		virtual void Read() {}
+		virtual void Write();
+		virtual void Heartbeat() {}
+		virtual void HandleError() { Write(); }
+
+		virtual bool SelectForRead() {return false;}
+		virtual bool SelectForWrite() {return !bFinished;}
+
+		virtual bool GetPeername (struct sockaddr* s, socklen_t* len) { return _GenericGetPeername (s, len); }
+		virtual bool GetSockname (struct sockaddr* s, socklen_t* len) { return _GenericGetSockname (s, len); }
+
+	private:
+		uintptr_t Owner;
+		bool bFinished;
 };
+#endif
 
 
 /************************
@@ -332,7 +534,7 @@ class DatagramDescriptor: public EventableDescriptor
 			struct sockaddr_in6 From;
 		};
 
-		std::deque<OutboundPage> OutboundPages;
+		PageQueue_t<OutboundPage> OutboundPages;
 		int OutboundDataSize;
 
 		struct sockaddr_in6 ReturnAddress;
@@ -353,13 +555,50 @@ class AcceptorDescriptor: public EventableDescriptor
 		virtual void Write();
 		virtual void Heartbeat();
 
-		virtual bool SelectForRead() {return true;}
+		virtual bool SelectForRead() {return !bHeldBack;}
 		virtual bool SelectForWrite() {return false;}
 
+		virtual bool Pause();
+		virtual bool Resume();
+
 		virtual bool GetPeername (struct sockaddr* s, socklen_t* len) { return _GenericGetPeername (s, len); }
 		virtual bool GetSockname (struct sockaddr* s, socklen_t* len) { return _GenericGetSockname (s, len); };
 
 		static void StopAcceptor (const uintptr_t binding);
+
+		// Whether accepted sockets get their options from the listener.
+		void SetOptionsInherited (bool f) { bOptionsInherited = f; }
+
+		// NULL lifts the limits.
+		void SetAdmissionLimits (const AdmissionLimits_t*);
+		void GetAdmissionStats (AdmissionStats_t*);
+		void CheckAdmission();
+		void ConnectionClosed() { Connections--; }
+
+		// Shared by every connection it accepts. NULL lifts the limits.
+		void SetRateLimits (const RateLimits_t*);
+		TokenBucket_t *GetReadBucket() { return ReadBucket; }
+		TokenBucket_t *GetWriteBucket() { return WriteBucket; }
+
+	private:
+		int _OverLimit (int percent);
+		void _StartShedding (int reason);
+		void _StopShedding();
+		void _UpdatePolling();
+		void _Reject (SOCKET);
+
+		bool bOptionsInherited;
+
+		AdmissionLimits_t *Limits;
+		int Connections;
+		int Shedding;
+		// Left unpolled, while paused or shedding; bPaused is only the former.
+		bool bHeldBack;
+		uint64_t Sheds;
+		uint64_t Rejected;
+
+		TokenBucket_t *ReadBucket;
+		TokenBucket_t *WriteBucket;
 };
 
 /********************
@@ -400,7 +639,7 @@ class PipeDescriptor: public EventableDescriptor
 	protected:
 		bool bReadAttemptedAfterClose;
 
-		std::deque<OutboundPage> OutboundPages;
+		PageQueue_t<OutboundPage> OutboundPages;
 		int OutboundDataSize;
 
 		pid_t SubprocessPid;
@@ -32,13 +32,34 @@ static unsigned int MaxOutstandingTimers = 100000;
  */
 static unsigned int SimultaneousAcceptCount = 10;
 
+/* The number of threads TLS servers hand their handshakes to, or none to
+ * do them on the reactor thread.
+ */
+static unsigned int TlsHandshakeThreads = 0;
+
+/* How long, in microseconds, a TLS connection has to be idle before the
+ * buffers it can do without are freed, or 0 to leave them be.
+ */
+static uint64_t TlsIdleShrink = 0;
+
+/* The number of threads that look up the host names given to
+ * ConnectToServer, or none to look them up on the reactor thread.
+ */
+static unsigned int ResolverThreads = 0;
+
+/* How long, in microseconds, a connection to a name with several addresses
+ * gives each attempt before also trying the next address, or 0 to try only
+ * the first.
+ */
+static uint64_t ConnectAttemptDelay = 0;
+
 /* Internal helper to create a socket with SOCK_CLOEXEC set, and fall
  * back to fcntl'ing it if the headers/runtime don't support it.
  */
 SOCKET EmSocket (int domain, int type, int protocol)
 {
 	SOCKET sd;
-#ifdef HAVE_SOCKET_CLOEXEC
+#ifdef HAVE_CONST_SOCK_CLOEXEC
 	sd = socket (domain, type | SOCK_CLOEXEC, protocol);
 	if (sd == INVALID_SOCKET) {
 		sd = socket (domain, type, protocol);
@@ -57,6 +78,52 @@ SOCKET EmSocket (int domain, int type, int protocol)
 	return sd;
 }
 
+/* Internal helper to create the socket of an outbound TCP connection,
+ * nonblocking and close-on-exec in the one call where the platform allows,
+ * with Nagle off, and asking for TCP Fast Open if fast_open is set. With
+ * Fast Open, connect succeeds at once when the kernel holds a cookie for
+ * the server, and the SYN waits to carry the first write.
+ */
+SOCKET EmConnectSocket (int domain, bool fast_open)
+{
+	SOCKET sd = INVALID_SOCKET;
+#if defined(HAVE_CONST_SOCK_CLOEXEC) && defined(HAVE_CONST_SOCK_NONBLOCK)
+	sd = socket (domain, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+#endif
+	if (sd == INVALID_SOCKET) {
+		sd = EmSocket (domain, SOCK_STREAM, 0);
+		if (sd == INVALID_SOCKET)
+			return sd;
+		if (!SetSocketNonblocking (sd)) {
+			int e = errno;
+			close (sd);
+			errno = e;
+			return INVALID_SOCKET;
+		}
+	}
+
+	int one = 1;
+	setsockopt (sd, IPPROTO_TCP, TCP_NODELAY, (char*) &one, sizeof(one));
+	// Set reuseaddr to improve performance on restarts
+	setsockopt (sd, SOL_SOCKET, SO_REUSEADDR, (char*) &one, sizeof(one));
+	#ifdef TCP_FASTOPEN_CONNECT
+	if (fast_open)
+		setsockopt (sd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (char*) &one, sizeof(one));
+	#endif
+	return sd;
+}
+
+#ifdef OS_UNIX
+/* Internal helper to tell an address, which needs no lookup, from a host
+ * name.
+ */
+static bool is_numeric_host (const char *host)
+{
+	struct in6_addr addr;
+	return (inet_pton (AF_INET, host, &addr) == 1) || (inet_pton (AF_INET6, host, &addr) == 1);
+}
+#endif
+
 
 /***************************************
 STATIC EventMachine_t::GetMaxTimerCount
@@ -98,6 +165,53 @@ void EventMachine_t::SetSimultaneousAcceptCount (int count)
 	SimultaneousAcceptCount = count;
 }
 
+int EventMachine_t::GetTlsHandshakeThreads()
+{
+	return TlsHandshakeThreads;
+}
+
+void EventMachine_t::SetTlsHandshakeThreads (int count)
+{
+	// Takes effect when a reactor first offloads a handshake.
+	if (count < 0)
+		count = 0;
+	TlsHandshakeThreads = count;
+}
+
+uint64_t EventMachine_t::GetTlsIdleShrink()
+{
+	return TlsIdleShrink;
+}
+
+void EventMachine_t::SetTlsIdleShrink (uint64_t interval)
+{
+	// Takes effect for connections that start TLS afterwards.
+	TlsIdleShrink = interval;
+}
+
+int EventMachine_t::GetResolverThreads()
+{
+	return ResolverThreads;
+}
+
+void EventMachine_t::SetResolverThreads (int count)
+{
+	// Takes effect when a reactor first looks up a name.
+	if (count < 0)
+		count = 0;
+	ResolverThreads = count;
+}
+
+uint64_t EventMachine_t::GetConnectAttemptDelay()
+{
+	return ConnectAttemptDelay;
+}
+
+void EventMachine_t::SetConnectAttemptDelay (uint64_t delay)
+{
+	ConnectAttemptDelay = delay;
+}
+
 
 /******************************
 EventMachine_t::EventMachine_t
@@ -109,6 +223,12 @@ EventMachine_t::EventMachine_t (EMCallback event_callback, Poller_t poller):
 	EventCallback (event_callback),
 	LoopBreakerReader (INVALID_SOCKET),
 	LoopBreakerWriter (INVALID_SOCKET),
+	PrefetchBuffers (NULL),
+	HandshakePool (NULL),
+	Resolver (NULL),
+	Pool (NULL),
+	Breakers (NULL),
+	RateLimitedListeners (0),
 	bTerminateSignalReceived (false),
 	Poller (poller),
 	epfd (-1),
@@ -121,6 +241,11 @@ EventMachine_t::EventMachine_t (EMCallback event_callback, Poller_t poller):
 	Quantum.tv_sec = 0;
 	Quantum.tv_usec = 90000;
 
+	memset (&TlsStats, 0, sizeof(TlsStats));
+	LoopWoke = 0;
+	LoopLag = 0;
+	OutboundBytes = 0;
+
 	// Override the requested poller back to default if needed.
 	#if !defined(HAVE_EPOLL) && !defined(HAVE_KQUEUE)
 	Poller = Poller_Default;
@@ -162,12 +287,35 @@ EventMachine_t::~EventMachine_t
 
 EventMachine_t::~EventMachine_t()
 {
+	// Pooled connections going down with the rest needn't be accounted for.
+	delete Pool;
+	Pool = NULL;
+
 	// Run down descriptors
 	size_t i;
 	for (i = 0; i < NewDescriptors.size(); i++)
 		delete NewDescriptors[i];
 	for (i = 0; i < Descriptors.size(); i++)
 		delete Descriptors[i];
+	while (!DeadDescriptors.empty()) {
+		EventableDescriptor *ed = DeadDescriptors.front();
+		DeadDescriptors.pop_front();
+		delete ed;
+	}
+
+	delete Breakers;
+
+	#if defined(WITH_SSL) && defined(OS_UNIX)
+	// Finishes off the boxes of connections that closed mid-handshake,
+	// before the loop breaker its threads signal goes away.
+	delete HandshakePool;
+	#endif
+
+	#ifdef OS_UNIX
+	// Lookups still under way are left to finish on their own.
+	if (Resolver)
+		Resolver->Stop();
+	#endif
 
 	close (LoopBreakerReader);
 	close (LoopBreakerWriter);
@@ -184,6 +332,12 @@ EventMachine_t::~EventMachine_t()
 		close (kqfd);
 
 	delete SelectData;
+	free (PrefetchBuffers);
+
+	#ifdef WITH_SSL
+	// Every connection is gone, so this frees all the cached TLS contexts.
+	SslContext_t::FlushCache (true);
+	#endif
 }
 
 
@@ -562,6 +716,90 @@ void EventMachine_t::ClearHeartbeat(uint64_t key, EventableDescriptor* ed)
 	}
 }
 
+/**********************************
+EventMachine_t::AddLimitedAcceptor
+**********************************/
+
+void EventMachine_t::AddLimitedAcceptor (AcceptorDescriptor *ad)
+{
+	LimitedAcceptors.insert (ad);
+}
+
+
+/*************************************
+EventMachine_t::RemoveLimitedAcceptor
+*************************************/
+
+void EventMachine_t::RemoveLimitedAcceptor (AcceptorDescriptor *ad)
+{
+	LimitedAcceptors.erase (ad);
+}
+
+
+/****************************
+EventMachine_t::AddThrottled
+****************************/
+
+void EventMachine_t::AddThrottled (ConnectionDescriptor *cd)
+{
+	Throttled.insert (cd);
+}
+
+
+/*******************************
+EventMachine_t::RemoveThrottled
+*******************************/
+
+void EventMachine_t::RemoveThrottled (ConnectionDescriptor *cd)
+{
+	Throttled.erase (cd);
+}
+
+
+/******************************
+EventMachine_t::_RefillBuckets
+******************************/
+
+void EventMachine_t::_RefillBuckets()
+{
+	/* A throttled connection isn't polled for the direction it's over its
+	 * limit in, so nothing would wake it. Instead every pass, at least
+	 * once per timer quantum (see _TimeTilNextEvent), gives each of them
+	 * a chance to find its buckets refilled. One timer for them all,
+	 * rather than one each.
+	 */
+	if (Throttled.empty())
+		return;
+
+	std::vector<ConnectionDescriptor*> throttled (Throttled.begin(), Throttled.end());
+	for (size_t i = 0; i < throttled.size(); i++) {
+		if (Throttled.count (throttled[i]) && !throttled[i]->RefillBuckets (MyCurrentLoopTime))
+			Throttled.erase (throttled[i]);
+	}
+}
+
+
+/*******************************
+EventMachine_t::_CheckAdmission
+*******************************/
+
+void EventMachine_t::_CheckAdmission()
+{
+	/* A paused listener hears nothing more from the poller, so every pass
+	 * asks the ones with limits whether to start or stop shedding. Copied,
+	 * because an event handler may stop a server or change its limits.
+	 */
+	if (LimitedAcceptors.empty())
+		return;
+
+	std::vector<AcceptorDescriptor*> acceptors (LimitedAcceptors.begin(), LimitedAcceptors.end());
+	for (size_t i = 0; i < acceptors.size(); i++) {
+		if (LimitedAcceptors.count (acceptors[i]))
+			acceptors[i]->CheckAdmission();
+	}
+}
+
+
 /*******************
 EventMachine_t::Run
 *******************/
@@ -579,6 +817,7 @@ bool EventMachine_t::RunOnce()
 {
 	_UpdateTime();
 	_RunTimers();
+	_RefillBuckets();
 
 	/* _Add must precede _Modify because the same descriptor might
 	 * be on both lists during the same pass through the machine,
@@ -587,6 +826,10 @@ bool EventMachine_t::RunOnce()
 	_AddNewDescriptors();
 	_ModifyDescriptors();
 
+	// The pollers set LoopWoke when they come back with something to do.
+	uint64_t busy = GetRealTime() - MyCurrentLoopTime;
+	LoopWoke = 0;
+
 	switch (Poller) {
 	case Poller_Epoll:
 		_RunEpollOnce();
@@ -599,9 +842,15 @@ bool EventMachine_t::RunOnce()
 		break;
 	}
 
+	if (LoopWoke == 0)
+		LoopWoke = GetRealTime();
 	_DispatchHeartbeats();
 	_CleanupSockets();
 
+	busy += GetRealTime() - LoopWoke;
+	LoopLag = (LoopLag * 3 + busy) / 4;
+	_CheckAdmission();
+
 	if (bTerminateSignalReceived)
 		return false;
 
@@ -655,8 +904,21 @@ void EventMachine_t::_RunEpollOnce()
 	duration = duration + (tv.tv_usec / 1000);
 	s = epoll_wait (epfd, epoll_events, MaxEvents, duration);
 	#endif
+	LoopWoke = GetRealTime();
 
 	if (s > 0) {
+		#ifdef BUILD_FOR_RUBY
+		PrefetchedReads.clear();
+		if (!rb_thread_alone()) {
+			for (int i=0; i < s; i++) {
+				if (epoll_events[i].events & EPOLLIN)
+					_QueuePrefetchedRead ((EventableDescriptor*) epoll_events[i].data.ptr);
+			}
+			_RunPrefetchedReads();
+		}
+		size_t p = 0;
+		#endif
+
 		for (int i=0; i < s; i++) {
 			EventableDescriptor *ed = (EventableDescriptor*) epoll_events[i].data.ptr;
 
@@ -665,6 +927,13 @@ void EventMachine_t::_RunEpollOnce()
 
 			assert(ed->GetSocket() != INVALID_SOCKET);
 
+			#ifdef BUILD_FOR_RUBY
+			if ((epoll_events[i].events & EPOLLIN) && p < PrefetchedReads.size() && (EventableDescriptor*) PrefetchedReads[p].Descriptor == ed) {
+				PrefetchedReads[p].Descriptor->Read (&PrefetchedReads[p]);
+				p++;
+			}
+			else
+			#endif
 			if (epoll_events[i].events & EPOLLIN)
 				ed->Read();
 			if (epoll_events[i].events & EPOLLOUT)
@@ -737,6 +1006,19 @@ void EventMachine_t::_RunKqueueOnce()
 	#else
 	k = kevent (kqfd, NULL, 0, Karray, MaxEvents, &ts);
 	#endif
+	LoopWoke = GetRealTime();
+
+	#ifdef BUILD_FOR_RUBY
+	PrefetchedReads.clear();
+	if (!rb_thread_alone()) {
+		for (int i=0; i < k; i++) {
+			if (Karray[i].filter == EVFILT_READ)
+				_QueuePrefetchedRead ((EventableDescriptor*) Karray[i].udata);
+		}
+		_RunPrefetchedReads();
+	}
+	size_t p = 0;
+	#endif
 
 	struct kevent *ke = Karray;
 	while (k > 0) {
@@ -758,6 +1040,13 @@ void EventMachine_t::_RunKqueueOnce()
 				if (ed->IsWatchOnly() && ed->GetSocket() == INVALID_SOCKET)
 					break;
 
+				#ifdef BUILD_FOR_RUBY
+				if (ke->filter == EVFILT_READ && p < PrefetchedReads.size() && (EventableDescriptor*) PrefetchedReads[p].Descriptor == ed) {
+					PrefetchedReads[p].Descriptor->Read (&PrefetchedReads[p]);
+					p++;
+				}
+				else
+				#endif
 				if (ke->filter == EVFILT_READ)
 					ed->Read();
 				else if (ke->filter == EVFILT_WRITE)
@@ -786,6 +1075,70 @@ void EventMachine_t::_RunKqueueOnce()
 #endif
 
 
+#ifdef BUILD_FOR_RUBY
+static void *nogvl_prefetch_reads (void *args)
+{
+	std::vector<PrefetchedRead_t> *reads = (std::vector<PrefetchedRead_t> *)args;
+	for (size_t i = 0; i < reads->size(); i++) {
+		PrefetchedRead_t &pr = (*reads)[i];
+		pr.Result = read (pr.Socket, pr.Buffer, pr.Size - 1);
+		pr.Error = errno;
+	}
+	return NULL;
+}
+#endif
+
+/************************************
+EventMachine_t::_QueuePrefetchedRead
+************************************/
+
+void EventMachine_t::_QueuePrefetchedRead (EventableDescriptor *ed)
+{
+	/* Called with the GVL held, before the poller's results are dispatched.
+	 * Plain connections that selected readable get a slot in the batch, and
+	 * their first read(2) is performed by _RunPrefetchedReads while other Ruby
+	 * threads (EM.defer workers, typically) are free to run. Everything that
+	 * can't be treated as a plain byte stream stays on the ordinary Read path.
+	 */
+	if (PrefetchedReads.size() >= MaxPrefetchedReads)
+		return;
+
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (ed);
+	if (!cd || !cd->IsPrefetchable())
+		return;
+
+	if (!PrefetchBuffers) {
+		PrefetchBuffers = (char*) malloc (MaxPrefetchedReads * PrefetchBufferSize);
+		if (!PrefetchBuffers)
+			throw std::runtime_error ("no memory for read buffers");
+	}
+
+	PrefetchedRead_t pr;
+	pr.Descriptor = cd;
+	pr.Socket = cd->GetSocket();
+	pr.Buffer = PrefetchBuffers + (PrefetchedReads.size() * PrefetchBufferSize);
+	pr.Size = PrefetchBufferSize;
+	pr.Result = 0;
+	pr.Error = 0;
+	PrefetchedReads.push_back (pr);
+}
+
+
+/***********************************
+EventMachine_t::_RunPrefetchedReads
+***********************************/
+
+void EventMachine_t::_RunPrefetchedReads()
+{
+	#ifdef BUILD_FOR_RUBY
+	if (PrefetchedReads.empty())
+		return;
+
+	rb_thread_call_without_gvl (nogvl_prefetch_reads, &PrefetchedReads, RUBY_UBF_IO, 0);
+	#endif
+}
+
+
 /*********************************
 EventMachine_t::_TimeTilNextEvent
 *********************************/
@@ -811,6 +1164,13 @@ timeval EventMachine_t::_TimeTilNextEvent()
 			next_event = timers->first;
 	}
 
+	// Listeners with admission limits, and throttled connections, look at the loop at least this often.
+	if (!LimitedAcceptors.empty() || !Throttled.empty()) {
+		uint64_t check = current_time + (Quantum.tv_sec * 1000000LL) + Quantum.tv_usec;
+		if (next_event == 0 || check < next_event)
+			next_event = check;
+	}
+
 	if (!NewDescriptors.empty() || !ModifiedDescriptors.empty()) {
 		next_event = current_time;
 	}
@@ -851,34 +1211,59 @@ void EventMachine_t::_CleanupSockets()
 	// the socket has already been closed but the descriptor in the ED object
 	// hasn't yet been set to INVALID_SOCKET.
 	// In kqueue, closing a descriptor automatically removes its event filters.
+	// The list is compacted before anything is deleted, because an unbind
+	// callback that raises (SIGTERM arriving, say) unwinds straight out of
+	// the destructor, and mustn't leave a deleted descriptor behind in it.
+	// For the same reason, connections that start over instead of going
+	// (see ConnectionDescriptor::Redial) only tell Ruby so at the end, and
+	// the dead wait in DeadDescriptors, each taken off just before it's
+	// deleted, so that those after one that raised are deleted next time
+	// round (or by ~EventMachine_t).
 	int i, j;
 	int nSockets = Descriptors.size();
+	std::vector<uintptr_t> redialled;
 	for (i=0, j=0; i < nSockets; i++) {
 		EventableDescriptor *ed = Descriptors[i];
 		assert (ed);
-		if (ed->ShouldDelete()) {
-		#ifdef HAVE_EPOLL
-			if (Poller == Poller_Epoll) {
-				assert (epfd != -1);
-				if (ed->GetSocket() != INVALID_SOCKET) {
-					int e = epoll_ctl (epfd, EPOLL_CTL_DEL, ed->GetSocket(), ed->GetEpollEvent());
-					// ENOENT or EBADF are not errors because the socket may be already closed when we get here.
-					if (e && (errno != ENOENT) && (errno != EBADF) && (errno != EPERM)) {
-						char buf [200];
-						snprintf (buf, sizeof(buf)-1, "unable to delete epoll event: %s", strerror(errno));
-						throw std::runtime_error (buf);
-					}
-				}
-				ModifiedDescriptors.erase(ed);
-			}
-		#endif
-			delete ed;
+		if (!ed->ShouldDelete())
+			Descriptors [j++] = ed;
+		else if (ed->Redial()) {
+			Descriptors [j++] = ed;
+			redialled.push_back (ed->GetBinding());
 		}
 		else
-			Descriptors [j++] = ed;
+			DeadDescriptors.push_back (ed);
 	}
 	while ((size_t)j < Descriptors.size())
 		Descriptors.pop_back();
+
+	while (!DeadDescriptors.empty()) {
+		EventableDescriptor *ed = DeadDescriptors.front();
+	#ifdef HAVE_EPOLL
+		if (Poller == Poller_Epoll) {
+			assert (epfd != -1);
+			if (ed->GetSocket() != INVALID_SOCKET) {
+				int e = epoll_ctl (epfd, EPOLL_CTL_DEL, ed->GetSocket(), ed->GetEpollEvent());
+				// ENOENT or EBADF are not errors because the socket may be already closed when we get here.
+				if (e && (errno != ENOENT) && (errno != EBADF) && (errno != EPERM)) {
+					char buf [200];
+					snprintf (buf, sizeof(buf)-1, "unable to delete epoll event: %s", strerror(errno));
+					throw std::runtime_error (buf);
+				}
+			}
+			ModifiedDescriptors.erase(ed);
+		}
+	#endif
+		DeadDescriptors.pop_front();
+		delete ed;
+	}
+
+	// Looked up afresh, as an unbind may have detached one.
+	for (i=0; i < (int)redialled.size(); i++) {
+		EventableDescriptor *ed = dynamic_cast <EventableDescriptor*> (Bindable_t::GetObject (redialled[i]));
+		if (ed)
+			ed->AnnounceRedial();
+	}
 }
 
 /*********************************
@@ -999,6 +1384,7 @@ void EventMachine_t::_RunSelectOnce()
 	{ // read and write the sockets
 		SelectData->tv = _TimeTilNextEvent();
 		int s = SelectData->_Select();
+		LoopWoke = GetRealTime();
 		if (s > 0) {
 			/* Changed 01Jun07. We used to handle the Loop-breaker right here.
 			 * Now we do it AFTER all the regular descriptors. There's an
@@ -1069,6 +1455,23 @@ void EventMachine_t::_CleanBadDescriptors()
 	}
 }
 
+/*********************************
+EventMachine_t::GetHandshakePool
+*********************************/
+
+SslHandshakePool_t *EventMachine_t::GetHandshakePool()
+{
+	// NULL unless TLS handshakes are to be run off the reactor thread.
+	#if defined(WITH_SSL) && defined(OS_UNIX)
+	if (!HandshakePool && (TlsHandshakeThreads > 0))
+		HandshakePool = new SslHandshakePool_t (this, TlsHandshakeThreads);
+	return HandshakePool;
+	#else
+	return NULL;
+	#endif
+}
+
+
 /********************************
 EventMachine_t::_ReadLoopBreaker
 ********************************/
@@ -1081,6 +1484,14 @@ void EventMachine_t::_ReadLoopBreaker()
 	 */
 	char buffer [1024];
 	(void)read (LoopBreakerReader, buffer, sizeof(buffer));
+	#if defined(WITH_SSL) && defined(OS_UNIX)
+	if (HandshakePool)
+		HandshakePool->RunCompletions();
+	#endif
+	#ifdef OS_UNIX
+	if (Resolver)
+		Resolver->RunCompletions();
+	#endif
 	if (EventCallback)
 		(*EventCallback)(0, EM_LOOPBREAK_SIGNAL, "", 0);
 }
@@ -1146,7 +1557,7 @@ const uintptr_t EventMachine_t::InstallOneshotTimer (uint64_t milliseconds)
 EventMachine_t::ConnectToServer
 *******************************/
 
-const uintptr_t EventMachine_t::ConnectToServer (const char *bind_addr, int bind_port, const char *server, int port)
+const uintptr_t EventMachine_t::ConnectToServer (const char *bind_addr, int bind_port, const char *server, int port, bool fast_open)
 {
 	/* We want to spend no more than a few seconds waiting for a connection
 	 * to a remote host. So we use a nonblocking connect.
@@ -1169,21 +1580,36 @@ const uintptr_t EventMachine_t::ConnectToServer (const char *bind_addr, int bind
 	 * the error parameter.
 	 * Return the binding-text of the newly-created pending connection,
 	 * or NULL if there was a problem.
+	 *
+	 * With fast_open, the socket asks for TCP Fast Open (see
+	 * EmConnectSocket), unless it races several addresses.
 	 */
 
 	if (!server || !*server || !port)
 		throw std::runtime_error ("invalid server or port");
 
-	struct sockaddr_storage bind_as;
-	size_t bind_as_len = sizeof bind_as;
-	int gai = name2address (server, port, SOCK_STREAM, (struct sockaddr *)&bind_as, &bind_as_len);
+	#ifdef OS_UNIX
+	if ((ResolverThreads > 0) && (!is_numeric_host (server) || (bind_addr && !is_numeric_host (bind_addr))))
+		return _ConnectWhenResolved (bind_addr, bind_port, server, port, fast_open);
+	#endif
+
+	std::vector<struct sockaddr_storage> addrs;
+	int gai = name2addresses (server, port, SOCK_STREAM, addrs);
 	if (gai != 0) {
 		char buf [200];
 		snprintf (buf, sizeof(buf)-1, "unable to resolve address: %s", gai_strerror(gai));
 		throw std::runtime_error (buf);
 	}
 
-	SOCKET sd = EmSocket (bind_as.ss_family, SOCK_STREAM, 0);
+	#ifdef OS_UNIX
+	if ((ConnectAttemptDelay > 0) && !bind_addr && (addrs.size() > 1))
+		return _ConnectRacing (server, port, addrs);
+	#endif
+
+	struct sockaddr_storage bind_as = addrs[0];
+	size_t bind_as_len = (bind_as.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+	SOCKET sd = EmConnectSocket (bind_as.ss_family, fast_open);
 	if (sd == INVALID_SOCKET) {
 		char buf [200];
 		snprintf (buf, sizeof(buf)-1, "unable to create new socket: %s", strerror(errno));
@@ -1191,17 +1617,6 @@ const uintptr_t EventMachine_t::ConnectToServer (const char *bind_addr, int bind
 	}
 
 	// From here on, ALL error returns must close the socket.
-	// Set the new socket nonblocking.
-	if (!SetSocketNonblocking (sd)) {
-		close (sd);
-		throw std::runtime_error ("unable to set socket as non-blocking");
-	}
-	// Disable slow-start (Nagle algorithm).
-	int one = 1;
-	setsockopt (sd, IPPROTO_TCP, TCP_NODELAY, (char*) &one, sizeof(one));
-	// Set reuseaddr to improve performance on restarts
-	setsockopt (sd, SOL_SOCKET, SO_REUSEADDR, (char*) &one, sizeof(one));
-
 	if (bind_addr) {
 		struct sockaddr_storage bind_to;
 		size_t bind_to_len = sizeof bind_to;
@@ -1226,7 +1641,9 @@ const uintptr_t EventMachine_t::ConnectToServer (const char *bind_addr, int bind
 		// This is a connect success, which Linux appears
 		// never to give when the socket is nonblocking,
 		// even if the connection is intramachine or to
-		// localhost.
+		// localhost. (Except with TCP Fast Open and a cookie
+		// for the server, where the handshake waits for the
+		// first write.)
 
 		/* Changed this branch 08Aug06. Evidently some kernels
 		 * (FreeBSD for example) will actually return success from
@@ -1329,9 +1746,146 @@ const uintptr_t EventMachine_t::ConnectToServer (const char *bind_addr, int bind
 
 	if (!out)
 		close (sd);
+
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (out));
+	if (cd) {
+		cd->SetFastOpen (fast_open);
+		#ifdef WITH_SSL
+		// Name the peer for the client TLS session store, should this
+		// connection start TLS before the connect completes.
+		cd->SetTlsPeerName (server, port);
+		#endif
+	}
+
 	return out;
 }
 
+
+/************************************
+EventMachine_t::_ConnectWhenResolved
+************************************/
+
+#ifdef OS_UNIX
+const uintptr_t EventMachine_t::_ConnectWhenResolved (const char *bind_addr, int bind_port, const char *server, int port, bool fast_open)
+{
+	/* Hands the names to the resolver threads and returns a connection
+	 * that waits for ConnectResolved. Until then it has a socket no one
+	 * polls, which keeps its descriptor number. Its pending-connect
+	 * timeout runs from now, so it covers the lookup too.
+	 */
+	if (!Resolver)
+		Resolver = new ResolverPool_t (this, ResolverThreads);
+
+	SOCKET sd = EmConnectSocket (AF_INET, fast_open);
+	if (sd == INVALID_SOCKET) {
+		char buf [200];
+		snprintf (buf, sizeof(buf)-1, "unable to create new socket: %s", strerror(errno));
+		throw std::runtime_error (buf);
+	}
+
+	ConnectionDescriptor *cd = new ConnectionDescriptor (sd, this);
+	cd->SetFastOpen (fast_open);
+	cd->SetResolving (true);
+	cd->SetConnectPending (true);
+	Add (cd);
+
+	#ifdef WITH_SSL
+	cd->SetTlsPeerName (server, port);
+	#endif
+
+	Resolver->Submit (cd->GetBinding(), server, port, bind_addr, bind_port);
+	return cd->GetBinding();
+}
+#endif
+
+
+/******************************
+EventMachine_t::_ConnectRacing
+******************************/
+
+#ifdef OS_UNIX
+const uintptr_t EventMachine_t::_ConnectRacing (const char *server, int port, const std::vector<struct sockaddr_storage> &addrs)
+{
+	/* Returns a connection that races connects to addrs (see
+	 * ConnectionDescriptor::StartConnectRace), holding a socket no one
+	 * polls until the winner's is swapped in under its number.
+	 */
+	SOCKET sd = EmSocket (AF_INET, SOCK_STREAM, 0);
+	if (sd == INVALID_SOCKET) {
+		char buf [200];
+		snprintf (buf, sizeof(buf)-1, "unable to create new socket: %s", strerror(errno));
+		throw std::runtime_error (buf);
+	}
+
+	ConnectionDescriptor *cd = new ConnectionDescriptor (sd, this);
+	cd->SetResolving (true);
+	cd->SetConnectPending (true);
+	Add (cd);
+
+	#ifdef WITH_SSL
+	cd->SetTlsPeerName (server, port);
+	#endif
+
+	cd->StartConnectRace (addrs);
+	return cd->GetBinding();
+}
+#endif
+
+
+/*******************************
+EventMachine_t::ConnectResolved
+*******************************/
+
+#ifdef OS_UNIX
+void EventMachine_t::ConnectResolved (const uintptr_t binding, int error, const std::vector<struct sockaddr_storage> &addrs, const struct sockaddr *bind_to, size_t bind_to_len)
+{
+	// Gone already if it was closed, or timed out, during the lookup.
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (!cd || !cd->IsResolving() || cd->IsCloseScheduled())
+		return;
+
+	if (!error && (ConnectAttemptDelay > 0) && !bind_to_len && (addrs.size() > 1)) {
+		cd->StartConnectRace (addrs);
+		return;
+	}
+
+	SOCKET sd = cd->GetSocket();
+	const struct sockaddr *addr = error ? NULL : (const struct sockaddr *)&addrs[0];
+	socklen_t addr_len = (addr && (addr->sa_family == AF_INET6)) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+	// dup2 swaps in a socket of the right family under the same number.
+	// Its options, nonblocking included, go with the socket.
+	if (!error && (addr->sa_family != AF_INET)) {
+		SOCKET s = EmConnectSocket (addr->sa_family, cd->IsFastOpen());
+		if (s == INVALID_SOCKET)
+			error = errno;
+		else {
+			if (dup2 (s, sd) < 0)
+				error = errno;
+			else
+				SetFdCloexec (sd);
+			close (s);
+		}
+	}
+
+	if (!error && bind_to_len && (bind (sd, bind_to, bind_to_len) < 0))
+		error = errno;
+
+	if (!error && (connect (sd, addr, addr_len) < 0) && (errno != EINPROGRESS))
+		error = errno;
+
+	cd->SetResolving (false);
+	if (error) {
+		cd->SetUnbindReasonCode (error);
+		cd->ScheduleClose (false);
+		return;
+	}
+
+	StartPolling (cd);
+	cd->SetConnectPending (true);
+}
+#endif
+
 /***********************************
 EventMachine_t::ConnectToUnixServer
 ***********************************/
@@ -1403,6 +1957,111 @@ const uintptr_t EventMachine_t::ConnectToUnixServer (const char *server UNUSED)
 }
 #endif
 
+
+/*****************************
+EventMachine_t::PooledConnect
+*****************************/
+
+const uintptr_t EventMachine_t::PooledConnect (const char *key, const char *server, int port)
+{
+	// The pool is only made once something connects through it.
+	if (!Pool)
+		Pool = new ConnectionPool_t (this);
+	return Pool->Connect (key, server, port);
+}
+
+
+/*****************************
+EventMachine_t::ReleaseToPool
+*****************************/
+
+bool EventMachine_t::ReleaseToPool (const uintptr_t binding)
+{
+	return Pool ? Pool->Release (binding) : false;
+}
+
+
+/*********************************
+EventMachine_t::ConnectWithRedial
+*********************************/
+
+#ifdef OS_UNIX
+const uintptr_t EventMachine_t::ConnectWithRedial (const char *server, int port)
+{
+	/* ConnectToServer, for a connection that reconnects when it fails or
+	 * is dropped, backing off as CircuitBreakers_t::Policy says. With the
+	 * server's breaker open, the connection is one that fails at once,
+	 * never having been polled, with the error that opened it.
+	 */
+	if (!server || !*server || !port)
+		throw std::runtime_error ("invalid server or port");
+
+	std::ostringstream target;
+	target << server << ":" << port;
+	int error = 0;
+	if (!GetCircuitBreakers()->Allows (target.str(), GetRealTime(), &error)) {
+		SOCKET sd = EmConnectSocket (AF_INET, false);
+		if (sd == INVALID_SOCKET) {
+			char buf [200];
+			snprintf (buf, sizeof(buf)-1, "unable to create new socket: %s", strerror(errno));
+			throw std::runtime_error (buf);
+		}
+		ConnectionDescriptor *cd = new ConnectionDescriptor (sd, this);
+		cd->SetResolving (true);
+		cd->SetConnectPending (true);
+		cd->SetUnbindReasonCode (error);
+		cd->ScheduleClose (false);
+		Add (cd);
+		return cd->GetBinding();
+	}
+
+	const uintptr_t binding = ConnectToServer (NULL, 0, server, port);
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (binding));
+	if (cd)
+		cd->SetRedial (server, port);
+	return binding;
+}
+#else
+const uintptr_t EventMachine_t::ConnectWithRedial (const char *server, int port)
+{
+	return ConnectToServer (NULL, 0, server, port);
+}
+#endif
+
+
+/*********************************
+EventMachine_t::ResolveAndConnect
+*********************************/
+
+#ifdef OS_UNIX
+void EventMachine_t::ResolveAndConnect (const uintptr_t binding, const char *server, int port)
+{
+	// Connects a resolving placeholder, looking server up first as ConnectToServer would.
+	if ((ResolverThreads > 0) && !is_numeric_host (server)) {
+		if (!Resolver)
+			Resolver = new ResolverPool_t (this, ResolverThreads);
+		Resolver->Submit (binding, server, port, NULL, 0);
+		return;
+	}
+
+	std::vector<struct sockaddr_storage> addrs;
+	int gai = name2addresses (server, port, SOCK_STREAM, addrs);
+	ConnectResolved (binding, gai ? EHOSTUNREACH : 0, addrs, NULL, 0);
+}
+#endif
+
+
+/**********************************
+EventMachine_t::GetCircuitBreakers
+**********************************/
+
+CircuitBreakers_t *EventMachine_t::GetCircuitBreakers()
+{
+	if (!Breakers)
+		Breakers = new CircuitBreakers_t();
+	return Breakers;
+}
+
 /************************
 EventMachine_t::AttachFD
 ************************/
@@ -1527,9 +2186,48 @@ name2address
 
 int EventMachine_t::name2address (const char *server, int port, int socktype, struct sockaddr *addr, size_t *addr_len)
 {
+	std::vector<struct sockaddr_storage> addrs;
+	int gai = name2addresses (server, port, socktype, addrs);
+	if (gai == 0) {
+		size_t len = (addrs[0].ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		assert (len <= *addr_len);
+		memcpy (addr, &addrs[0], len);
+		*addr_len = len;
+	}
+
+	return gai;
+}
+
+
+/**************
+name2addresses
+**************/
+
+int EventMachine_t::name2addresses (const char *server, int port, int socktype, std::vector<struct sockaddr_storage> &addrs)
+{
+	// All of server's addresses, in the order getaddrinfo prefers them.
 	if (!server || !*server)
 		server = "0.0.0.0";
 
+	addrs.clear();
+
+	#ifdef OS_UNIX
+	// Numeric hosts aren't worth a cache entry.
+	bool cached = (DnsCache_t::GetTtl() > 0) && !is_numeric_host (server);
+	if (cached) {
+		int gai;
+		if (DnsCache_t::Acquire (server, &gai, addrs)) {
+			for (size_t i = 0; i < addrs.size(); i++) {
+				if (addrs[i].ss_family == AF_INET6)
+					((struct sockaddr_in6 *)&addrs[i])->sin6_port = htons (port);
+				else
+					((struct sockaddr_in *)&addrs[i])->sin_port = htons (port);
+			}
+			return gai;
+		}
+	}
+	#endif
+
 	struct addrinfo *ai;
 	struct addrinfo hints;
 	memset (&hints, 0, sizeof(hints));
@@ -1541,10 +2239,20 @@ int EventMachine_t::name2address (const char *server, int port, int socktype, st
 	snprintf(portstr, sizeof(portstr), "%u", port);
 
 	int gai = getaddrinfo (server, portstr, &hints, &ai);
+
+	#ifdef OS_UNIX
+	if (cached)
+		DnsCache_t::Store (server, gai, (gai == 0) ? ai : NULL);
+	#endif
+
 	if (gai == 0) {
-		assert (ai->ai_addrlen <= *addr_len);
-		memcpy (addr, ai->ai_addr, ai->ai_addrlen);
-		*addr_len = ai->ai_addrlen;
+		for (struct addrinfo *a = ai; a; a = a->ai_next) {
+			struct sockaddr_storage ss;
+			memset (&ss, 0, sizeof(ss));
+			assert (a->ai_addrlen <= sizeof(ss));
+			memcpy (&ss, a->ai_addr, a->ai_addrlen);
+			addrs.push_back (ss);
+		}
 		freeaddrinfo(ai);
 	}
 
@@ -1556,14 +2264,21 @@ int EventMachine_t::name2address (const char *server, int port, int socktype, st
 EventMachine_t::CreateTcpServer
 *******************************/
 
-const uintptr_t EventMachine_t::CreateTcpServer (const char *server, int port)
+const uintptr_t EventMachine_t::CreateTcpServer (const char *server, int port, const ListenerOptions_t *options)
 {
 	/* Create a TCP-acceptor (server) socket and add it to the event machine.
 	 * Return the binding of the new acceptor to the caller.
 	 * This binding will be referenced when the new acceptor sends events
 	 * to indicate accepted connections.
+	 * Options the platform doesn't have are ignored; ones it refuses fail
+	 * the listener.
 	 */
 
+	ListenerOptions_t defaults;
+	if (!options)
+		options = &defaults;
+	uintptr_t out;
+	AcceptorDescriptor *ad;
 
 	struct sockaddr_storage bind_here;
 	size_t bind_here_len = sizeof bind_here;
@@ -1592,18 +2307,53 @@ const uintptr_t EventMachine_t::CreateTcpServer (const char *server, int port)
 		#endif
 	}
 
+	#ifdef SO_REUSEPORT
+	if (options->bReusePort) {
+		int oval = 1;
+		if (setsockopt (sd_accept, SOL_SOCKET, SO_REUSEPORT, (char*)&oval, sizeof(oval)) < 0)
+			goto fail;
+	}
+	#endif
+
+	{ // accepted sockets inherit these, which saves setting them on each one.
+		int nodelay = options->bNoDelay ? 1 : 0;
+		int keepalive = options->bKeepalive ? 1 : 0;
+		if (setsockopt (sd_accept, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay)) < 0)
+			goto fail;
+		if (keepalive && (setsockopt (sd_accept, SOL_SOCKET, SO_KEEPALIVE, (char*)&keepalive, sizeof(keepalive)) < 0))
+			goto fail;
+		if ((options->SendBuffer > 0) && (setsockopt (sd_accept, SOL_SOCKET, SO_SNDBUF, (char*)&options->SendBuffer, sizeof(int)) < 0))
+			goto fail;
+		if ((options->ReceiveBuffer > 0) && (setsockopt (sd_accept, SOL_SOCKET, SO_RCVBUF, (char*)&options->ReceiveBuffer, sizeof(int)) < 0))
+			goto fail;
+	}
+
+	#ifdef TCP_DEFER_ACCEPT
+	if ((options->DeferAccept > 0) && (setsockopt (sd_accept, IPPROTO_TCP, TCP_DEFER_ACCEPT, (char*)&options->DeferAccept, sizeof(int)) < 0))
+		goto fail;
+	#endif
+
+	#ifdef TCP_FASTOPEN
+	if ((options->FastOpenQueue > 0) && (setsockopt (sd_accept, IPPROTO_TCP, TCP_FASTOPEN, (char*)&options->FastOpenQueue, sizeof(int)) < 0))
+		goto fail;
+	#endif
+
 
 	if (bind (sd_accept, (struct sockaddr *)&bind_here, bind_here_len)) {
 		//__warning ("binding failed");
 		goto fail;
 	}
 
-	if (listen (sd_accept, 100)) {
+	if (listen (sd_accept, (options->Backlog > 0) ? options->Backlog : 100)) {
 		//__warning ("listen failed");
 		goto fail;
 	}
 
-	return AttachSD(sd_accept);
+	out = AttachSD(sd_accept);
+	ad = dynamic_cast <AcceptorDescriptor*> (Bindable_t::GetObject (out));
+	if (ad)
+		ad->SetOptionsInherited (true);
+	return out;
 
 	fail:
 	if (sd_accept != INVALID_SOCKET)
@@ -1730,6 +2480,35 @@ void EventMachine_t::ArmKqueueReader (EventableDescriptor *ed)
 void EventMachine_t::ArmKqueueReader (EventableDescriptor *ed UNUSED) { }
 #endif
 
+/**********************************
+EventMachine_t::DisarmKqueueReader
+**********************************/
+
+#ifdef HAVE_KQUEUE
+void EventMachine_t::DisarmKqueueReader (EventableDescriptor *ed)
+{
+	if (Poller == Poller_Kqueue) {
+		if (!ed)
+			throw std::runtime_error ("disarmed bad descriptor");
+		struct kevent k;
+#ifdef __NetBSD__
+		EV_SET (&k, ed->GetSocket(), EVFILT_READ, EV_DELETE, 0, 0, (intptr_t)ed);
+#else
+		EV_SET (&k, ed->GetSocket(), EVFILT_READ, EV_DELETE, 0, 0, ed);
+#endif
+		// ENOENT only means it wasn't armed.
+		int t = kevent (kqfd, &k, 1, NULL, 0, NULL);
+		if ((t < 0) && (errno != ENOENT)) {
+			char buf [200];
+			snprintf (buf, sizeof(buf)-1, "disarm kqueue reader failed on %d: %s", ed->GetSocket(), strerror(errno));
+			throw std::runtime_error (buf);
+		}
+	}
+}
+#else
+void EventMachine_t::DisarmKqueueReader (EventableDescriptor *ed UNUSED) { }
+#endif
+
 /**********************************
 EventMachine_t::_AddNewDescriptors
 **********************************/
@@ -1752,39 +2531,51 @@ void EventMachine_t::_AddNewDescriptors()
 		if (ed == NULL)
 			throw std::runtime_error ("adding bad descriptor");
 
-		#if HAVE_EPOLL
-		if (Poller == Poller_Epoll) {
-			assert (epfd != -1);
-			int e = epoll_ctl (epfd, EPOLL_CTL_ADD, ed->GetSocket(), ed->GetEpollEvent());
-			if (e) {
-				char buf [200];
-				snprintf (buf, sizeof(buf)-1, "unable to add new descriptor: %s", strerror(errno));
-				throw std::runtime_error (buf);
-			}
+		// A connection still waiting for its address has no socket to poll yet.
+		if (!ed->IsResolving())
+			_AddToPoller (ed);
+
+		QueueHeartbeat(ed);
+		Descriptors.push_back (ed);
+	}
+	NewDescriptors.clear();
+}
+
+
+/****************************
+EventMachine_t::_AddToPoller
+****************************/
+
+void EventMachine_t::_AddToPoller (EventableDescriptor *ed)
+{
+	#if HAVE_EPOLL
+	if (Poller == Poller_Epoll) {
+		assert (epfd != -1);
+		int e = epoll_ctl (epfd, EPOLL_CTL_ADD, ed->GetSocket(), ed->GetEpollEvent());
+		if (e) {
+			char buf [200];
+			snprintf (buf, sizeof(buf)-1, "unable to add new descriptor: %s", strerror(errno));
+			throw std::runtime_error (buf);
 		}
-		#endif
+	}
+	#endif
 
-		#if HAVE_KQUEUE
-		/*
-		if (Poller == Poller_Kqueue) {
-			// INCOMPLETE. Some descriptors don't want to be readable.
-			assert (kqfd != -1);
-			struct kevent k;
+	#if HAVE_KQUEUE
+	/*
+	if (Poller == Poller_Kqueue) {
+		// INCOMPLETE. Some descriptors don't want to be readable.
+		assert (kqfd != -1);
+		struct kevent k;
 #ifdef __NetBSD__
-			EV_SET (&k, ed->GetSocket(), EVFILT_READ, EV_ADD, 0, 0, (intptr_t)ed);
+		EV_SET (&k, ed->GetSocket(), EVFILT_READ, EV_ADD, 0, 0, (intptr_t)ed);
 #else
-			EV_SET (&k, ed->GetSocket(), EVFILT_READ, EV_ADD, 0, 0, ed);
+		EV_SET (&k, ed->GetSocket(), EVFILT_READ, EV_ADD, 0, 0, ed);
 #endif
-			int t = kevent (kqfd, &k, 1, NULL, 0, NULL);
-			assert (t == 0);
-		}
-		*/
-		#endif
-
-		QueueHeartbeat(ed);
-		Descriptors.push_back (ed);
+		int t = kevent (kqfd, &k, 1, NULL, 0, NULL);
+		assert (t == 0);
 	}
-	NewDescriptors.clear();
+	*/
+	#endif
 }
 
 
@@ -1886,6 +2677,21 @@ void EventMachine_t::Deregister (EventableDescriptor *ed)
 }
 
 
+/****************************
+EventMachine_t::StartPolling
+****************************/
+
+void EventMachine_t::StartPolling (EventableDescriptor *ed)
+{
+	/* Polls a descriptor that was kept out of the poller while it had no
+	 * real socket (see EventableDescriptor::IsResolving). One that hasn't
+	 * been added to the machine yet is polled with the rest.
+	 */
+	if (std::find (NewDescriptors.begin(), NewDescriptors.end(), ed) == NewDescriptors.end())
+		_AddToPoller (ed);
+}
+
+
 /**************************************
 EventMachine_t::CreateUnixDomainServer
 **************************************/
@@ -65,9 +65,126 @@ extern "C" {
 #endif
 
 class EventableDescriptor;
+class ConnectionDescriptor;
+class AcceptorDescriptor;
 class InotifyDescriptor;
+class SslHandshakePool_t;
+class ResolverPool_t;
+class ConnectionPool_t;
+class CircuitBreakers_t;
 struct SelectData_t;
 
+
+/***********************
+struct PrefetchedRead_t
+***********************/
+
+struct PrefetchedRead_t
+{
+	ConnectionDescriptor *Descriptor;
+	SOCKET Socket;
+	char *Buffer;
+	size_t Size;
+	int Result;
+	int Error;
+};
+
+/*****************
+struct TlsStats_t
+*****************/
+
+#define TLS_HANDSHAKE_TIME_BUCKETS 12
+
+struct TlsStats_t
+{
+	uint64_t StartedHandshakes;
+	uint64_t FullHandshakes;
+	uint64_t ResumedHandshakes;
+	uint64_t FailedHandshakes;
+
+	// Completed handshakes by how long they took from StartTls (or the
+	// connect, if later): under 1 ms, under 2 ms, and so on doubling up to
+	// under 1024 ms, and then the rest.
+	uint64_t HandshakeTimes [TLS_HANDSHAKE_TIME_BUCKETS];
+
+	uint64_t BytesEncrypted;
+	uint64_t BytesDecrypted;
+	uint64_t RecordsSent;
+	uint64_t RecordsReceived;
+
+	// Nanoseconds spent in SSL_read, SSL_write and the handshake calls.
+	uint64_t ReadTime;
+	uint64_t WriteTime;
+	uint64_t HandshakeTime;
+
+	// SSL contexts built for connections, and connections that found one cached.
+	uint64_t ContextsCreated;
+	uint64_t ContextsReused;
+};
+
+/************************
+struct ListenerOptions_t
+************************/
+
+struct ListenerOptions_t
+{
+	ListenerOptions_t(): Backlog (100), DeferAccept (0), FastOpenQueue (0), bReusePort (false), bNoDelay (true), bKeepalive (false), SendBuffer (0), ReceiveBuffer (0) {}
+
+	int Backlog;
+	// Seconds to wait for a client's first data before accepting (Linux).
+	int DeferAccept;
+	// Pending TCP Fast Open requests to queue, or 0 for none.
+	int FastOpenQueue;
+	bool bReusePort;
+
+	// Set on the listener, and inherited by the sockets it accepts.
+	bool bNoDelay;
+	bool bKeepalive;
+	int SendBuffer;
+	int ReceiveBuffer;
+};
+
+/************************
+struct AdmissionLimits_t
+************************/
+
+struct AdmissionLimits_t
+{
+	/* When a listener sheds load. A limit of zero is off. Shedding starts
+	 * when any measure reaches its limit, and stops once every one is back
+	 * under ResumePercent of it.
+	 */
+	AdmissionLimits_t(): MaxConnections (0), MaxLoopLag (0), MaxOutboundBytes (0), ResumePercent (80), bReject (false) {}
+
+	// Open connections the listener accepted.
+	int MaxConnections;
+	// Microseconds, see EventMachine_t::GetLoopLag.
+	uint64_t MaxLoopLag;
+	// Queued on all of the reactor's connections.
+	uint64_t MaxOutboundBytes;
+	int ResumePercent;
+
+	// Accept and hang up on (after sending RejectResponse) instead of
+	// leaving connections in the kernel's queue.
+	bool bReject;
+	std::string RejectResponse;
+};
+
+/***********************
+struct AdmissionStats_t
+***********************/
+
+struct AdmissionStats_t
+{
+	int Connections;
+	// One of the EM_SHED_ reasons, or 0 when admitting.
+	int Shedding;
+	uint64_t Sheds;
+	uint64_t Rejected;
+	uint64_t LoopLag;
+	uint64_t OutboundBytes;
+};
+
 /*************
 enum Poller_t
 *************/
@@ -91,6 +208,16 @@ class EventMachine_t
 		static int GetSimultaneousAcceptCount();
 		static void SetSimultaneousAcceptCount (int);
 
+		static int GetTlsHandshakeThreads();
+		static void SetTlsHandshakeThreads (int);
+		static uint64_t GetTlsIdleShrink();
+		static void SetTlsIdleShrink (uint64_t);
+
+		static int GetResolverThreads();
+		static void SetResolverThreads (int);
+		static uint64_t GetConnectAttemptDelay();
+		static void SetConnectAttemptDelay (uint64_t);
+
 	public:
 		EventMachine_t (EMCallback, Poller_t);
 		virtual ~EventMachine_t();
@@ -102,10 +229,17 @@ class EventMachine_t
 		void SignalLoopBreaker();
 		size_t GetTimerCount();
 		const uintptr_t InstallOneshotTimer (uint64_t);
-		const uintptr_t ConnectToServer (const char *, int, const char *, int);
+		const uintptr_t ConnectToServer (const char *, int, const char *, int, bool fast_open = false);
+		void ConnectResolved (const uintptr_t, int, const std::vector<struct sockaddr_storage>&, const struct sockaddr*, size_t);
 		const uintptr_t ConnectToUnixServer (const char *);
-
-		const uintptr_t CreateTcpServer (const char *, int);
+		const uintptr_t PooledConnect (const char *, const char *, int);
+		bool ReleaseToPool (const uintptr_t);
+		ConnectionPool_t *GetConnectionPool() { return Pool; }
+		const uintptr_t ConnectWithRedial (const char *, int);
+		void ResolveAndConnect (const uintptr_t, const char *, int);
+		CircuitBreakers_t *GetCircuitBreakers();
+
+		const uintptr_t CreateTcpServer (const char *, int, const ListenerOptions_t* = NULL);
 		const uintptr_t OpenDatagramSocket (const char *, int);
 		const uintptr_t CreateUnixDomainServer (const char*);
 		const uintptr_t AttachSD (SOCKET);
@@ -116,12 +250,14 @@ class EventMachine_t
 		void Add (EventableDescriptor*);
 		void Modify (EventableDescriptor*);
 		void Deregister (EventableDescriptor*);
+		void StartPolling (EventableDescriptor*);
 
 		const uintptr_t AttachFD (SOCKET, bool);
 		int DetachFD (EventableDescriptor*);
 
 		void ArmKqueueWriter (EventableDescriptor*);
 		void ArmKqueueReader (EventableDescriptor*);
+		void DisarmKqueueReader (EventableDescriptor*);
 
 		uint64_t GetTimerQuantum();
 		void SetTimerQuantum (int);
@@ -131,6 +267,9 @@ class EventMachine_t
 		pid_t SubprocessPid;
 		int SubprocessExitStatus;
 
+		TlsStats_t TlsStats;
+		SslHandshakePool_t *GetHandshakePool();
+
 		int GetConnectionCount();
 		float GetHeartbeatInterval();
 		int SetHeartbeatInterval(float);
@@ -154,6 +293,20 @@ class EventMachine_t
 
 		uint64_t GetCurrentLoopTime() { return MyCurrentLoopTime; }
 
+		// A moving average of how long each pass spends away from the poller.
+		uint64_t GetLoopLag() { return LoopLag; }
+		uint64_t GetOutboundBytes() { return OutboundBytes; }
+		void AdjustOutboundBytes (int64_t delta) { OutboundBytes += delta; }
+
+		void AddLimitedAcceptor (AcceptorDescriptor*);
+		void RemoveLimitedAcceptor (AcceptorDescriptor*);
+
+		// Connections over a rate limit, refilled once per timer quantum.
+		void AddThrottled (ConnectionDescriptor*);
+		void RemoveThrottled (ConnectionDescriptor*);
+		void AdjustRateLimitedListeners (int delta) { RateLimitedListeners += delta; }
+		bool HasRateLimitedListeners() { return RateLimitedListeners > 0; }
+
 		void QueueHeartbeat(EventableDescriptor*);
 		void ClearHeartbeat(uint64_t, EventableDescriptor*);
 
@@ -162,11 +315,15 @@ class EventMachine_t
 		Poller_t GetPoller() { return Poller; }
 
 		static int name2address (const char *server, int port, int socktype, struct sockaddr *addr, size_t *addr_len);
+		static int name2addresses (const char *server, int port, int socktype, std::vector<struct sockaddr_storage> &addrs);
 
 	private:
 		void _RunTimers();
 		void _UpdateTime();
 		void _AddNewDescriptors();
+		void _AddToPoller (EventableDescriptor*);
+		const uintptr_t _ConnectWhenResolved (const char *, int, const char *, int, bool);
+		const uintptr_t _ConnectRacing (const char *, int, const std::vector<struct sockaddr_storage>&);
 		void _ModifyDescriptors();
 		void _InitializeLoopBreaker();
 		void _CleanupSockets();
@@ -176,7 +333,11 @@ class EventMachine_t
 		void _RunKqueueOnce();
 
 		void _ModifyEpollEvent (EventableDescriptor*);
+		void _QueuePrefetchedRead (EventableDescriptor*);
+		void _RunPrefetchedReads();
 		void _DispatchHeartbeats();
+		void _CheckAdmission();
+		void _RefillBuckets();
 		timeval _TimeTilNextEvent();
 		void _CleanBadDescriptors();
 
@@ -187,7 +348,9 @@ class EventMachine_t
 
 	private:
 		enum {
-			MaxEvents = 4096
+			MaxEvents = 4096,
+			MaxPrefetchedReads = 64,
+			PrefetchBufferSize = 16 * 1024 + 1
 		};
 		int HeartbeatInterval;
 		EMCallback EventCallback;
@@ -201,7 +364,20 @@ class EventMachine_t
 		std::map<int, Bindable_t*> Pids;
 		std::vector<EventableDescriptor*> Descriptors;
 		std::vector<EventableDescriptor*> NewDescriptors;
+		// Taken out of Descriptors by _CleanupSockets, and not deleted yet.
+		std::deque<EventableDescriptor*> DeadDescriptors;
 		std::set<EventableDescriptor*> ModifiedDescriptors;
+		std::set<AcceptorDescriptor*> LimitedAcceptors;
+		std::set<ConnectionDescriptor*> Throttled;
+		int RateLimitedListeners;
+
+		std::vector<PrefetchedRead_t> PrefetchedReads;
+		char *PrefetchBuffers;
+
+		SslHandshakePool_t *HandshakePool;
+		ResolverPool_t *Resolver;
+		ConnectionPool_t *Pool;
+		CircuitBreakers_t *Breakers;
 
 		SOCKET LoopBreakerReader;
 		SOCKET LoopBreakerWriter;
@@ -212,6 +388,9 @@ class EventMachine_t
 		timeval Quantum;
 
 		uint64_t MyCurrentLoopTime;
+		uint64_t LoopWoke;
+		uint64_t LoopLag;
+		uint64_t OutboundBytes;
 
 		#ifdef OS_WIN32
 		unsigned TickCountTickover;
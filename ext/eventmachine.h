@@ -36,7 +36,19 @@ extern "C" {
 		EM_SSL_HANDSHAKE_COMPLETED = 108,
 		EM_SSL_VERIFY = 109,
 		EM_PROXY_TARGET_UNBOUND = 110,
-		EM_PROXY_COMPLETED = 111
+		EM_PROXY_COMPLETED = 111,
+		EM_CONNECTION_LINE = 112,
+		EM_CONNECTION_FRAME = 113,
+		EM_SHEDDING_STARTED = 114,
+		EM_SHEDDING_STOPPED = 115,
+		EM_CONNECTION_REBOUND = 116,
+		EM_CONNECTION_RECONNECTING = 117
+	};
+
+	enum { // Why a listener sheds load
+		EM_SHED_CONNECTIONS = 1,
+		EM_SHED_LOOP_LAG = 2,
+		EM_SHED_OUTBOUND_BYTES = 3
 	};
 
 	enum { // SSL/TLS Protocols
@@ -60,6 +72,15 @@ extern "C" {
 	const uintptr_t evma_install_oneshot_timer (uint64_t milliseconds);
 	const uintptr_t evma_connect_to_server (const char *bind_addr, int bind_port, const char *server, int port);
 	const uintptr_t evma_connect_to_unix_server (const char *server);
+	const uintptr_t evma_pool_connect (const char *key, const char *server, int port);
+	int evma_pool_release (const uintptr_t binding);
+	int evma_get_pool_connection_state (const uintptr_t binding);
+	void evma_set_pool_limits (int max_per_host, float idle_timeout);
+	void evma_get_pool_stats (ConnectionPoolStats_t *stats);
+	const uintptr_t evma_connect_with_retry (const char *server, int port);
+	const uintptr_t evma_connect_fast_open (const char *server, int port);
+	void evma_set_reconnect_policy (float base_delay, float max_delay, float jitter, int max_attempts, int breaker_threshold, float breaker_timeout);
+	int evma_get_redial_attempts (const uintptr_t binding);
 
 	const uintptr_t evma_attach_fd (int file_descriptor, int watch_mode);
 	int evma_detach_fd (const uintptr_t binding);
@@ -76,12 +97,15 @@ extern "C" {
 	int evma_num_close_scheduled();
 
 	void evma_stop_tcp_server (const uintptr_t binding);
-	const uintptr_t evma_create_tcp_server (const char *address, int port);
+	const uintptr_t evma_create_tcp_server (const char *address, int port, const ListenerOptions_t *options);
+	void evma_set_admission_limits (const uintptr_t binding, const AdmissionLimits_t *limits);
+	void evma_get_admission_stats (const uintptr_t binding, AdmissionStats_t *stats);
+	void evma_set_rate_limits (const uintptr_t binding, const RateLimits_t *limits);
 	const uintptr_t evma_create_unix_domain_server (const char *filename);
 	const uintptr_t evma_attach_sd (int sd);
 	const uintptr_t evma_open_datagram_socket (const char *server, int port);
 	const uintptr_t evma_open_keyboard();
-	void evma_set_tls_parms (const uintptr_t binding, const char *privatekey_filename, const char *privatekey, const char *privatekeypass, const char *certchain_filename, const char *cert, int verify_peer, int fail_if_no_peer_cert, const char *sni_hostname, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int protocols);
+	void evma_set_tls_parms (const uintptr_t binding, const char *privatekey_filename, const char *privatekey, const char *privatekeypass, const char *certchain_filename, const char *cert, int verify_peer, int fail_if_no_peer_cert, const char *sni_hostname, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int protocols, int ktls, int dynamic_records);
 	void evma_start_tls (const uintptr_t binding);
 
 	#ifdef WITH_SSL
@@ -91,7 +115,13 @@ extern "C" {
 	const char *evma_get_cipher_protocol (const uintptr_t binding);
 	const char *evma_get_sni_hostname (const uintptr_t binding);
 	void evma_accept_ssl_peer (const uintptr_t binding);
+	int evma_get_ktls_status (const uintptr_t binding);
+	int evma_get_tls_memory (const uintptr_t binding);
+	int evma_is_tls_shrunk (const uintptr_t binding);
+	void evma_set_tls_ticket_keys (const char *keys, int length);
+	void evma_set_tls_session_cache (int size, int timeout);
 	#endif
+	void evma_get_tls_stats (TlsStats_t *stats);
 
 	int evma_get_peername (const uintptr_t binding, struct sockaddr*, socklen_t*);
 	int evma_get_sockname (const uintptr_t binding, struct sockaddr*, socklen_t*);
@@ -118,6 +148,23 @@ extern "C" {
 	void evma_set_max_timer_count (int);
 	int evma_get_simultaneous_accept_count();
 	void evma_set_simultaneous_accept_count (int);
+	int evma_get_tls_handshake_threads();
+	void evma_set_tls_handshake_threads (int);
+	int evma_get_resolver_threads();
+	void evma_set_resolver_threads (int);
+	float evma_get_connection_attempt_delay();
+	void evma_set_connection_attempt_delay (float);
+	float evma_get_dns_cache_ttl();
+	void evma_set_dns_cache_ttl (float);
+	float evma_get_dns_negative_ttl();
+	void evma_set_dns_negative_ttl (float);
+	void evma_get_dns_cache_stats (DnsCacheStats_t *stats);
+	int evma_dns_cache_lookup (const char *host, struct sockaddr_storage *addrs, int max);
+	void evma_dns_cache_store (const char *host, const struct sockaddr_storage *addrs, int count, float ttl);
+	float evma_get_tls_idle_shrink();
+	void evma_set_tls_idle_shrink (float);
+	void evma_preload_tls_context (const char *privatekey_filename, const char *privatekey, const char *privatekeypass, const char *certchain_filename, const char *cert, const char *cipherlist, const char *ecdh_curve, const char *dhparam, int protocols);
+	int evma_reload_tls_contexts (const char *filename);
 	void evma_setuid_string (const char *username);
 	void evma_stop_machine();
 	bool evma_stopping();
@@ -137,6 +184,9 @@ extern "C" {
 	void evma_stop_proxy(const uintptr_t from);
 	unsigned long evma_proxied_bytes(const uintptr_t from);
 
+	void evma_set_line_framing (const uintptr_t binding, const char *delimiter, int delimiter_length, size_t max_length);
+	void evma_set_length_framing (const uintptr_t binding, int width, int big_endian, int offset, int adjustment, int strip, size_t max_frame_size);
+
 	int evma_set_rlimit_nofile (int n_files);
 
 	void evma_set_epoll (int use);
@@ -117,6 +117,7 @@ have_func('writev', 'sys/uio.h')
 have_func('pipe2', 'unistd.h')
 have_func('accept4', 'sys/socket.h')
 have_const('SOCK_CLOEXEC', 'sys/socket.h')
+have_const('SOCK_NONBLOCK', 'sys/socket.h')
 
 # Minor platform details between *nix and Windows:
 
@@ -242,6 +243,8 @@ end
 #   below are yes for 1.1.0 & later, may need to check func rather than macro
 #   with versions after 1.1.1
 have_func  "TLS_server_method"            , "openssl/ssl.h"
+have_func  "SSL_SESSION_up_ref"           , "openssl/ssl.h"
+have_func  "BIO_meth_new"                 , "openssl/bio.h"
 have_macro "SSL_CTX_set_min_proto_version", "openssl/ssl.h"
 
 # Hack so that try_link will test with a C++ compiler instead of a C compiler
@@ -0,0 +1,170 @@
+/*****************************************************************************
+
+$Id$
+
+File:     framer.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#include "project.h"
+
+
+/******************
+Framer_t::Framer_t
+******************/
+
+Framer_t::Framer_t (int width, bool big_endian, int offset, int adjustment, int strip, size_t max_frame_size):
+	LengthWidth (width),
+	bBigEndian (big_endian),
+	LengthOffset (offset),
+	Adjustment (adjustment),
+	Strip (strip),
+	MaxFrameSize (max_frame_size),
+	Consumed (0),
+	bOverflowed (false)
+{
+	if ((width != 1) && (width != 2) && (width != 4) && (width != 8))
+		throw std::runtime_error ("frame length width must be 1, 2, 4 or 8 bytes");
+	if ((offset < 0) || (strip < 0))
+		throw std::runtime_error ("frame length offset and strip must not be negative");
+}
+
+
+/*******************
+Framer_t::~Framer_t
+*******************/
+
+Framer_t::~Framer_t()
+{
+}
+
+
+/****************
+Framer_t::Append
+****************/
+
+void Framer_t::Append (const char *data, size_t length)
+{
+	_Compact();
+	Buffer.append (data, length);
+}
+
+
+/**************
+Framer_t::Next
+**************/
+
+bool Framer_t::Next (const char **frame, size_t *length)
+{
+	/* Returns the next complete frame, which points into our buffer and
+	 * stays valid until the next call to Append or Clear. Returns false
+	 * when no complete frame is buffered, or when the header announces
+	 * a frame that is malformed or larger than MaxFrameSize (which also
+	 * sets bOverflowed).
+	 */
+	assert (frame && length);
+
+	if (bOverflowed)
+		return false;
+
+	const size_t available = Buffer.size() - Consumed;
+	const size_t header = LengthOffset + LengthWidth;
+	if (available < header)
+		return false;
+
+	const unsigned char *p = (const unsigned char*) Buffer.data() + Consumed + LengthOffset;
+	uint64_t value = 0;
+	for (int i = 0; i < LengthWidth; i++) {
+		if (bBigEndian)
+			value = (value << 8) | p[i];
+		else
+			value |= ((uint64_t) p[i]) << (8 * i);
+	}
+
+	// Anything that doesn't fit comfortably in an int64 is nonsense anyway.
+	if (value > ((uint64_t)1 << 48)) {
+		bOverflowed = true;
+		return false;
+	}
+
+	int64_t total = (int64_t) header + (int64_t) value + Adjustment;
+	if ((total < (int64_t) header) || (total < Strip) || (MaxFrameSize && ((uint64_t) total > MaxFrameSize))) {
+		bOverflowed = true;
+		return false;
+	}
+
+	if (available < (size_t) total) {
+		// Grow once to the announced size rather than by repeated appends,
+		// without trusting the peer with more than a sane amount of memory.
+		size_t wanted = Consumed + (((uint64_t) total < (16 * 1024 * 1024)) ? (size_t) total : (16 * 1024 * 1024));
+		if (wanted > Buffer.capacity())
+			Buffer.reserve (wanted);
+		return false;
+	}
+
+	*frame = Buffer.data() + Consumed + Strip;
+	*length = total - Strip;
+	Consumed += total;
+	return true;
+}
+
+
+/***************
+Framer_t::Flush
+***************/
+
+void Framer_t::Flush (const char **data, size_t *length)
+{
+	assert (data && length);
+
+	*data = Buffer.data() + Consumed;
+	*length = Buffer.size() - Consumed;
+	Consumed = Buffer.size();
+}
+
+
+/***************
+Framer_t::Clear
+***************/
+
+void Framer_t::Clear()
+{
+	Buffer.clear();
+	Consumed = 0;
+	bOverflowed = false;
+}
+
+
+/******************
+Framer_t::_Compact
+******************/
+
+void Framer_t::_Compact()
+{
+	if (Consumed == 0)
+		return;
+
+	if (Consumed == Buffer.size()) {
+		// Don't hang on to the memory of an unusually large frame.
+		if (Buffer.capacity() > 64 * 1024)
+			std::string().swap (Buffer);
+		else
+			Buffer.clear();
+	}
+	else
+		Buffer.erase (0, Consumed);
+
+	Consumed = 0;
+}
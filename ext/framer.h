@@ -0,0 +1,68 @@
+/*****************************************************************************
+
+$Id$
+
+File:     framer.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#ifndef __Framer__H_
+#define __Framer__H_
+
+
+/**************
+class Framer_t
+**************/
+
+class Framer_t
+{
+	/* Splits a byte stream into frames that carry their own length in a
+	 * fixed-position header field. The complete frame occupies
+	 *   LengthOffset + LengthWidth + <field value> + Adjustment
+	 * bytes, of which the first Strip are dropped before the frame is
+	 * handed out. This covers a bare length prefix (offset 0), a type byte
+	 * in front of the length (offset 1), and lengths that count the header
+	 * themselves (a negative adjustment).
+	 */
+
+	public:
+		Framer_t (int width, bool big_endian, int offset, int adjustment, int strip, size_t max_frame_size);
+		virtual ~Framer_t();
+
+		void Append (const char *data, size_t length);
+		bool Next (const char **frame, size_t *length);
+		void Flush (const char **data, size_t *length);
+		void Clear();
+
+		size_t GetBufferedSize() { return Buffer.size() - Consumed; }
+		bool IsOverflowed() { return bOverflowed; }
+
+	private:
+		void _Compact();
+
+		int LengthWidth;
+		bool bBigEndian;
+		int LengthOffset;
+		int Adjustment;
+		int Strip;
+		size_t MaxFrameSize;
+
+		std::string Buffer;
+		size_t Consumed;
+		bool bOverflowed;
+};
+
+
+#endif // __Framer__H_
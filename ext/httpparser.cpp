@@ -0,0 +1,674 @@
+/*****************************************************************************
+
+$Id$
+
+File:     httpparser.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#include "project.h"
+
+
+/*************
+Local helpers
+*************/
+
+static bool _IsBlank (char c)
+{
+	return (c == ' ') || (c == '\t');
+}
+
+static bool _IsDigit (char c)
+{
+	return (c >= '0') && (c <= '9');
+}
+
+static int _HexValue (char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool _EqualsIgnoringCase (const char *s, size_t length, const char *lower)
+{
+	// lower must be NUL-terminated and already lowercase.
+	size_t i;
+	for (i = 0; i < length; i++) {
+		if (!lower[i] || (tolower ((unsigned char) s[i]) != lower[i]))
+			return false;
+	}
+	return lower[i] == 0;
+}
+
+static bool _HasToken (const char *s, size_t length, const char *lower, bool last_only)
+{
+	/* Looks for a token in a comma-separated header value such as
+	 * Connection or Transfer-Encoding, ignoring case and blanks.
+	 */
+	bool found = false;
+	size_t pos = 0;
+	while (pos <= length) {
+		const char *comma = (const char*) memchr (s + pos, ',', length - pos);
+		size_t end = comma ? (size_t)(comma - s) : length;
+
+		size_t b = pos, e = end;
+		while ((b < e) && _IsBlank (s[b]))
+			b++;
+		while ((e > b) && _IsBlank (s[e - 1]))
+			e--;
+		found = _EqualsIgnoringCase (s + b, e - b, lower);
+		if (found && !last_only)
+			return true;
+
+		pos = end + 1;
+	}
+	return found;
+}
+
+
+/**************************
+HttpParser_t::HttpParser_t
+**************************/
+
+HttpParser_t::HttpParser_t (size_t max_header_size):
+	MaxHeaderSize (max_header_size ? max_header_size : (size_t) DefaultMaxHeaderSize),
+	Consumed (0),
+	Scanned (0),
+	State (ParseHead),
+	MajorVersion (0),
+	MinorVersion (0),
+	Status (0),
+	Reason (0),
+	ReasonLength (0),
+	bKeepAlive (false),
+	Remaining (0),
+	BodyData (NULL),
+	BodyLength (0)
+{
+}
+
+
+/***************************
+HttpParser_t::~HttpParser_t
+***************************/
+
+HttpParser_t::~HttpParser_t()
+{
+}
+
+
+/****************************
+HttpParser_t::ExpectResponse
+****************************/
+
+void HttpParser_t::ExpectResponse (bool head)
+{
+	/* Responses are matched to requests in order. Only a HEAD request
+	 * changes how its response is parsed (it has headers but no body),
+	 * so callers that never send one needn't call this at all.
+	 */
+	HeadRequests.push_back (head);
+}
+
+
+/********************
+HttpParser_t::Append
+********************/
+
+void HttpParser_t::Append (const char *data, size_t length)
+{
+	_Compact();
+
+	// Grow once to the announced body size rather than by repeated appends,
+	// without trusting the server with more than a sane amount of memory.
+	if ((State == ParseBodyLength) && (Remaining > Buffer.size())) {
+		uint64_t wanted = Remaining < (16 * 1024 * 1024) ? Remaining : (16 * 1024 * 1024);
+		if (wanted > Buffer.capacity())
+			Buffer.reserve ((size_t) wanted);
+	}
+
+	Buffer.append (data, length);
+}
+
+
+/******************
+HttpParser_t::Next
+******************/
+
+bool HttpParser_t::Next()
+{
+	if (State == ParseFailed)
+		throw std::runtime_error (Error);
+	return _Parse();
+}
+
+
+/********************
+HttpParser_t::Finish
+********************/
+
+bool HttpParser_t::Finish()
+{
+	/* Called when the server has closed the connection. That completes a
+	 * response whose body runs to end-of-stream, and we also accept one
+	 * that was cut off in its chunked trailer since the body is complete.
+	 * Anything else that is half-received is an error.
+	 */
+	if (State == ParseFailed)
+		throw std::runtime_error (Error);
+
+	if ((State == ParseBodyEof) || (State == ParseTrailer)) {
+		State = ParseHead;
+		return _Complete();
+	}
+
+	if (State == ParseHead) {
+		size_t i = Consumed;
+		while ((i < Buffer.size()) && ((Buffer[i] == '\r') || (Buffer[i] == '\n')))
+			i++;
+		if (i == Buffer.size())
+			return false;
+	}
+
+	_Fail ("connection closed before the response was complete");
+	return false;
+}
+
+
+/*******************
+HttpParser_t::Clear
+*******************/
+
+void HttpParser_t::Clear()
+{
+	HeadRequests.clear();
+	Buffer.clear();
+	Consumed = Scanned = 0;
+	State = ParseHead;
+	Error.clear();
+	HeaderBlock.clear();
+	Headers.clear();
+	Body.clear();
+	BodyData = NULL;
+	BodyLength = 0;
+	Remaining = 0;
+}
+
+
+/***********************
+HttpParser_t::GetReason
+***********************/
+
+void HttpParser_t::GetReason (const char **reason, size_t *length)
+{
+	assert (reason && length);
+	*reason = HeaderBlock.data() + Reason;
+	*length = ReasonLength;
+}
+
+
+/***********************
+HttpParser_t::GetHeader
+***********************/
+
+void HttpParser_t::GetHeader (size_t index, const char **name, size_t *name_length, const char **value, size_t *value_length)
+{
+	assert (index < Headers.size());
+	const HttpHeader_t &h = Headers[index];
+	*name = HeaderBlock.data() + h.Name;
+	*name_length = h.NameLength;
+	*value = HeaderBlock.data() + h.Value;
+	*value_length = h.ValueLength;
+}
+
+
+/*********************
+HttpParser_t::GetBody
+*********************/
+
+void HttpParser_t::GetBody (const char **body, size_t *length)
+{
+	assert (body && length);
+	*body = BodyData ? BodyData : Body.data();
+	*length = BodyData ? BodyLength : Body.size();
+}
+
+
+/********************
+HttpParser_t::_Parse
+********************/
+
+bool HttpParser_t::_Parse()
+{
+	const char *line;
+	size_t length;
+
+	for (;;) {
+		switch (State) {
+			case ParseHead:
+			{
+				size_t end;
+				if (!_FindHeadEnd (&end))
+					return false;
+				_ParseHead (end);
+
+				// Interim responses (100 Continue and friends) precede the
+				// real one and aren't handed out.
+				if ((Status < 200) && (Status != 101))
+					break;
+
+				_StartBody();
+				if (State == ParseHead)
+					return _Complete();
+				break;
+			}
+
+			case ParseBodyLength:
+				if (GetBufferedSize() < Remaining)
+					return false;
+				BodyData = Buffer.data() + Consumed;
+				BodyLength = (size_t) Remaining;
+				Consumed = Scanned = Consumed + BodyLength;
+				State = ParseHead;
+				return _Complete();
+
+			case ParseBodyEof:
+				Body.append (Buffer.data() + Consumed, GetBufferedSize());
+				Consumed = Scanned = Buffer.size();
+				return false;
+
+			case ParseChunkSize:
+			{
+				if (!_NextLine (&line, &length))
+					return false;
+
+				uint64_t size = 0;
+				size_t i;
+				for (i = 0; i < length; i++) {
+					int digit = _HexValue (line[i]);
+					if (digit < 0)
+						break;
+					if (size >> 56)
+						_Fail ("chunk size too large");
+					size = (size << 4) | digit;
+				}
+				if ((i == 0) || ((i < length) && (line[i] != ';') && !_IsBlank (line[i])))
+					_Fail ("malformed chunk size");
+
+				if (size == 0)
+					State = ParseTrailer;
+				else {
+					Remaining = size;
+					State = ParseChunkData;
+				}
+				break;
+			}
+
+			case ParseChunkData:
+			{
+				size_t n = GetBufferedSize();
+				if (n > Remaining)
+					n = (size_t) Remaining;
+				Body.append (Buffer.data() + Consumed, n);
+				Consumed = Scanned = Consumed + n;
+				Remaining -= n;
+				if (Remaining > 0)
+					return false;
+				State = ParseChunkEnd;
+				break;
+			}
+
+			case ParseChunkEnd:
+				if (!_NextLine (&line, &length))
+					return false;
+				if (length > 0)
+					_Fail ("missing line break after chunk data");
+				State = ParseChunkSize;
+				break;
+
+			case ParseTrailer:
+			{
+				if (!_NextLine (&line, &length))
+					return false;
+				if (length == 0) {
+					State = ParseHead;
+					return _Complete();
+				}
+
+				// Trailer fields are reported along with the other headers.
+				if (HeaderBlock.size() + length > MaxHeaderSize)
+					_Fail ("response header too large");
+				size_t offset = HeaderBlock.size();
+				HeaderBlock.append (line, length);
+				_ParseHeaderLine (HeaderBlock.data() + offset, length);
+				break;
+			}
+
+			case ParseFailed:
+				throw std::runtime_error (Error);
+		}
+	}
+}
+
+
+/**************************
+HttpParser_t::_FindHeadEnd
+**************************/
+
+bool HttpParser_t::_FindHeadEnd (size_t *end)
+{
+	/* Looks for the blank line that ends the status line and headers,
+	 * picking up the scan where the last call left off. memchr does the
+	 * heavy lifting, and is vectorized by any modern libc.
+	 */
+	const char *base = Buffer.data();
+	const size_t size = Buffer.size();
+
+	// Tolerate stray line breaks ahead of the status line (RFC 7230 3.5).
+	if (Scanned == Consumed) {
+		while ((Consumed < size) && ((base[Consumed] == '\r') || (base[Consumed] == '\n')))
+			Consumed++;
+		Scanned = Consumed;
+	}
+
+	size_t pos = Scanned;
+	while (pos < size) {
+		const char *p = (const char*) memchr (base + pos, '\n', size - pos);
+		if (!p) {
+			pos = size;
+			break;
+		}
+
+		// A line break followed by an empty line; if the bytes that decide
+		// it haven't arrived yet, come back to this line break next time.
+		size_t nl = p - base;
+		size_t blank = 0;
+		if ((nl + 1 < size) && (base[nl + 1] == '\n'))
+			blank = 2;
+		else if ((nl + 2 < size) && (base[nl + 1] == '\r') && (base[nl + 2] == '\n'))
+			blank = 3;
+		else if ((nl + 1 >= size) || ((nl + 2 >= size) && (base[nl + 1] == '\r'))) {
+			pos = nl;
+			break;
+		}
+
+		if (blank) {
+			*end = nl + blank;
+			if (*end - Consumed > MaxHeaderSize)
+				_Fail ("response header too large");
+			return true;
+		}
+		pos = nl + 1;
+	}
+
+	Scanned = pos;
+	if (Scanned - Consumed > MaxHeaderSize)
+		_Fail ("response header too large");
+	return false;
+}
+
+
+/***********************
+HttpParser_t::_NextLine
+***********************/
+
+bool HttpParser_t::_NextLine (const char **line, size_t *length)
+{
+	/* Consumes the next line of the chunked framing, returning it without
+	 * its line break. The line points into our buffer.
+	 */
+	const char *base = Buffer.data();
+	const char *p = (const char*) memchr (base + Scanned, '\n', Buffer.size() - Scanned);
+	if (!p) {
+		Scanned = Buffer.size();
+		if (Scanned - Consumed > MaxHeaderSize)
+			_Fail ("line too long in chunked body");
+		return false;
+	}
+
+	*line = base + Consumed;
+	*length = p - *line;
+	if ((*length > 0) && ((*line)[*length - 1] == '\r'))
+		(*length)--;
+
+	Consumed = Scanned = (p - base) + 1;
+	return true;
+}
+
+
+/************************
+HttpParser_t::_ParseHead
+************************/
+
+void HttpParser_t::_ParseHead (size_t end)
+{
+	HeaderBlock.assign (Buffer.data() + Consumed, end - Consumed);
+	Consumed = Scanned = end;
+
+	Headers.clear();
+	if (Body.capacity() > 64 * 1024)
+		std::string().swap (Body);
+	else
+		Body.clear();
+	BodyData = NULL;
+	BodyLength = 0;
+	Remaining = 0;
+
+	const char *base = HeaderBlock.data();
+	const size_t size = HeaderBlock.size();
+	size_t pos = 0;
+	bool status_line = true;
+
+	while (pos < size) {
+		// The block always ends in a line break, so this always finds one.
+		const char *p = (const char*) memchr (base + pos, '\n', size - pos);
+		size_t eol = p - base;
+		size_t length = eol - pos;
+		if ((length > 0) && (base[pos + length - 1] == '\r'))
+			length--;
+		if (length == 0)
+			break;
+
+		if (status_line)
+			_ParseStatusLine (base + pos, length);
+		else
+			_ParseHeaderLine (base + pos, length);
+
+		status_line = false;
+		pos = eol + 1;
+	}
+}
+
+
+/******************************
+HttpParser_t::_ParseStatusLine
+******************************/
+
+void HttpParser_t::_ParseStatusLine (const char *line, size_t length)
+{
+	// HTTP/x.y SSS[ reason]
+	if ((length < 12) || memcmp (line, "HTTP/", 5) || !_IsDigit (line[5]) || (line[6] != '.') || !_IsDigit (line[7]) ||
+			(line[8] != ' ') || !_IsDigit (line[9]) || !_IsDigit (line[10]) || !_IsDigit (line[11]) ||
+			((length > 12) && (line[12] != ' ')))
+		_Fail ("malformed status line");
+
+	MajorVersion = line[5] - '0';
+	MinorVersion = line[7] - '0';
+	Status = (line[9] - '0') * 100 + (line[10] - '0') * 10 + (line[11] - '0');
+
+	Reason = (line - HeaderBlock.data()) + (length > 12 ? 13 : 12);
+	ReasonLength = length > 12 ? length - 13 : 0;
+}
+
+
+/******************************
+HttpParser_t::_ParseHeaderLine
+******************************/
+
+void HttpParser_t::_ParseHeaderLine (const char *line, size_t length)
+{
+	if (_IsBlank (line[0]))
+		_Fail ("obsolete line folding in header");
+
+	const char *colon = (const char*) memchr (line, ':', length);
+	if (!colon || (colon == line) || _IsBlank (colon[-1]))
+		_Fail ("malformed header line");
+
+	const char *value = colon + 1;
+	const char *end = line + length;
+	while ((value < end) && _IsBlank (*value))
+		value++;
+	while ((end > value) && _IsBlank (end[-1]))
+		end--;
+
+	HttpHeader_t h;
+	h.Name = line - HeaderBlock.data();
+	h.NameLength = colon - line;
+	h.Value = value - HeaderBlock.data();
+	h.ValueLength = end - value;
+	Headers.push_back (h);
+}
+
+
+/************************
+HttpParser_t::_StartBody
+************************/
+
+void HttpParser_t::_StartBody()
+{
+	/* Works out from the status, the request and the headers how the body
+	 * is delimited (RFC 7230 3.3.3), and whether the connection stays open
+	 * after this response.
+	 */
+	bool head = false;
+	if (!HeadRequests.empty()) {
+		head = HeadRequests.front();
+		HeadRequests.pop_front();
+	}
+
+	bool transfer_encoding = false;
+	bool chunked = false;
+	bool has_content_length = false;
+	uint64_t content_length = 0;
+	bool close = false;
+	bool keep_alive = false;
+
+	const char *base = HeaderBlock.data();
+	for (size_t i = 0; i < Headers.size(); i++) {
+		const char *name = base + Headers[i].Name;
+		const char *value = base + Headers[i].Value;
+		const size_t name_length = Headers[i].NameLength;
+		const size_t value_length = Headers[i].ValueLength;
+
+		if (_EqualsIgnoringCase (name, name_length, "content-length")) {
+			uint64_t n = 0;
+			if (value_length == 0)
+				_Fail ("malformed content-length");
+			for (size_t j = 0; j < value_length; j++) {
+				if (!_IsDigit (value[j]) || (n > ((uint64_t)1 << 56)))
+					_Fail ("malformed content-length");
+				n = (n * 10) + (value[j] - '0');
+			}
+			if (has_content_length && (n != content_length))
+				_Fail ("conflicting content-length headers");
+			has_content_length = true;
+			content_length = n;
+		}
+		else if (_EqualsIgnoringCase (name, name_length, "transfer-encoding")) {
+			transfer_encoding = true;
+			chunked = _HasToken (value, value_length, "chunked", true);
+		}
+		else if (_EqualsIgnoringCase (name, name_length, "connection")) {
+			close = close || _HasToken (value, value_length, "close", false);
+			keep_alive = keep_alive || _HasToken (value, value_length, "keep-alive", false);
+		}
+	}
+
+	if ((MajorVersion > 1) || ((MajorVersion == 1) && (MinorVersion >= 1)))
+		bKeepAlive = !close;
+	else
+		bKeepAlive = keep_alive && !close;
+
+	if (head || (Status == 101) || (Status == 204) || (Status == 304))
+		State = ParseHead;
+	else if (transfer_encoding) {
+		// A transfer coding other than chunked can only end at end-of-stream.
+		State = chunked ? ParseChunkSize : ParseBodyEof;
+	}
+	else if (has_content_length) {
+		Remaining = content_length;
+		State = content_length ? ParseBodyLength : ParseHead;
+	}
+	else
+		State = ParseBodyEof;
+
+	if (State == ParseBodyEof)
+		bKeepAlive = false;
+}
+
+
+/***********************
+HttpParser_t::_Complete
+***********************/
+
+bool HttpParser_t::_Complete()
+{
+	if (!BodyData) {
+		BodyData = Body.data();
+		BodyLength = Body.size();
+	}
+	return true;
+}
+
+
+/**********************
+HttpParser_t::_Compact
+**********************/
+
+void HttpParser_t::_Compact()
+{
+	if (Consumed == 0)
+		return;
+
+	if (Consumed == Buffer.size()) {
+		// Don't hang on to the memory of an unusually large response.
+		if (Buffer.capacity() > 64 * 1024)
+			std::string().swap (Buffer);
+		else
+			Buffer.clear();
+	}
+	else
+		Buffer.erase (0, Consumed);
+
+	Scanned -= Consumed;
+	Consumed = 0;
+}
+
+
+/*******************
+HttpParser_t::_Fail
+*******************/
+
+void HttpParser_t::_Fail (const char *reason)
+{
+	State = ParseFailed;
+	Error = reason;
+	throw std::runtime_error (Error);
+}
@@ -0,0 +1,134 @@
+/*****************************************************************************
+
+$Id$
+
+File:     httpparser.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#ifndef __HttpParser__H_
+#define __HttpParser__H_
+
+
+/*******************
+struct HttpHeader_t
+*******************/
+
+struct HttpHeader_t
+{
+	// Offsets into the parser's header block.
+	size_t Name;
+	size_t NameLength;
+	size_t Value;
+	size_t ValueLength;
+};
+
+
+/******************
+class HttpParser_t
+******************/
+
+class HttpParser_t
+{
+	/* Incremental HTTP/1.x response parser. Bytes are fed in with Append
+	 * as they come off the wire, and Next returns true each time a complete
+	 * response is available, which may be several times per Append when
+	 * responses are pipelined. Parsing resumes where it left off, so a
+	 * response that trickles in is scanned once, not once per Append.
+	 *
+	 * Status line, headers and body of the current response are read with
+	 * the accessors below; they stay valid until the next call to Append,
+	 * Next, Finish or Clear. Protocol errors throw std::runtime_error, after
+	 * which the parser stays failed until Clear.
+	 */
+
+	public:
+		HttpParser_t (size_t max_header_size);
+		virtual ~HttpParser_t();
+
+		enum { DefaultMaxHeaderSize = 80 * 1024 };
+
+		void ExpectResponse (bool head);
+		void Append (const char *data, size_t length);
+		bool Next();
+		bool Finish();
+		void Clear();
+
+		size_t GetBufferedSize() { return Buffer.size() - Consumed; }
+		size_t GetMemorySize() { return Buffer.capacity() + HeaderBlock.capacity() + Body.capacity(); }
+
+		int GetMajorVersion() { return MajorVersion; }
+		int GetMinorVersion() { return MinorVersion; }
+		int GetStatus() { return Status; }
+		void GetReason (const char **reason, size_t *length);
+		size_t GetHeaderCount() { return Headers.size(); }
+		void GetHeader (size_t index, const char **name, size_t *name_length, const char **value, size_t *value_length);
+		void GetBody (const char **body, size_t *length);
+		bool IsKeepAlive() { return bKeepAlive; }
+
+	private:
+		enum ParseState {
+			ParseHead,
+			ParseBodyLength,
+			ParseBodyEof,
+			ParseChunkSize,
+			ParseChunkData,
+			ParseChunkEnd,
+			ParseTrailer,
+			ParseFailed
+		};
+
+		bool _Parse();
+		bool _FindHeadEnd (size_t *end);
+		bool _NextLine (const char **line, size_t *length);
+		void _ParseHead (size_t end);
+		void _ParseStatusLine (const char *line, size_t length);
+		void _ParseHeaderLine (const char *line, size_t length);
+		void _StartBody();
+		bool _Complete();
+		void _Compact();
+		void _Fail (const char *reason);
+
+		size_t MaxHeaderSize;
+		std::deque<bool> HeadRequests;
+
+		// Bytes before Consumed belong to responses already handed out.
+		// Bytes between Consumed and Scanned are known not to end the
+		// header block or line that is being looked for.
+		std::string Buffer;
+		size_t Consumed;
+		size_t Scanned;
+		ParseState State;
+		std::string Error;
+
+		// The current response. Its header block is copied out of Buffer
+		// so that the body can be consumed independently of it.
+		std::string HeaderBlock;
+		std::vector<HttpHeader_t> Headers;
+		int MajorVersion;
+		int MinorVersion;
+		int Status;
+		size_t Reason;
+		size_t ReasonLength;
+		bool bKeepAlive;
+		uint64_t Remaining;
+
+		std::string Body;
+		const char *BodyData;
+		size_t BodyLength;
+};
+
+
+#endif // __HttpParser__H_
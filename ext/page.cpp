@@ -86,6 +86,19 @@ bool PageList::HasPages()
 }
 
 
+/*****************
+PageList::GetSize
+*****************/
+
+size_t PageList::GetSize()
+{
+	size_t size = 0;
+	for (size_t i = 0; i < Pages.size(); i++)
+		size += Pages[i].Size;
+	return size;
+}
+
+
 /**************
 PageList::Push
 **************/
@@ -102,6 +115,22 @@ void PageList::Push (const char *buf, int size)
 }
 
 
+/*******************
+PageList::PushFront
+*******************/
+
+void PageList::PushFront (const char *buf, int size)
+{
+	if (buf && (size > 0)) {
+		char *copy = (char*) malloc (size);
+		if (!copy)
+			throw std::runtime_error ("no memory in pagelist");
+		memcpy (copy, buf, size);
+		Pages.push_front (Page (copy, size));
+	}
+}
+
+
 
 
 
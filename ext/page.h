@@ -39,13 +39,96 @@ class PageList
 		virtual ~PageList();
 
 		void Push (const char*, int);
+		void PushFront (const char*, int);
 		bool HasPages();
 		void Front (const char**, int*);
 		void PopFront();
+		size_t GetSize();
 
 	private:
 		std::deque<Page> Pages;
 };
 
 
+/*****************
+class PageQueue_t
+*****************/
+
+template <class T>
+class PageQueue_t
+{
+	/* The outbound pages of a descriptor, as a ring that doubles when it
+	 * fills up. std::deque allocates over half a kilobyte as soon as it's
+	 * constructed, which every idle connection paid for; this allocates
+	 * nothing until the first page is pushed, and hands back anything
+	 * bigger than MinCapacity once it drains. The pages are plain structs,
+	 * copied with memcpy.
+	 */
+	public:
+		PageQueue_t(): Items(NULL), Capacity(0), Head(0), Count(0) {}
+		~PageQueue_t() { free (Items); }
+
+		size_t size() const { return Count; }
+		bool empty() const { return (Count == 0); }
+		T &front() { return Items [Head]; }
+		T &operator[] (size_t i) { return Items [(Head + i) & (Capacity - 1)]; }
+
+		void push_back (const T &page)
+		{
+			_Grow();
+			memcpy (&Items [(Head + Count) & (Capacity - 1)], &page, sizeof(T));
+			Count++;
+		}
+
+		void push_front (const T &page)
+		{
+			_Grow();
+			Head = (Head + Capacity - 1) & (Capacity - 1);
+			memcpy (&Items [Head], &page, sizeof(T));
+			Count++;
+		}
+
+		void pop_front()
+		{
+			assert (Count > 0);
+			Head = (Head + 1) & (Capacity - 1);
+			if (--Count == 0) {
+				Head = 0;
+				if (Capacity > MinCapacity) {
+					free (Items);
+					Items = NULL;
+					Capacity = 0;
+				}
+			}
+		}
+
+	private:
+		PageQueue_t (const PageQueue_t&);
+		PageQueue_t &operator= (const PageQueue_t&);
+
+		void _Grow()
+		{
+			if (Count < Capacity)
+				return;
+			size_t capacity = Capacity ? (Capacity * 2) : MinCapacity;
+			T *items = (T*) malloc (capacity * sizeof(T));
+			if (!items)
+				throw std::runtime_error ("no memory for outbound pages");
+			for (size_t i = 0; i < Count; i++)
+				memcpy (&items [i], &(*this)[i], sizeof(T));
+			free (Items);
+			Items = items;
+			Capacity = capacity;
+			Head = 0;
+		}
+
+		enum { MinCapacity = 4 };
+
+		T *Items;
+		size_t Capacity;
+		size_t Head;
+		size_t Count;
+};
+
+
 #endif // __PageManager__H_
@@ -30,6 +30,7 @@ See the file COPYING for complete licensing information.
 #include <string>
 #include <sstream>
 #include <stdexcept>
+#include <algorithm>
 
 
 #ifdef OS_UNIX
@@ -52,6 +53,7 @@ See the file COPYING for complete licensing information.
 #include <arpa/inet.h>
 #include <pwd.h>
 #include <string.h>
+#include <pthread.h>
 typedef int SOCKET;
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR -1
@@ -118,6 +120,12 @@ typedef int SOCKET;
 #ifdef WITH_SSL
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 #endif
 
 #ifdef HAVE_EPOLL
@@ -165,10 +173,17 @@ extern "C" {
 #endif
 
 #include "binder.h"
+#include "page.h"
 #include "em.h"
 #include "ed.h"
-#include "page.h"
+#include "tokenizer.h"
+#include "framer.h"
+#include "httpparser.h"
 #include "ssl.h"
+#include "resolver.h"
+#include "connpool.h"
+#include "reconnect.h"
+#include "ratelimit.h"
 #include "eventmachine.h"
 
 #endif // __Project__H_
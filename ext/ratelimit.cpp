@@ -0,0 +1,63 @@
+/*****************************************************************************
+
+$Id$
+
+File:     ratelimit.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+
+#include "project.h"
+
+
+/****************************
+TokenBucket_t::TokenBucket_t
+****************************/
+
+TokenBucket_t::TokenBucket_t (uint64_t rate, uint64_t burst, uint64_t now):
+	Rate ((double) rate),
+	Burst ((double) (burst ? burst : rate)),
+	LastRefill (now)
+{
+	Tokens = Burst;
+}
+
+
+/*********************
+TokenBucket_t::Refill
+*********************/
+
+void TokenBucket_t::Refill (uint64_t now)
+{
+	if (now <= LastRefill)
+		return;
+	Tokens += Rate * (now - LastRefill) / 1000000;
+	if (Tokens > Burst)
+		Tokens = Burst;
+	LastRefill = now;
+}
+
+
+/************************
+TokenBucket_t::GetBudget
+************************/
+
+size_t TokenBucket_t::GetBudget (size_t want)
+{
+	// Whole bytes only; none at all while in debt.
+	if (Tokens < 1)
+		return 0;
+	return (Tokens < want) ? (size_t) Tokens : want;
+}
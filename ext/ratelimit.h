@@ -0,0 +1,71 @@
+/*****************************************************************************
+
+$Id$
+
+File:     ratelimit.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+
+#ifndef __RateLimit__H_
+#define __RateLimit__H_
+
+
+/*******************
+struct RateLimits_t
+*******************/
+
+struct RateLimits_t
+{
+	RateLimits_t(): ReadRate (0), WriteRate (0), Burst (0) {}
+
+	// Bytes a second, zero for no limit.
+	uint64_t ReadRate;
+	uint64_t WriteRate;
+	// Bytes that can go at once after a quiet spell. Zero is a second's worth.
+	uint64_t Burst;
+};
+
+
+/*******************
+class TokenBucket_t
+*******************/
+
+class TokenBucket_t
+{
+	/* Rate bytes a second, in a bucket that holds Burst of them. A read
+	 * or write takes what it moved out of the bucket, and may leave it in
+	 * debt when it couldn't be cut short (a whole TLS record, say); the
+	 * debt is paid off before anything more goes. Refilled from the time
+	 * that's passed whenever it's looked at.
+	 */
+
+	public:
+		TokenBucket_t (uint64_t rate, uint64_t burst, uint64_t now);
+
+		void Refill (uint64_t now);
+		size_t GetBudget (size_t want);
+		void Spend (size_t n) { Tokens -= n; }
+		bool IsEmpty() { return Tokens < 1; }
+
+	private:
+		double Rate;
+		double Burst;
+		double Tokens;
+		uint64_t LastRefill;
+};
+
+
+#endif // __RateLimit__H_
@@ -0,0 +1,111 @@
+/*****************************************************************************
+
+$Id$
+
+File:     reconnect.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#include "project.h"
+
+
+ReconnectPolicy_t CircuitBreakers_t::Policy;
+
+// xorshift64*, seeded on first use. Only the reactor thread draws from it.
+static uint64_t JitterState = 0;
+
+static double jitter_random()
+{
+	if (!JitterState) {
+		struct timeval tv;
+		gettimeofday (&tv, NULL);
+		JitterState = ((uint64_t)tv.tv_sec << 20) ^ (uint64_t)tv.tv_usec ^ ((uint64_t)getpid() << 40) ^ (uint64_t)(uintptr_t)&tv;
+		if (!JitterState)
+			JitterState = 1;
+	}
+	JitterState ^= JitterState >> 12;
+	JitterState ^= JitterState << 25;
+	JitterState ^= JitterState >> 27;
+	return (double)((JitterState * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+
+/***************************
+CircuitBreakers_t::GetDelay
+***************************/
+
+uint64_t CircuitBreakers_t::GetDelay (int attempt)
+{
+	/* BaseDelay doubled for each attempt already made, up to MaxDelay,
+	 * less a random part of it so that clients which lost the same server
+	 * at the same moment don't all come back to it at the same moment.
+	 * With Jitter at 1 the whole delay is random ("full jitter").
+	 */
+	uint64_t delay = Policy.BaseDelay;
+	for (int i = 0; (i < attempt) && (delay < Policy.MaxDelay); i++)
+		delay *= 2;
+	if (delay > Policy.MaxDelay)
+		delay = Policy.MaxDelay;
+
+	if (Policy.Jitter > 0)
+		delay -= (uint64_t)(delay * Policy.Jitter * jitter_random());
+	return delay;
+}
+
+
+/*************************
+CircuitBreakers_t::Allows
+*************************/
+
+bool CircuitBreakers_t::Allows (const std::string &target, uint64_t now, int *error)
+{
+	if (!Policy.BreakerThreshold)
+		return true;
+
+	std::map<std::string, Breaker_t>::iterator i = Breakers.find (target);
+	if ((i == Breakers.end()) || (i->second.Failures < Policy.BreakerThreshold))
+		return true;
+
+	Breaker_t &b = i->second;
+	if (now < b.OpenUntil) {
+		*error = b.Error;
+		return false;
+	}
+
+	// The trial. Everything else fails fast until it reports, or times out.
+	b.OpenUntil = now + Policy.BreakerTimeout;
+	return true;
+}
+
+
+/*************************
+CircuitBreakers_t::Report
+*************************/
+
+void CircuitBreakers_t::Report (const std::string &target, uint64_t now, bool ok, int error)
+{
+	if (ok) {
+		Breakers.erase (target);
+		return;
+	}
+	if (!Policy.BreakerThreshold)
+		return;
+
+	Breaker_t &b = Breakers[target];
+	b.Failures++;
+	b.Error = error;
+	if (b.Failures >= Policy.BreakerThreshold)
+		b.OpenUntil = now + Policy.BreakerTimeout;
+}
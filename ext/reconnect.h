@@ -0,0 +1,81 @@
+/*****************************************************************************
+
+$Id$
+
+File:     reconnect.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#ifndef __Reconnect__H_
+#define __Reconnect__H_
+
+
+/************************
+struct ReconnectPolicy_t
+************************/
+
+struct ReconnectPolicy_t
+{
+	ReconnectPolicy_t(): BaseDelay (100000), MaxDelay (30000000), Jitter (1.0), MaxAttempts (0), BreakerThreshold (0), BreakerTimeout (30000000) {}
+
+	// Microseconds. The delay doubles with each attempt, up to MaxDelay.
+	uint64_t BaseDelay;
+	uint64_t MaxDelay;
+	// How much of the delay may be taken off at random, from 0 to 1.
+	double Jitter;
+	// Zero for no limit.
+	int MaxAttempts;
+	// Failed connects in a row that open a server's breaker, zero for none.
+	int BreakerThreshold;
+	uint64_t BreakerTimeout;
+};
+
+
+/***********************
+class CircuitBreakers_t
+***********************/
+
+class CircuitBreakers_t
+{
+	/* How outbound connections made with a reconnect policy back off, and
+	 * which servers they've stopped trying. Every connect to a server,
+	 * keyed by host and port, reports how it went. BreakerThreshold
+	 * failures in a row open the server's breaker: for BreakerTimeout,
+	 * connects to it fail at once with the last error, without trying.
+	 * Then one connect is let through as a trial. If it succeeds the
+	 * breaker closes, and if it fails it opens again. A trial that never
+	 * reports back is given up on after another BreakerTimeout.
+	 */
+
+	public:
+		static ReconnectPolicy_t Policy;
+		static uint64_t GetDelay (int attempt);
+
+		bool Allows (const std::string &target, uint64_t now, int *error);
+		void Report (const std::string &target, uint64_t now, bool ok, int error);
+
+	private:
+		struct Breaker_t {
+			Breaker_t(): Failures(0), Error(0), OpenUntil(0) {}
+			int Failures;
+			int Error;
+			uint64_t OpenUntil;
+		};
+
+		std::map<std::string, Breaker_t> Breakers;
+};
+
+
+#endif // __Reconnect__H_
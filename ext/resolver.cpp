@@ -0,0 +1,410 @@
+/*****************************************************************************
+
+$Id$
+
+File:     resolver.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#include "project.h"
+
+
+#ifdef OS_UNIX
+
+/******************************
+ResolverPool_t::ResolverPool_t
+******************************/
+
+ResolverPool_t::ResolverPool_t (EventMachine_t *em, int threads):
+	MyEventMachine (em),
+	Running (0),
+	bStopping (false)
+{
+	pthread_mutex_init (&Lock, NULL);
+	pthread_cond_init (&JobReady, NULL);
+
+	pthread_mutex_lock (&Lock);
+	for (int i = 0; i < threads; i++) {
+		pthread_t thread;
+		if (pthread_create (&thread, NULL, _Run, this) != 0)
+			break;
+		pthread_detach (thread);
+		Running++;
+	}
+	bool started = (Running > 0);
+	pthread_mutex_unlock (&Lock);
+
+	if (!started) {
+		pthread_cond_destroy (&JobReady);
+		pthread_mutex_destroy (&Lock);
+		throw std::runtime_error ("unable to start resolver threads");
+	}
+}
+
+
+/*******************************
+ResolverPool_t::~ResolverPool_t
+*******************************/
+
+ResolverPool_t::~ResolverPool_t()
+{
+	pthread_cond_destroy (&JobReady);
+	pthread_mutex_destroy (&Lock);
+}
+
+
+/**********************
+ResolverPool_t::Submit
+**********************/
+
+void ResolverPool_t::Submit (const uintptr_t binding, const char *server, int port, const char *bind_addr, int bind_port)
+{
+	Job_t job;
+	job.Binding = binding;
+	job.Server = server;
+	job.Port = port;
+	job.bBind = (bind_addr != NULL);
+	job.BindAddr = bind_addr ? bind_addr : "";
+	job.BindPort = bind_port;
+
+	pthread_mutex_lock (&Lock);
+	Queued.push_back (job);
+	pthread_cond_signal (&JobReady);
+	pthread_mutex_unlock (&Lock);
+}
+
+
+/******************************
+ResolverPool_t::RunCompletions
+******************************/
+
+void ResolverPool_t::RunCompletions()
+{
+	std::deque<Result_t> finished;
+
+	pthread_mutex_lock (&Lock);
+	finished.swap (Finished);
+	pthread_mutex_unlock (&Lock);
+
+	for (size_t i = 0; i < finished.size(); i++) {
+		Result_t &r = finished[i];
+		MyEventMachine->ConnectResolved (r.Binding, r.Error, r.Addrs, (struct sockaddr *)&r.BindTo, r.BindToLen);
+	}
+}
+
+
+/********************
+ResolverPool_t::Stop
+********************/
+
+void ResolverPool_t::Stop()
+{
+	// Lookups still queued are dropped, and those under way are thrown away.
+	pthread_mutex_lock (&Lock);
+	bStopping = true;
+	Queued.clear();
+	pthread_cond_broadcast (&JobReady);
+	pthread_mutex_unlock (&Lock);
+}
+
+
+/********************
+ResolverPool_t::_Run
+********************/
+
+void *ResolverPool_t::_Run (void *arg)
+{
+	ResolverPool_t *pool = (ResolverPool_t*) arg;
+
+	pthread_mutex_lock (&pool->Lock);
+	while (true) {
+		while (!pool->bStopping && pool->Queued.empty())
+			pthread_cond_wait (&pool->JobReady, &pool->Lock);
+		if (pool->bStopping)
+			break;
+
+		Job_t job = pool->Queued.front();
+		pool->Queued.pop_front();
+		pthread_mutex_unlock (&pool->Lock);
+
+		Result_t result;
+		result.Binding = job.Binding;
+		result.Error = 0;
+		memset (&result.BindTo, 0, sizeof(result.BindTo));
+		result.BindToLen = 0;
+		int gai = EventMachine_t::name2addresses (job.Server.c_str(), job.Port, SOCK_STREAM, result.Addrs);
+		if (gai != 0)
+			result.Error = (gai == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+		else if (job.bBind) {
+			result.BindToLen = sizeof(result.BindTo);
+			if (EventMachine_t::name2address (job.BindAddr.c_str(), job.BindPort, SOCK_STREAM, (struct sockaddr *)&result.BindTo, &result.BindToLen) != 0)
+				result.Error = EADDRNOTAVAIL;
+		}
+
+		pthread_mutex_lock (&pool->Lock);
+		if (pool->bStopping)
+			break;
+		pool->Finished.push_back (result);
+		pool->MyEventMachine->SignalLoopBreaker();
+	}
+
+	bool last = (--pool->Running == 0);
+	pthread_mutex_unlock (&pool->Lock);
+	if (last)
+		delete pool;
+
+	return NULL;
+}
+
+
+
+/*******************
+DnsCache_t statics
+*******************/
+
+uint64_t DnsCache_t::Ttl = 0;
+uint64_t DnsCache_t::NegativeTtl = 0;
+std::map<std::string, DnsCache_t::Entry_t> DnsCache_t::Entries;
+DnsCacheStats_t DnsCache_t::Stats = { 0, 0, 0, 0, 0 };
+pthread_mutex_t DnsCache_t::Lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t DnsCache_t::Stored = PTHREAD_COND_INITIALIZER;
+
+
+/****************
+DnsCache_t::_Now
+****************/
+
+uint64_t DnsCache_t::_Now()
+{
+	// Microseconds, from a clock that only goes forward.
+	struct timespec tv;
+	clock_gettime (CLOCK_MONOTONIC, &tv);
+	return (((uint64_t)(tv.tv_sec)) * 1000000LL) + ((uint64_t)((tv.tv_nsec) / 1000));
+}
+
+
+/******************
+DnsCache_t::SetTtl
+******************/
+
+void DnsCache_t::SetTtl (uint64_t ttl)
+{
+	Ttl = ttl;
+	if (ttl == 0)
+		Flush();
+}
+
+
+/*******************
+DnsCache_t::Acquire
+*******************/
+
+bool DnsCache_t::Acquire (const std::string &host, int *gai, std::vector<struct sockaddr_storage> &addrs)
+{
+	/* Returns true with the cached addresses for host, or the error
+	 * that it doesn't exist. Otherwise marks host pending, and the caller
+	 * looks it up and Stores the answer.
+	 */
+	bool waited = false;
+
+	pthread_mutex_lock (&Lock);
+	while (true) {
+		std::map<std::string, Entry_t>::iterator it = Entries.find (host);
+		if (it == Entries.end())
+			break;
+		if (it->second.bPending) {
+			if (!waited)
+				Stats.Coalesced++;
+			waited = true;
+			pthread_cond_wait (&Stored, &Lock);
+			continue;
+		}
+		if (it->second.Expires <= _Now())
+			break;
+
+		if (it->second.Error) {
+			Stats.NegativeHits++;
+			*gai = it->second.Error;
+		}
+		else {
+			Stats.Hits++;
+			addrs = it->second.Addrs;
+			*gai = 0;
+		}
+		pthread_mutex_unlock (&Lock);
+		return true;
+	}
+
+	uint64_t now = _Now();
+	if (Entries.find (host) == Entries.end())
+		_MakeRoom (now);
+	Entry_t &entry = Entries [host];
+	entry.Addrs.clear();
+	entry.Error = 0;
+	entry.Expires = 0;
+	entry.bPending = true;
+	Stats.Misses++;
+	pthread_mutex_unlock (&Lock);
+	return false;
+}
+
+
+/*****************
+DnsCache_t::Store
+*****************/
+
+void DnsCache_t::Store (const std::string &host, int gai, const struct addrinfo *ai)
+{
+	pthread_mutex_lock (&Lock);
+	std::map<std::string, Entry_t>::iterator it = Entries.find (host);
+	if (it != Entries.end()) {
+		Entry_t &entry = it->second;
+		entry.bPending = false;
+		if ((gai == 0) && (Ttl > 0)) {
+			for (; ai; ai = ai->ai_next) {
+				struct sockaddr_storage ss;
+				memset (&ss, 0, sizeof(ss));
+				memcpy (&ss, ai->ai_addr, ai->ai_addrlen);
+				entry.Addrs.push_back (ss);
+			}
+			entry.Expires = _Now() + Ttl;
+		}
+		else if ((gai == EAI_NONAME) && (Ttl > 0) && (NegativeTtl > 0)) {
+			entry.Error = gai;
+			entry.Expires = _Now() + NegativeTtl;
+		}
+		if (entry.Expires == 0)
+			Entries.erase (it);
+	}
+	pthread_cond_broadcast (&Stored);
+	pthread_mutex_unlock (&Lock);
+}
+
+
+/****************
+DnsCache_t::Peek
+****************/
+
+int DnsCache_t::Peek (const std::string &host, std::vector<struct sockaddr_storage> &addrs)
+{
+	// Returns how many addresses host has, 0 if it doesn't exist, or -1 if
+	// we don't know.
+	int count = -1;
+
+	pthread_mutex_lock (&Lock);
+	std::map<std::string, Entry_t>::iterator it = Entries.find (host);
+	if ((it != Entries.end()) && !it->second.bPending && (it->second.Expires > _Now())) {
+		if (it->second.Error)
+			Stats.NegativeHits++;
+		else
+			Stats.Hits++;
+		addrs = it->second.Addrs;
+		count = addrs.size();
+	}
+	else
+		Stats.Misses++;
+	pthread_mutex_unlock (&Lock);
+
+	return count;
+}
+
+
+/******************
+DnsCache_t::Insert
+******************/
+
+void DnsCache_t::Insert (const std::string &host, const std::vector<struct sockaddr_storage> &addrs, uint64_t ttl)
+{
+	// No addresses means the name doesn't exist.
+	if ((Ttl == 0) || (ttl == 0))
+		return;
+
+	pthread_mutex_lock (&Lock);
+	std::map<std::string, Entry_t>::iterator it = Entries.find (host);
+	if ((it == Entries.end()) || !it->second.bPending) {
+		uint64_t now = _Now();
+		if (it == Entries.end())
+			_MakeRoom (now);
+		Entry_t &entry = Entries [host];
+		entry.Addrs = addrs;
+		entry.Error = addrs.empty() ? EAI_NONAME : 0;
+		entry.Expires = now + ttl;
+		entry.bPending = false;
+	}
+	pthread_mutex_unlock (&Lock);
+}
+
+
+/*********************
+DnsCache_t::_MakeRoom
+*********************/
+
+void DnsCache_t::_MakeRoom (uint64_t now)
+{
+	// Called with the lock held, before adding an entry.
+	if (Entries.size() < MaxEntries)
+		return;
+
+	std::map<std::string, Entry_t>::iterator it = Entries.begin();
+	while (it != Entries.end()) {
+		if (!it->second.bPending && (it->second.Expires <= now))
+			Entries.erase (it++);
+		else
+			++it;
+	}
+
+	// Then any that aren't being looked up, if that wasn't enough.
+	it = Entries.begin();
+	while ((Entries.size() >= MaxEntries) && (it != Entries.end())) {
+		if (!it->second.bPending)
+			Entries.erase (it++);
+		else
+			++it;
+	}
+}
+
+
+/********************
+DnsCache_t::GetStats
+********************/
+
+void DnsCache_t::GetStats (DnsCacheStats_t *stats)
+{
+	pthread_mutex_lock (&Lock);
+	*stats = Stats;
+	stats->Size = Entries.size();
+	pthread_mutex_unlock (&Lock);
+}
+
+
+/*****************
+DnsCache_t::Flush
+*****************/
+
+void DnsCache_t::Flush()
+{
+	// Lookups under way still Store their answers.
+	pthread_mutex_lock (&Lock);
+	std::map<std::string, Entry_t>::iterator it = Entries.begin();
+	while (it != Entries.end()) {
+		if (!it->second.bPending)
+			Entries.erase (it++);
+		else
+			++it;
+	}
+	pthread_mutex_unlock (&Lock);
+}
+
+#endif // OS_UNIX
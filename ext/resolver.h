@@ -0,0 +1,159 @@
+/*****************************************************************************
+
+$Id$
+
+File:     resolver.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#ifndef __Resolver__H_
+#define __Resolver__H_
+
+
+/********************
+class ResolverPool_t
+********************/
+
+#ifdef OS_UNIX
+class ResolverPool_t
+{
+	/* Worker threads that look up the host names outbound connections are
+	 * made to, so that a slow name server doesn't hold up the reactor.
+	 * ConnectToServer Submits the names with the binding of a connection
+	 * that waits in the resolving state, and RunCompletions (on the
+	 * reactor, after the loop breaker fires) hands each answer to
+	 * EventMachine_t::ConnectResolved. A connection that closes meanwhile,
+	 * say because its pending-connect timeout went by, is simply not found.
+	 *
+	 * A lookup can take as long as the resolver's own timeouts, so the
+	 * threads aren't waited for when the reactor goes away. Stop detaches
+	 * the pool from it instead, and the last thread out deletes it.
+	 */
+
+	public:
+		ResolverPool_t (EventMachine_t*, int threads);
+
+		void Submit (const uintptr_t binding, const char *server, int port, const char *bind_addr, int bind_port);
+		void RunCompletions();
+		void Stop();
+
+	private:
+		virtual ~ResolverPool_t();
+		static void *_Run (void*);
+
+		struct Job_t {
+			uintptr_t Binding;
+			std::string Server;
+			int Port;
+			bool bBind;
+			std::string BindAddr;
+			int BindPort;
+		};
+
+		struct Result_t {
+			uintptr_t Binding;
+			int Error;
+			std::vector<struct sockaddr_storage> Addrs;
+			struct sockaddr_storage BindTo;
+			size_t BindToLen;
+		};
+
+		EventMachine_t *MyEventMachine;
+		pthread_mutex_t Lock;
+		pthread_cond_t JobReady;
+		int Running;
+		bool bStopping;
+
+		std::deque<Job_t> Queued;
+		std::deque<Result_t> Finished;
+};
+#endif
+
+
+/*********************
+struct DnsCacheStats_t
+*********************/
+
+struct DnsCacheStats_t
+{
+	uint64_t Hits;
+	uint64_t NegativeHits;
+	uint64_t Misses;
+	// Lookups that waited for the same name's lookup on another thread.
+	uint64_t Coalesced;
+	uint64_t Size;
+};
+
+
+/*****************
+class DnsCache_t
+*****************/
+
+#ifdef OS_UNIX
+class DnsCache_t
+{
+	/* The addresses host names were last found to have, shared by every
+	 * reactor, the resolver threads and EM::DNS::Resolver. getaddrinfo
+	 * doesn't say how long its answers are good for, so name2address keeps
+	 * them for Ttl; EM::DNS::Resolver gives the TTLs of the records it got.
+	 * Names that don't exist are kept for NegativeTtl, and failures that may
+	 * pass, like a name server timing out, not at all. A Ttl of zero turns
+	 * the cache off.
+	 *
+	 * A name being looked up is marked pending, and other threads that want
+	 * it wait for that lookup to Store its answer instead of making their
+	 * own.
+	 */
+
+	public:
+		static uint64_t GetTtl() { return Ttl; }
+		static void SetTtl (uint64_t);
+		static uint64_t GetNegativeTtl() { return NegativeTtl; }
+		static void SetNegativeTtl (uint64_t ttl) { NegativeTtl = ttl; }
+
+		// For name2address, which Stores what it finds when this is false.
+		static bool Acquire (const std::string &host, int *gai, std::vector<struct sockaddr_storage> &addrs);
+		static void Store (const std::string &host, int gai, const struct addrinfo *ai);
+
+		// For EM::DNS::Resolver, on the reactor thread, which never waits.
+		static int Peek (const std::string &host, std::vector<struct sockaddr_storage> &addrs);
+		static void Insert (const std::string &host, const std::vector<struct sockaddr_storage> &addrs, uint64_t ttl);
+
+		static void GetStats (DnsCacheStats_t*);
+		static void Flush();
+
+	private:
+		struct Entry_t {
+			std::vector<struct sockaddr_storage> Addrs;
+			int Error;
+			uint64_t Expires;
+			bool bPending;
+		};
+
+		static uint64_t _Now();
+		static void _MakeRoom (uint64_t now);
+
+		static uint64_t Ttl;
+		static uint64_t NegativeTtl;
+		static std::map<std::string, Entry_t> Entries;
+		static DnsCacheStats_t Stats;
+		static pthread_mutex_t Lock;
+		static pthread_cond_t Stored;
+		enum { MaxEntries = 4096 };
+};
+#endif
+
+
+#endif // __Resolver__H_
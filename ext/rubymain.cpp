@@ -20,6 +20,7 @@ See the file COPYING for complete licensing information.
 #include "project.h"
 #include "eventmachine.h"
 #include <ruby.h>
+#include <ruby/encoding.h>
 
 #ifndef RFLOAT_VALUE
 #define RFLOAT_VALUE(arg) RFLOAT(arg)->value
@@ -60,17 +61,23 @@ static VALUE EM_eConnectionNotBound;
 static VALUE EM_eUnsupported;
 static VALUE EM_eInvalidSignature;
 static VALUE EM_eInvalidPrivateKey;
+static VALUE EM_eHttpParseError;
+
+static VALUE EmHttpResponse;
 
 static VALUE Intern_at_signature;
 static VALUE Intern_at_timers;
 static VALUE Intern_at_conns;
 static VALUE Intern_at_error_handler;
+static VALUE Intern_at_encoding;
 static VALUE Intern_event_callback;
 static VALUE Intern_run_deferred_callbacks;
 static VALUE Intern_delete;
 static VALUE Intern_call;
 static VALUE Intern_at;
 static VALUE Intern_receive_data;
+static VALUE Intern_receive_line;
+static VALUE Intern_receive_frame;
 static VALUE Intern_ssl_handshake_completed;
 static VALUE Intern_ssl_verify_peer;
 static VALUE Intern_notify_readable;
@@ -97,6 +104,24 @@ static inline VALUE ensure_conn(const uintptr_t signature)
 }
 
 
+/***********
+shed_reason
+***********/
+
+static VALUE shed_reason (int reason)
+{
+	switch (reason) {
+		case EM_SHED_CONNECTIONS:
+			return ID2SYM (rb_intern ("connections"));
+		case EM_SHED_LOOP_LAG:
+			return ID2SYM (rb_intern ("loop_lag"));
+		case EM_SHED_OUTBOUND_BYTES:
+			return ID2SYM (rb_intern ("outbound_bytes"));
+	}
+	return Qnil;
+}
+
+
 /****************
 t_event_callback
 ****************/
@@ -117,6 +142,18 @@ static inline void event_callback (struct em_event* e)
 			rb_funcall (conn, Intern_receive_data, 1, rb_str_new (data_str, data_num));
 			return;
 		}
+		case EM_CONNECTION_LINE:
+		{
+			VALUE conn = ensure_conn(signature);
+			rb_funcall (conn, Intern_receive_line, 1, rb_str_new (data_str, data_num));
+			return;
+		}
+		case EM_CONNECTION_FRAME:
+		{
+			VALUE conn = ensure_conn(signature);
+			rb_funcall (conn, Intern_receive_frame, 1, rb_str_new (data_str, data_num));
+			return;
+		}
 		case EM_CONNECTION_ACCEPTED:
 		{
 			rb_funcall (EmModule, Intern_event_callback, 3, BSIG2NUM(signature), INT2FIX(event), ULONG2NUM(data_num));
@@ -127,6 +164,18 @@ static inline void event_callback (struct em_event* e)
 			rb_funcall (EmModule, Intern_event_callback, 3, BSIG2NUM(signature), INT2FIX(event), ULONG2NUM(data_num));
 			return;
 		}
+		case EM_CONNECTION_REBOUND:
+		case EM_CONNECTION_RECONNECTING:
+		{
+			rb_funcall (EmModule, Intern_event_callback, 3, BSIG2NUM(signature), INT2FIX(event), ULONG2NUM(data_num));
+			return;
+		}
+		case EM_SHEDDING_STARTED:
+		case EM_SHEDDING_STOPPED:
+		{
+			rb_funcall (EmModule, Intern_event_callback, 3, BSIG2NUM(signature), INT2FIX(event), shed_reason (data_num));
+			return;
+		}
 		case EM_CONNECTION_COMPLETED:
 		{
 			VALUE conn = ensure_conn(signature);
@@ -282,14 +331,118 @@ static VALUE t_add_oneshot_timer (VALUE self UNUSED, VALUE interval)
 t_start_server
 **************/
 
-static VALUE t_start_server (VALUE self UNUSED, VALUE server, VALUE port)
-{
-	const uintptr_t f = evma_create_tcp_server (StringValueCStr(server), FIX2INT(port));
+static VALUE listener_option (VALUE options, const char *name)
+{
+	return NIL_P(options) ? Qnil : rb_hash_aref (options, ID2SYM (rb_intern (name)));
+}
+
+static VALUE t_start_server (VALUE self UNUSED, VALUE server, VALUE port, VALUE options)
+{
+	ListenerOptions_t opts;
+	VALUE v;
+	if (!NIL_P(options))
+		Check_Type (options, T_HASH);
+	if (!NIL_P(v = listener_option (options, "backlog")))
+		opts.Backlog = NUM2INT (v);
+	if (!NIL_P(v = listener_option (options, "defer_accept")))
+		opts.DeferAccept = NUM2INT (v);
+	if (!NIL_P(v = listener_option (options, "fastopen")))
+		opts.FastOpenQueue = NUM2INT (v);
+	if (!NIL_P(v = listener_option (options, "reuseport")))
+		opts.bReusePort = RTEST (v);
+	if (!NIL_P(v = listener_option (options, "nodelay")))
+		opts.bNoDelay = RTEST (v);
+	if (!NIL_P(v = listener_option (options, "keepalive")))
+		opts.bKeepalive = RTEST (v);
+	if (!NIL_P(v = listener_option (options, "sndbuf")))
+		opts.SendBuffer = NUM2INT (v);
+	if (!NIL_P(v = listener_option (options, "rcvbuf")))
+		opts.ReceiveBuffer = NUM2INT (v);
+
+	const uintptr_t f = evma_create_tcp_server (StringValueCStr(server), FIX2INT(port), &opts);
 	if (!f)
 		rb_raise (rb_eRuntimeError, "%s", "no acceptor (port is in use or requires root privileges)");
 	return BSIG2NUM (f);
 }
 
+/**********************
+t_set_admission_limits
+**********************/
+
+static VALUE t_set_admission_limits (VALUE self UNUSED, VALUE signature, VALUE limits)
+{
+	if (NIL_P(limits)) {
+		evma_set_admission_limits (NUM2BSIG (signature), NULL);
+		return Qnil;
+	}
+
+	AdmissionLimits_t l;
+	VALUE v;
+	Check_Type (limits, T_HASH);
+	if (!NIL_P(v = listener_option (limits, "max_connections")))
+		l.MaxConnections = NUM2INT (v);
+	if (!NIL_P(v = listener_option (limits, "max_loop_lag")))
+		l.MaxLoopLag = (uint64_t) (NUM2DBL (v) * 1000000);
+	if (!NIL_P(v = listener_option (limits, "max_outbound_bytes")))
+		l.MaxOutboundBytes = NUM2ULL (v);
+	if (!NIL_P(v = listener_option (limits, "resume_at")))
+		l.ResumePercent = (int) (NUM2DBL (v) * 100);
+	if (!NIL_P(v = listener_option (limits, "reject")))
+		l.bReject = RTEST (v);
+	if (!NIL_P(v = listener_option (limits, "reject_response"))) {
+		StringValue (v);
+		l.RejectResponse.assign (RSTRING_PTR (v), RSTRING_LEN (v));
+	}
+
+	evma_set_admission_limits (NUM2BSIG (signature), &l);
+	return Qnil;
+}
+
+/*********************
+t_get_admission_stats
+*********************/
+
+static VALUE t_get_admission_stats (VALUE self UNUSED, VALUE signature)
+{
+	AdmissionStats_t stats;
+	evma_get_admission_stats (NUM2BSIG (signature), &stats);
+
+	VALUE hash = rb_hash_new();
+	rb_hash_aset (hash, ID2SYM (rb_intern ("connections")), INT2NUM (stats.Connections));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("shedding")), shed_reason (stats.Shedding));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("sheds")), ULL2NUM (stats.Sheds));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("rejected")), ULL2NUM (stats.Rejected));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("loop_lag")), rb_float_new ((double) stats.LoopLag / 1000000));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("outbound_bytes")), ULL2NUM (stats.OutboundBytes));
+	return hash;
+}
+
+/*****************
+t_set_rate_limits
+*****************/
+
+static VALUE t_set_rate_limits (VALUE self UNUSED, VALUE signature, VALUE limits)
+{
+	RateLimits_t l;
+	VALUE v;
+	if (!NIL_P(limits)) {
+		Check_Type (limits, T_HASH);
+		if (!NIL_P(v = listener_option (limits, "read")))
+			l.ReadRate = NUM2ULL (v);
+		if (!NIL_P(v = listener_option (limits, "write")))
+			l.WriteRate = NUM2ULL (v);
+		if (!NIL_P(v = listener_option (limits, "burst")))
+			l.Burst = NUM2ULL (v);
+	}
+
+	try {
+		evma_set_rate_limits (NUM2BSIG (signature), (l.ReadRate || l.WriteRate) ? &l : NULL);
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eConnectionNotBound, "%s", e.what());
+	}
+	return Qnil;
+}
+
 /*************
 t_stop_server
 *************/
@@ -355,14 +508,14 @@ static VALUE t_start_tls (VALUE self UNUSED, VALUE signature)
 t_set_tls_parms
 ***************/
 
-static VALUE t_set_tls_parms (VALUE self UNUSED, VALUE signature, VALUE privkeyfile, VALUE privkey, VALUE privkeypass, VALUE certchainfile, VALUE cert, VALUE verify_peer, VALUE fail_if_no_peer_cert, VALUE snihostname, VALUE cipherlist, VALUE ecdh_curve, VALUE dhparam, VALUE ssl_version)
+static VALUE t_set_tls_parms (VALUE self UNUSED, VALUE signature, VALUE privkeyfile, VALUE privkey, VALUE privkeypass, VALUE certchainfile, VALUE cert, VALUE verify_peer, VALUE fail_if_no_peer_cert, VALUE snihostname, VALUE cipherlist, VALUE ecdh_curve, VALUE dhparam, VALUE ssl_version, VALUE ktls, VALUE dynamic_records)
 {
 	/* set_tls_parms takes a series of positional arguments for specifying such things
 	 * as private keys and certificate chains.
 	 * It's expected that the parameter list will grow as we add more supported features.
 	 * ALL of these parameters are optional, and can be specified as empty or NULL strings.
 	 */
-	evma_set_tls_parms (NUM2BSIG (signature), StringValueCStr (privkeyfile), StringValueCStr (privkey), StringValueCStr (privkeypass), StringValueCStr (certchainfile), StringValueCStr (cert), (verify_peer == Qtrue ? 1 : 0), (fail_if_no_peer_cert == Qtrue ? 1 : 0), StringValueCStr (snihostname), StringValueCStr (cipherlist), StringValueCStr (ecdh_curve), StringValueCStr (dhparam), NUM2INT (ssl_version));
+	evma_set_tls_parms (NUM2BSIG (signature), StringValueCStr (privkeyfile), StringValueCStr (privkey), StringValueCStr (privkeypass), StringValueCStr (certchainfile), StringValueCStr (cert), (verify_peer == Qtrue ? 1 : 0), (fail_if_no_peer_cert == Qtrue ? 1 : 0), StringValueCStr (snihostname), StringValueCStr (cipherlist), StringValueCStr (ecdh_curve), StringValueCStr (dhparam), NUM2INT (ssl_version), (RTEST (ktls) ? 1 : 0), (RTEST (dynamic_records) ? 1 : 0));
 	return Qnil;
 }
 
@@ -478,6 +631,139 @@ static VALUE t_get_sni_hostname (VALUE self UNUSED, VALUE signature UNUSED)
 }
 #endif
 
+/*****************
+t_get_ktls_status
+*****************/
+
+#ifdef WITH_SSL
+static VALUE t_get_ktls_status (VALUE self UNUSED, VALUE signature)
+{
+	int status = evma_get_ktls_status (NUM2BSIG (signature));
+	if (status == -1)
+		return Qnil;
+	return INT2NUM (status);
+}
+#else
+static VALUE t_get_ktls_status (VALUE self UNUSED, VALUE signature UNUSED)
+{
+	return Qnil;
+}
+#endif
+
+/*****************
+t_get_tls_memory
+*****************/
+
+#ifdef WITH_SSL
+static VALUE t_get_tls_memory (VALUE self UNUSED, VALUE signature)
+{
+	int size = evma_get_tls_memory (NUM2BSIG (signature));
+	if (size == -1)
+		return Qnil;
+	return INT2NUM (size);
+}
+#else
+static VALUE t_get_tls_memory (VALUE self UNUSED, VALUE signature UNUSED)
+{
+	return Qnil;
+}
+#endif
+
+/***************
+t_is_tls_shrunk
+***************/
+
+#ifdef WITH_SSL
+static VALUE t_is_tls_shrunk (VALUE self UNUSED, VALUE signature)
+{
+	int shrunk = evma_is_tls_shrunk (NUM2BSIG (signature));
+	if (shrunk == -1)
+		return Qnil;
+	return shrunk ? Qtrue : Qfalse;
+}
+#else
+static VALUE t_is_tls_shrunk (VALUE self UNUSED, VALUE signature UNUSED)
+{
+	return Qnil;
+}
+#endif
+
+/**************************
+t_set_tls_ticket_key_data
+**************************/
+
+#ifdef WITH_SSL
+static VALUE t_set_tls_ticket_key_data (VALUE self UNUSED, VALUE keys)
+{
+	StringValue (keys);
+	try {
+		evma_set_tls_ticket_keys (RSTRING_PTR (keys), (int) RSTRING_LEN (keys));
+	} catch (std::runtime_error e) {
+		rb_raise (rb_eArgError, "%s", e.what());
+	}
+	return Qnil;
+}
+#else
+static VALUE t_set_tls_ticket_key_data (VALUE self UNUSED, VALUE keys UNUSED)
+{
+	rb_raise (EM_eUnsupported, "%s", "SSL is not available");
+	return Qnil;
+}
+#endif
+
+/*****************************
+t_set_tls_session_cache_limits
+*****************************/
+
+#ifdef WITH_SSL
+static VALUE t_set_tls_session_cache_limits (VALUE self UNUSED, VALUE size, VALUE timeout)
+{
+	try {
+		evma_set_tls_session_cache (NUM2INT (size), NUM2INT (timeout));
+	} catch (std::runtime_error e) {
+		rb_raise (rb_eArgError, "%s", e.what());
+	}
+	return Qnil;
+}
+#else
+static VALUE t_set_tls_session_cache_limits (VALUE self UNUSED, VALUE size UNUSED, VALUE timeout UNUSED)
+{
+	rb_raise (EM_eUnsupported, "%s", "SSL is not available");
+	return Qnil;
+}
+#endif
+
+/***************
+t_get_tls_stats
+***************/
+
+static VALUE t_get_tls_stats (VALUE self UNUSED)
+{
+	TlsStats_t stats;
+	evma_get_tls_stats (&stats);
+
+	VALUE times = rb_ary_new2 (TLS_HANDSHAKE_TIME_BUCKETS);
+	for (int i = 0; i < TLS_HANDSHAKE_TIME_BUCKETS; i++)
+		rb_ary_push (times, ULL2NUM (stats.HandshakeTimes[i]));
+
+	VALUE hash = rb_hash_new();
+	rb_hash_aset (hash, ID2SYM (rb_intern ("started_handshakes")), ULL2NUM (stats.StartedHandshakes));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("full_handshakes")), ULL2NUM (stats.FullHandshakes));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("resumed_handshakes")), ULL2NUM (stats.ResumedHandshakes));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("failed_handshakes")), ULL2NUM (stats.FailedHandshakes));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("handshake_times")), times);
+	rb_hash_aset (hash, ID2SYM (rb_intern ("bytes_encrypted")), ULL2NUM (stats.BytesEncrypted));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("bytes_decrypted")), ULL2NUM (stats.BytesDecrypted));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("records_sent")), ULL2NUM (stats.RecordsSent));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("records_received")), ULL2NUM (stats.RecordsReceived));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("read_time")), rb_float_new (stats.ReadTime / 1e9));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("write_time")), rb_float_new (stats.WriteTime / 1e9));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("handshake_time")), rb_float_new (stats.HandshakeTime / 1e9));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("contexts_created")), ULL2NUM (stats.ContextsCreated));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("contexts_reused")), ULL2NUM (stats.ContextsReused));
+	return hash;
+}
+
 /**************
 t_get_peername
 **************/
@@ -708,6 +994,80 @@ static VALUE t_connect_unix_server (VALUE self UNUSED, VALUE serversocket)
 	return BSIG2NUM (f);
 }
 
+/*********************
+t_pool_connect_server
+*********************/
+
+static VALUE t_pool_connect_server (VALUE self UNUSED, VALUE key, VALUE server, VALUE port)
+{
+	try {
+		const uintptr_t f = evma_pool_connect (StringValueCStr(key), StringValueCStr(server), NUM2INT(port));
+		if (!f)
+			rb_raise (EM_eConnectionError, "%s", "no connection");
+		return BSIG2NUM (f);
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eConnectionError, "%s", e.what());
+	}
+	return Qnil;
+}
+
+/***************************
+t_connect_server_with_retry
+***************************/
+
+static VALUE t_connect_server_with_retry (VALUE self UNUSED, VALUE server, VALUE port)
+{
+	try {
+		const uintptr_t f = evma_connect_with_retry (StringValueCStr(server), NUM2INT(port));
+		if (!f)
+			rb_raise (EM_eConnectionError, "%s", "no connection");
+		return BSIG2NUM (f);
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eConnectionError, "%s", e.what());
+	}
+	return Qnil;
+}
+
+/**************************
+t_connect_server_fast_open
+**************************/
+
+static VALUE t_connect_server_fast_open (VALUE self UNUSED, VALUE server, VALUE port)
+{
+	try {
+		const uintptr_t f = evma_connect_fast_open (StringValueCStr(server), NUM2INT(port));
+		if (!f)
+			rb_raise (EM_eConnectionError, "%s", "no connection");
+		return BSIG2NUM (f);
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eConnectionError, "%s", e.what());
+	}
+	return Qnil;
+}
+
+/*************************
+t_pool_release_connection
+*************************/
+
+static VALUE t_pool_release_connection (VALUE self UNUSED, VALUE signature)
+{
+	return evma_pool_release (NUM2BSIG (signature)) ? Qtrue : Qfalse;
+}
+
+/***************************
+t_get_pool_connection_state
+***************************/
+
+static VALUE t_get_pool_connection_state (VALUE self UNUSED, VALUE signature)
+{
+	try {
+		return INT2NUM (evma_get_pool_connection_state (NUM2BSIG (signature)));
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eConnectionNotBound, "%s", e.what());
+	}
+	return Qnil;
+}
+
 /***********
 t_attach_fd
 ***********/
@@ -966,6 +1326,241 @@ static VALUE t_set_simultaneous_accept_count (VALUE self UNUSED, VALUE ct)
 	return Qnil;
 }
 
+/*******************************
+t_get/set_tls_handshake_threads
+*******************************/
+
+static VALUE t_get_tls_handshake_threads (VALUE self UNUSED)
+{
+	return INT2FIX (evma_get_tls_handshake_threads());
+}
+
+static VALUE t_set_tls_handshake_threads (VALUE self UNUSED, VALUE ct)
+{
+	evma_set_tls_handshake_threads (NUM2INT (ct));
+	return Qnil;
+}
+
+/****************************
+t_get/set_resolver_threads
+****************************/
+
+static VALUE t_get_resolver_threads (VALUE self UNUSED)
+{
+	return INT2FIX (evma_get_resolver_threads());
+}
+
+static VALUE t_set_resolver_threads (VALUE self UNUSED, VALUE ct)
+{
+	evma_set_resolver_threads (NUM2INT (ct));
+	return Qnil;
+}
+
+/**********************************
+t_get/set_connection_attempt_delay
+**********************************/
+
+static VALUE t_get_connection_attempt_delay (VALUE self UNUSED)
+{
+	return rb_float_new (evma_get_connection_attempt_delay());
+}
+
+static VALUE t_set_connection_attempt_delay (VALUE self UNUSED, VALUE seconds)
+{
+	evma_set_connection_attempt_delay (NUM2DBL (seconds));
+	return Qnil;
+}
+
+
+/***********************
+t_get/set_dns_cache_ttl
+***********************/
+
+static VALUE t_get_dns_cache_ttl (VALUE self UNUSED)
+{
+	return rb_float_new (evma_get_dns_cache_ttl());
+}
+
+static VALUE t_set_dns_cache_ttl (VALUE self UNUSED, VALUE seconds)
+{
+	evma_set_dns_cache_ttl (NUM2DBL (seconds));
+	return Qnil;
+}
+
+/**************************
+t_get/set_dns_negative_ttl
+**************************/
+
+static VALUE t_get_dns_negative_ttl (VALUE self UNUSED)
+{
+	return rb_float_new (evma_get_dns_negative_ttl());
+}
+
+static VALUE t_set_dns_negative_ttl (VALUE self UNUSED, VALUE seconds)
+{
+	evma_set_dns_negative_ttl (NUM2DBL (seconds));
+	return Qnil;
+}
+
+/*********************
+t_get_dns_cache_stats
+*********************/
+
+static VALUE t_get_dns_cache_stats (VALUE self UNUSED)
+{
+	DnsCacheStats_t stats;
+	evma_get_dns_cache_stats (&stats);
+
+	VALUE hash = rb_hash_new();
+	rb_hash_aset (hash, ID2SYM (rb_intern ("hits")), ULL2NUM (stats.Hits));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("negative_hits")), ULL2NUM (stats.NegativeHits));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("misses")), ULL2NUM (stats.Misses));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("coalesced")), ULL2NUM (stats.Coalesced));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("size")), ULL2NUM (stats.Size));
+	return hash;
+}
+
+/*****************
+t_set_pool_limits
+*****************/
+
+static VALUE t_set_pool_limits (VALUE self UNUSED, VALUE max_per_host, VALUE idle_timeout)
+{
+	evma_set_pool_limits (NUM2INT (max_per_host), (float) NUM2DBL (idle_timeout));
+	return Qnil;
+}
+
+/****************
+t_get_pool_stats
+****************/
+
+static VALUE t_get_pool_stats (VALUE self UNUSED)
+{
+	ConnectionPoolStats_t stats;
+	evma_get_pool_stats (&stats);
+
+	VALUE hash = rb_hash_new();
+	rb_hash_aset (hash, ID2SYM (rb_intern ("idle")), INT2NUM (stats.Idle));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("active")), INT2NUM (stats.Active));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("waiting")), INT2NUM (stats.Waiting));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("created")), ULL2NUM (stats.Created));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("reused")), ULL2NUM (stats.Reused));
+	rb_hash_aset (hash, ID2SYM (rb_intern ("discarded")), ULL2NUM (stats.Discarded));
+	return hash;
+}
+
+/*******************
+t_set_redial_policy
+*******************/
+
+static VALUE t_set_redial_policy (VALUE self UNUSED, VALUE base_delay, VALUE max_delay, VALUE jitter, VALUE max_attempts, VALUE breaker_threshold, VALUE breaker_timeout)
+{
+	evma_set_reconnect_policy ((float) NUM2DBL (base_delay), (float) NUM2DBL (max_delay), (float) NUM2DBL (jitter), NUM2INT (max_attempts), NUM2INT (breaker_threshold), (float) NUM2DBL (breaker_timeout));
+	return Qnil;
+}
+
+/*********************
+t_get_redial_attempts
+*********************/
+
+static VALUE t_get_redial_attempts (VALUE self UNUSED, VALUE signature)
+{
+	return INT2NUM (evma_get_redial_attempts (NUM2BSIG (signature)));
+}
+
+/******************
+t_dns_cache_lookup
+******************/
+
+static VALUE t_dns_cache_lookup (VALUE self UNUSED, VALUE host)
+{
+	struct sockaddr_storage addrs [16];
+	int count = evma_dns_cache_lookup (StringValueCStr (host), addrs, 16);
+	if (count < 0)
+		return Qnil;
+	if (count == 0)
+		return ID2SYM (rb_intern ("nxdomain"));
+
+	VALUE ary = rb_ary_new();
+	for (int i = 0; i < count && i < 16; i++) {
+		char buf [INET6_ADDRSTRLEN];
+		const void *in = (addrs[i].ss_family == AF_INET6) ? (const void *)&((struct sockaddr_in6 *)&addrs[i])->sin6_addr : (const void *)&((struct sockaddr_in *)&addrs[i])->sin_addr;
+		if (inet_ntop (addrs[i].ss_family, in, buf, sizeof(buf)))
+			rb_ary_push (ary, rb_str_new2 (buf));
+	}
+	return ary;
+}
+
+/*****************
+t_dns_cache_store
+*****************/
+
+static VALUE t_dns_cache_store (VALUE self UNUSED, VALUE host, VALUE ips, VALUE ttl)
+{
+	// An empty list of addresses caches host as not existing.
+	// The addresses go in a buffer Ruby frees, as any of them may raise.
+	Check_Type (ips, T_ARRAY);
+	const char *name = StringValueCStr (host);
+	double seconds = NUM2DBL (ttl);
+	long count = RARRAY_LEN (ips);
+	VALUE buffer;
+	struct sockaddr_storage *addrs = ALLOCV_N (struct sockaddr_storage, buffer, count);
+	for (long i = 0; i < count; i++) {
+		VALUE ip = rb_ary_entry (ips, i);
+		const char *text = StringValueCStr (ip);
+		struct sockaddr_storage *ss = &addrs[i];
+		memset (ss, 0, sizeof(*ss));
+		if (inet_pton (AF_INET, text, &((struct sockaddr_in *)ss)->sin_addr) == 1)
+			ss->ss_family = AF_INET;
+		else if (inet_pton (AF_INET6, text, &((struct sockaddr_in6 *)ss)->sin6_addr) == 1)
+			ss->ss_family = AF_INET6;
+		else
+			rb_raise (rb_eArgError, "not an IP address: %s", text);
+	}
+	evma_dns_cache_store (name, count ? addrs : NULL, count, seconds);
+	ALLOCV_END (buffer);
+	return Qnil;
+}
+
+/***************************
+t_get/set_tls_idle_shrink
+***************************/
+
+static VALUE t_get_tls_idle_shrink (VALUE self UNUSED)
+{
+	return rb_float_new (evma_get_tls_idle_shrink());
+}
+
+static VALUE t_set_tls_idle_shrink (VALUE self UNUSED, VALUE seconds)
+{
+	evma_set_tls_idle_shrink (NUM2DBL (seconds));
+	return Qnil;
+}
+
+/*********************
+t_preload_tls_context
+*********************/
+
+static VALUE t_preload_tls_context (VALUE self UNUSED, VALUE privkeyfile, VALUE privkey, VALUE privkeypass, VALUE certchainfile, VALUE cert, VALUE cipherlist, VALUE ecdh_curve, VALUE dhparam, VALUE ssl_version)
+{
+	try {
+		evma_preload_tls_context (StringValueCStr (privkeyfile), StringValueCStr (privkey), StringValueCStr (privkeypass), StringValueCStr (certchainfile), StringValueCStr (cert), StringValueCStr (cipherlist), StringValueCStr (ecdh_curve), StringValueCStr (dhparam), NUM2INT (ssl_version));
+	} catch (const std::runtime_error& e) {
+		rb_raise (EM_eInvalidPrivateKey, "%s", e.what());
+	}
+	return Qnil;
+}
+
+/*********************
+t_reload_tls_contexts
+*********************/
+
+static VALUE t_reload_tls_contexts (VALUE self UNUSED, VALUE filename)
+{
+	int count = evma_reload_tls_contexts (StringValueCStr (filename));
+	return (count < 0) ? Qfalse : INT2NUM (count);
+}
+
 /***************
 t_setuid_string
 ***************/
@@ -1413,6 +2008,322 @@ static VALUE t_set_heartbeat_interval (VALUE self UNUSED, VALUE interval)
 }
 
 
+/******************
+t_set_line_framing
+******************/
+
+static VALUE t_set_line_framing (VALUE self UNUSED, VALUE signature, VALUE delimiter, VALUE max_length)
+{
+	try {
+		if (NIL_P(delimiter))
+			evma_set_line_framing (NUM2BSIG (signature), NULL, 0, 0);
+		else {
+			StringValue (delimiter);
+			if (RSTRING_LEN(delimiter) == 0)
+				rb_raise (rb_eArgError, "delimiter must not be empty");
+			if (NUM2LL (max_length) < 0)
+				rb_raise (rb_eArgError, "max_length must not be negative");
+			evma_set_line_framing (NUM2BSIG (signature), RSTRING_PTR(delimiter), RSTRING_LEN(delimiter), NUM2SIZET (max_length));
+		}
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eConnectionError, "%s", e.what());
+	}
+	return Qnil;
+}
+
+
+/********************
+t_set_length_framing
+********************/
+
+static VALUE t_set_length_framing (VALUE self UNUSED, VALUE signature, VALUE width, VALUE big_endian, VALUE offset, VALUE adjustment, VALUE strip, VALUE max_frame_size)
+{
+	if (NUM2LL (max_frame_size) < 0)
+		rb_raise (rb_eArgError, "max_frame_size must not be negative");
+	try {
+		evma_set_length_framing (NUM2BSIG (signature), NUM2INT (width), RTEST (big_endian) ? 1 : 0, NUM2INT (offset), NUM2INT (adjustment), NUM2INT (strip), NUM2SIZET (max_frame_size));
+	} catch (std::runtime_error e) {
+		rb_raise (rb_eArgError, "%s", e.what());
+	}
+	return Qnil;
+}
+
+
+/***************
+Tokenizer class
+***************/
+
+static void tokenizer_free (void *ptr)
+{
+	delete (Tokenizer_t*) ptr;
+}
+
+static size_t tokenizer_memsize (const void *ptr)
+{
+	return ptr ? sizeof(Tokenizer_t) + ((Tokenizer_t*)ptr)->GetBufferedSize() : 0;
+}
+
+static const rb_data_type_t tokenizer_type = {
+	"EventMachine::Tokenizer",
+	{ NULL, tokenizer_free, tokenizer_memsize, },
+	NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static Tokenizer_t *get_tokenizer (VALUE self)
+{
+	Tokenizer_t *t;
+	TypedData_Get_Struct (self, Tokenizer_t, &tokenizer_type, t);
+	if (!t)
+		rb_raise (rb_eRuntimeError, "uninitialized tokenizer");
+	return t;
+}
+
+
+/*****************
+t_tokenizer_alloc
+*****************/
+
+static VALUE t_tokenizer_alloc (VALUE klass)
+{
+	return TypedData_Wrap_Struct (klass, &tokenizer_type, NULL);
+}
+
+
+/**********************
+t_tokenizer_initialize
+**********************/
+
+static VALUE t_tokenizer_initialize (int argc, VALUE *argv, VALUE self)
+{
+	VALUE delimiter, size_limit;
+	rb_scan_args (argc, argv, "02", &delimiter, &size_limit);
+
+	if (NIL_P(delimiter))
+		delimiter = rb_gv_get ("$/");
+	StringValue (delimiter);
+	if (RSTRING_LEN(delimiter) == 0)
+		rb_raise (rb_eArgError, "delimiter must not be empty");
+
+	size_t max_length = NIL_P(size_limit) ? 0 : NUM2SIZET (size_limit);
+
+	delete (Tokenizer_t*) DATA_PTR (self);
+	DATA_PTR (self) = NULL;
+	DATA_PTR (self) = new Tokenizer_t (RSTRING_PTR(delimiter), RSTRING_LEN(delimiter), max_length);
+	return self;
+}
+
+
+/*******************
+t_tokenizer_extract
+*******************/
+
+static VALUE t_tokenizer_extract (VALUE self, VALUE data)
+{
+	Tokenizer_t *t = get_tokenizer (self);
+	StringValue (data);
+	rb_encoding *enc = rb_enc_get (data);
+	// For #flush, which hands back what's left in the same encoding.
+	rb_ivar_set (self, Intern_at_encoding, INT2FIX (rb_enc_to_index (enc)));
+
+	t->Append (RSTRING_PTR(data), RSTRING_LEN(data));
+
+	VALUE tokens = rb_ary_new();
+	const char *token;
+	size_t length;
+	while (t->Next (&token, &length))
+		rb_ary_push (tokens, rb_enc_str_new (token, length, enc));
+
+	if (t->IsOverflowed()) {
+		t->Clear();
+		rb_raise (rb_eRuntimeError, "input buffer full");
+	}
+
+	return tokens;
+}
+
+
+/*****************
+t_tokenizer_flush
+*****************/
+
+static VALUE t_tokenizer_flush (VALUE self)
+{
+	Tokenizer_t *t = get_tokenizer (self);
+
+	const char *data;
+	size_t length;
+	t->Flush (&data, &length);
+
+	VALUE enc = rb_ivar_get (self, Intern_at_encoding);
+	if (NIL_P (enc))
+		return rb_str_new (data, length);
+	return rb_enc_str_new (data, length, rb_enc_from_index (FIX2INT (enc)));
+}
+
+
+/********************
+t_tokenizer_is_empty
+********************/
+
+static VALUE t_tokenizer_is_empty (VALUE self)
+{
+	return get_tokenizer (self)->GetBufferedSize() == 0 ? Qtrue : Qfalse;
+}
+
+
+/************************
+HttpResponseParser class
+************************/
+
+static void http_parser_free (void *ptr)
+{
+	delete (HttpParser_t*) ptr;
+}
+
+static size_t http_parser_memsize (const void *ptr)
+{
+	return ptr ? sizeof(HttpParser_t) + ((HttpParser_t*)ptr)->GetMemorySize() : 0;
+}
+
+static const rb_data_type_t http_parser_type = {
+	"EventMachine::HttpResponseParser",
+	{ NULL, http_parser_free, http_parser_memsize, },
+	NULL, NULL, RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static HttpParser_t *get_http_parser (VALUE self)
+{
+	HttpParser_t *p;
+	TypedData_Get_Struct (self, HttpParser_t, &http_parser_type, p);
+	if (!p)
+		rb_raise (rb_eRuntimeError, "uninitialized parser");
+	return p;
+}
+
+static VALUE http_parser_response (HttpParser_t *p)
+{
+	/* Builds an EventMachine::HttpResponse from the response the parser
+	 * has just completed. This has to happen before the parser is called
+	 * again, since everything it hands out points into its buffers.
+	 */
+	char version[16];
+	snprintf (version, sizeof(version), "%d.%d", p->GetMajorVersion(), p->GetMinorVersion());
+
+	const char *reason;
+	size_t reason_length;
+	p->GetReason (&reason, &reason_length);
+
+	size_t count = p->GetHeaderCount();
+	VALUE headers = rb_ary_new2 (count);
+	for (size_t i = 0; i < count; i++) {
+		const char *name, *value;
+		size_t name_length, value_length;
+		p->GetHeader (i, &name, &name_length, &value, &value_length);
+		rb_ary_push (headers, rb_assoc_new (rb_str_new (name, name_length), rb_str_new (value, value_length)));
+	}
+
+	const char *body;
+	size_t body_length;
+	p->GetBody (&body, &body_length);
+
+	return rb_struct_new (EmHttpResponse,
+		rb_str_new2 (version),
+		INT2FIX (p->GetStatus()),
+		rb_str_new (reason, reason_length),
+		headers,
+		rb_str_new (body, body_length),
+		p->IsKeepAlive() ? Qtrue : Qfalse);
+}
+
+
+/*******************
+t_http_parser_alloc
+*******************/
+
+static VALUE t_http_parser_alloc (VALUE klass)
+{
+	return TypedData_Wrap_Struct (klass, &http_parser_type, NULL);
+}
+
+
+/************************
+t_http_parser_initialize
+************************/
+
+static VALUE t_http_parser_initialize (int argc, VALUE *argv, VALUE self)
+{
+	VALUE max_header_size;
+	rb_scan_args (argc, argv, "01", &max_header_size);
+
+	delete (HttpParser_t*) DATA_PTR (self);
+	DATA_PTR (self) = NULL;
+	DATA_PTR (self) = new HttpParser_t (NIL_P(max_header_size) ? 0 : NUM2SIZET (max_header_size));
+	return self;
+}
+
+
+/**************************
+t_http_parser_request_sent
+**************************/
+
+static VALUE t_http_parser_request_sent (VALUE self, VALUE verb)
+{
+	HttpParser_t *p = get_http_parser (self);
+	verb = rb_funcall (rb_obj_as_string (verb), rb_intern ("upcase"), 0);
+	p->ExpectResponse (strcmp (StringValueCStr (verb), "HEAD") == 0);
+	return self;
+}
+
+
+/*******************
+t_http_parser_parse
+*******************/
+
+static VALUE t_http_parser_parse (VALUE self, VALUE data)
+{
+	HttpParser_t *p = get_http_parser (self);
+	StringValue (data);
+
+	VALUE responses = rb_ary_new();
+	try {
+		p->Append (RSTRING_PTR(data), RSTRING_LEN(data));
+		while (p->Next())
+			rb_ary_push (responses, http_parser_response (p));
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eHttpParseError, "%s", e.what());
+	}
+	return responses;
+}
+
+
+/********************
+t_http_parser_finish
+********************/
+
+static VALUE t_http_parser_finish (VALUE self)
+{
+	HttpParser_t *p = get_http_parser (self);
+	try {
+		if (p->Finish())
+			return http_parser_response (p);
+	} catch (std::runtime_error e) {
+		rb_raise (EM_eHttpParseError, "%s", e.what());
+	}
+	return Qnil;
+}
+
+
+/*******************
+t_http_parser_reset
+*******************/
+
+static VALUE t_http_parser_reset (VALUE self)
+{
+	get_http_parser (self)->Clear();
+	return self;
+}
+
+
 /*********************
 Init_rubyeventmachine
 *********************/
@@ -1428,6 +2339,7 @@ extern "C" void Init_rubyeventmachine()
 	Intern_at_timers = rb_intern ("@timers");
 	Intern_at_conns = rb_intern ("@conns");
 	Intern_at_error_handler = rb_intern("@error_handler");
+	Intern_at_encoding = rb_intern("@encoding");
 
 	Intern_event_callback = rb_intern ("event_callback");
 	Intern_run_deferred_callbacks = rb_intern ("run_deferred_callbacks");
@@ -1435,6 +2347,8 @@ extern "C" void Init_rubyeventmachine()
 	Intern_call = rb_intern ("call");
 	Intern_at = rb_intern("at");
 	Intern_receive_data = rb_intern ("receive_data");
+	Intern_receive_line = rb_intern ("receive_line");
+	Intern_receive_frame = rb_intern ("receive_frame");
 	Intern_ssl_handshake_completed = rb_intern ("ssl_handshake_completed");
 	Intern_ssl_verify_peer = rb_intern ("ssl_verify_peer");
 	Intern_notify_readable = rb_intern ("notify_readable");
@@ -1456,6 +2370,7 @@ extern "C" void Init_rubyeventmachine()
 	EM_eUnsupported = rb_define_class_under (EmModule, "Unsupported", rb_eRuntimeError);
 	EM_eInvalidSignature = rb_define_class_under (EmModule, "InvalidSignature", rb_eRuntimeError);
 	EM_eInvalidPrivateKey = rb_define_class_under (EmModule, "InvalidPrivateKey", rb_eRuntimeError);
+	EM_eHttpParseError = rb_define_class_under (EmModule, "HttpParseError", rb_eRuntimeError);
 
 	rb_define_module_function (EmModule, "initialize_event_machine", (VALUE(*)(...))t_initialize_event_machine, 0);
 	rb_define_module_function (EmModule, "run_machine_once", (VALUE(*)(...))t_run_machine_once, 0);
@@ -1463,17 +2378,26 @@ extern "C" void Init_rubyeventmachine()
 	rb_define_module_function (EmModule, "run_machine_without_threads", (VALUE(*)(...))t_run_machine, 0);
 	rb_define_module_function (EmModule, "get_timer_count", (VALUE(*)(...))t_get_timer_count, 0);
 	rb_define_module_function (EmModule, "add_oneshot_timer", (VALUE(*)(...))t_add_oneshot_timer, 1);
-	rb_define_module_function (EmModule, "start_tcp_server", (VALUE(*)(...))t_start_server, 2);
+	rb_define_module_function (EmModule, "start_tcp_server", (VALUE(*)(...))t_start_server, 3);
 	rb_define_module_function (EmModule, "stop_tcp_server", (VALUE(*)(...))t_stop_server, 1);
+	rb_define_module_function (EmModule, "set_acceptor_limits", (VALUE(*)(...))t_set_admission_limits, 2);
+	rb_define_module_function (EmModule, "get_acceptor_stats", (VALUE(*)(...))t_get_admission_stats, 1);
+	rb_define_module_function (EmModule, "set_descriptor_rate_limits", (VALUE(*)(...))t_set_rate_limits, 2);
 	rb_define_module_function (EmModule, "start_unix_server", (VALUE(*)(...))t_start_unix_server, 1);
 	rb_define_module_function (EmModule, "attach_sd", (VALUE(*)(...))t_attach_sd, 1);
-	rb_define_module_function (EmModule, "set_tls_parms", (VALUE(*)(...))t_set_tls_parms, 13);
+	rb_define_module_function (EmModule, "set_tls_parms", (VALUE(*)(...))t_set_tls_parms, 15);
 	rb_define_module_function (EmModule, "start_tls", (VALUE(*)(...))t_start_tls, 1);
 	rb_define_module_function (EmModule, "get_peer_cert", (VALUE(*)(...))t_get_peer_cert, 1);
 	rb_define_module_function (EmModule, "get_cipher_bits", (VALUE(*)(...))t_get_cipher_bits, 1);
 	rb_define_module_function (EmModule, "get_cipher_name", (VALUE(*)(...))t_get_cipher_name, 1);
 	rb_define_module_function (EmModule, "get_cipher_protocol", (VALUE(*)(...))t_get_cipher_protocol, 1);
 	rb_define_module_function (EmModule, "get_sni_hostname", (VALUE(*)(...))t_get_sni_hostname, 1);
+	rb_define_module_function (EmModule, "get_ktls_status", (VALUE(*)(...))t_get_ktls_status, 1);
+	rb_define_module_function (EmModule, "get_tls_memory", (VALUE(*)(...))t_get_tls_memory, 1);
+	rb_define_module_function (EmModule, "is_tls_shrunk", (VALUE(*)(...))t_is_tls_shrunk, 1);
+	rb_define_module_function (EmModule, "set_tls_ticket_key_data", (VALUE(*)(...))t_set_tls_ticket_key_data, 1);
+	rb_define_module_function (EmModule, "set_tls_session_cache_limits", (VALUE(*)(...))t_set_tls_session_cache_limits, 2);
+	rb_define_module_function (EmModule, "get_tls_stats", (VALUE(*)(...))t_get_tls_stats, 0);
 	rb_define_module_function (EmModule, "send_data", (VALUE(*)(...))t_send_data, 3);
 	rb_define_module_function (EmModule, "send_datagram", (VALUE(*)(...))t_send_datagram, 5);
 	rb_define_module_function (EmModule, "close_connection", (VALUE(*)(...))t_close_connection, 2);
@@ -1481,6 +2405,15 @@ extern "C" void Init_rubyeventmachine()
 	rb_define_module_function (EmModule, "connect_server", (VALUE(*)(...))t_connect_server, 2);
 	rb_define_module_function (EmModule, "bind_connect_server", (VALUE(*)(...))t_bind_connect_server, 4);
 	rb_define_module_function (EmModule, "connect_unix_server", (VALUE(*)(...))t_connect_unix_server, 1);
+	rb_define_module_function (EmModule, "pool_connect_server", (VALUE(*)(...))t_pool_connect_server, 3);
+	rb_define_module_function (EmModule, "pool_release_connection", (VALUE(*)(...))t_pool_release_connection, 1);
+	rb_define_module_function (EmModule, "get_pool_connection_state", (VALUE(*)(...))t_get_pool_connection_state, 1);
+	rb_define_module_function (EmModule, "set_pool_limits", (VALUE(*)(...))t_set_pool_limits, 2);
+	rb_define_module_function (EmModule, "get_pool_stats", (VALUE(*)(...))t_get_pool_stats, 0);
+	rb_define_module_function (EmModule, "connect_server_with_retry", (VALUE(*)(...))t_connect_server_with_retry, 2);
+	rb_define_module_function (EmModule, "connect_server_fast_open", (VALUE(*)(...))t_connect_server_fast_open, 2);
+	rb_define_module_function (EmModule, "set_redial_policy", (VALUE(*)(...))t_set_redial_policy, 6);
+	rb_define_module_function (EmModule, "get_redial_attempts", (VALUE(*)(...))t_get_redial_attempts, 1);
 
 	rb_define_module_function (EmModule, "attach_fd", (VALUE (*)(...))t_attach_fd, 2);
 	rb_define_module_function (EmModule, "detach_fd", (VALUE (*)(...))t_detach_fd, 1);
@@ -1501,6 +2434,9 @@ extern "C" void Init_rubyeventmachine()
 	rb_define_module_function (EmModule, "stop_proxy", (VALUE (*)(...))t_stop_proxy, 1);
 	rb_define_module_function (EmModule, "get_proxied_bytes", (VALUE (*)(...))t_proxied_bytes, 1);
 
+	rb_define_module_function (EmModule, "set_line_framing", (VALUE (*)(...))t_set_line_framing, 3);
+	rb_define_module_function (EmModule, "set_length_framing", (VALUE (*)(...))t_set_length_framing, 7);
+
 	rb_define_module_function (EmModule, "watch_filename", (VALUE (*)(...))t_watch_filename, 1);
 	rb_define_module_function (EmModule, "unwatch_filename", (VALUE (*)(...))t_unwatch_filename, 1);
 
@@ -1521,6 +2457,23 @@ extern "C" void Init_rubyeventmachine()
 	rb_define_module_function (EmModule, "set_max_timer_count", (VALUE(*)(...))t_set_max_timer_count, 1);
 	rb_define_module_function (EmModule, "get_simultaneous_accept_count", (VALUE(*)(...))t_get_simultaneous_accept_count, 0);
 	rb_define_module_function (EmModule, "set_simultaneous_accept_count", (VALUE(*)(...))t_set_simultaneous_accept_count, 1);
+	rb_define_module_function (EmModule, "get_tls_handshake_thread_count", (VALUE(*)(...))t_get_tls_handshake_threads, 0);
+	rb_define_module_function (EmModule, "set_tls_handshake_thread_count", (VALUE(*)(...))t_set_tls_handshake_threads, 1);
+	rb_define_module_function (EmModule, "get_resolver_thread_count", (VALUE(*)(...))t_get_resolver_threads, 0);
+	rb_define_module_function (EmModule, "set_resolver_thread_count", (VALUE(*)(...))t_set_resolver_threads, 1);
+	rb_define_module_function (EmModule, "get_connection_attempt_delay_time", (VALUE(*)(...))t_get_connection_attempt_delay, 0);
+	rb_define_module_function (EmModule, "set_connection_attempt_delay_time", (VALUE(*)(...))t_set_connection_attempt_delay, 1);
+	rb_define_module_function (EmModule, "get_dns_cache_ttl_time", (VALUE(*)(...))t_get_dns_cache_ttl, 0);
+	rb_define_module_function (EmModule, "set_dns_cache_ttl_time", (VALUE(*)(...))t_set_dns_cache_ttl, 1);
+	rb_define_module_function (EmModule, "get_dns_negative_ttl_time", (VALUE(*)(...))t_get_dns_negative_ttl, 0);
+	rb_define_module_function (EmModule, "set_dns_negative_ttl_time", (VALUE(*)(...))t_set_dns_negative_ttl, 1);
+	rb_define_module_function (EmModule, "get_dns_cache_stats", (VALUE(*)(...))t_get_dns_cache_stats, 0);
+	rb_define_module_function (EmModule, "dns_cache_lookup", (VALUE(*)(...))t_dns_cache_lookup, 1);
+	rb_define_module_function (EmModule, "dns_cache_store", (VALUE(*)(...))t_dns_cache_store, 3);
+	rb_define_module_function (EmModule, "get_tls_idle_shrink_time", (VALUE(*)(...))t_get_tls_idle_shrink, 0);
+	rb_define_module_function (EmModule, "set_tls_idle_shrink_time", (VALUE(*)(...))t_set_tls_idle_shrink, 1);
+	rb_define_module_function (EmModule, "preload_tls_context", (VALUE(*)(...))t_preload_tls_context, 9);
+	rb_define_module_function (EmModule, "reload_tls_contexts", (VALUE(*)(...))t_reload_tls_contexts, 1);
 	rb_define_module_function (EmModule, "setuid_string", (VALUE(*)(...))t_setuid_string, 1);
 	rb_define_module_function (EmModule, "invoke_popen", (VALUE(*)(...))t_invoke_popen, 1);
 	rb_define_module_function (EmModule, "send_file_data", (VALUE(*)(...))t_send_file_data, 2);
@@ -1555,6 +2508,22 @@ extern "C" void Init_rubyeventmachine()
 	rb_define_method (EmConnection, "enable_keepalive", (VALUE(*)(...))t_enable_keepalive, -1);
 	rb_define_method (EmConnection, "disable_keepalive", (VALUE(*)(...))t_disable_keepalive, 0);
 
+	VALUE EmTokenizer = rb_define_class_under (EmModule, "Tokenizer", rb_cObject);
+	rb_define_alloc_func (EmTokenizer, t_tokenizer_alloc);
+	rb_define_method (EmTokenizer, "initialize", (VALUE(*)(...))t_tokenizer_initialize, -1);
+	rb_define_method (EmTokenizer, "extract", (VALUE(*)(...))t_tokenizer_extract, 1);
+	rb_define_method (EmTokenizer, "flush", (VALUE(*)(...))t_tokenizer_flush, 0);
+	rb_define_method (EmTokenizer, "empty?", (VALUE(*)(...))t_tokenizer_is_empty, 0);
+
+	EmHttpResponse = rb_struct_define_under (EmModule, "HttpResponse", "version", "status", "reason", "headers", "content", "keep_alive", NULL);
+	VALUE EmHttpResponseParser = rb_define_class_under (EmModule, "HttpResponseParser", rb_cObject);
+	rb_define_alloc_func (EmHttpResponseParser, t_http_parser_alloc);
+	rb_define_method (EmHttpResponseParser, "initialize", (VALUE(*)(...))t_http_parser_initialize, -1);
+	rb_define_method (EmHttpResponseParser, "request_sent", (VALUE(*)(...))t_http_parser_request_sent, 1);
+	rb_define_method (EmHttpResponseParser, "parse", (VALUE(*)(...))t_http_parser_parse, 1);
+	rb_define_method (EmHttpResponseParser, "finish", (VALUE(*)(...))t_http_parser_finish, 0);
+	rb_define_method (EmHttpResponseParser, "reset", (VALUE(*)(...))t_http_parser_reset, 0);
+
 	// Connection states
 	rb_define_const (EmModule, "TimerFired",               INT2NUM(EM_TIMER_FIRED               ));
 	rb_define_const (EmModule, "ConnectionData",           INT2NUM(EM_CONNECTION_READ           ));
@@ -1568,6 +2537,12 @@ extern "C" void Init_rubyeventmachine()
 	rb_define_const (EmModule, "SslVerify",                INT2NUM(EM_SSL_VERIFY                ));
 	// EM_PROXY_TARGET_UNBOUND = 110,
 	// EM_PROXY_COMPLETED = 111
+	rb_define_const (EmModule, "ConnectionLine",           INT2NUM(EM_CONNECTION_LINE           ));
+	rb_define_const (EmModule, "ConnectionFrame",          INT2NUM(EM_CONNECTION_FRAME          ));
+	rb_define_const (EmModule, "SheddingStarted",          INT2NUM(EM_SHEDDING_STARTED          ));
+	rb_define_const (EmModule, "SheddingStopped",          INT2NUM(EM_SHEDDING_STOPPED          ));
+	rb_define_const (EmModule, "ConnectionRebound",        INT2NUM(EM_CONNECTION_REBOUND        ));
+	rb_define_const (EmModule, "ConnectionReconnecting",   INT2NUM(EM_CONNECTION_RECONNECTING   ));
 
 	// SSL Protocols
 	rb_define_const (EmModule, "EM_PROTO_SSLv2",   INT2NUM(EM_PROTO_SSLv2  ));
@@ -24,6 +24,63 @@ See the file COPYING for complete licensing information.
 
 
 bool SslContext_t::bLibraryInitialized = false;
+std::map<std::string, SslContext_t*> SslContext_t::Cache;
+std::set<SslContext_t*> SslContext_t::Retired;
+
+// Server-side session resumption settings, shared by every server context.
+// Each ticket key is 48 bytes: a 16-byte name, then the HMAC and AES keys.
+static std::vector<std::string> TicketKeys;
+static long SessionCacheSize = 20 * 1024;
+static long SessionTimeout = 300;
+
+// Handshakes on SslHandshakePool_t threads read the ticket keys.
+#ifdef OS_UNIX
+static pthread_mutex_t TicketKeysLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Where SslBox_t keeps a pointer to itself in its SSL object.
+static int SslBoxIndex = -1;
+
+/* A monotonic clock in nanoseconds, for the time SslBox_t spends in
+ * OpenSSL calls. These may be made on SslHandshakePool_t threads.
+ */
+static uint64_t SslClock()
+{
+	#if defined(HAVE_CONST_CLOCK_MONOTONIC)
+	struct timespec tv;
+	clock_gettime (CLOCK_MONOTONIC, &tv);
+	return (((uint64_t)(tv.tv_sec)) * 1000000000LL) + ((uint64_t)(tv.tv_nsec));
+	#elif defined(OS_UNIX)
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return (((uint64_t)(tv.tv_sec)) * 1000000000LL) + ((uint64_t)(tv.tv_usec) * 1000);
+	#elif defined(OS_WIN32)
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter (&count);
+	QueryPerformanceFrequency (&frequency);
+	return (uint64_t)((double)count.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
+	#endif
+}
+
+/* Sessions resume only where the session id context they were made under
+ * matches. This one is a digest of id, which says what the server
+ * context or connection was set up with.
+ */
+static unsigned int SessionIdContext (const std::string &id, unsigned char *sid_ctx)
+{
+	unsigned char digest [EVP_MAX_MD_SIZE];
+	unsigned int length = 0;
+	EVP_Digest (id.data(), id.size(), digest, &length, EVP_sha256(), NULL);
+	if (length > SSL_MAX_SID_CTX_LENGTH)
+		length = SSL_MAX_SID_CTX_LENGTH;
+	memcpy (sid_ctx, digest, length);
+	return length;
+}
+
+#ifdef HAVE_BIO_METH_NEW
+// The BIO that connects an SslBox_t to its connection's buffers.
+static BIO_METHOD *ConnectionBioMethod = NULL;
+#endif
 
 
 
@@ -122,6 +179,19 @@ SslContext_t::SslContext_t
 SslContext_t::SslContext_t (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version) :
 	bIsServer (is_server),
 	pCtx (NULL),
+	RefCount (0),
+	bPinned (false),
+	bRetired (false),
+	Generation (0),
+	KeyFile (privkeyfile),
+	KeyPem (privkey),
+	KeyPass (privkeypass),
+	ChainFile (certchainfile),
+	CertPem (cert),
+	CipherList (cipherlist),
+	EcdhCurve (ecdh_curve),
+	DhParamFile (dhparam),
+	SslVersion (ssl_version),
 	PrivateKey (NULL),
 	Certificate (NULL)
 {
@@ -141,6 +211,15 @@ SslContext_t::SslContext_t (bool is_server, const std::string &privkeyfile, cons
 		SSL_load_error_strings();
 		ERR_load_crypto_strings();
 
+		SslBoxIndex = SSL_get_ex_new_index (0, NULL, NULL, NULL, NULL);
+		#ifdef HAVE_BIO_METH_NEW
+		ConnectionBioMethod = BIO_meth_new (BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "eventmachine connection");
+		if (!ConnectionBioMethod)
+			throw std::runtime_error ("no BIO method");
+		BIO_meth_set_read (ConnectionBioMethod, ssl_bio_read_wrapper);
+		BIO_meth_set_write (ConnectionBioMethod, ssl_bio_write_wrapper);
+		BIO_meth_set_ctrl (ConnectionBioMethod, ssl_bio_ctrl_wrapper);
+		#endif
 		InitializeDefaultCredentials();
 	}
 	#ifdef HAVE_TLS_SERVER_METHOD
@@ -195,19 +274,30 @@ SslContext_t::SslContext_t (bool is_server, const std::string &privkeyfile, cons
 
 		// The SSL_CTX calls here do NOT allocate memory.
 		int e;
-		if (privkeyfile.length() > 0)
-			e = SSL_CTX_use_PrivateKey_file (pCtx, const_cast<char *>(privkeyfile.c_str()), SSL_FILETYPE_PEM);
-		else
+		if (privkeyfile.length() > 0) {
+			if (SSL_CTX_use_PrivateKey_file (pCtx, const_cast<char *>(privkeyfile.c_str()), SSL_FILETYPE_PEM) <= 0)
+				_LoadFailed ("private key", privkeyfile);
+		}
+		else {
 			e = SSL_CTX_use_PrivateKey (pCtx, DefaultPrivateKey);
-		if (e <= 0) ERR_print_errors_fp(stderr);
-		assert (e > 0);
+			if (e <= 0) ERR_print_errors_fp(stderr);
+			assert (e > 0);
+		}
 
-		if (certchainfile.length() > 0)
-			e = SSL_CTX_use_certificate_chain_file (pCtx, const_cast<char *>(certchainfile.c_str()));
-		else
+		if (certchainfile.length() > 0) {
+			if (SSL_CTX_use_certificate_chain_file (pCtx, const_cast<char *>(certchainfile.c_str())) <= 0)
+				_LoadFailed ("certificate chain", certchainfile);
+		}
+		else {
 			e = SSL_CTX_use_certificate (pCtx, DefaultCertificate);
-		if (e <= 0) ERR_print_errors_fp(stderr);
-		assert (e > 0);
+			if (e <= 0) ERR_print_errors_fp(stderr);
+			assert (e > 0);
+		}
+
+		// A key and certificate read while they were being replaced may not
+		// be a pair.
+		if ((privkeyfile.length() > 0) && (certchainfile.length() > 0) && (SSL_CTX_check_private_key (pCtx) != 1))
+			_LoadFailed ("private key matching the certificate", privkeyfile);
 
 		if (dhparam.length() > 0) {
 			DH   *dh;
@@ -271,10 +361,16 @@ SslContext_t::SslContext_t (bool is_server, const std::string &privkeyfile, cons
 		SSL_CTX_set_cipher_list (pCtx, "ALL:!ADH:!LOW:!EXP:!DES-CBC3-SHA:@STRENGTH");
 
 	if (bIsServer) {
-		SSL_CTX_sess_set_cache_size (pCtx, 128);
 		SSL_CTX_set_session_id_context (pCtx, (unsigned char*)"eventmachine", 12);
+		_ApplySessionSettings();
 	}
 	else {
+		#ifdef HAVE_SSL_SESSION_UP_REF
+		// Sessions are kept by SslBox_t::SaveSession, not OpenSSL's cache.
+		SSL_CTX_set_session_cache_mode (pCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb (pCtx, ssl_new_session_wrapper);
+		#endif
+
 		int e;
 		// As indicated in man(3) ssl_ctx_use_privatekey_file
 		// To change a certificate, private key pair the new certificate needs to be set with
@@ -326,12 +422,33 @@ SslContext_t::SslContext_t (bool is_server, const std::string &privkeyfile, cons
 
 
 
+/**************************
+SslContext_t::_LoadFailed
+**************************/
+
+void SslContext_t::_LoadFailed (const char *what, const std::string &filename)
+{
+	// Called from the constructor, whose caller won't get the object to free.
+	char error [256];
+	ERR_error_string_n (ERR_get_error(), error, sizeof(error));
+	ERR_clear_error();
+
+	SSL_CTX_free (pCtx);
+	pCtx = NULL;
+
+	std::string msg = std::string ("couldn't load ") + what + " from " + filename + ": " + error;
+	throw std::runtime_error (msg);
+}
+
+
 /***************************
 SslContext_t::~SslContext_t
 ***************************/
 
 SslContext_t::~SslContext_t()
 {
+	for (std::map<std::string, SSL_SESSION*>::iterator it = Sessions.begin(); it != Sessions.end(); ++it)
+		SSL_SESSION_free (it->second);
 	if (pCtx)
 		SSL_CTX_free (pCtx);
 	if (PrivateKey)
@@ -342,31 +459,320 @@ SslContext_t::~SslContext_t()
 
 
 
+/*********************
+SslContext_t::Acquire
+*********************/
+
+SslContext_t *SslContext_t::Acquire (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version, bool *created)
+{
+	// Length-prefix every field so that no two parameter sets share a key.
+	std::ostringstream key;
+	key << (is_server ? 'S' : 'C') << ssl_version;
+	const std::string *fields[] = { &privkeyfile, &privkey, &privkeypass, &certchainfile, &cert, &cipherlist, &ecdh_curve, &dhparam };
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+		key << ':' << fields[i]->length() << ':' << *fields[i];
+
+	std::map<std::string, SslContext_t*>::iterator it = Cache.find (key.str());
+	if (created)
+		*created = (it == Cache.end());
+	if (it != Cache.end()) {
+		it->second->RefCount++;
+		return it->second;
+	}
+
+	if (Cache.size() >= MaxIdleContexts)
+		FlushCache();
+
+	SslContext_t *ctx = _Create (key.str(), 0, is_server, privkeyfile, privkey, privkeypass, certchainfile, cert, cipherlist, ecdh_curve, dhparam, ssl_version);
+	ctx->RefCount = 1;
+	Cache.insert (std::make_pair (ctx->CacheKey, ctx));
+	return ctx;
+}
+
+
+/*********************
+SslContext_t::_Create
+*********************/
+
+SslContext_t *SslContext_t::_Create (const std::string &key, int generation, bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version)
+{
+	SslContext_t *ctx = new SslContext_t (is_server, privkeyfile, privkey, privkeypass, certchainfile, cert, cipherlist, ecdh_curve, dhparam, ssl_version);
+	ctx->CacheKey = key;
+	ctx->Generation = generation;
+
+	if (is_server) {
+		// Sessions (and tickets, whose keys all server contexts share) may
+		// only be resumed on a context with the same certificate and settings,
+		// and not on one Reload has since read the files for again.
+		// Connections that verify their peer narrow it further; see SslBox_t.
+		std::ostringstream id;
+		id << generation << ':' << key;
+		ctx->SessionId = id.str();
+		unsigned char sid_ctx [SSL_MAX_SID_CTX_LENGTH];
+		unsigned int sid_ctx_length = SessionIdContext (ctx->SessionId, sid_ctx);
+		SSL_CTX_set_session_id_context (ctx->pCtx, sid_ctx, sid_ctx_length);
+	}
+	return ctx;
+}
+
+
+/*********************
+SslContext_t::Preload
+*********************/
+
+void SslContext_t::Preload (const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version)
+{
+	// Builds the server context for these parameters now, unless it's
+	// cached already, and keeps it cached.
+	SslContext_t *ctx = Acquire (true, privkeyfile, privkey, privkeypass, certchainfile, cert, cipherlist, ecdh_curve, dhparam, ssl_version);
+	ctx->bPinned = true;
+	ctx->Release();
+}
+
+
+/********************
+SslContext_t::Reload
+********************/
+
+int SslContext_t::Reload (const std::string &filename)
+{
+	/* Rebuilds every cached context made from the key, certificate chain
+	 * or DH parameters in filename, and puts the new one in its place.
+	 * Returns how many there were, or -1 if any of them couldn't be
+	 * rebuilt (say, because the file is only half written), in which case
+	 * that one stays as it was.
+	 */
+	int reloaded = 0;
+	bool failed = false;
+
+	for (std::map<std::string, SslContext_t*>::iterator it = Cache.begin(); it != Cache.end(); ++it) {
+		SslContext_t *old = it->second;
+		if ((old->KeyFile != filename) && (old->ChainFile != filename) && (old->DhParamFile != filename))
+			continue;
+
+		SslContext_t *ctx;
+		try {
+			ctx = _Create (old->CacheKey, old->Generation + 1, old->bIsServer, old->KeyFile, old->KeyPem, old->KeyPass, old->ChainFile, old->CertPem, old->CipherList, old->EcdhCurve, old->DhParamFile, old->SslVersion);
+		} catch (std::runtime_error e) {
+			failed = true;
+			continue;
+		}
+		ctx->bPinned = old->bPinned;
+		it->second = ctx;
+		reloaded++;
+
+		if (old->RefCount == 0)
+			delete old;
+		else {
+			old->bRetired = true;
+			Retired.insert (old);
+		}
+	}
+
+	return failed ? -1 : reloaded;
+}
+
+
+/*********************
+SslContext_t::Release
+*********************/
+
+void SslContext_t::Release()
+{
+	// Idle contexts stay in the cache; FlushCache is what frees them.
+	// Those Reload replaced go with their last connection.
+	assert (RefCount > 0);
+	RefCount--;
+	if (bRetired && (RefCount == 0)) {
+		Retired.erase (this);
+		delete this;
+	}
+}
+
+
+/************************
+SslContext_t::FlushCache
+************************/
+
+void SslContext_t::FlushCache (bool unpin)
+{
+	/* Frees every cached context no connection is using. Called when the
+	 * cache fills up, which leaves preloaded contexts be, and when the
+	 * machine shuts down, which doesn't.
+	 */
+	std::map<std::string, SslContext_t*>::iterator it = Cache.begin();
+	while (it != Cache.end()) {
+		if ((it->second->RefCount == 0) && (unpin || !it->second->bPinned)) {
+			delete it->second;
+			Cache.erase (it++);
+		}
+		else
+			++it;
+	}
+}
+
+
+/***************************
+SslContext_t::SetTicketKeys
+***************************/
+
+void SslContext_t::SetTicketKeys (const char *keys, size_t length)
+{
+	/* Installs application-supplied session ticket keys, 48 bytes each.
+	 * The first one encrypts new tickets; the others are only used to
+	 * decrypt tickets issued before a rotation, which are then renewed.
+	 * With no keys, OpenSSL's own random per-context key is used.
+	 */
+	if (length % 48)
+		throw std::runtime_error ("session ticket keys must be 48 bytes each");
+
+	#ifdef OS_UNIX
+	pthread_mutex_lock (&TicketKeysLock);
+	#endif
+	TicketKeys.clear();
+	for (size_t i = 0; i < length; i += 48)
+		TicketKeys.push_back (std::string (keys + i, 48));
+	#ifdef OS_UNIX
+	pthread_mutex_unlock (&TicketKeysLock);
+	#endif
+
+	_ReapplySessionSettings();
+}
+
+
+/***********************************
+SslContext_t::SetSessionCacheLimits
+***********************************/
+
+void SslContext_t::SetSessionCacheLimits (long size, long timeout)
+{
+	if ((size < 0) || (timeout <= 0))
+		throw std::runtime_error ("invalid session cache size or timeout");
+
+	SessionCacheSize = size;
+	SessionTimeout = timeout;
+
+	_ReapplySessionSettings();
+}
+
+
+/*************************************
+SslContext_t::_ReapplySessionSettings
+*************************************/
+
+void SslContext_t::_ReapplySessionSettings()
+{
+	// Retired contexts too, as their connections may still issue tickets.
+	for (std::map<std::string, SslContext_t*>::iterator it = Cache.begin(); it != Cache.end(); ++it)
+		it->second->_ApplySessionSettings();
+	for (std::set<SslContext_t*>::iterator it = Retired.begin(); it != Retired.end(); ++it)
+		(*it)->_ApplySessionSettings();
+}
+
+
+/***********************************
+SslContext_t::_ApplySessionSettings
+***********************************/
+
+void SslContext_t::_ApplySessionSettings()
+{
+	if (!bIsServer)
+		return;
+
+	SSL_CTX_sess_set_cache_size (pCtx, SessionCacheSize);
+	SSL_CTX_set_timeout (pCtx, SessionTimeout);
+
+	#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb (pCtx, TicketKeys.empty() ? NULL : ssl_ticket_key_wrapper);
+	#elif defined(SSL_CTX_set_tlsext_ticket_key_cb)
+	SSL_CTX_set_tlsext_ticket_key_cb (pCtx, TicketKeys.empty() ? NULL : ssl_ticket_key_wrapper);
+	#endif
+}
+
+
+/**************************
+SslContext_t::_TakeSession
+**************************/
+
+SSL_SESSION *SslContext_t::_TakeSession (const std::string &key)
+{
+	/* Returns a reference to the session stored under key, or NULL.
+	 * TLS 1.3 tickets are meant to be used once, so those are removed;
+	 * the connection that resumes with one will be sent fresh ones.
+	 */
+	SSL_SESSION *session = NULL;
+
+	#ifdef HAVE_SSL_SESSION_UP_REF
+	std::map<std::string, SSL_SESSION*>::iterator it = Sessions.find (key);
+	if (it == Sessions.end())
+		return NULL;
+
+	session = it->second;
+	#ifdef TLS1_3_VERSION
+	if (SSL_SESSION_get_protocol_version (session) >= TLS1_3_VERSION) {
+		Sessions.erase (it);
+		return session;
+	}
+	#endif
+	SSL_SESSION_up_ref (session);
+	#endif
+
+	return session;
+}
+
+
+/***************************
+SslContext_t::_StoreSession
+***************************/
+
+void SslContext_t::_StoreSession (const std::string &key, SSL_SESSION *session)
+{
+	// Takes over the caller's reference to session.
+	std::map<std::string, SSL_SESSION*>::iterator it = Sessions.find (key);
+	if (it != Sessions.end()) {
+		SSL_SESSION_free (it->second);
+		it->second = session;
+		return;
+	}
+
+	if (Sessions.size() >= MaxClientSessions) {
+		SSL_SESSION_free (Sessions.begin()->second);
+		Sessions.erase (Sessions.begin());
+	}
+	Sessions.insert (std::make_pair (key, session));
+}
+
+
 /******************
 SslBox_t::SslBox_t
 ******************/
 
-SslBox_t::SslBox_t (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, bool verify_peer, bool fail_if_no_peer_cert, const std::string &snihostname, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version, const uintptr_t binding):
+SslBox_t::SslBox_t (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, bool verify_peer, bool fail_if_no_peer_cert, const std::string &snihostname, const std::string &peername, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version, bool dynamic_records, SOCKET sd, const uintptr_t binding):
 	bIsServer (is_server),
 	bHandshakeCompleted (false),
 	bVerifyPeer (verify_peer),
 	bFailIfNoPeerCert (fail_if_no_peer_cert),
+	bOnSocket (sd != INVALID_SOCKET),
+	bWantWrite (false),
+	bDynamicRecords (dynamic_records && (sd == INVALID_SOCKET)),
+	bShrunk (false),
+	SmallRecordBytes (0),
+	LastWriteTime (0),
 	pSSL (NULL),
 	pbioRead (NULL),
-	pbioWrite (NULL)
+	pbioWrite (NULL),
+	InboundCiphertext (NULL),
+	InboundLength (0)
 {
-	/* TODO someday: make it possible to re-use SSL contexts so we don't have to create
-	 * a new one every time we come here.
-	 */
+	memset (&Counters, 0, sizeof(Counters));
 
-	Context = new SslContext_t (bIsServer, privkeyfile, privkey, privkeypass, certchainfile, cert, cipherlist, ecdh_curve, dhparam, ssl_version);
+	bool created;
+	Context = SslContext_t::Acquire (bIsServer, privkeyfile, privkey, privkeypass, certchainfile, cert, cipherlist, ecdh_curve, dhparam, ssl_version, &created);
 	assert (Context);
-
-	pbioRead = BIO_new (BIO_s_mem());
-	assert (pbioRead);
-
-	pbioWrite = BIO_new (BIO_s_mem());
-	assert (pbioWrite);
+	if (created)
+		Counters.ContextsCreated++;
+	else
+		Counters.ContextsReused++;
 
 	pSSL = SSL_new (Context->pCtx);
 	assert (pSSL);
@@ -375,20 +781,95 @@ SslBox_t::SslBox_t (bool is_server, const std::string &privkeyfile, const std::s
 		SSL_set_tlsext_host_name (pSSL, snihostname.c_str());
 	}
 
-	SSL_set_bio (pSSL, pbioRead, pbioWrite);
+	if (bOnSocket) {
+		/* OpenSSL reads and writes the socket itself, and switches it to
+		 * kernel TLS after the handshake if the kernel and the negotiated
+		 * cipher allow; otherwise it carries on encrypting in userspace.
+		 * EventMachine never sends close_notify, so neither should the
+		 * destructor, by which time the descriptor may have been reused.
+		 */
+		SSL_set_fd (pSSL, sd);
+		#ifdef SSL_OP_ENABLE_KTLS
+		SSL_set_options (pSSL, SSL_OP_ENABLE_KTLS);
+		#endif
+		#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+		SSL_set_options (pSSL, SSL_OP_IGNORE_UNEXPECTED_EOF);
+		#endif
+		#ifdef SSL_OP_NO_RENEGOTIATION
+		SSL_set_options (pSSL, SSL_OP_NO_RENEGOTIATION);
+		#endif
+		SSL_set_mode (pSSL, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		SSL_set_quiet_shutdown (pSSL, 1);
+		if (bIsServer)
+			SSL_set_accept_state (pSSL);
+		else {
+			SSL_set_connect_state (pSSL);
+			bWantWrite = true;
+		}
+	}
+	else {
+		#ifdef HAVE_BIO_METH_NEW
+		/* One BIO for both directions, reading and writing the connection's
+		 * buffers rather than copying through memory BIOs. Since writes to
+		 * it never block, SSL_write turns all the plaintext it's given into
+		 * full-size records at once; reading ahead lets SSL_read take all
+		 * the ciphertext there is in one go.
+		 */
+		pbioRead = pbioWrite = BIO_new (ConnectionBioMethod);
+		assert (pbioRead);
+		BIO_set_data (pbioRead, this);
+		BIO_set_init (pbioRead, 1);
+		SSL_set_read_ahead (pSSL, 1);
+		#else
+		pbioRead = BIO_new (BIO_s_mem());
+		assert (pbioRead);
+
+		pbioWrite = BIO_new (BIO_s_mem());
+		assert (pbioWrite);
+		#endif
+
+		SSL_set_bio (pSSL, pbioRead, pbioWrite);
+	}
 
 	// Store a pointer to the binding signature in the SSL object so we can retrieve it later
 	SSL_set_ex_data(pSSL, 0, (void*) binding);
+	SSL_set_ex_data(pSSL, SslBoxIndex, this);
+
+	#ifdef SSL3_RT_HEADER
+	SSL_set_msg_callback (pSSL, ssl_msg_wrapper);
+	#endif
 
 	if (bVerifyPeer) {
 		int mode = SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE;
 		if (bFailIfNoPeerCert)
 			mode = mode | SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
 		SSL_set_verify(pSSL, mode, ssl_verify_wrapper);
+
+		/* Keep sessions from listeners that didn't ask for a certificate, or
+		 * didn't insist on one, from resuming here without one. Those that
+		 * do resume are still put to ssl_verify_peer; see _VerifyResumedPeer.
+		 */
+		if (bIsServer) {
+			std::string id = Context->SessionId + (bFailIfNoPeerCert ? ":verify-required" : ":verify");
+			unsigned char sid_ctx [SSL_MAX_SID_CTX_LENGTH];
+			unsigned int sid_ctx_length = SessionIdContext (id, sid_ctx);
+			SSL_set_session_id_context (pSSL, sid_ctx, sid_ctx_length);
+		}
 	}
 
-	if (!bIsServer) {
+	if (!bIsServer && (peername.length() > 0)) {
+		SessionKey = peername + " " + snihostname;
+		SSL_SESSION *session = Context->_TakeSession (SessionKey);
+		if (session) {
+			SSL_set_session (pSSL, session);
+			SSL_SESSION_free (session);
+		}
+	}
+
+	if (!bIsServer && !bOnSocket) {
+		uint64_t started = SslClock();
 		int e = SSL_connect (pSSL);
+		Counters.HandshakeTime += SslClock() - started;
 		if (e != 1)
 			ERR_print_errors_fp(stderr);
 	}
@@ -406,12 +887,22 @@ SslBox_t::~SslBox_t()
 	if (pSSL) {
 		if (SSL_get_shutdown (pSSL) & SSL_RECEIVED_SHUTDOWN)
 			SSL_shutdown (pSSL);
-		else
+		else {
+			// Most peers hang up without a close_notify. Don't let SSL_clear
+			// invalidate the session for that; fatal errors already have.
+			if (bHandshakeCompleted)
+				SSL_set_shutdown (pSSL, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
 			SSL_clear (pSSL);
+		}
 		SSL_free (pSSL);
 	}
 
-	delete Context;
+	while (!OutboundCiphertext.empty()) {
+		free (OutboundCiphertext.front().first);
+		OutboundCiphertext.pop_front();
+	}
+
+	Context->Release();
 }
 
 
@@ -423,11 +914,85 @@ SslBox_t::PutCiphertext
 bool SslBox_t::PutCiphertext (const char *buf, int bufsize)
 {
 	assert (buf && (bufsize > 0));
-
+	bShrunk = false;
+
+	#ifdef HAVE_BIO_METH_NEW
+	// The caller's buffer is only borrowed: it has to stay put until the
+	// caller is done calling GetPlaintext, and then calls KeepCiphertext.
+	if (InboundLength > 0) {
+		UnreadCiphertext.erase (0, InboundCiphertext - UnreadCiphertext.data());
+		UnreadCiphertext.append (buf, bufsize);
+		InboundCiphertext = UnreadCiphertext.data();
+		InboundLength = UnreadCiphertext.size();
+	}
+	else {
+		InboundCiphertext = buf;
+		InboundLength = bufsize;
+	}
+	return true;
+	#else
 	assert (pbioRead);
 	int n = BIO_write (pbioRead, buf, bufsize);
 
 	return (n == bufsize) ? true : false;
+	#endif
+}
+
+
+/************************
+SslBox_t::KeepCiphertext
+************************/
+
+void SslBox_t::KeepCiphertext()
+{
+	/* Called when the buffer last given to PutCiphertext is about to go
+	 * away. Reading until GetPlaintext returns 0 uses it all up, so this
+	 * only copies when that was cut short.
+	 */
+	if (InboundLength > 0) {
+		std::string unread (InboundCiphertext, InboundLength);
+		UnreadCiphertext.swap (unread);
+		InboundCiphertext = UnreadCiphertext.data();
+	}
+	else {
+		std::string().swap (UnreadCiphertext);
+		InboundCiphertext = NULL;
+	}
+}
+
+
+/************************
+SslBox_t::ReadCiphertext
+************************/
+
+int SslBox_t::ReadCiphertext (char *buf, int bufsize)
+{
+	if (InboundLength == 0)
+		return 0;
+
+	int n = (bufsize < InboundLength) ? bufsize : InboundLength;
+	memcpy (buf, InboundCiphertext, n);
+	InboundCiphertext += n;
+	InboundLength -= n;
+	return n;
+}
+
+
+/*************************
+SslBox_t::WriteCiphertext
+*************************/
+
+bool SslBox_t::WriteCiphertext (const char *buf, int bufsize)
+{
+	// Pages are malloc'd with a guard byte, like the connection's own, so
+	// that it can take them over as they are.
+	char *page = (char *) malloc (bufsize + 1);
+	if (!page)
+		return false;
+	memcpy (page, buf, bufsize);
+	page [bufsize] = 0;
+	OutboundCiphertext.push_back (std::make_pair (page, bufsize));
+	return true;
 }
 
 
@@ -438,18 +1003,9 @@ SslBox_t::GetPlaintext
 int SslBox_t::GetPlaintext (char *buf, int bufsize)
 {
 	if (!SSL_is_init_finished (pSSL)) {
-		int e = bIsServer ? SSL_accept (pSSL) : SSL_connect (pSSL);
-		if (e != 1) {
-			int er = SSL_get_error (pSSL, e);
-			if (er != SSL_ERROR_WANT_READ) {
-				ERR_print_errors_fp(stderr);
-				// Return -1 for a nonfatal error, -2 for an error that should force the connection down.
-				return (er == SSL_ERROR_SSL) ? (-2) : (-1);
-			}
-			else
-				return 0;
-		}
-		bHandshakeCompleted = true;
+		int h = Handshake();
+		if (h <= 0)
+			return h;
 		// If handshake finished, FALL THROUGH and return the available plaintext.
 	}
 
@@ -462,8 +1018,11 @@ int SslBox_t::GetPlaintext (char *buf, int bufsize)
 
 	//cerr << "CIPH: " << SSL_get_cipher (pSSL) << endl;
 
+	uint64_t started = SslClock();
 	int n = SSL_read (pSSL, buf, bufsize);
+	Counters.ReadTime += SslClock() - started;
 	if (n >= 0) {
+		Counters.BytesDecrypted += n;
 		return n;
 	}
 	else {
@@ -480,28 +1039,201 @@ int SslBox_t::GetPlaintext (char *buf, int bufsize)
 
 
 
+/*******************
+SslBox_t::Handshake
+*******************/
+
+int SslBox_t::Handshake()
+{
+	/* Moves the handshake along with the ciphertext we have. Returns 1 when
+	 * it has completed, 0 if it needs more data, -1 for a nonfatal error and
+	 * -2 for an error that should force the connection down. For servers
+	 * this may run on an SslHandshakePool_t thread.
+	 */
+	uint64_t started = SslClock();
+	int e = bIsServer ? SSL_accept (pSSL) : SSL_connect (pSSL);
+	Counters.HandshakeTime += SslClock() - started;
+	if (e != 1) {
+		int er = SSL_get_error (pSSL, e);
+		if (er != SSL_ERROR_WANT_READ) {
+			ERR_print_errors_fp(stderr);
+			return (er == SSL_ERROR_SSL) ? (-2) : (-1);
+		}
+		else
+			return 0;
+	}
+	bHandshakeCompleted = true;
+	if (!_VerifyResumedPeer())
+		return -2;
+	return 1;
+}
+
+
+
+/********************
+SslBox_t::ReadSocket
+********************/
+
+int SslBox_t::ReadSocket (char *buf, int bufsize)
+{
+	/* Takes the place of PutCiphertext and GetPlaintext when the box owns
+	 * the socket. Returns the number of plaintext bytes read, 0 when the
+	 * socket has nothing more for now (or the handshake is still going),
+	 * -1 once the peer has closed and -2 on a fatal TLS error.
+	 */
+	assert (bOnSocket);
+	ERR_clear_error();
+	bWantWrite = false;
+	bShrunk = false;
+
+	if (!bHandshakeCompleted) {
+		int h = _SocketHandshake();
+		if (h != 1)
+			return h;
+	}
+
+	uint64_t started = SslClock();
+	int n = SSL_read (pSSL, buf, bufsize);
+	Counters.ReadTime += SslClock() - started;
+	if (n <= 0)
+		return _SocketResult (n);
+	Counters.BytesDecrypted += n;
+	return n;
+}
+
+
+/*********************
+SslBox_t::WriteSocket
+*********************/
+
+int SslBox_t::WriteSocket (const char *buf, int length)
+{
+	/* Takes the place of PutPlaintext and TakeCiphertext when the box owns
+	 * the socket. Returns the number of bytes accepted, which may be fewer
+	 * than length, and otherwise the same as ReadSocket. A zero length
+	 * just moves the handshake along.
+	 */
+	assert (bOnSocket);
+	ERR_clear_error();
+	bWantWrite = false;
+	bShrunk = false;
+
+	if (!bHandshakeCompleted) {
+		int h = _SocketHandshake();
+		if (h != 1)
+			return h;
+	}
+
+	if (length == 0)
+		return 0;
+
+	uint64_t started = SslClock();
+	int n = SSL_write (pSSL, buf, length);
+	Counters.WriteTime += SslClock() - started;
+	if (n <= 0)
+		return _SocketResult (n);
+	Counters.BytesEncrypted += n;
+	return n;
+}
+
+
 /**************************
-SslBox_t::CanGetCiphertext
+SslBox_t::_SocketHandshake
 **************************/
 
-bool SslBox_t::CanGetCiphertext()
+int SslBox_t::_SocketHandshake()
 {
-	assert (pbioWrite);
-	return BIO_pending (pbioWrite) ? true : false;
+	uint64_t started = SslClock();
+	int e = SSL_do_handshake (pSSL);
+	Counters.HandshakeTime += SslClock() - started;
+	if (e != 1)
+		return _SocketResult (e);
+
+	bHandshakeCompleted = true;
+	if (!_VerifyResumedPeer())
+		return -2;
+	return 1;
 }
 
 
+/***********************
+SslBox_t::_SocketResult
+***********************/
+
+int SslBox_t::_SocketResult (int ret)
+{
+	switch (SSL_get_error (pSSL, ret)) {
+		case SSL_ERROR_WANT_READ:
+			return 0;
+		case SSL_ERROR_WANT_WRITE:
+			bWantWrite = true;
+			return 0;
+		case SSL_ERROR_ZERO_RETURN:
+			return -1;
+		case SSL_ERROR_SYSCALL:
+			ERR_clear_error();
+			return -1;
+		default:
+			ERR_print_errors_fp(stderr);
+			return -2;
+	}
+}
+
 
 /***********************
-SslBox_t::GetCiphertext
+SslBox_t::GetKtlsStatus
 ***********************/
 
-int SslBox_t::GetCiphertext (char *buf, int bufsize)
+int SslBox_t::GetKtlsStatus()
 {
-	assert (pbioWrite);
-	assert (buf && (bufsize > 0));
+	// Bit 0 is set if the kernel encrypts what we send, bit 1 if it
+	// decrypts what we receive.
+	int status = 0;
+
+	#ifdef BIO_get_ktls_send
+	if (bOnSocket) {
+		if (BIO_get_ktls_send (SSL_get_wbio (pSSL)))
+			status |= 1;
+		if (BIO_get_ktls_recv (SSL_get_rbio (pSSL)))
+			status |= 2;
+	}
+	#endif
 
-	return BIO_read (pbioWrite, buf, bufsize);
+	return status;
+}
+
+
+/************************
+SslBox_t::TakeCiphertext
+************************/
+
+char *SslBox_t::TakeCiphertext (int *length)
+{
+	/* Returns the next page of ciphertext to send, with its length, or NULL
+	 * if there is none. The caller owns the page and frees it with free().
+	 */
+	assert (length);
+
+	#ifdef HAVE_BIO_METH_NEW
+	if (OutboundCiphertext.empty())
+		return NULL;
+	char *page = OutboundCiphertext.front().first;
+	*length = OutboundCiphertext.front().second;
+	OutboundCiphertext.pop_front();
+	return page;
+	#else
+	assert (pbioWrite);
+	int pending = BIO_pending (pbioWrite);
+	if (pending <= 0)
+		return NULL;
+	char *page = (char *) malloc (pending + 1);
+	if (!page)
+		throw std::runtime_error ("no allocation for outbound data");
+	*length = BIO_read (pbioWrite, page, pending);
+	assert (*length == pending);
+	page [pending] = 0;
+	return page;
+	#endif
 }
 
 
@@ -529,26 +1261,42 @@ int SslBox_t::PutPlaintext (const char *buf, int bufsize)
 	 * and we are signalling that we have accepted the outbound data (if any).
 	 */
 
-	OutboundQ.Push (buf, bufsize);
+	/* The caller's data is only copied into the queue when it can't be
+	 * written straight away. Nothing holds back the ciphertext, which the
+	 * caller takes with TakeCiphertext, so a write turns all of the data
+	 * into records at once.
+	 */
+
+	bShrunk = false;
+
+	if (buf && (bufsize > 0) && (OutboundQ.HasPages() || !SSL_is_init_finished (pSSL))) {
+		OutboundQ.Push (buf, bufsize);
+		buf = NULL;
+	}
 
 	if (!SSL_is_init_finished (pSSL))
 		return 0;
 
 	bool fatal = false;
 	bool did_work = false;
-	int pending = BIO_pending(pbioWrite);
 
-	while (OutboundQ.HasPages() && pending < SSLBOX_WRITE_BUFFER_SIZE) {
+	while (OutboundQ.HasPages()) {
 		const char *page;
 		int length;
 		OutboundQ.Front (&page, &length);
 		assert (page && (length > 0));
-		int n = SSL_write (pSSL, page, length);
-		pending = BIO_pending(pbioWrite);
+		int n = _WritePlaintext (page, length);
 
 		if (n > 0) {
 			did_work = true;
-			OutboundQ.PopFront();
+			if (n < length) {
+				// The rest of the page is past the small records.
+				std::string rest (page + n, length - n);
+				OutboundQ.PopFront();
+				OutboundQ.PushFront (rest.data(), rest.size());
+			}
+			else
+				OutboundQ.PopFront();
 		}
 		else {
 			int er = SSL_get_error (pSSL, n);
@@ -558,6 +1306,23 @@ int SslBox_t::PutPlaintext (const char *buf, int bufsize)
 		}
 	}
 
+	while (buf && (bufsize > 0)) {
+		int n = OutboundQ.HasPages() ? 0 : _WritePlaintext (buf, bufsize);
+		if (n > 0) {
+			did_work = true;
+			buf += n;
+			bufsize -= n;
+		}
+		else {
+			int er = SSL_get_error (pSSL, n);
+			if (!OutboundQ.HasPages() && (er != SSL_ERROR_WANT_READ) && (er != SSL_ERROR_WANT_WRITE))
+				fatal = true;
+			else
+				OutboundQ.Push (buf, bufsize);
+			break;
+		}
+	}
+
 
 	if (did_work)
 		return 1;
@@ -567,6 +1332,119 @@ int SslBox_t::PutPlaintext (const char *buf, int bufsize)
 		return 0;
 }
 
+/****************
+SslBox_t::Shrink
+****************/
+
+void SslBox_t::Shrink()
+{
+	/* Called when the connection has been idle for a while. With
+	 * SSL_MODE_RELEASE_BUFFERS OpenSSL lets its record buffers go when
+	 * they're empty, but not those holding a partial record or read ahead
+	 * of what was asked for; those are freed here when they're empty, as
+	 * are the memory BIOs' buffers. Anything still to be processed stays.
+	 */
+	bShrunk = true;
+
+	#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_free_buffers (pSSL);
+	#endif
+
+	#ifndef HAVE_BIO_METH_NEW
+	if (!bOnSocket && (BIO_pending (pbioRead) == 0) && (BIO_pending (pbioWrite) == 0)) {
+		pbioRead = BIO_new (BIO_s_mem());
+		pbioWrite = BIO_new (BIO_s_mem());
+		assert (pbioRead && pbioWrite);
+		SSL_set_bio (pSSL, pbioRead, pbioWrite);
+	}
+	#endif
+}
+
+
+/************************
+SslBox_t::GetMemoryUsage
+************************/
+
+size_t SslBox_t::GetMemoryUsage()
+{
+	/* The bytes this box holds on to: itself, and ciphertext and plaintext
+	 * waiting to go one way or the other. OpenSSL's own state for the
+	 * connection (a few KB, plus up to two record buffers when they're in
+	 * use) is not counted, as OpenSSL doesn't report it.
+	 */
+	size_t size = sizeof (*this) + UnreadCiphertext.capacity() + OutboundQ.GetSize();
+	for (size_t i = 0; i < OutboundCiphertext.size(); i++)
+		size += OutboundCiphertext[i].second;
+	#ifndef HAVE_BIO_METH_NEW
+	if (!bOnSocket)
+		size += BIO_pending (pbioRead) + BIO_pending (pbioWrite);
+	#endif
+	return size;
+}
+
+
+/***********************
+SslBox_t::NoteWriteTime
+***********************/
+
+void SslBox_t::NoteWriteTime (uint64_t now)
+{
+	// Called with the time whenever the application sends data. A queue
+	// still waiting on a write has to be retried with the same sizes.
+	if (bDynamicRecords && (now - LastWriteTime >= SSLBOX_RECORD_IDLE_RESET) && !OutboundQ.HasPages())
+		SmallRecordBytes = 0;
+	LastWriteTime = now;
+}
+
+
+/*************************
+SslBox_t::_WritePlaintext
+*************************/
+
+int SslBox_t::_WritePlaintext (const char *buf, int bufsize)
+{
+	/* SSL_write, except that with dynamic record sizing, only what still
+	 * goes in small records is written while they last. The caller writes
+	 * the rest in full-size records with another call.
+	 */
+	bool small = bDynamicRecords && (SmallRecordBytes < SSLBOX_SMALL_RECORD_LIMIT);
+	if (small) {
+		if ((uint64_t) bufsize > SSLBOX_SMALL_RECORD_LIMIT - SmallRecordBytes)
+			bufsize = (int) (SSLBOX_SMALL_RECORD_LIMIT - SmallRecordBytes);
+		SSL_set_max_send_fragment (pSSL, SSLBOX_SMALL_RECORD_SIZE);
+	}
+
+	uint64_t started = SslClock();
+	int n = SSL_write (pSSL, buf, bufsize);
+	Counters.WriteTime += SslClock() - started;
+
+	if (small) {
+		SSL_set_max_send_fragment (pSSL, SSL3_RT_MAX_PLAIN_LENGTH);
+		#ifdef SSL_set_split_send_fragment
+		// Shrinking the fragment size shrank the split size with it.
+		SSL_set_split_send_fragment (pSSL, SSL3_RT_MAX_PLAIN_LENGTH);
+		#endif
+		if (n > 0)
+			SmallRecordBytes += n;
+	}
+
+	if (n > 0)
+		Counters.BytesEncrypted += n;
+	return n;
+}
+
+
+/**********************
+SslBox_t::TakeCounters
+**********************/
+
+void SslBox_t::TakeCounters (SslCounters_t *counters)
+{
+	*counters = Counters;
+	memset (&Counters, 0, sizeof(Counters));
+}
+
+
 /**********************
 SslBox_t::GetPeerCert
 **********************/
@@ -581,6 +1459,56 @@ X509 *SslBox_t::GetPeerCert()
 	return cert;
 }
 
+/*********************
+SslBox_t::SaveSession
+*********************/
+
+bool SslBox_t::SaveSession (SSL_SESSION *session)
+{
+	// Called by OpenSSL with each new session (or TLS 1.3 ticket) a server
+	// gives us. Returns true if we kept the reference we were handed.
+	if (bIsServer || SessionKey.empty())
+		return false;
+
+	Context->_StoreSession (SessionKey, session);
+	return true;
+}
+
+
+/****************************
+SslBox_t::_VerifyResumedPeer
+****************************/
+
+bool SslBox_t::_VerifyResumedPeer()
+{
+	/* A resumed handshake carries no certificates, so OpenSSL doesn't call
+	 * ssl_verify_wrapper. Offer the peer certificate remembered with the
+	 * session instead, so that ssl_verify_peer still gets to see it; the
+	 * session may have been made on a listener with another handler.
+	 * A server that doesn't insist on a certificate can do without one.
+	 */
+	if (!bVerifyPeer || !SSL_session_reused (pSSL))
+		return true;
+
+	X509 *cert = SSL_get_peer_certificate (pSSL);
+	if (!cert)
+		return bIsServer && !bFailIfNoPeerCert;
+
+	BIO *out = BIO_new (BIO_s_mem());
+	BUF_MEM *buf;
+	PEM_write_bio_X509 (out, cert);
+	BIO_write (out, "\0", 1);
+	BIO_get_mem_ptr (out, &buf);
+
+	ConnectionDescriptor *cd = dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject ((uintptr_t) SSL_get_ex_data (pSSL, 0)));
+	bool result = cd ? cd->VerifySslPeer (buf->data) : false;
+	BIO_free (out);
+	X509_free (cert);
+
+	return result;
+}
+
+
 /**********************
 SslBox_t::GetCipherBits
 **********************/
@@ -657,5 +1585,285 @@ extern "C" int ssl_verify_wrapper(int preverify_ok UNUSED, X509_STORE_CTX *ctx)
 	return result;
 }
 
+/***************
+ssl_msg_wrapper
+***************/
+
+#ifdef SSL3_RT_HEADER
+extern "C" void ssl_msg_wrapper(int write_p, int version UNUSED, int content_type, const void *buf UNUSED, size_t len UNUSED, SSL *ssl, void *arg UNUSED)
+{
+	// OpenSSL shows us the header of each record it reads or writes.
+	if (content_type != SSL3_RT_HEADER)
+		return;
+	SslBox_t *box = (SslBox_t*) SSL_get_ex_data (ssl, SslBoxIndex);
+	if (box)
+		box->CountRecord (write_p ? true : false);
+}
+#endif
+
+
+/***********************
+ssl_new_session_wrapper
+***********************/
+
+extern "C" int ssl_new_session_wrapper(SSL *ssl, SSL_SESSION *session)
+{
+	SslBox_t *box = (SslBox_t*) SSL_get_ex_data (ssl, SslBoxIndex);
+	return (box && box->SaveSession (session)) ? 1 : 0;
+}
+
+
+#ifdef HAVE_BIO_METH_NEW
+/********************
+ssl_bio_read_wrapper
+********************/
+
+extern "C" int ssl_bio_read_wrapper(BIO *bio, char *buf, int len)
+{
+	SslBox_t *box = (SslBox_t*) BIO_get_data (bio);
+	BIO_clear_retry_flags (bio);
+	int n = box->ReadCiphertext (buf, len);
+	if (n == 0) {
+		BIO_set_retry_read (bio);
+		return -1;
+	}
+	return n;
+}
+
+
+/*********************
+ssl_bio_write_wrapper
+*********************/
+
+extern "C" int ssl_bio_write_wrapper(BIO *bio, const char *buf, int len)
+{
+	SslBox_t *box = (SslBox_t*) BIO_get_data (bio);
+	BIO_clear_retry_flags (bio);
+	return box->WriteCiphertext (buf, len) ? len : -1;
+}
+
+
+/********************
+ssl_bio_ctrl_wrapper
+********************/
+
+extern "C" long ssl_bio_ctrl_wrapper(BIO *bio UNUSED, int cmd, long num UNUSED, void *ptr UNUSED)
+{
+	// Writes go straight to the outbound queue, so there's never anything
+	// to flush.
+	return (cmd == BIO_CTRL_FLUSH) ? 1 : 0;
+}
+#endif
+
+
+/**********************
+ssl_ticket_key_wrapper
+**********************/
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+extern "C" int ssl_ticket_key_wrapper(SSL *ssl UNUSED, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc)
+#else
+extern "C" int ssl_ticket_key_wrapper(SSL *ssl UNUSED, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc)
+#endif
+{
+	/* Returns 1 to use the ticket, 2 to use it and issue a fresh one under
+	 * the current key, 0 for an unknown key (a full handshake follows)
+	 * and -1 on error.
+	 */
+	if (enc && (RAND_bytes (iv, EVP_CIPHER_iv_length (EVP_aes_128_cbc())) <= 0))
+		return -1;
+
+	// Take a copy of the key, which may be replaced meanwhile.
+	unsigned char key [48];
+	size_t i = 0;
+	size_t count;
+	#ifdef OS_UNIX
+	pthread_mutex_lock (&TicketKeysLock);
+	#endif
+	count = TicketKeys.size();
+	if (!enc) {
+		while ((i < count) && memcmp (key_name, TicketKeys[i].data(), 16))
+			i++;
+	}
+	if (i < count)
+		memcpy (key, TicketKeys[i].data(), 48);
+	#ifdef OS_UNIX
+	pthread_mutex_unlock (&TicketKeysLock);
+	#endif
+
+	if (count == 0)
+		return enc ? -1 : 0;
+	if (i == count)
+		return 0;
+	if (enc)
+		memcpy (key_name, key, 16);
+
+	#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[3];
+	params[0] = OSSL_PARAM_construct_octet_string (OSSL_MAC_PARAM_KEY, (void*)(key + 16), 16);
+	params[1] = OSSL_PARAM_construct_utf8_string (OSSL_MAC_PARAM_DIGEST, (char*)"sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (!EVP_MAC_CTX_set_params (hctx, params))
+		return -1;
+	#else
+	if (!HMAC_Init_ex (hctx, key + 16, 16, EVP_sha256(), NULL))
+		return -1;
+	#endif
+
+	int ok = enc ? EVP_EncryptInit_ex (ctx, EVP_aes_128_cbc(), NULL, key + 32, iv) : EVP_DecryptInit_ex (ctx, EVP_aes_128_cbc(), NULL, key + 32, iv);
+	if (!ok)
+		return -1;
+
+	return (i == 0) ? 1 : 2;
+}
+
+
+#ifdef OS_UNIX
+/**************************************
+SslHandshakePool_t::SslHandshakePool_t
+**************************************/
+
+SslHandshakePool_t::SslHandshakePool_t (EventMachine_t *em, int threads):
+	MyEventMachine (em),
+	bStopping (false)
+{
+	pthread_mutex_init (&Lock, NULL);
+	pthread_cond_init (&JobReady, NULL);
+
+	for (int i = 0; i < threads; i++) {
+		pthread_t thread;
+		if (pthread_create (&thread, NULL, _Run, this) != 0)
+			break;
+		Threads.push_back (thread);
+	}
+	if (Threads.empty())
+		throw std::runtime_error ("unable to start TLS handshake threads");
+}
+
+
+/***************************************
+SslHandshakePool_t::~SslHandshakePool_t
+***************************************/
+
+SslHandshakePool_t::~SslHandshakePool_t()
+{
+	/* By now every connection has gone, so whatever boxes are left have
+	 * all been released to us. Jobs still queued are dropped.
+	 */
+	pthread_mutex_lock (&Lock);
+	bStopping = true;
+	pthread_cond_broadcast (&JobReady);
+	pthread_mutex_unlock (&Lock);
+
+	for (size_t i = 0; i < Threads.size(); i++)
+		pthread_join (Threads[i], NULL);
+
+	for (std::map<SslBox_t*, uintptr_t>::iterator it = InFlight.begin(); it != InFlight.end(); ++it)
+		delete it->first;
+
+	pthread_cond_destroy (&JobReady);
+	pthread_mutex_destroy (&Lock);
+}
+
+
+/**************************
+SslHandshakePool_t::Submit
+**************************/
+
+void SslHandshakePool_t::Submit (SslBox_t *box, const uintptr_t binding)
+{
+	Job_t job;
+	job.Box = box;
+	job.Result = 0;
+
+	pthread_mutex_lock (&Lock);
+	InFlight [box] = binding;
+	Queued.push_back (job);
+	pthread_cond_signal (&JobReady);
+	pthread_mutex_unlock (&Lock);
+}
+
+
+/***************************
+SslHandshakePool_t::Release
+***************************/
+
+bool SslHandshakePool_t::Release (SslBox_t *box)
+{
+	// Returns true if we took the box over, because it's in a handshake.
+	bool taken = false;
+
+	pthread_mutex_lock (&Lock);
+	std::map<SslBox_t*, uintptr_t>::iterator it = InFlight.find (box);
+	if (it != InFlight.end()) {
+		it->second = 0;
+		taken = true;
+	}
+	pthread_mutex_unlock (&Lock);
+
+	return taken;
+}
+
+
+/**********************************
+SslHandshakePool_t::RunCompletions
+**********************************/
+
+void SslHandshakePool_t::RunCompletions()
+{
+	std::deque<Job_t> finished;
+	std::vector<uintptr_t> bindings;
+
+	pthread_mutex_lock (&Lock);
+	finished.swap (Finished);
+	for (size_t i = 0; i < finished.size(); i++) {
+		std::map<SslBox_t*, uintptr_t>::iterator it = InFlight.find (finished[i].Box);
+		assert (it != InFlight.end());
+		bindings.push_back (it->second);
+		InFlight.erase (it);
+	}
+	pthread_mutex_unlock (&Lock);
+
+	for (size_t i = 0; i < finished.size(); i++) {
+		ConnectionDescriptor *cd = bindings[i] ? dynamic_cast <ConnectionDescriptor*> (Bindable_t::GetObject (bindings[i])) : NULL;
+		if (cd)
+			cd->FinishOffloadedHandshake (finished[i].Result);
+		else
+			delete finished[i].Box;
+	}
+}
+
+
+/************************
+SslHandshakePool_t::_Run
+************************/
+
+void *SslHandshakePool_t::_Run (void *arg)
+{
+	SslHandshakePool_t *pool = (SslHandshakePool_t*) arg;
+
+	pthread_mutex_lock (&pool->Lock);
+	while (true) {
+		while (!pool->bStopping && pool->Queued.empty())
+			pthread_cond_wait (&pool->JobReady, &pool->Lock);
+		if (pool->bStopping)
+			break;
+
+		Job_t job = pool->Queued.front();
+		pool->Queued.pop_front();
+		pthread_mutex_unlock (&pool->Lock);
+
+		job.Result = job.Box->Handshake();
+
+		pthread_mutex_lock (&pool->Lock);
+		pool->Finished.push_back (job);
+		pool->MyEventMachine->SignalLoopBreaker();
+	}
+	pthread_mutex_unlock (&pool->Lock);
+
+	return NULL;
+}
+#endif // OS_UNIX
+
 #endif // WITH_SSL
 
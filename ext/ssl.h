@@ -32,16 +32,74 @@ class SslContext_t
 
 class SslContext_t
 {
+	/* Contexts are shared by every connection that starts TLS with the same
+	 * parameters, so keys, certificates and DH params are loaded once rather
+	 * than per connection. Get one with Acquire and hand it back with Release.
+	 * Contexts no connection is using stay cached for the next one, until
+	 * the cache grows to MaxIdleContexts and they are flushed.
+	 *
+	 * Client contexts also keep the sessions of the peers they connect to,
+	 * so that the next connection to the same host, port and SNI hostname
+	 * can resume rather than do a full handshake.
+	 *
+	 * A server context can be Preloaded, so that no connection has to wait
+	 * for its files to be read, and stays cached until the machine shuts
+	 * down. Reload rebuilds the contexts that use a file that has changed
+	 * and swaps them in for new connections; connections already using the
+	 * old ones keep them until they close.
+	 */
+
 	public:
+		static SslContext_t *Acquire (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version, bool *created = NULL);
+		void Release();
+
+		static void Preload (const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version);
+		static int Reload (const std::string &filename);
+
+		static void FlushCache (bool unpin = false);
+
+		static void SetTicketKeys (const char *keys, size_t length);
+		static void SetSessionCacheLimits (long size, long timeout);
+
 		SslContext_t (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version);
 		virtual ~SslContext_t();
 
 	private:
 		static bool bLibraryInitialized;
+		static std::map<std::string, SslContext_t*> Cache;
+		// Those Reload replaced that connections still use.
+		static std::set<SslContext_t*> Retired;
+		enum { MaxIdleContexts = 32 };
+		enum { MaxClientSessions = 1024 };
 
 	private:
+		static SslContext_t *_Create (const std::string &key, int generation, bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version);
+		void _ApplySessionSettings();
+		static void _ReapplySessionSettings();
+		void _LoadFailed (const char*, const std::string&);
+		SSL_SESSION *_TakeSession (const std::string&);
+		void _StoreSession (const std::string&, SSL_SESSION*);
+
 		bool bIsServer;
 		SSL_CTX *pCtx;
+		std::string CacheKey;
+		std::string SessionId;
+		int RefCount;
+		bool bPinned;
+		bool bRetired;
+		int Generation;
+
+		// What the context was made from, for Reload.
+		std::string KeyFile;
+		std::string KeyPem;
+		std::string KeyPass;
+		std::string ChainFile;
+		std::string CertPem;
+		std::string CipherList;
+		std::string EcdhCurve;
+		std::string DhParamFile;
+		int SslVersion;
+		std::map<std::string, SSL_SESSION*> Sessions;
 
 		EVP_PKEY *PrivateKey;
 		X509 *Certificate;
@@ -50,27 +108,77 @@ class SslContext_t
 };
 
 
+/********************
+struct SslCounters_t
+********************/
+
+struct SslCounters_t
+{
+	/* What an SslBox_t did since its connection last took the counts for
+	 * the reactor's TlsStats_t. Times are in nanoseconds spent in OpenSSL.
+	 */
+	uint64_t BytesEncrypted;
+	uint64_t BytesDecrypted;
+	uint64_t RecordsSent;
+	uint64_t RecordsReceived;
+	uint64_t ReadTime;
+	uint64_t WriteTime;
+	uint64_t HandshakeTime;
+	uint64_t ContextsCreated;
+	uint64_t ContextsReused;
+};
+
+
 /**************
 class SslBox_t
 **************/
 
-#define SSLBOX_INPUT_CHUNKSIZE 2019
-#define SSLBOX_OUTPUT_CHUNKSIZE 2048
-#define SSLBOX_WRITE_BUFFER_SIZE 8192 // (SSLBOX_OUTPUT_CHUNKSIZE * 4)
+// Plaintext handed to SSL_write at a time, a whole number of full-size
+// (16 KB) records. Decrypted data is collected in up to
+// SSLBOX_PLAINTEXT_BUFFER_SIZE bytes before it's dispatched.
+#define SSLBOX_RECORD_SIZE (16 * 1024)
+#define SSLBOX_INPUT_CHUNKSIZE (64 * SSLBOX_RECORD_SIZE)
+#define SSLBOX_PLAINTEXT_BUFFER_SIZE (4 * SSLBOX_RECORD_SIZE)
+
+// With dynamic record sizing, records carry at most SSLBOX_SMALL_RECORD_SIZE
+// bytes (so that, with their overhead, each fits in one TCP segment) until
+// SSLBOX_SMALL_RECORD_LIMIT bytes have been sent, counting again from zero
+// after SSLBOX_RECORD_IDLE_RESET microseconds with nothing sent.
+#define SSLBOX_SMALL_RECORD_SIZE 1400
+#define SSLBOX_SMALL_RECORD_LIMIT (1024 * 1024)
+#define SSLBOX_RECORD_IDLE_RESET 1000000
 
 class SslBox_t
 {
 	public:
-		SslBox_t (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, bool verify_peer, bool fail_if_no_peer_cert, const std::string &snihostname, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version, const uintptr_t binding);
+		SslBox_t (bool is_server, const std::string &privkeyfile, const std::string &privkey, const std::string &privkeypass, const std::string &certchainfile, const std::string &cert, bool verify_peer, bool fail_if_no_peer_cert, const std::string &snihostname, const std::string &peername, const std::string &cipherlist, const std::string &ecdh_curve, const std::string &dhparam, int ssl_version, bool dynamic_records, SOCKET sd, const uintptr_t binding);
 		virtual ~SslBox_t();
 
 		int PutPlaintext (const char*, int);
 		int GetPlaintext (char*, int);
+		void NoteWriteTime (uint64_t);
+		int Handshake();
+
+		// Frees what buffers an idle connection can do without.
+		void Shrink();
+		bool IsShrunk() {return bShrunk;}
+		// Written before the handshake finished, so not encrypted yet.
+		size_t GetQueuedPlaintextSize() {return OutboundQ.GetSize();}
+		size_t GetMemoryUsage();
 
 		bool PutCiphertext (const char*, int);
-		bool CanGetCiphertext();
-		int GetCiphertext (char*, int);
+		void KeepCiphertext();
+		char *TakeCiphertext (int*);
+		bool IsServer() {return bIsServer;}
 		bool IsHandshakeCompleted() {return bHandshakeCompleted;}
+		bool IsSessionReused() {return SSL_session_reused (pSSL) ? true : false;}
+
+		// When the box owns the socket, for kernel TLS offload.
+		bool IsOnSocket() {return bOnSocket;}
+		bool WantsWrite() {return bWantWrite;}
+		int ReadSocket (char*, int);
+		int WriteSocket (const char*, int);
+		int GetKtlsStatus();
 
 		X509 *GetPeerCert();
 		int GetCipherBits();
@@ -78,6 +186,15 @@ class SslBox_t
 		const char *GetCipherProtocol();
 		const char *GetSNIHostname();
 
+		bool SaveSession (SSL_SESSION*);
+
+		void TakeCounters (SslCounters_t*);
+		void CountRecord (bool sent) {if (sent) Counters.RecordsSent++; else Counters.RecordsReceived++;}
+
+		// Called by the connection BIO.
+		int ReadCiphertext (char*, int);
+		bool WriteCiphertext (const char*, int);
+
 		void Shutdown();
 
 	protected:
@@ -87,14 +204,98 @@ class SslBox_t
 		bool bHandshakeCompleted;
 		bool bVerifyPeer;
 		bool bFailIfNoPeerCert;
+		bool bOnSocket;
+		bool bWantWrite;
+		bool bDynamicRecords;
+		bool bShrunk;
+		uint64_t SmallRecordBytes;
+		uint64_t LastWriteTime;
+		std::string SessionKey;
+		SslCounters_t Counters;
 		SSL *pSSL;
 		BIO *pbioRead;
 		BIO *pbioWrite;
 
+		/* Without memory BIOs, OpenSSL reads ciphertext from the buffer the
+		 * connection passed to PutCiphertext, and KeepCiphertext copies out
+		 * what it hasn't read by the time the connection is done with it.
+		 * Records it writes are queued as pages for the connection to send.
+		 */
+		const char *InboundCiphertext;
+		int InboundLength;
+		std::string UnreadCiphertext;
+		std::deque<std::pair<char*, int> > OutboundCiphertext;
+
 		PageList OutboundQ;
+
+	private:
+		int _WritePlaintext (const char*, int);
+		bool _VerifyResumedPeer();
+		int _SocketHandshake();
+		int _SocketResult (int);
+};
+
+
+/************************
+class SslHandshakePool_t
+************************/
+
+#ifdef OS_UNIX
+class SslHandshakePool_t
+{
+	/* Worker threads that run the server side of TLS handshakes, where the
+	 * private-key operations are, so that a burst of new clients doesn't
+	 * hold up every other connection on the reactor. A connection hands its
+	 * SslBox to Submit with the ciphertext it has read, and leaves it alone
+	 * until RunCompletions (on the reactor, after the loop breaker fires)
+	 * gives it back with the result of SslBox_t::Handshake. A box whose
+	 * connection goes away meanwhile is Released to the pool, which deletes
+	 * it when its handshake step is done.
+	 */
+
+	public:
+		SslHandshakePool_t (EventMachine_t*, int threads);
+		virtual ~SslHandshakePool_t();
+
+		void Submit (SslBox_t*, const uintptr_t binding);
+		bool Release (SslBox_t*);
+		void RunCompletions();
+
+	private:
+		static void *_Run (void*);
+
+		struct Job_t {
+			SslBox_t *Box;
+			int Result;
+		};
+
+		EventMachine_t *MyEventMachine;
+		pthread_mutex_t Lock;
+		pthread_cond_t JobReady;
+		std::vector<pthread_t> Threads;
+		bool bStopping;
+
+		std::deque<Job_t> Queued;
+		std::deque<Job_t> Finished;
+		std::map<SslBox_t*, uintptr_t> InFlight;
 };
+#endif
 
 extern "C" int ssl_verify_wrapper(int, X509_STORE_CTX*);
+extern "C" int ssl_new_session_wrapper(SSL*, SSL_SESSION*);
+#ifdef SSL3_RT_HEADER
+extern "C" void ssl_msg_wrapper(int, int, int, const void*, size_t, SSL*, void*);
+#endif
+#ifdef HAVE_BIO_METH_NEW
+extern "C" int ssl_bio_read_wrapper(BIO*, char*, int);
+extern "C" int ssl_bio_write_wrapper(BIO*, const char*, int);
+extern "C" long ssl_bio_ctrl_wrapper(BIO*, int, long, void*);
+#endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+extern "C" int ssl_ticket_key_wrapper(SSL*, unsigned char*, unsigned char*, EVP_CIPHER_CTX*, EVP_MAC_CTX*, int);
+#else
+extern "C" int ssl_ticket_key_wrapper(SSL*, unsigned char*, unsigned char*, EVP_CIPHER_CTX*, HMAC_CTX*, int);
+#endif
 
 #endif // WITH_SSL
 
@@ -0,0 +1,174 @@
+/*****************************************************************************
+
+$Id$
+
+File:     tokenizer.cpp
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#include "project.h"
+
+
+/************************
+Tokenizer_t::Tokenizer_t
+************************/
+
+Tokenizer_t::Tokenizer_t (const char *delimiter, size_t delimiter_length, size_t max_length):
+	MaxLength (max_length),
+	Consumed (0),
+	Scanned (0),
+	bOverflowed (false)
+{
+	SetDelimiter (delimiter, delimiter_length);
+}
+
+
+/*************************
+Tokenizer_t::~Tokenizer_t
+*************************/
+
+Tokenizer_t::~Tokenizer_t()
+{
+}
+
+
+/*************************
+Tokenizer_t::SetDelimiter
+*************************/
+
+void Tokenizer_t::SetDelimiter (const char *delimiter, size_t delimiter_length)
+{
+	if (!delimiter || !delimiter_length)
+		throw std::runtime_error ("empty tokenizer delimiter");
+
+	Delimiter.assign (delimiter, delimiter_length);
+
+	// Whatever is buffered has to be looked at again with the new delimiter.
+	Scanned = Consumed;
+}
+
+
+/*******************
+Tokenizer_t::Append
+*******************/
+
+void Tokenizer_t::Append (const char *data, size_t length)
+{
+	_Compact();
+	Buffer.append (data, length);
+}
+
+
+/*****************
+Tokenizer_t::Next
+*****************/
+
+bool Tokenizer_t::Next (const char **token, size_t *length)
+{
+	/* Returns the next complete token, without its delimiter. The token
+	 * points into our buffer and stays valid until the next call to Append
+	 * or Clear. Returns false when no complete token is buffered, or when
+	 * a token has grown past MaxLength (which also sets bOverflowed).
+	 */
+	assert (token && length);
+
+	if (bOverflowed)
+		return false;
+
+	const char *base = Buffer.data();
+	const size_t size = Buffer.size();
+	const size_t dlen = Delimiter.size();
+	const char first = Delimiter[0];
+
+	size_t pos = Scanned;
+	while (size - pos >= dlen) {
+		const char *p = (const char*) memchr (base + pos, first, size - pos - dlen + 1);
+		if (!p) {
+			pos = size - dlen + 1;
+			break;
+		}
+
+		pos = p - base;
+		if ((dlen == 1) || (memcmp (p + 1, Delimiter.data() + 1, dlen - 1) == 0)) {
+			*token = base + Consumed;
+			*length = pos - Consumed;
+			Consumed = Scanned = pos + dlen;
+
+			if (MaxLength && (*length > MaxLength)) {
+				bOverflowed = true;
+				return false;
+			}
+			return true;
+		}
+		pos++;
+	}
+
+	// Everything before pos belongs to the next token, so it can be
+	// skipped when more data arrives, and counted against MaxLength now.
+	Scanned = pos;
+	if (MaxLength && (Scanned - Consumed > MaxLength))
+		bOverflowed = true;
+
+	return false;
+}
+
+
+/******************
+Tokenizer_t::Flush
+******************/
+
+void Tokenizer_t::Flush (const char **data, size_t *length)
+{
+	/* Hands out whatever is buffered, complete tokens and delimiters
+	 * included, and marks it consumed. Like a token, the data stays valid
+	 * until the next call to Append or Clear.
+	 */
+	assert (data && length);
+
+	*data = Buffer.data() + Consumed;
+	*length = Buffer.size() - Consumed;
+	Consumed = Scanned = Buffer.size();
+}
+
+
+/******************
+Tokenizer_t::Clear
+******************/
+
+void Tokenizer_t::Clear()
+{
+	Buffer.clear();
+	Consumed = Scanned = 0;
+	bOverflowed = false;
+}
+
+
+/*********************
+Tokenizer_t::_Compact
+*********************/
+
+void Tokenizer_t::_Compact()
+{
+	if (Consumed == 0)
+		return;
+
+	if (Consumed == Buffer.size())
+		Buffer.clear();
+	else
+		Buffer.erase (0, Consumed);
+
+	Scanned -= Consumed;
+	Consumed = 0;
+}
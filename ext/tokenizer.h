@@ -0,0 +1,60 @@
+/*****************************************************************************
+
+$Id$
+
+File:     tokenizer.h
+Date:     17Oct26
+
+Copyright (C) 2006-07 by Francis Cianfrocca. All Rights Reserved.
+Gmail: blackhedd
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of either: 1) the GNU General Public License
+as published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version; or 2) Ruby's License.
+
+See the file COPYING for complete licensing information.
+
+*****************************************************************************/
+
+
+#ifndef __Tokenizer__H_
+#define __Tokenizer__H_
+
+
+/*****************
+class Tokenizer_t
+*****************/
+
+class Tokenizer_t
+{
+	public:
+		Tokenizer_t (const char *delimiter, size_t delimiter_length, size_t max_length);
+		virtual ~Tokenizer_t();
+
+		void SetDelimiter (const char *delimiter, size_t delimiter_length);
+		void Append (const char *data, size_t length);
+		bool Next (const char **token, size_t *length);
+		void Flush (const char **data, size_t *length);
+		void Clear();
+
+		void SetMaxLength (size_t max_length) { MaxLength = max_length; }
+		size_t GetBufferedSize() { return Buffer.size() - Consumed; }
+		bool IsOverflowed() { return bOverflowed; }
+
+	private:
+		void _Compact();
+
+		std::string Delimiter;
+		size_t MaxLength;
+
+		// Bytes before Consumed have already been handed out as tokens.
+		// Bytes between Consumed and Scanned are known not to start a delimiter.
+		std::string Buffer;
+		size_t Consumed;
+		size_t Scanned;
+		bool bOverflowed;
+};
+
+
+#endif // __Tokenizer__H_
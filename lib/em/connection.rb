@@ -53,6 +53,9 @@ module EventMachine
         @signature = sig
         # associate_callback_target sig
 
+        # Whatever must happen before user code runs, such as starting TLS
+        yield self if block_given?
+
         # Call a superclass's #initialize if it has one
         initialize(*args)
 
@@ -268,6 +271,50 @@ module EventMachine
       EventMachine::close_connection @signature, after_writing
     end
 
+    # Gives a connection made with {EventMachine.pooled_connect} back to
+    # the pool, for the next pooled connect to the same server to reuse.
+    # No more callbacks are made on this handler, not even {#unbind},
+    # unless the connection can't be reused, when it's closed instead.
+    #
+    # @return [Boolean] Whether the connection was kept.
+    # @see EventMachine.release_connection
+    def release
+      EventMachine::release_connection self
+    end
+
+    # Limits how fast this connection reads and writes, in bytes a second.
+    # It isn't read from while it's over its read limit, and what it has
+    # to send waits while it's over its write limit.
+    #
+    # @param [Hash] limits +:read+, +:write+ and +:burst+, or +nil+ to lift them.
+    # @see EventMachine.set_rate_limits
+    def set_rate_limits limits
+      EventMachine::set_rate_limits @signature, limits
+    end
+
+    # Called instead of {#unbind} when a connection made with
+    # {EventMachine.connect_with_retry} failed to connect, or was closed,
+    # and is going to connect again. Nothing it sent before is still to
+    # go. Closing it from here stops it trying.
+    #
+    # @param [Class] reason The error the connection went with, if any, like {#unbind}'s.
+    # @see EventMachine.set_reconnect_policy
+    def reconnecting(reason)
+    end
+
+    # @return [Integer] How many times in a row a connection made with
+    #   {EventMachine.connect_with_retry} has tried to connect again,
+    #   zero once it's connected.
+    def reconnect_attempts
+      EventMachine::get_redial_attempts @signature
+    end
+
+    # @return [Boolean] true if the connection came out of the pool
+    #   {EventMachine.pooled_connect} keeps, rather than being made afresh.
+    def reused?
+      EventMachine::get_pool_connection_state(@signature) == 1
+    end
+
     # Removes given connection from the event loop.
     # The connection's socket remains open and its file descriptor number is returned.
     def detach
@@ -370,6 +417,12 @@ module EventMachine
     # your redefined {#post_init} method, or in the {#connection_completed} handler for
     # an outbound connection.
     #
+    # Outbound connections made with {EventMachine.connect} remember the TLS
+    # session they negotiate, and offer it again on the next connection to
+    # the same host, port and :sni_hostname with the same TLS options, so
+    # that the server can resume it instead of doing a full handshake.
+    # {#ssl_verify_peer} is still called, once, for a resumed session.
+    #
     #
     # @option args [String] :cert_chain_file (nil) local path of a readable file that contants  a chain of X509 certificates in
     #                                              the [PEM format](http://en.wikipedia.org/wiki/Privacy_Enhanced_Mail),
@@ -400,6 +453,17 @@ module EventMachine
     #
     # @option args [Array] :ssl_version (TLSv1 TLSv1_1 TLSv1_2) indicates the allowed SSL/TLS versions. Possible values are: {SSLv2}, {SSLv3}, {TLSv1}, {TLSv1_1}, {TLSv1_2}.
     #
+    # @option args [Boolean] :ktls (false) lets OpenSSL read and write the socket itself, so that after the handshake it can hand
+    #                                      encryption (and, where supported, decryption) to the kernel. This needs Linux with the
+    #                                      tls module and an OpenSSL built with kTLS support; otherwise the connection carries on with
+    #                                      TLS in userspace. See {#ktls_status}. Ignored if data was sent before calling start_tls.
+    #
+    # @option args [Boolean] :dynamic_records (false) sends data in small TLS records, each fitting in one TCP segment, until 1MB
+    #                                                 has gone out, and in full 16KB records after that. Small records can be
+    #                                                 decrypted as soon as they arrive, which cuts the time to the first bytes of a
+    #                                                 response; big ones cost less CPU and framing for bulk transfers. The count
+    #                                                 starts over when nothing has been sent for a second. Not used with :ktls.
+    #
     # @example Using TLS with EventMachine
     #
     #  require 'rubygems'
@@ -436,6 +500,8 @@ module EventMachine
       ecdh_curve      = args[:ecdh_curve]
       dhparam         = args[:dhparam]
       fail_if_no_peer_cert = args[:fail_if_no_peer_cert]
+      ktls            = args[:ktls]
+      dynamic_records = args[:dynamic_records]
 
       [priv_key_path, cert_chain_path].each do |file|
         next if file.nil? or file.empty?
@@ -457,36 +523,9 @@ module EventMachine
         end
       end
 
-      protocols_bitmask = 0
-      if ssl_version.nil?
-        protocols_bitmask |= EventMachine::EM_PROTO_TLSv1
-        protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_1
-        protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_2
-        if EventMachine.const_defined? :EM_PROTO_TLSv1_3
-          protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_3
-        end
-      else
-        [ssl_version].flatten.each do |p|
-          case p.to_s.downcase
-          when 'sslv2'
-            protocols_bitmask |= EventMachine::EM_PROTO_SSLv2
-          when 'sslv3'
-            protocols_bitmask |= EventMachine::EM_PROTO_SSLv3
-          when 'tlsv1'
-            protocols_bitmask |= EventMachine::EM_PROTO_TLSv1
-          when 'tlsv1_1'
-            protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_1
-          when 'tlsv1_2'
-            protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_2
-          when 'tlsv1_3'
-            protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_3
-          else
-            raise("Unrecognized SSL/TLS Protocol: #{p}")
-          end
-        end
-      end
+      protocols_bitmask = EventMachine.tls_protocols_bitmask(ssl_version)
 
-      EventMachine::set_tls_parms(@signature, priv_key_path || '', priv_key || '', priv_key_pass || '', cert_chain_path || '', cert || '', verify_peer, fail_if_no_peer_cert, sni_hostname || '', cipher_list || '', ecdh_curve || '', dhparam || '', protocols_bitmask)
+      EventMachine::set_tls_parms(@signature, priv_key_path || '', priv_key || '', priv_key_pass || '', cert_chain_path || '', cert || '', verify_peer, fail_if_no_peer_cert, sni_hostname || '', cipher_list || '', ecdh_curve || '', dhparam || '', protocols_bitmask, ktls ? true : false, dynamic_records ? true : false)
       EventMachine::start_tls @signature
     end
 
@@ -578,6 +617,35 @@ module EventMachine
       EventMachine::get_sni_hostname @signature
     end
 
+    # Which directions of a TLS connection started with the :ktls option
+    # of {#start_tls} the kernel encrypts or decrypts.
+    #
+    # @return [Array<Symbol>, nil] +:send+ and/or +:recv+, or nil if TLS isn't active.
+    def ktls_status
+      status = EventMachine::get_ktls_status @signature
+      return nil unless status
+      [(:send if status & 1 != 0), (:recv if status & 2 != 0)].compact
+    end
+
+    # Bytes held for this connection's TLS, mostly data waiting to be
+    # encrypted, sent or decrypted. OpenSSL's own per-connection state isn't
+    # included.
+    #
+    # @return [Integer, nil] The byte count, or nil if TLS hasn't started.
+    # @see EventMachine.set_tls_idle_shrink
+    def tls_memory
+      EventMachine::get_tls_memory @signature
+    end
+
+    # Whether an idle shrink has let this connection's TLS buffers go, and
+    # they haven't been needed again since.
+    #
+    # @return [Boolean, nil] nil if TLS hasn't started.
+    # @see EventMachine.set_tls_idle_shrink
+    def tls_shrunk?
+      EventMachine::is_tls_shrunk @signature
+    end
+
     # Sends UDP messages.
     #
     # This method may be called from any Connection object that refers
@@ -791,6 +859,68 @@ module EventMachine
       EventMachine::resume_connection @signature
     end
 
+    # Splits inbound data on +delimiter+ in the reactor, before it reaches Ruby. Each
+    # complete line, without its delimiter, is passed to #receive_line; #receive_data is
+    # no longer called. Passing nil switches back to #receive_data, which is then handed
+    # whatever was buffered but not yet dispatched.
+    #
+    # A line longer than +max_length+ bytes closes the connection with Errno::EMSGSIZE
+    # as the unbind reason.
+    #
+    # @example
+    #
+    #   class Echo < EM::Connection
+    #     def post_init
+    #       set_line_framing "\r\n", 1024
+    #     end
+    #
+    #     def receive_line line
+    #       send_data "#{line}\r\n"
+    #     end
+    #   end
+    #
+    # @param [String, nil] delimiter  Line delimiter, or nil to switch framing off
+    # @param [Integer]     max_length Maximum line length in bytes (0 for no limit)
+    def set_line_framing delimiter = "\n", max_length = 0
+      EventMachine::set_line_framing @signature, delimiter, max_length.to_i
+    end
+
+    # Splits inbound data in the reactor into frames that carry their own length in a
+    # fixed-position header field. Each complete frame is passed to #receive_frame;
+    # #receive_data is no longer called. A frame spans
+    # <tt>offset + width + length + adjustment</tt> bytes, of which the first +strip+
+    # are dropped before it's handed over. Passing nil switches back to #receive_data,
+    # which is then handed whatever was buffered but not yet dispatched.
+    #
+    # A frame announcing more than +max_frame_size+ bytes (or a nonsensical length)
+    # closes the connection with Errno::EMSGSIZE as the unbind reason.
+    #
+    # @example 4-byte big-endian length prefix, as used by {EventMachine::Protocols::ObjectProtocol}
+    #
+    #   set_length_framing :strip => 4
+    #
+    # @example PostgreSQL v3 messages: a type byte, then an int32 length that counts itself
+    #
+    #   set_length_framing :offset => 1, :adjustment => -4
+    #
+    # @option opts [Integer] :width          (4) Width of the length field: 1, 2, 4 or 8 bytes
+    # @option opts [Boolean] :big_endian     (true) Byte order of the length field
+    # @option opts [Integer] :offset         (0) Position of the length field in the frame
+    # @option opts [Integer] :adjustment     (0) Added to the length field to get the bytes that follow it
+    # @option opts [Integer] :strip          (0) Leading bytes to drop from every frame
+    # @option opts [Integer] :max_frame_size (16MB) Largest acceptable frame in bytes. 0 is no
+    #   limit, which lets the peer make the connection buffer as much as it likes.
+    #
+    # @param [Hash, nil] opts Framing options, or nil to switch framing off
+    def set_length_framing opts = {}
+      if opts
+        EventMachine::set_length_framing @signature, opts.fetch(:width, 4), opts.fetch(:big_endian, true),
+          opts.fetch(:offset, 0), opts.fetch(:adjustment, 0), opts.fetch(:strip, 0), opts.fetch(:max_frame_size, 16 * 1024 * 1024)
+      else
+        EventMachine::set_length_framing @signature, 0, false, 0, 0, 0, 0
+      end
+    end
+
     # @return [Boolean] true if the connect was paused using {EventMachine::Connection#pause}.
     # @see #pause
     # @see #resume
@@ -0,0 +1,293 @@
+module EventMachine
+  # A Fiber::Scheduler (Ruby 3.0+) that runs non-blocking fibers on the
+  # reactor. Blocking-style code (database drivers, Net::HTTP, Queue#pop,
+  # sleep, ...) running inside a scheduled fiber suspends that fiber instead
+  # of the reactor thread: I/O waits become watch-mode descriptors (see
+  # {EventMachine.watch}) and timed waits become reactor timers.
+  #
+  # The scheduler must be installed from the reactor thread while the reactor
+  # is running. Fibers that are still suspended when the reactor stops are
+  # abandoned.
+  #
+  # @example
+  #
+  #   EM.run do
+  #     Fiber.set_scheduler EM::FiberScheduler.new
+  #
+  #     Fiber.schedule do
+  #       body = Net::HTTP.get(URI('http://example.com/'))
+  #       puts body.bytesize
+  #       EM.stop
+  #     end
+  #   end
+  #
+  class FiberScheduler
+    # @private
+    # One pending wake-up of a suspended fiber. Only the first call to
+    # {#resume} has any effect, so a timer and an I/O event (or a late
+    # unblock) can race without resuming the fiber twice.
+    class Waiter
+      def initialize(fiber)
+        @fiber = fiber
+        @pending = true
+        @suspended = false
+        @value = nil
+      end
+
+      def pending?
+        @pending
+      end
+
+      def resume(value = true)
+        return unless @pending
+        @pending = false
+
+        if @suspended
+          @fiber.resume value
+        else
+          # woken before we got around to suspending, e.g. a deferrable
+          # that succeeded synchronously
+          @value = value
+        end
+      end
+
+      def suspend
+        return @value unless @pending
+
+        @suspended = true
+        begin
+          Fiber.yield
+        ensure
+          @suspended = false
+        end
+      end
+
+      def cancel
+        @pending = false
+      end
+    end
+
+    # @private
+    # Watch-mode connection shared by every fiber waiting on the same file
+    # descriptor. It is detached as soon as nobody is waiting on it, so a
+    # descriptor closed by user code is never left registered with the reactor.
+    class Watcher < Connection
+      def initialize(scheduler)
+        @scheduler = scheduler
+        @waiters = {}
+      end
+
+      def add(waiter, events)
+        @waiters[waiter] = events
+        update
+      end
+
+      def remove(waiter)
+        return unless @waiters.delete(waiter)
+        if @waiters.empty?
+          @scheduler.send :release_watcher, self
+          detach
+        else
+          update
+        end
+      end
+
+      def notify_readable
+        ready IO::READABLE
+      end
+
+      def notify_writable
+        ready IO::WRITABLE
+      end
+
+      private
+
+      def update
+        readable = writable = false
+        @waiters.each_value do |events|
+          readable ||= (events & (IO::READABLE | IO::PRIORITY)) != 0
+          writable ||= (events & IO::WRITABLE) != 0
+        end
+        self.notify_readable = readable if notify_readable? != readable
+        self.notify_writable = writable if notify_writable? != writable
+      end
+
+      def ready(event)
+        # resumed fibers may add and remove waiters, so work on a snapshot
+        @waiters.to_a.each do |waiter, events|
+          next unless waiter.pending?
+          mask = events & event
+          mask |= events & IO::PRIORITY if event == IO::READABLE
+          waiter.resume mask if mask != 0
+        end
+      end
+    end
+
+    def initialize
+      @watchers = {}
+      @blocked = {}
+    end
+
+    # Called by Fiber.schedule. Creates a non-blocking fiber and runs it
+    # until its first blocking operation.
+    def fiber(&block)
+      fiber = Fiber.new(blocking: false, &block)
+      fiber.resume
+      fiber
+    end
+
+    # Suspends the current fiber until +io+ is ready for +events+.
+    #
+    # @return [Integer, false] the ready events, or false on timeout
+    def io_wait(io, events, timeout = nil)
+      watcher = nil
+      waiter = nil
+      wait(timeout) do |w|
+        waiter = w
+        watcher = watcher_for(io)
+        watcher.add waiter, events
+      end
+    ensure
+      watcher.remove waiter if watcher
+    end
+
+    # io_read and io_write are only provided where Fiber.blocking is available
+    # (Ruby 3.2+): the nonblocking calls they are built on would otherwise
+    # re-enter the scheduler. Older Rubies fall back to their own read/write
+    # loops around {#io_wait}.
+    if Fiber.respond_to?(:blocking)
+      # Reads at least +length+ bytes (or whatever is available, when +length+
+      # is zero) from +io+ into +buffer+ at +offset+.
+      #
+      # @return [Integer] bytes read, or a negated errno
+      def io_read(io, buffer, length, offset = 0)
+        total = 0
+        loop do
+          maximum = buffer.size - offset - total
+          break if maximum <= 0
+
+          result = Fiber.blocking { io.read_nonblock(maximum, exception: false) }
+          case result
+          when :wait_readable
+            io_wait io, IO::READABLE
+          when nil
+            break
+          else
+            buffer.set_string result, offset + total
+            total += result.bytesize
+            break if total >= length
+          end
+        end
+        total
+      rescue SystemCallError => e
+        -e.errno
+      end
+
+      # Writes at least +length+ bytes (or whatever fits, when +length+ is zero)
+      # from +buffer+ at +offset+ to +io+.
+      #
+      # @return [Integer] bytes written, or a negated errno
+      def io_write(io, buffer, length, offset = 0)
+        total = 0
+        loop do
+          maximum = buffer.size - offset - total
+          break if maximum <= 0
+
+          chunk = buffer.get_string(offset + total, maximum)
+          result = Fiber.blocking { io.write_nonblock(chunk, exception: false) }
+          if result == :wait_writable
+            io_wait io, IO::WRITABLE
+          else
+            total += result
+            break if total >= length
+          end
+        end
+        total
+      rescue SystemCallError => e
+        -e.errno
+      end
+    end
+
+    # Called by Kernel#sleep and friends. A nil +duration+ sleeps until the
+    # fiber is explicitly resumed.
+    def kernel_sleep(duration = nil)
+      wait duration
+      nil
+    end
+
+    # Called when a Mutex, Queue, ConditionVariable etc. would block.
+    #
+    # @return [Boolean] false if the timeout elapsed
+    def block(blocker, timeout = nil)
+      fiber = Fiber.current
+      wait(timeout) { |waiter| @blocked[fiber] = waiter }
+    ensure
+      @blocked.delete fiber
+    end
+
+    # Wakes a fiber suspended in {#block}. May be called from any thread, so
+    # the wake-up itself always happens on the reactor.
+    def unblock(blocker, fiber)
+      EventMachine.schedule do
+        waiter = @blocked[fiber]
+        waiter.resume true if waiter
+      end
+    end
+
+    # Runs the block, raising +exception+ in the current fiber if it has not
+    # finished after +duration+ seconds.
+    def timeout_after(duration, exception, message, &block)
+      fiber = Fiber.current
+      timer = EventMachine.add_timer(duration) do
+        fiber.raise exception, message if fiber.alive?
+      end
+      yield duration
+    ensure
+      EventMachine.cancel_timer timer if timer
+    end
+
+    # Resolves +hostname+ with {EventMachine::DNS::Resolver}, so lookups made
+    # by Socket, TCPSocket, Net::HTTP, etc. don't stall the reactor.
+    #
+    # @return [Array<String>, nil] the addresses, or nil if resolution failed
+    def address_resolve(hostname)
+      hostname = hostname.split('%', 2).first
+      return [hostname] if hostname =~ Resolv::IPv4::Regex || hostname =~ Resolv::IPv6::Regex
+
+      wait do |waiter|
+        request = EventMachine::DNS::Resolver.resolve(hostname)
+        request.callback { |addrs| waiter.resume addrs }
+        request.errback { waiter.resume nil }
+      end
+    end
+
+    # Called when the scheduler is replaced or its thread exits.
+    def close
+      @watchers.each_value(&:detach) if EventMachine.reactor_running?
+      @watchers.clear
+      @blocked.clear
+    end
+
+    private
+
+    # Suspends the current fiber until the block's waiter is resumed, or
+    # +timeout+ seconds have passed (in which case the result is false).
+    def wait(timeout = nil)
+      waiter = Waiter.new(Fiber.current)
+      timer = EventMachine.add_timer(timeout) { waiter.resume false } if timeout
+      yield waiter if block_given?
+      waiter.suspend
+    ensure
+      waiter.cancel if waiter
+      EventMachine.cancel_timer timer if timer
+    end
+
+    def watcher_for(io)
+      @watchers[io.fileno] ||= EventMachine.watch(io, Watcher, self)
+    end
+
+    def release_watcher(watcher)
+      @watchers.delete_if { |_, w| w.equal?(watcher) }
+    end
+  end
+end
@@ -70,4 +70,37 @@ module EventMachine
       EventMachine::unwatch_filename(@signature)
     end # stop_watching
   end # FileWatch
+
+  # Reloads the TLS contexts made from the file it watches when it changes,
+  # and watches the path again when the file is replaced.
+  #
+  # @see EventMachine.preload_tls
+  # @private
+  class TlsFileWatch < FileWatch
+    # How often to look for a file that's been moved away to come back.
+    RETRY_INTERVAL = 0.1
+
+    def file_modified
+      EventMachine.reload_tls_file path
+    end
+
+    def file_moved
+      stop_watching
+      rewatch
+    end
+
+    # The watch itself is gone after this.
+    def file_deleted
+      rewatch
+    end
+
+    def rewatch
+      if File.exist? path
+        EventMachine.watch_file path, TlsFileWatch
+        EventMachine.reload_tls_file path
+      else
+        EventMachine.add_timer(RETRY_INTERVAL) { rewatch }
+      end
+    end
+  end # TlsFileWatch
 end # EventMachine
@@ -0,0 +1,250 @@
+module EventMachine
+  # Raised by {HttpResponseParser} on a response it can't make sense of.
+  class HttpParseError < RuntimeError; end
+
+  # A complete HTTP response as returned by {HttpResponseParser}.
+  #
+  # +version+ is a String such as "1.1", +status+ an Integer, and +headers+
+  # an Array of [name, value] pairs in the order they were received
+  # (chunked trailer fields included). +keep_alive+ tells whether the
+  # connection can carry another response after this one.
+  HttpResponse = Struct.new(:version, :status, :reason, :headers, :content, :keep_alive) unless defined?(HttpResponse)
+
+  class HttpResponse
+    alias keep_alive? keep_alive
+
+    # All values of the named header, which is matched ignoring case.
+    def header(name)
+      name = name.downcase
+      headers.select { |n, _| n.downcase == name }.map { |_, v| v }
+    end
+
+    # The status line followed by one "Name: value" string per header.
+    def header_lines
+      ["HTTP/#{version} #{status} #{reason}".rstrip] + headers.map { |n, v| "#{n}: #{v}" }
+    end
+  end
+
+  # Pure-Ruby HTTP/1.x response parser. This is what {HttpResponseParser}
+  # is when the C++ extension (which provides a native one) isn't available,
+  # i.e. under the pure-Ruby and Java reactors.
+  class PureRubyHttpResponseParser
+    DEFAULT_MAX_HEADER_SIZE = 80 * 1024
+
+    def initialize(max_header_size = nil)
+      @max_header_size = max_header_size || DEFAULT_MAX_HEADER_SIZE
+      reset
+    end
+
+    def request_sent(verb)
+      @head_requests << (verb.to_s.upcase == 'HEAD')
+      self
+    end
+
+    def parse(data)
+      raise HttpParseError, @error if @error
+      @buffer << data.b
+      responses = []
+      while (response = next_response)
+        responses << response
+      end
+      responses
+    rescue HttpParseError => e
+      @error = e.message
+      raise
+    end
+
+    def finish
+      raise HttpParseError, @error if @error
+      case @state
+      when :body_eof, :trailer
+        @state = :head
+        complete
+      when :head
+        return nil if @buffer =~ /\A[\r\n]*\z/
+        fail!('connection closed before the response was complete')
+      else
+        fail!('connection closed before the response was complete')
+      end
+    end
+
+    def reset
+      @head_requests = []
+      @buffer = ''.b
+      @state = :head
+      @error = nil
+      self
+    end
+
+    private
+
+    def fail!(reason)
+      @error = reason
+      raise HttpParseError, reason
+    end
+
+    def next_response
+      loop do
+        case @state
+        when :head
+          @buffer.sub!(/\A[\r\n]+/, '')
+          unless (m = /\r?\n\r?\n/.match(@buffer))
+            fail!('response header too large') if @buffer.bytesize > @max_header_size
+            return nil
+          end
+          fail!('response header too large') if m.end(0) > @max_header_size
+          head = @buffer.slice!(0, m.end(0))
+          parse_head(head)
+          next if @status < 200 && @status != 101
+          start_body
+          return complete if @state == :head
+
+        when :body_length
+          return nil if @buffer.bytesize < @remaining
+          @content = @buffer.slice!(0, @remaining)
+          @state = :head
+          return complete
+
+        when :body_eof
+          @content << @buffer
+          @buffer = ''.b
+          return nil
+
+        when :chunk_size
+          return nil unless (line = next_line)
+          fail!('malformed chunk size') unless line =~ /\A([0-9a-fA-F]+)(?:[;\t ]|\z)/
+          size = $1.to_i(16)
+          if size == 0
+            @state = :trailer
+          else
+            @remaining = size
+            @state = :chunk_data
+          end
+
+        when :chunk_data
+          data = @buffer.slice!(0, @remaining)
+          @content << data
+          @remaining -= data.bytesize
+          return nil if @remaining > 0
+          @state = :chunk_end
+
+        when :chunk_end
+          return nil unless (line = next_line)
+          fail!('missing line break after chunk data') unless line.empty?
+          @state = :chunk_size
+
+        when :trailer
+          return nil unless (line = next_line)
+          if line.empty?
+            @state = :head
+            return complete
+          end
+          @headers << parse_header_line(line)
+        end
+      end
+    end
+
+    def next_line
+      unless (ix = @buffer.index("\n"))
+        fail!('line too long in chunked body') if @buffer.bytesize > @max_header_size
+        return nil
+      end
+      @buffer.slice!(0, ix + 1).chomp
+    end
+
+    def parse_head(head)
+      lines = head.split(/\r?\n/)
+      unless lines.first =~ /\AHTTP\/(\d\.\d) (\d{3})(?: (.*))?\z/
+        fail!('malformed status line')
+      end
+      @version, @status, @reason = $1, $2.to_i, $3 || ''
+      @headers = lines.drop(1).map { |line| parse_header_line(line) }
+      @content = ''.b
+    end
+
+    def parse_header_line(line)
+      fail!('obsolete line folding in header') if line =~ /\A[ \t]/
+      fail!('malformed header line') unless line =~ /\A([^:]*[^:\s]):[ \t]*(.*?)[ \t]*\z/
+      [$1, $2]
+    end
+
+    def start_body
+      head = @head_requests.shift || false
+      content_length = nil
+      transfer_encoding = chunked = close = keep_alive = false
+
+      @headers.each do |name, value|
+        case name.downcase
+        when 'content-length'
+          fail!('malformed content-length') unless value =~ /\A\d+\z/
+          fail!('conflicting content-length headers') if content_length && content_length != value.to_i
+          content_length = value.to_i
+        when 'transfer-encoding'
+          transfer_encoding = true
+          chunked = value.split(',').last.to_s.strip.downcase == 'chunked'
+        when 'connection'
+          tokens = value.split(',').map { |t| t.strip.downcase }
+          close ||= tokens.include?('close')
+          keep_alive ||= tokens.include?('keep-alive')
+        end
+      end
+
+      @keep_alive = @version >= '1.1' ? !close : (keep_alive && !close)
+
+      @state = if head || [101, 204, 304].include?(@status)
+        :head
+      elsif transfer_encoding
+        chunked ? :chunk_size : :body_eof
+      elsif content_length
+        @remaining = content_length
+        content_length > 0 ? :body_length : :head
+      else
+        :body_eof
+      end
+
+      @keep_alive = false if @state == :body_eof
+    end
+
+    def complete
+      HttpResponse.new(@version, @status, @reason, @headers, @content, @keep_alive)
+    end
+  end
+
+  # Incremental HTTP/1.x response parser, as used by
+  # {Protocols::HttpClient} and {Protocols::HttpClient2}.
+  #
+  # Feed it bytes as they arrive with #parse, which returns the responses
+  # completed by them (several, if requests are pipelined). Parsing picks up
+  # where it left off, so a response that arrives in pieces is only scanned
+  # once. A response whose body runs until the server closes the connection
+  # is returned by #finish, which should be called from #unbind.
+  #
+  # With the C++ reactor this is implemented natively; otherwise it is
+  # {EventMachine::PureRubyHttpResponseParser}.
+  #
+  # @example
+  #   parser = EM::HttpResponseParser.new
+  #   parser.request_sent 'GET'
+  #   parser.parse(data).each { |response| p response.status, response.content }
+  #
+  # @!method initialize(max_header_size = 80 * 1024)
+  #   Responses with a larger status line and header block raise
+  #   {HttpParseError}.
+  #
+  # @!method request_sent(verb)
+  #   Tells the parser that a request went out, so that the response to a
+  #   HEAD request is known to have no body. Optional for other verbs.
+  #
+  # @!method parse(data)
+  #   @return [Array<HttpResponse>] the responses completed by +data+.
+  #   @raise [HttpParseError]
+  #
+  # @!method finish
+  #   Tells the parser that the connection has closed.
+  #   @return [HttpResponse, nil] a response that was delimited by the close.
+  #   @raise [HttpParseError] if a response was cut off.
+  #
+  # @!method reset
+  #   Discards all buffered data and state.
+  HttpResponseParser = PureRubyHttpResponseParser unless defined?(HttpResponseParser)
+end
@@ -89,8 +89,7 @@ module EventMachine
 
       def post_init
         @start_time = Time.now
-        @data = ""
-        @read_state = :base
+        @parser = HttpResponseParser.new
       end
 
       # We send the request when we get a connection.
@@ -167,6 +166,7 @@ module EventMachine
 
           req << ""
           reqstring = req.map {|l| "#{l}\r\n"}.join
+          @parser.request_sent verb
           send_data reqstring
 
           if verb == "POST" || verb == "PUT"
@@ -175,117 +175,25 @@ module EventMachine
       end
 
 
+      # Only the first response answers the request; anything after it is
+      # dropped along with the connection.
       def receive_data data
-        while data and data.length > 0
-          case @read_state
-          when :base
-            # Perform any per-request initialization here and don't consume any data.
-            @data = ""
-            @headers = []
-            @content_length = nil # not zero
-            @content = ""
-            @status = nil
-            @chunked = false
-            @chunk_length = nil
-            @read_state = :header
-            @connection_close = nil
-          when :header
-            ary = data.split( /\r?\n/m, 2 )
-            if ary.length == 2
-              data = ary.last
-              if ary.first == ""
-                if (@content_length and @content_length > 0) || @chunked || @connection_close
-                  @read_state = :content
-                else
-                  dispatch_response
-                  @read_state = :base
-                end
-              else
-                @headers << ary.first
-                if @headers.length == 1
-                  parse_response_line
-                elsif ary.first =~ /\Acontent-length:\s*/i
-                  # Only take the FIRST content-length header that appears,
-                  # which we can distinguish because @content_length is nil.
-                  # TODO, it's actually a fatal error if there is more than one
-                  # content-length header, because the caller is presumptively
-                  # a bad guy. (There is an exploit that depends on multiple
-                  # content-length headers.)
-                  @content_length ||= $'.to_i
-                elsif ary.first =~ /\Aconnection:\s*close/i
-                  @connection_close = true
-                elsif ary.first =~ /\Atransfer-encoding:\s*chunked/i
-                  @chunked = true
-                end
-              end
-            else
-              @data << data
-              data = ""
-            end
-          when :content
-            if @chunked && @chunk_length
-              bytes_needed = @chunk_length - @chunk_read
-              new_data = data[0, bytes_needed]
-              @chunk_read += new_data.length
-              @content += new_data
-              data = data[bytes_needed..-1] || ""
-              if @chunk_length == @chunk_read && data[0,2] == "\r\n"
-                @chunk_length = nil
-                data = data[2..-1]
-              end
-            elsif @chunked
-              if (m = data.match(/\A(\S*)\r\n/m))
-                data = data[m[0].length..-1]
-                @chunk_length = m[1].to_i(16)
-                @chunk_read = 0
-                if @chunk_length == 0
-                  dispatch_response
-                  @read_state = :base
-                end
-              end
-            elsif @content_length
-              # If there was no content-length header, we have to wait until the connection
-              # closes. Everything we get until that point is content.
-              # TODO: Must impose a content-size limit, and also must implement chunking.
-              # Also, must support either temporary files for large content, or calling
-              # a content-consumer block supplied by the user.
-              bytes_needed = @content_length - @content.length
-              @content += data[0, bytes_needed]
-              data = data[bytes_needed..-1] || ""
-              if @content_length == @content.length
-                dispatch_response
-                @read_state = :base
-              end
-            else
-              @content << data
-              data = ""
-            end
-          end
-        end
-      end
-
-
-      # We get called here when we have received an HTTP response line.
-      # It's an opportunity to throw an exception or trigger other exceptional
-      # handling.
-      def parse_response_line
-        if @headers.first =~ /\AHTTP\/1\.[01] ([\d]{3})/
-          @status = $1.to_i
-        else
-          set_deferred_status :failed, {
-            :status => 0 # crappy way of signifying an unrecognized response. TODO, find a better way to do this.
-          }
-          close_connection
-        end
+        return if @responded
+        response = @parser.parse(data).first
+        dispatch_response response if response
+      rescue HttpParseError
+        set_deferred_status :failed, {
+          :status => 0 # crappy way of signifying an unrecognized response. TODO, find a better way to do this.
+        }
+        close_connection
       end
-      private :parse_response_line
 
-      def dispatch_response
-        @read_state = :base
+      def dispatch_response response
+        @responded = true
         set_deferred_status :succeeded, {
-          :content => @content,
-          :headers => @headers,
-          :status => @status
+          :content => response.content,
+          :headers => response.header_lines,
+          :status => response.status
         }
         # TODO, we close the connection for now, but this is wrong for persistent clients.
         close_connection
@@ -294,9 +202,13 @@ module EventMachine
       def unbind
         if !@connected
           set_deferred_status :failed, {:status => 0} # YECCCCH. Find a better way to signal no-connect/network error.
-        elsif (@read_state == :content and @content_length == nil)
-          dispatch_response
+        elsif !@responded
+          # A response without a content-length ends when the server closes.
+          response = @parser.finish
+          dispatch_response response if response
         end
+      rescue HttpParseError
+        set_deferred_status :failed, {:status => 0}
       end
     end
   end
@@ -44,14 +44,13 @@ module EventMachine
     # @deprecated Please use [EM-HTTP-Request](https://github.com/igrigorik/em-http-request) instead.
     #
     class HttpClient2 < Connection
-      include LineText2
-
       def initialize
         warn "HttpClient2 is deprecated and will be removed. EM-Http-Request should be used instead."
 
         @authorization = nil
         @closed = nil
         @requests = nil
+        @parser = HttpResponseParser.new
       end
 
       # @private
@@ -70,9 +69,6 @@ module EventMachine
           @args = args
           @header_lines = []
           @headers = {}
-          @blanks = 0
-          @chunk_trailer = nil
-          @chunking = nil
         end
 
         def send_request
@@ -88,153 +84,24 @@ module EventMachine
         end
 
         #--
+        # Called by the connection with the HttpResponse it parsed for us.
         #
-        def receive_line ln
-          if @chunk_trailer
-            receive_chunk_trailer(ln)
-          elsif @chunking
-            receive_chunk_header(ln)
-          else
-            receive_header_line(ln)
-          end
-        end
-
-        #--
-        #
-        def receive_chunk_trailer ln
-          if ln.length == 0
-            @conn.pop_request
-            succeed(self)
-          else
-            p "Received chunk trailer line"
-          end
-        end
-
-        #--
-        # Allow up to ten blank lines before we get a real response line.
-        # Allow no more than 100 lines in the header.
-        #
-        def receive_header_line ln
-          if ln.length == 0
-            if @header_lines.length > 0
-              process_header
-            else
-              @blanks += 1
-              if @blanks > 10
-                @conn.close_connection
-              end
-            end
-          else
-            @header_lines << ln
-            if @header_lines.length > 100
-              @internal_error = :bad_header
-              @conn.close_connection
-            end
-          end
-        end
-
-        #--
-        # Cf RFC 2616 pgh 3.6.1 for the format of HTTP chunks.
-        #
-        def receive_chunk_header ln
-          if ln.length > 0
-            chunksize = ln.to_i(16)
-            if chunksize > 0
-              @conn.set_text_mode(ln.to_i(16))
-            else
-              @content = @content ? @content.join : ''
-              @chunk_trailer = true
-            end
-          else
-            # We correctly come here after each chunk gets read.
-            # p "Got A BLANK chunk line"
+        def receive_response response
+          @version = response.version
+          @status = response.status
+          @header_lines = response.header_lines
+          response.headers.each do |hdr, val|
+            (@headers[hdr.downcase] ||= []) << val
           end
-
-        end
-
-
-        #--
-        # We get a single chunk. Append it to the incoming content and switch back to line mode.
-        #
-        def receive_chunked_text text
-          # p "RECEIVED #{text.length} CHUNK"
-          (@content ||= []) << text
-        end
-
-
-        #--
-        # TODO, inefficient how we're handling this. Part of it is done so as to
-        # make sure we don't have problems in detecting chunked-encoding, content-length,
-        # etc.
-        #
-        HttpResponseRE = /\AHTTP\/(1.[01]) ([\d]{3})/i
-        ClenRE = /\AContent-length:\s*(\d+)/i
-        ChunkedRE = /\ATransfer-encoding:\s*chunked/i
-        ColonRE = /\:\s*/
-
-        def process_header
-          unless @header_lines.first =~ HttpResponseRE
-            @conn.close_connection
-            @internal_error = :bad_request
-          end
-          @version = $1.dup
-          @status = $2.dup.to_i
-
-          clen = nil
-          chunks = nil
-          @header_lines.each_with_index do |e,ix|
-            if ix > 0
-              hdr,val = e.split(ColonRE,2)
-              (@headers[hdr.downcase] ||= []) << val
-            end
-
-            if clen == nil and e =~ ClenRE
-              clen = $1.dup.to_i
-            end
-            if e =~ ChunkedRE
-              chunks = true
-            end
-          end
-
-          if clen
-            # If the content length is zero we should not call set_text_mode,
-            # because a value of zero will make it wait forever, hanging the
-            # connection. Just return success instead, with empty content.
-            if clen == 0 then
-              @content = ""
-              @conn.pop_request
-              succeed(self)
-            else
-              @conn.set_text_mode clen
-            end
-          elsif chunks
-            @chunking = true
-          else
-            # Chunked transfer, multipart, or end-of-connection.
-            # For end-of-connection, we need to go the unbind
-            # method and suppress its desire to fail us.
-            p "NO CLEN"
-            p @args[:uri]
-            p @header_lines
-            @internal_error = :unsupported_clen
-            @conn.close_connection
-          end
-        end
-        private :process_header
-
-
-        def receive_text text
-          @chunking ? receive_chunked_text(text) : receive_sized_text(text)
+          @content = response.content
+          succeed(self)
         end
 
         #--
-        # At the present time, we only handle contents that have a length
-        # specified by the content-length header.
+        # The connection is about to close because of a malformed response.
         #
-        def receive_sized_text text
-          @content = text
-          @conn.pop_request
-          succeed(self)
+        def receive_error reason
+          @internal_error = reason
         end
       end
 
@@ -329,6 +196,12 @@ module EventMachine
       def unbind
         super
         @closed = true
+        begin
+          # A response without a content-length ends when the server closes.
+          response = @parser.finish
+          dispatch_response response if response
+        rescue HttpParseError
+        end
         (@requests || []).each {|r| r.fail}
       end
 
@@ -341,32 +214,31 @@ module EventMachine
           r.fail
         else
           (@requests ||= []).unshift r
-          @connected.callback {r.send_request}
+          @connected.callback {
+            @parser.request_sent args[:verb]
+            r.send_request
+          }
         end
         r
       end
 
+      #--
+      # Responses come back in the order the requests went out, so each one
+      # the parser completes belongs to the oldest pending request.
+      #
       # @private
-      def receive_line ln
-        if req = @requests.last
-          req.receive_line ln
-        else
-          p "??????????"
-          p ln
-        end
-      end
-
-      # @private
-      def receive_binary_data text
-        @requests.last.receive_text text
+      def receive_data data
+        @parser.parse(data).each {|response| dispatch_response response }
+      rescue HttpParseError
+        (req = (@requests || []).last) and req.receive_error(:bad_response)
+        close_connection
       end
 
-      #--
-      # Called by a Request object when it completes.
-      #
       # @private
-      def pop_request
-        @requests.pop
+      def dispatch_response response
+        if req = (@requests || []).pop
+          req.receive_response response
+        end
       end
     end
 
@@ -13,10 +13,9 @@ module EventMachine
     module LineProtocol
       # @private
       def receive_data data
-        (@buf ||= '') << data
-
-        while @buf.slice!(/(.*?)\r?\n/)
-          receive_line($1)
+        (@buf ||= BufferedTokenizer.new("\n")).extract(data).each do |line|
+          line.chop! if line.end_with?("\r")
+          receive_line(line)
         end
       end
 
@@ -10,6 +10,13 @@ module EventMachine
     #    end
     #  end
     #
+    # To have the reactor reassemble the messages instead of Ruby, enable
+    # native framing when the connection starts:
+    #
+    #    def post_init
+    #      set_length_framing :strip => 4
+    #    end
+    #
     module ObjectProtocol
       # By default returns Marshal, override to return JSON or YAML, or any
       # other serializer/deserializer responding to #dump and #load.
@@ -31,6 +38,11 @@ module EventMachine
         end
       end
 
+      # @private
+      def receive_frame frame
+        receive_object serializer.load(frame)
+      end
+
       # Invoked with ruby objects received over the network
       def receive_object obj
         # stub
@@ -148,26 +148,38 @@ module EventMachine
       end
 
 
+      def post_init
+        super
+        # Messages are a type byte followed by an int32 length that counts itself.
+        # Only the C++ reactor frames them; elsewhere receive_data does.
+        unless [:pure_ruby, :java].include? EventMachine.library_type
+          set_length_framing :offset => 1, :adjustment => -4
+        end
+      end
+
       def receive_data data
         @data << data
         while @data.length >= 5
           pktlen = @data[1...5].unpack("N").first
           if @data.length >= (1 + pktlen)
-            pkt = @data.slice!(0...(1+pktlen))
-            m = StringIO.open( pkt, "r" ) {|io| PostgresPR::Message.read( io ) }
-            if @pending_conn
-              dispatch_conn_message m
-            elsif @pending_query
-              dispatch_query_message m
-            else
-              raise "Unexpected message from database"
-            end
+            receive_frame @data.slice!(0...(1+pktlen))
           else
             break # very important, break out of the while
           end
         end
       end
 
+      def receive_frame pkt
+        m = StringIO.open( pkt, "r" ) {|io| PostgresPR::Message.read( io ) }
+        if @pending_conn
+          dispatch_conn_message m
+        elsif @pending_query
+          dispatch_query_message m
+        else
+          raise "Unexpected message from database"
+        end
+      end
+
 
       def unbind
         if o = (@pending_query || @pending_conn)
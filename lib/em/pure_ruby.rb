@@ -181,8 +181,9 @@ module EventMachine
       selectable.schedule_close after_writing if selectable
     end
 
+    # Listener options are ignored in pure Ruby.
     # @private
-    def start_tcp_server host, port
+    def start_tcp_server host, port, options = nil
       (s = EvmaTCPServer.start_server host, port) or raise "no acceptor"
       s.uuid
     end
@@ -193,6 +194,21 @@ module EventMachine
       s.schedule_close
     end
 
+    # Servers take every connection in pure Ruby.
+    # @private
+    def set_acceptor_limits sig, limits
+    end
+
+    # @private
+    def get_acceptor_stats sig
+      { :connections => 0, :shedding => nil, :sheds => 0, :rejected => 0, :loop_lag => 0.0, :outbound_bytes => 0 }
+    end
+
+    # No rate limits in pure Ruby.
+    # @private
+    def set_descriptor_rate_limits sig, limits
+    end
+
     # @private
     def start_unix_server chain
       (s = EvmaUNIXServer.start_server chain) or raise "no acceptor"
@@ -262,7 +278,7 @@ module EventMachine
     # parameter list will grow as we add more supported features. ALL of these
     # parameters are optional, and can be specified as empty or nil strings.
     # @private
-    def set_tls_parms signature, priv_key_path, priv_key, priv_key_pass, cert_chain_path, cert, verify_peer, fail_if_no_peer_cert, sni_hostname, cipher_list, ecdh_curve, dhparam, protocols_bitmask
+    def set_tls_parms signature, priv_key_path, priv_key, priv_key_pass, cert_chain_path, cert, verify_peer, fail_if_no_peer_cert, sni_hostname, cipher_list, ecdh_curve, dhparam, protocols_bitmask, ktls = false, dynamic_records = false
       bitmask = protocols_bitmask
       ssl_options = OpenSSL::SSL::OP_ALL
       ssl_options |= OpenSSL::SSL::OP_NO_SSLv2 if defined?(OpenSSL::SSL::OP_NO_SSLv2) && EM_PROTO_SSLv2 & bitmask == 0
@@ -378,6 +394,24 @@ module EventMachine
       end
     end
 
+    # Ruby's OpenSSL doesn't offload to kernel TLS.
+    def get_ktls_status signature
+      selectable = Reactor.instance.get_selectable(signature) or raise "unknown get_ktls_status target"
+      selectable.io.respond_to?(:cipher) ? 0 : nil
+    end
+
+    # Ruby's OpenSSL doesn't say how much memory a connection uses.
+    # @private
+    def get_tls_memory signature
+      nil
+    end
+
+    # Nor are there any TLS buffers to shrink.
+    # @private
+    def is_tls_shrunk signature
+      nil
+    end
+
     # This method is a no-op in the pure-Ruby implementation. We simply return Ruby's built-in
     # per-process file-descriptor limit.
     # @private
@@ -391,6 +425,167 @@ module EventMachine
     def set_max_timer_count n
     end
 
+    # Handshakes always run on the reactor thread in pure Ruby.
+    # @private
+    def set_tls_handshake_thread_count n
+    end
+
+    # @private
+    def get_tls_handshake_thread_count
+      0
+    end
+
+    # Host names are always looked up on the reactor thread in pure Ruby.
+    # @private
+    def set_resolver_thread_count n
+    end
+
+    # @private
+    def get_resolver_thread_count
+      0
+    end
+
+    # Only the first address is connected to in pure Ruby.
+    # @private
+    def set_connection_attempt_delay_time seconds
+    end
+
+    # @private
+    def get_connection_attempt_delay_time
+      0.0
+    end
+
+    # No TCP Fast Open in pure Ruby: the connect is an ordinary one.
+    # @private
+    def connect_server_fast_open server, port
+      connect_server server, port
+    end
+
+    # No connection pool in pure Ruby: every pooled connect is a fresh one,
+    # and nothing can be released.
+    # @private
+    def pool_connect_server key, server, port
+      connect_server server, port
+    end
+
+    # @private
+    def pool_release_connection signature
+      false
+    end
+
+    # @private
+    def get_pool_connection_state signature
+      0
+    end
+
+    # @private
+    def set_pool_limits max_per_host, idle_timeout
+    end
+
+    # @private
+    def get_pool_stats
+      { :idle => 0, :active => 0, :waiting => 0, :created => 0, :reused => 0, :discarded => 0 }
+    end
+
+    # No reconnecting in pure Ruby: a connection made to retry is unbound
+    # like any other.
+    # @private
+    def connect_server_with_retry server, port
+      connect_server server, port
+    end
+
+    # @private
+    def set_redial_policy base_delay, max_delay, jitter, max_attempts, breaker_threshold, breaker_timeout
+    end
+
+    # @private
+    def get_redial_attempts signature
+      0
+    end
+
+    # Host names aren't cached in pure Ruby.
+    # @private
+    def set_dns_cache_ttl_time seconds
+    end
+
+    # @private
+    def get_dns_cache_ttl_time
+      0.0
+    end
+
+    # @private
+    def set_dns_negative_ttl_time seconds
+    end
+
+    # @private
+    def get_dns_negative_ttl_time
+      0.0
+    end
+
+    # @private
+    def get_dns_cache_stats
+      { :hits => 0, :negative_hits => 0, :misses => 0, :coalesced => 0, :size => 0 }
+    end
+
+    # @private
+    def dns_cache_lookup host
+      nil
+    end
+
+    # @private
+    def dns_cache_store host, addrs, ttl
+    end
+
+    # Idle TLS connections are left as they are in pure Ruby.
+    # @private
+    def set_tls_idle_shrink_time seconds
+    end
+
+    # @private
+    def get_tls_idle_shrink_time
+      0.0
+    end
+
+    # TLS contexts aren't cached in pure Ruby, so there's nothing to preload.
+    # @private
+    def preload_tls_context priv_key_path, priv_key, priv_key_pass, cert_chain_path, cert, cipher_list, ecdh_curve, dhparam, protocols_bitmask
+    end
+
+    # @private
+    def reload_tls_contexts filename
+      0
+    end
+
+    # Ruby's OpenSSL makes its own ticket keys and session cache, and
+    # doesn't keep the counts that tls_stats returns.
+    # @private
+    def set_tls_ticket_key_data keys
+    end
+
+    # @private
+    def set_tls_session_cache_limits size, timeout
+    end
+
+    # @private
+    def get_tls_stats
+      { :started_handshakes => 0, :full_handshakes => 0, :resumed_handshakes => 0, :failed_handshakes => 0,
+        :handshake_times => [0] * 12, :bytes_encrypted => 0, :bytes_decrypted => 0,
+        :records_sent => 0, :records_received => 0, :read_time => 0.0, :write_time => 0.0, :handshake_time => 0.0,
+        :contexts_created => 0, :contexts_reused => 0 }
+    end
+
+    # Framing is done by the C++ reactor; in pure Ruby, use a
+    # BufferedTokenizer or Protocols::LineText2 from #receive_data instead.
+    # @private
+    def set_line_framing signature, delimiter, max_length
+      raise Unsupported, "framing in the reactor isn't available in pure Ruby" if delimiter
+    end
+
+    # @private
+    def set_length_framing signature, width, big_endian, offset, adjustment, strip, max_frame_size
+      raise Unsupported, "framing in the reactor isn't available in pure Ruby" if width != 0
+    end
+
     # @private
     def get_sock_opt signature, level, optname
       selectable = Reactor.instance.get_selectable( signature ) or raise "unknown get_sock_opt target"
@@ -492,6 +687,14 @@ module EventMachine
   # @private
   SslVerify = 109
   # @private
+  SheddingStarted = 114
+  # @private
+  SheddingStopped = 115
+  # @private
+  ConnectionRebound = 116
+  # @private
+  ConnectionReconnecting = 117
+  # @private
   EM_PROTO_SSLv2 = 2
   # @private
   EM_PROTO_SSLv3 = 4
@@ -16,9 +16,24 @@ module EventMachine
       @hosts = nil
       @nameservers = nil
       @socket = nil
+      @requests = {}
+      @requests_socket = nil
 
+      # Callers asking for a name that's already being looked up share its
+      # request. Requests made on a socket from an earlier reactor are
+      # forgotten.
       def self.resolve(hostname)
-        Request.new(socket, hostname)
+        sock = socket
+        @requests = {} unless @requests_socket.equal?(sock)
+        @requests_socket = sock
+        return @requests[hostname] if @requests[hostname]
+
+        req = Request.new(sock, hostname)
+        @requests[hostname] = req
+        done = proc { @requests.delete(hostname) if @requests[hostname].equal?(req) }
+        req.callback(&done)
+        req.errback(&done)
+        req
       end
 
       def self.socket
@@ -168,6 +183,12 @@ module EventMachine
 
         if addrs = Resolver.hosts[hostname]
           succeed addrs
+        elsif EM.dns_cache_ttl > 0 && cached = EM.dns_cache_lookup(hostname)
+          if cached == :nxdomain
+            fail "rcode=#{Resolv::DNS::RCode::NXDomain}"
+          else
+            succeed cached
+          end
         else
           EM.next_tick { tick }
         end
@@ -186,16 +207,22 @@ module EventMachine
 
       def receive_answer(msg)
         addrs = []
+        min_ttl = nil
         msg.each_answer do |name,ttl,data|
           if data.kind_of?(Resolv::DNS::Resource::IN::A) ||
               data.kind_of?(Resolv::DNS::Resource::IN::AAAA)
             addrs << data.address.to_s
+            min_ttl = ttl if min_ttl.nil? || ttl < min_ttl
           end
         end
 
         if addrs.empty?
+          if msg.rcode == Resolv::DNS::RCode::NXDomain
+            EM.dns_cache_store(@hostname, [], EM.dns_negative_ttl)
+          end
           fail "rcode=#{msg.rcode}"
         else
+          EM.dns_cache_store(@hostname, addrs, [min_ttl, EM.dns_cache_ttl].min)
           succeed addrs
         end
       end
@@ -21,6 +21,7 @@ require 'em/spawnable'
 require 'em/processes'
 require 'em/iterator'
 require 'em/buftok'
+require 'em/http_response_parser'
 require 'em/timers'
 require 'em/protocols'
 require 'em/connection'
@@ -33,6 +34,7 @@ require 'em/tick_loop'
 require 'em/resolver'
 require 'em/completion'
 require 'em/threaded_resource'
+require 'em/fiber_scheduler' if defined?(Fiber) && Fiber.respond_to?(:set_scheduler)
 
 require 'shellwords'
 require 'thread'
@@ -173,6 +175,8 @@ module EventMachine
     else
       @conns = {}
       @acceptors = {}
+      @admission_handlers = {}
+      @pool_tls = {}
       @timers = {}
       @wrapped_exception = nil
       @next_tick_queue ||= []
@@ -529,7 +533,7 @@ module EventMachine
     klass = klass_from_handler(Connection, handler, *args)
 
     s = if port
-          start_tcp_server server, port
+          start_tcp_server server, port, nil
         else
           start_unix_server server
         end
@@ -537,6 +541,48 @@ module EventMachine
     s
   end
 
+  # @private
+  LISTENER_OPTIONS = [:backlog, :defer_accept, :fastopen, :reuseport, :nodelay, :keepalive, :sndbuf, :rcvbuf]
+
+  # Starts a TCP server like {EventMachine.start_server}, with the listening
+  # socket set up according to +options+. Options the platform doesn't have
+  # are ignored.
+  #
+  # @example
+  #
+  #   EventMachine.run {
+  #     EventMachine.start_server_with_options "0.0.0.0", 8080, { backlog: 1024, defer_accept: 5, reuseport: true }, HttpHandler
+  #   }
+  #
+  # @param [String] server         Host to bind to.
+  # @param [Integer] port          Port to bind to.
+  # @param [Hash] options
+  # @option options [Integer] :backlog (100) Length of the queue of connections waiting to be accepted.
+  # @option options [Integer] :defer_accept Seconds the kernel waits for a client to send something
+  #   before handing its connection over, so that {Connection#receive_data} can follow
+  #   {Connection#post_init} at once (Linux).
+  # @option options [Integer] :fastopen Length of the queue of TCP Fast Open requests, which
+  #   lets clients send data with their SYN. The kernel must have server Fast Open enabled.
+  # @option options [Boolean] :reuseport (false) Sets SO_REUSEPORT, so that several processes
+  #   can listen on the same port and share its connections.
+  # @option options [Boolean] :nodelay (true) Whether accepted connections have Nagle's algorithm turned off.
+  # @option options [Boolean] :keepalive (false) Whether accepted connections send TCP keepalives.
+  # @option options [Integer] :sndbuf Send buffer size for accepted connections.
+  # @option options [Integer] :rcvbuf Receive buffer size for accepted connections.
+  # @param [Module, Class] handler A module or class that implements connection callbacks
+  #
+  # @see EventMachine.start_server
+  def self.start_server_with_options server, port, options, handler=nil, *args, &block
+    unknown = options.keys - LISTENER_OPTIONS
+    raise ArgumentError, "unknown listener options: #{unknown.join(', ')}" unless unknown.empty?
+
+    klass = klass_from_handler(Connection, handler, *args)
+
+    s = start_tcp_server server, Integer(port), options
+    @acceptors[s] = [klass,args,block]
+    s
+  end
+
   # Attach to an existing socket's file descriptor. The socket may have been
   # started with {EventMachine.start_server}.
   def self.attach_server sock, handler=nil, *args, &block
@@ -553,6 +599,119 @@ module EventMachine
     EventMachine::stop_tcp_server signature
   end
 
+  # @private
+  ADMISSION_LIMITS = [:max_connections, :max_loop_lag, :max_outbound_bytes, :resume_at, :reject]
+
+  # Protects a server from overload. Once any of the limits is reached the
+  # server sheds load: it stops accepting, so that new connections wait in
+  # the kernel's queue (whose length is the :backlog of
+  # {EventMachine.start_server_with_options}), or with +:reject+ it accepts
+  # them and hangs up at once, without the handler ever seeing them. It
+  # goes back to accepting once every measure is under +:resume_at+ of its
+  # limit.
+  #
+  # The block, if given, is called when the server starts shedding, with
+  # +true+ and the limit that was reached (+:connections+, +:loop_lag+ or
+  # +:outbound_bytes+), and when it stops, with +false+ and +nil+.
+  #
+  # @example
+  #
+  #   EventMachine.run {
+  #     server = EventMachine.start_server "0.0.0.0", 8080, HttpHandler
+  #     EventMachine.set_admission_limits(server, max_connections: 10_000, max_loop_lag: 0.05,
+  #                                               reject: "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n") { |shedding, reason|
+  #       logger.warn(shedding ? "shedding load: #{reason}" : "accepting again")
+  #     }
+  #   }
+  #
+  # @param [Integer] server Signature returned by {EventMachine.start_server}.
+  # @param [Hash] limits    +nil+ lifts the limits.
+  # @option limits [Integer] :max_connections Open connections accepted by this server.
+  # @option limits [Float] :max_loop_lag Seconds the reactor spends on each pass through its
+  #   loop, outside of waiting for events, as a moving average. See {EventMachine.admission_stats}.
+  # @option limits [Integer] :max_outbound_bytes Bytes waiting to be sent on all of the
+  #   reactor's connections.
+  # @option limits [Float] :resume_at (0.8) Fraction of each limit to get back under.
+  # @option limits [Boolean, String] :reject (false) Turn connections away instead of leaving
+  #   them queued. A String is sent to them first.
+  #
+  # @see EventMachine.admission_stats
+  def self.set_admission_limits server, limits, &block
+    if limits
+      unknown = limits.keys - ADMISSION_LIMITS
+      raise ArgumentError, "unknown admission limits: #{unknown.join(', ')}" unless unknown.empty?
+
+      limits = limits.dup
+      if limits[:reject].is_a?(String)
+        limits[:reject_response] = limits[:reject]
+        limits[:reject] = true
+      end
+    end
+
+    set_acceptor_limits server, limits
+    if limits && block
+      @admission_handlers[server] = block
+    else
+      @admission_handlers.delete(server)
+    end
+  end
+
+  # How a server with {EventMachine.set_admission_limits} is doing.
+  #
+  # @param [Integer] server Signature returned by {EventMachine.start_server}.
+  # @return [Hash] +:connections+ open that it accepted, +:shedding+ (the limit it is over, or
+  #   +nil+), +:sheds+ (times it started shedding), +:rejected+ connections, and the reactor's
+  #   +:loop_lag+ (seconds) and +:outbound_bytes+.
+  def self.admission_stats server
+    get_acceptor_stats server
+  end
+
+  # @private
+  RATE_LIMITS = [:read, :write, :burst]
+
+  # Shapes a connection's traffic, or a server's, with token buckets. A
+  # connection over its read limit isn't read from until the limit allows
+  # it again, so what the peer sends waits in the kernel (and, once that
+  # fills, the peer waits), rather than being read and then thrown away
+  # or buffered in Ruby. One over its write limit keeps what it has to
+  # send queued. The reactor refills the buckets of throttled connections
+  # once per timer quantum ({EventMachine.set_quantum}), so +:burst+
+  # should be at least a quantum's worth of the rate.
+  #
+  # Limits on a server are for all of the connections it accepts
+  # together, each of which may have its own limits as well. They apply
+  # to connections accepted before they were set, too.
+  #
+  # @example Slowing down a client that sends too much
+  #
+  #   module Upload
+  #     def post_init
+  #       set_rate_limits read: 64 * 1024
+  #     end
+  #   end
+  #
+  #   EventMachine.run {
+  #     server = EventMachine.start_server "0.0.0.0", 8080, Upload
+  #     # And no more than 10MB/s in and out between them.
+  #     EventMachine.set_rate_limits(server, read: 10_000_000, write: 10_000_000)
+  #   }
+  #
+  # @param [Integer] signature A connection's signature, or one returned by {EventMachine.start_server}.
+  # @param [Hash] limits       +nil+ lifts the limits.
+  # @option limits [Integer] :read Bytes a second to read, counted as they come off the socket.
+  # @option limits [Integer] :write Bytes a second to write.
+  # @option limits [Integer] :burst Bytes that can go at once after a quiet spell. By default,
+  #   a second's worth.
+  #
+  # @see Connection#set_rate_limits
+  def self.set_rate_limits signature, limits
+    if limits
+      unknown = limits.keys - RATE_LIMITS
+      raise ArgumentError, "unknown rate limits: #{unknown.join(', ')}" unless unknown.empty?
+    end
+    set_descriptor_rate_limits signature, limits
+  end
+
   # Start a Unix-domain server.
   #
   # Note that this is an alias for {EventMachine.start_server}, which can be used to start both
@@ -574,6 +733,11 @@ module EventMachine
   # Learn more about connection lifecycle callbacks in the {file:docs/GettingStarted.md EventMachine tutorial} and
   # {file:docs/ConnectionLifecycleCallbacks.md Connection lifecycle guide}.
   #
+  # A hostname is looked up on the reactor thread, which waits for the answer,
+  # unless {EventMachine.set_resolver_threads} has been called.
+  # Only its first address is connected to unless
+  # {EventMachine.set_connection_attempt_delay} has been called.
+  #
   #
   # @example
   #
@@ -688,6 +852,327 @@ module EventMachine
     c
   end
 
+  # Connects like {EventMachine.connect}, but through a pool of
+  # connections kept open for reuse. A connection given back with
+  # {Connection#release} is parked, and the next pooled connect to the
+  # same host and port (and TLS settings) gets it without a DNS lookup,
+  # TCP handshake or TLS handshake. It still sees
+  # {Connection#connection_completed}, but not
+  # {Connection#ssl_handshake_completed}; {Connection#reused?} tells it
+  # from a fresh one. With :verify_peer, connections are only shared by
+  # connects with the same handler, since the peer was approved by the
+  # {Connection#ssl_verify_peer} of the one that made it.
+  #
+  # A parked connection is closed quietly if the server closes it or
+  # sends anything, or once it has been idle for the pool's idle timeout,
+  # and it's checked again before it's handed out. With a limit on
+  # connections per host (see {EventMachine.set_connection_pool_limits}),
+  # a connect beyond it waits for one to be released or closed. Its
+  # handler is created at once, as usual, and what it sends meanwhile is
+  # sent once it has a connection. The wait counts towards its
+  # {Connection#pending_connect_timeout}.
+  #
+  # The protocol must leave a connection ready for the next request
+  # before it's released: a response read to the end, say.
+  #
+  # @example Pooled HTTP requests
+  #
+  #   module Get
+  #     def post_init
+  #       send_data "GET / HTTP/1.1\r\nHost: example.com\r\n\r\n"
+  #     end
+  #
+  #     def receive_data data
+  #       # ... once the whole response is in:
+  #       release
+  #     end
+  #   end
+  #
+  #   EM.pooled_connect 'example.com', 443, { :tls => { :verify_peer => true } }, Get
+  #
+  # @param [String] server         Host to connect to
+  # @param [Integer] port          Port to connect to
+  # @param [Hash] options          :tls, arguments for {Connection#start_tls}, to connect over TLS
+  # @param [Module, Class] handler A module or class that implements connection lifecycle callbacks
+  #
+  # @see EventMachine.connect
+  # @see EventMachine.connection_pool_stats
+  def self.pooled_connect server, port, options = {}, handler = nil, *args
+    port = Integer(port)
+    tls = options[:tls]
+    klass = klass_from_handler(Connection, handler, *args)
+    key = "#{server}:#{port}"
+    key << " tls:" << tls.sort_by { |k, _| k.to_s }.inspect if tls
+    # Only the handler whose ssl_verify_peer approved the peer gets it again.
+    key << " handler:#{klass.object_id}" if tls && tls[:verify_peer]
+
+    s = pool_connect_server key, server, port
+    state = get_pool_connection_state s
+
+    # TLS goes on before post_init can send anything in the clear.
+    c = klass.new(s, *args) { |conn| conn.start_tls(tls) if tls && state == 0 }
+    @conns[s] = c
+    @pool_tls[s] = tls if tls && state == 2
+    block_given? and yield c
+    c
+  end
+
+  # Gives a connection made with {EventMachine.pooled_connect} back to
+  # the pool. Its handler gets no further callbacks, not even
+  # {Connection#unbind}. If it can't be reused (it has data still to send
+  # or to be framed, hasn't finished its TLS handshake, or the server has
+  # closed it or sent more), it's closed instead and unbound as usual.
+  #
+  # @param [EventMachine::Connection] c The connection to release
+  # @return [Boolean] Whether the connection was kept.
+  def self.release_connection c
+    s = c.signature
+    return false unless @conns.delete(s)
+    return true if pool_release_connection(s)
+    @conns[s] = c
+    c.close_connection
+    false
+  end
+
+  # Limits the connections {EventMachine.pooled_connect} keeps, per host,
+  # port and TLS settings. Takes a hash:
+  #
+  # :max_per_host, the most connections to be open at once, in use or
+  # idle. Zero, the default, is no limit.
+  #
+  # :idle_timeout, how many seconds a parked connection is kept before
+  # it's closed. The default is 30; zero keeps them until the server
+  # closes them.
+  #
+  # @param [Hash] options :max_per_host and :idle_timeout
+  def self.set_connection_pool_limits options
+    set_pool_limits Integer(options[:max_per_host] || 0), (options[:idle_timeout] || 30).to_f
+  end
+
+  # @return [Hash] The reactor's connection pool: :idle, :active and
+  #   :waiting connections now, and how many were :created, :reused and
+  #   :discarded (closed while idle) so far.
+  # @see EventMachine.pooled_connect
+  def self.connection_pool_stats
+    get_pool_stats
+  end
+
+  # Connects like {EventMachine.connect}, but when the connect fails, or
+  # the connection is closed by anything but {Connection#close_connection},
+  # it connects again, under the same handler, after a delay that backs off
+  # as {EventMachine.set_reconnect_policy} says. The handler gets
+  # {Connection#reconnecting} instead of {Connection#unbind} each time, and
+  # {Connection#connection_completed} each time it's connected again.
+  # Anything it sent that hadn't gone out is dropped. It's unbound for good
+  # once the policy's attempts run out, when the server's circuit breaker
+  # is open, or when the reactor stops.
+  #
+  # Retries are timed by the reactor, without a Ruby timer each, and the
+  # server's name is looked up again for each (see
+  # {EventMachine.set_resolver_threads}). TLS isn't restarted for it;
+  # call {Connection#start_tls} from {Connection#reconnecting} or
+  # {Connection#connection_completed}.
+  #
+  # @example A client that stays connected
+  #
+  #   module Feed
+  #     def connection_completed
+  #       send_data "SUBSCRIBE prices\r\n"
+  #     end
+  #
+  #     def reconnecting reason
+  #       puts "lost the feed (#{reason.inspect}), try #{reconnect_attempts}"
+  #     end
+  #   end
+  #
+  #   EM.set_reconnect_policy :base_delay => 0.5, :max_delay => 60, :breaker_threshold => 10
+  #   EM.connect_with_retry 'feed.example.com', 9000, Feed
+  #
+  # @param [String] server         Host to connect to
+  # @param [Integer] port          Port to connect to
+  # @param [Module, Class] handler A module or class that implements connection lifecycle callbacks
+  #
+  # @see EventMachine.connect
+  # @see EventMachine.set_reconnect_policy
+  def self.connect_with_retry server, port, handler=nil, *args
+    klass = klass_from_handler(Connection, handler, *args)
+    s = connect_server_with_retry server, Integer(port)
+    c = klass.new s, *args
+    @conns[s] = c
+    block_given? and yield c
+    c
+  end
+
+  # Like {EventMachine.connect}, but the connection asks for TCP Fast Open
+  # (RFC 7413). Once a server has handed out a cookie, later connections to
+  # it send what was queued with {Connection#send_data} before the connect
+  # completed (in +post_init+, say) with the SYN, which saves a round trip
+  # on short requests. Such a connection sees
+  # {Connection#connection_completed} at once, before the handshake, and a
+  # refused connect shows up as an unbind with its reason. Servers must
+  # turn Fast Open on too: see +:fastopen+ in
+  # {EventMachine.start_server_with_options}.
+  #
+  # Only for protocols where the client speaks first. With a cookie, the
+  # kernel holds the SYN back until the first write, so a client that
+  # waits for the server to greet it (SMTP, IMAP, MySQL,
+  # {EventMachine::Protocols::SmtpClient}) never gets connected at all.
+  #
+  # Only where the kernel supports it (Linux 4.11 and later); elsewhere the
+  # connection is made as usual. Connections racing several addresses (see
+  # {EventMachine.set_connection_attempt_delay}) never use it.
+  #
+  # @param [String] server         Host to connect to
+  # @param [Integer] port          Port to connect to
+  # @param [Module, Class] handler A module or class that implements connection lifecycle callbacks
+  #
+  # @see EventMachine.connect
+  def self.connect_fast_open server, port, handler=nil, *args
+    klass = klass_from_handler(Connection, handler, *args)
+    s = connect_server_fast_open server, Integer(port)
+    c = klass.new s, *args
+    @conns[s] = c
+    block_given? and yield c
+    c
+  end
+
+  # Sets how connections made with {EventMachine.connect_with_retry}
+  # reconnect. The delay before each attempt is :base_delay doubled for
+  # every attempt since the connection last succeeded, up to :max_delay,
+  # less a random part of it, up to :jitter of it, so that clients which
+  # lost a server together don't come back to it together.
+  #
+  # Each server, by host and port, has a circuit breaker. After
+  # :breaker_threshold connects to it in a row have failed, connects to
+  # it fail at once, with the error the last one failed with, for
+  # :breaker_timeout seconds. Then one is let through as a trial, which
+  # closes the breaker if it succeeds.
+  #
+  # Takes a hash, of which anything left out is set to its default:
+  #
+  # :base_delay, seconds, 0.1 by default.
+  #
+  # :max_delay, seconds, 30 by default.
+  #
+  # :jitter, from 0 to 1. The default, 1, makes the whole delay random.
+  #
+  # :max_attempts, how many times in a row a connection tries again
+  # before it's unbound. Zero, the default, is no limit.
+  #
+  # :breaker_threshold, zero (the default) for no circuit breaker.
+  #
+  # :breaker_timeout, seconds, 30 by default.
+  #
+  # The policy is for the process, and takes effect from the next attempt.
+  #
+  # @param [Hash] options
+  def self.set_reconnect_policy options
+    set_redial_policy((options[:base_delay] || 0.1).to_f, (options[:max_delay] || 30).to_f,
+      (options[:jitter] || 1).to_f, Integer(options[:max_attempts] || 0),
+      Integer(options[:breaker_threshold] || 0), (options[:breaker_timeout] || 30).to_f)
+  end
+
+  # Looks up the hostnames given to {EventMachine.connect} and
+  # {EventMachine.bind_connect} on +count+ threads, so that a slow name
+  # server doesn't hold up every other connection. The connection is
+  # returned straight away and connects once the address is known. If the
+  # name can't be resolved, it's unbound with +Errno::EHOSTUNREACH+. The
+  # lookup counts towards the connection's
+  # {Connection#pending_connect_timeout}. Zero, the default, looks names
+  # up on the reactor thread, where a failed lookup raises
+  # {EventMachine::ConnectionError} from {EventMachine.connect}. IP
+  # addresses are never looked up.
+  #
+  # The threads are started when a reactor first needs them, so set this
+  # before {EventMachine.run}.
+  #
+  # @param [Integer] count Number of resolver threads
+  def self.set_resolver_threads(count)
+    set_resolver_thread_count count
+  end
+
+  # @return [Integer] The number of resolver threads.
+  # @see EventMachine.set_resolver_threads
+  def self.resolver_threads
+    get_resolver_thread_count
+  end
+
+  # Races connects to the addresses a hostname given to
+  # {EventMachine.connect} resolves to, as in Happy Eyeballs (RFC 8305),
+  # instead of trying only the first one. Attempts alternate between IPv6
+  # and IPv4 addresses, and each one gets +seconds+ before the next one is
+  # started alongside it; one that fails starts the next one at once. The
+  # first to connect is kept and the others are closed, so the connection
+  # sees {Connection#connection_completed} once, for the winner. If all of
+  # them fail, it's unbound with the last error. The whole race counts
+  # towards the connection's {Connection#pending_connect_timeout}.
+  #
+  # RFC 8305 recommends 0.25 seconds. Zero, the default, connects to the
+  # first address only. Hostnames given a bind address, and IP addresses,
+  # are always connected to directly.
+  #
+  # @param [Float] seconds How long each attempt gets before the next starts
+  def self.set_connection_attempt_delay(seconds)
+    set_connection_attempt_delay_time seconds.to_f
+  end
+
+  # @return [Float] How long each connect attempt gets before the next starts.
+  # @see EventMachine.set_connection_attempt_delay
+  def self.connection_attempt_delay
+    get_connection_attempt_delay_time
+  end
+
+  # Keeps the addresses host names resolve to for +seconds+, so that
+  # connecting to the same name again doesn't ask the name server again.
+  # The cache is shared by every reactor, the resolver threads (see
+  # {EventMachine.set_resolver_threads}) and {EventMachine::DNS::Resolver}.
+  # The system resolver doesn't say how long its answers are good for, so
+  # they're all kept for +seconds+; {EventMachine::DNS::Resolver} keeps
+  # its answers for the TTLs of the records, up to +seconds+. When several
+  # threads want the same name, only one of them looks it up. Zero, the
+  # default, turns the cache off and empties it.
+  #
+  # @param [Float] seconds How long to keep addresses for
+  # @see EventMachine.set_dns_negative_ttl
+  # @see EventMachine.dns_cache_stats
+  def self.set_dns_cache_ttl(seconds)
+    set_dns_cache_ttl_time seconds.to_f
+  end
+
+  # @return [Float] How long the DNS cache keeps addresses for.
+  # @see EventMachine.set_dns_cache_ttl
+  def self.dns_cache_ttl
+    get_dns_cache_ttl_time
+  end
+
+  # Keeps names the name server said don't exist for +seconds+, while the
+  # DNS cache is on. Connecting to one fails straight away meanwhile.
+  # Other failures, like a name server that doesn't answer, aren't kept.
+  # Zero, the default, doesn't keep them at all.
+  #
+  # @param [Float] seconds How long to keep names that don't exist for
+  # @see EventMachine.set_dns_cache_ttl
+  def self.set_dns_negative_ttl(seconds)
+    set_dns_negative_ttl_time seconds.to_f
+  end
+
+  # @return [Float] How long the DNS cache keeps names that don't exist for.
+  # @see EventMachine.set_dns_negative_ttl
+  def self.dns_negative_ttl
+    get_dns_negative_ttl_time
+  end
+
+  # Counts how the DNS cache has been used since the process started.
+  #
+  # @return [Hash] +:hits+ and +:negative_hits+ (names answered from the
+  #   cache, with addresses or as not existing), +:misses+ (names that had
+  #   to be looked up), +:coalesced+ (lookups that waited for the same
+  #   name's lookup on another thread) and +:size+ (names cached now).
+  # @see EventMachine.set_dns_cache_ttl
+  def self.dns_cache_stats
+    get_dns_cache_stats
+  end
+
   # {EventMachine.watch} registers a given file descriptor or IO object with the eventloop. The
   # file descriptor will not be modified (it will remain blocking or non-blocking).
   #
@@ -957,6 +1442,186 @@ module EventMachine
     self.get_connection_count
   end
 
+  # Sets the keys that TLS servers use to encrypt and decrypt session
+  # tickets, so that clients can resume sessions across processes (and
+  # machines) that share them. Each key is 48 bytes: a 16-byte key name,
+  # a 16-byte HMAC secret and a 16-byte AES key, the same layout as
+  # nginx's +ssl_session_ticket_key+ files.
+  #
+  # The first key encrypts new tickets; the others are only accepted, and
+  # tickets presented under them are replaced by one under the first key.
+  # To rotate, prepend a new key and drop the oldest one. Without keys,
+  # each server context uses a random key of its own.
+  #
+  # @example
+  #   EM.set_tls_ticket_keys(File.binread('current.key'), File.binread('previous.key'))
+  #
+  # @param [Array<String>] keys 48-byte keys, newest first
+  def self.set_tls_ticket_keys(*keys)
+    keys.each do |key|
+      raise ArgumentError, "session ticket keys must be 48 bytes, not #{key.bytesize}" unless key.bytesize == 48
+    end
+    set_tls_ticket_key_data keys.map(&:b).join
+  end
+
+  # Sets the size of the server-side TLS session cache, and how long
+  # (in seconds) cached sessions and tickets stay valid. Each server
+  # context (a certificate and its TLS settings) has a cache of its own,
+  # holding 20480 sessions for 300 seconds by default.
+  #
+  # @param [Integer] size Maximum number of cached sessions, 0 for no limit
+  # @param [Integer] timeout Session lifetime in seconds
+  def self.set_tls_session_cache(size, timeout = 300)
+    set_tls_session_cache_limits size, timeout
+  end
+
+  # TLS counters for the running reactor, covering its servers and clients
+  # since it started. Telling how much time goes to TLS helps to see whether
+  # it or the application is using the CPU.
+  #
+  # @return [Hash] with these keys:
+  #   * +:started_handshakes+, +:full_handshakes+, +:resumed_handshakes+ and
+  #     +:failed_handshakes+ (those whose connection closed before they
+  #     completed);
+  #   * +:handshake_times+, completed handshakes by how long they took from
+  #     {Connection#start_tls}, or the connect if that was later: an Array of
+  #     12 counts, for under 1ms, 1-2ms, 2-4ms and so on up to 512-1024ms,
+  #     then 1024ms or more;
+  #   * +:bytes_encrypted+ and +:bytes_decrypted+, plaintext sent and received;
+  #   * +:records_sent+ and +:records_received+, TLS records of any kind
+  #     (after kernel TLS takes over, its records aren't counted);
+  #   * +:read_time+, +:write_time+ and +:handshake_time+, seconds spent in
+  #     OpenSSL's SSL_read, SSL_write and handshake calls;
+  #   * +:contexts_created+ and +:contexts_reused+, connections that had an
+  #     SSL context built for their parameters and those that shared one
+  #     already cached.
+  def self.tls_stats
+    get_tls_stats
+  end
+
+  # Runs the handshakes of TLS servers on +count+ threads, so that the
+  # private-key operations for a burst of new clients don't hold up I/O on
+  # established connections. While one of those threads works on a
+  # connection's handshake, the connection isn't read from; the reactor
+  # picks it up again when the thread is done. Handshakes that verify the
+  # peer (+:verify_peer+) still run on the reactor thread, as do those of
+  # clients and of kernel TLS connections. Zero, the default, runs every
+  # handshake on the reactor thread.
+  #
+  # The threads are started when a reactor first needs them, so set this
+  # before {EventMachine.run}.
+  #
+  # @param [Integer] count Number of handshake threads
+  def self.set_tls_handshake_threads(count)
+    set_tls_handshake_thread_count count
+  end
+
+  # @return [Integer] The number of TLS handshake threads.
+  # @see EventMachine.set_tls_handshake_threads
+  def self.tls_handshake_threads
+    get_tls_handshake_thread_count
+  end
+
+  # Frees the buffers a TLS connection can do without once it has sent and
+  # received nothing for +seconds+, such as OpenSSL's record buffers when
+  # they hold a partial record. A connection that is busy again gets them
+  # back as it needs them. This saves memory on servers with many mostly
+  # idle TLS connections, such as websockets. Zero, the default, turns it
+  # off. See {Connection#tls_memory}.
+  #
+  # @param [Float] seconds Idle time before a connection's buffers are freed
+  def self.set_tls_idle_shrink(seconds)
+    set_tls_idle_shrink_time seconds
+  end
+
+  # @return [Float] The idle time before TLS connection buffers are freed.
+  # @see EventMachine.set_tls_idle_shrink
+  def self.tls_idle_shrink
+    get_tls_idle_shrink_time
+  end
+
+  # Reads the key, certificate chain and DH parameters for a TLS server
+  # now, so that connections calling {Connection#start_tls} with the same
+  # arguments don't read them from disk as they're accepted. The context
+  # made from them stays cached for as long as the reactor runs.
+  #
+  # With +watch+, the files are watched with {EventMachine.watch_file}, and
+  # reloaded with {EventMachine.reload_tls_file} when they change. Files
+  # replaced by a rename, as certificate renewal tools tend to do, are
+  # watched again at the same path. Until a key and certificate that go
+  # together can be read, connections keep getting the previous ones.
+  #
+  # Call this inside {EventMachine.run}.
+  #
+  # @example
+  #
+  #  EventMachine.run do
+  #    tls = { :private_key_file => '/tmp/server.key', :cert_chain_file => '/tmp/server.crt' }
+  #    EventMachine.preload_tls(tls, true)
+  #    EventMachine.start_server('0.0.0.0', 443, Handler, tls)
+  #  end
+  #
+  # @param [Hash] args The server's {Connection#start_tls} arguments
+  # @param [Boolean] watch Whether to reload the files when they change
+  # @raise [EventMachine::InvalidPrivateKey] if the files can't be loaded
+  def self.preload_tls(args, watch = false)
+    files = args.values_at(:private_key_file, :cert_chain_file, :dhparam).reject { |f| f.nil? || f.empty? }
+    files.each do |file|
+      raise FileNotFoundException, "Could not find #{file} for preload_tls" unless File.exist? file
+    end
+
+    preload_tls_context(args[:private_key_file] || '', args[:private_key] || '', args[:private_key_pass] || '',
+                        args[:cert_chain_file] || '', args[:cert] || '', args[:cipher_list] || '',
+                        args[:ecdh_curve] || '', args[:dhparam] || '', tls_protocols_bitmask(args[:ssl_version]))
+
+    files.uniq.each { |file| watch_file(file, TlsFileWatch) } if watch
+    nil
+  end
+
+  # Reads +filename+ again for every cached TLS context that uses it as a
+  # key, certificate chain or DH parameter file. New connections get the
+  # new context; those already open keep the one they started with.
+  #
+  # @param [String] filename Path as given to {Connection#start_tls}
+  # @return [Integer, false] The number of contexts reloaded, or false if
+  #   any of them couldn't be, in which case those are left as they were.
+  def self.reload_tls_file(filename)
+    reload_tls_contexts filename
+  end
+
+  # @private
+  def self.tls_protocols_bitmask(ssl_version)
+    protocols_bitmask = 0
+    if ssl_version.nil?
+      protocols_bitmask |= EventMachine::EM_PROTO_TLSv1
+      protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_1
+      protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_2
+      if EventMachine.const_defined? :EM_PROTO_TLSv1_3
+        protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_3
+      end
+    else
+      [ssl_version].flatten.each do |p|
+        case p.to_s.downcase
+        when 'sslv2'
+          protocols_bitmask |= EventMachine::EM_PROTO_SSLv2
+        when 'sslv3'
+          protocols_bitmask |= EventMachine::EM_PROTO_SSLv3
+        when 'tlsv1'
+          protocols_bitmask |= EventMachine::EM_PROTO_TLSv1
+        when 'tlsv1_1'
+          protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_1
+        when 'tlsv1_2'
+          protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_2
+        when 'tlsv1_3'
+          protocols_bitmask |= EventMachine::EM_PROTO_TLSv1_3
+        else
+          raise("Unrecognized SSL/TLS Protocol: #{p}")
+        end
+      end
+    end
+    protocols_bitmask
+  end
+
   # The is the responder for the loopback-signalled event.
   # It can be fired either by code running on a separate thread ({EventMachine.defer}) or on
   # the main thread ({EventMachine.next_tick}).
@@ -1477,6 +2142,7 @@ module EventMachine
     # code, but the performance impact may be too large.
     #
     if opcode == ConnectionUnbound
+      @pool_tls.delete( conn_binding ) unless @pool_tls.empty?
       if c = @conns.delete( conn_binding )
         begin
           if c.original_method(:unbind).arity != 0
@@ -1511,7 +2177,7 @@ module EventMachine
           end
         end
       elsif c = @acceptors.delete( conn_binding )
-        # no-op
+        @admission_handlers.delete( conn_binding )
       else
         if $! # Bubble user generated errors.
           @wrapped_exception = $!
@@ -1527,6 +2193,18 @@ module EventMachine
       @conns[data] = c
       blk and blk.call(c)
       c # (needed?)
+    elsif opcode == SheddingStarted || opcode == SheddingStopped
+      h = @admission_handlers[conn_binding] and h.call(opcode == SheddingStarted, data)
+    elsif opcode == ConnectionRebound
+      # A pooled connect that waited has been given a connection.
+      c = @conns.delete( conn_binding ) or raise ConnectionNotBound, "received ConnectionRebound for unknown signature: #{conn_binding}"
+      c.signature = data
+      @conns[data] = c
+      tls = @pool_tls.delete( conn_binding )
+      c.start_tls(tls) if tls && get_pool_connection_state(data) == 0
+    elsif opcode == ConnectionReconnecting
+      c = @conns[conn_binding] or raise ConnectionNotBound, "received ConnectionReconnecting for unknown signature: #{conn_binding}"
+      c.reconnecting(data == 0 ? nil : EventMachine::ERRNOS[data])
       ##
       # The remaining code is a fallback for the pure ruby and java reactors.
       # In the C++ reactor, these events are handled in the C event_callback() in rubymain.cpp
@@ -79,6 +79,14 @@ module EventMachine
   SslHandshakeCompleted = 108
   # @private
   SslVerify = 109
+  # @private
+  SheddingStarted = 114
+  # @private
+  SheddingStopped = 115
+  # @private
+  ConnectionRebound = 116
+  # @private
+  ConnectionReconnecting = 117
 
   # @private
   EM_PROTO_SSLv2 = 2
@@ -130,7 +138,7 @@ module EventMachine
   def self.stop
     @em.stop
   end
-  def self.start_tcp_server server, port
+  def self.start_tcp_server server, port, options = nil
     @em.startTcpServer server, port
   end
   def self.stop_tcp_server sig
@@ -308,6 +316,14 @@ module EventMachine
   def self.send_file_data(sig, filename)
   end
 
+  # Framing is done by the C++ reactor only.
+  def self.set_line_framing(sig, delimiter, max_length)
+    raise Unsupported, "framing in the reactor isn't available in the Java reactor" if delimiter
+  end
+  def self.set_length_framing(sig, width, big_endian, offset, adjustment, strip, max_frame_size)
+    raise Unsupported, "framing in the reactor isn't available in the Java reactor" if width != 0
+  end
+
   class Connection
     def associate_callback_target sig
       # No-op for the time being
@@ -0,0 +1,167 @@
+require_relative 'em_test_helper'
+require 'socket'
+
+class TestAdmissionControl < Test::Unit::TestCase
+
+  module Server
+    def initialize(accepted)
+      @accepted = accepted
+    end
+
+    def post_init
+      @accepted << self
+    end
+  end
+
+  module Client
+    attr_reader :received, :connected, :unbound
+
+    def initialize
+      @received = ''
+    end
+
+    def connection_completed
+      @connected = true
+    end
+
+    def receive_data(data)
+      @received << data
+    end
+
+    def unbind
+      @unbound = true
+    end
+  end
+
+  def setup
+    @port = next_port
+  end
+
+  def start(limits, events = [])
+    accepted = []
+    server = EM.start_server '127.0.0.1', @port, Server, accepted
+    EM.set_admission_limits(server, limits) { |shedding, reason| events << [shedding, reason] }
+    [server, accepted]
+  end
+
+  def connect(count)
+    Array.new(count) { EM.connect '127.0.0.1', @port, Client }
+  end
+
+  def test_pauses_at_max_connections
+    accepted, events, stats = nil, [], nil
+    EM.run do
+      setup_timeout 5
+      server, accepted = start({ max_connections: 2 }, events)
+      connect 4
+      EM.add_timer(0.3) do
+        stats = EM.admission_stats(server)
+        EM.stop
+      end
+    end
+    assert_equal 2, accepted.size
+    assert_equal 2, stats[:connections]
+    assert_equal :connections, stats[:shedding]
+    assert_equal [[true, :connections]], events
+  end
+
+  def test_resumes_under_resume_at
+    accepted, events, closed = nil, [], 0
+    EM.run do
+      setup_timeout 5
+      _, accepted = start({ max_connections: 4, resume_at: 0.5 }, events)
+      connect 6
+      # Stays paused until fewer than half of 4 are open.
+      close_one = proc do
+        accepted.shift.close_connection
+        closed += 1
+        if closed < 3
+          EM.add_timer(0.1) do
+            assert_equal [[true, :connections]], events
+            close_one.call
+          end
+        else
+          EM.add_timer(0.2) { EM.stop }
+        end
+      end
+      EM.add_timer(0.2) { close_one.call }
+    end
+    assert_equal [[true, :connections], [false, nil]], events
+    assert_equal 3, accepted.size
+  end
+
+  def test_reject_with_response
+    clients, stats, unbound = nil, nil, nil
+    EM.run do
+      setup_timeout 5
+      server, _ = start(max_connections: 1, reject: "busy\n")
+      clients = connect 3
+      EM.add_timer(0.3) do
+        stats = EM.admission_stats(server)
+        unbound = clients.map { |c| !!c.unbound }
+        EM.stop
+      end
+    end
+    assert_equal ['', "busy\n", "busy\n"], clients.map(&:received)
+    assert_equal [false, true, true], unbound
+    assert_equal 2, stats[:rejected]
+    assert_equal 1, stats[:connections]
+  end
+
+  def test_loop_lag
+    accepted, events = nil, []
+    EM.run do
+      setup_timeout 5
+      _, accepted = start({ max_loop_lag: 0.05 }, events)
+      EM.next_tick do
+        sleep 0.3
+        connect 1
+        EM.add_timer(0.5) { EM.stop }
+      end
+    end
+    assert_equal [true, :loop_lag], events.first
+    assert_equal [false, nil], events.last
+    assert_equal 1, accepted.size
+  end
+
+  def test_outbound_bytes
+    events = []
+    EM.run do
+      setup_timeout 5
+      start({ max_outbound_bytes: 1000 }, events)
+      client = EM.connect '127.0.0.1', @port, Client
+      client.pause
+      EM.next_tick { client.send_data 'x' * 10_000 }
+      EM.add_timer(0.2) { EM.stop }
+    end
+    assert_include events, [true, :outbound_bytes]
+  end
+
+  def test_lifting_limits
+    accepted, stats = nil, nil
+    EM.run do
+      setup_timeout 5
+      server, accepted = start(max_connections: 1)
+      connect 3
+      EM.add_timer(0.2) do
+        EM.set_admission_limits server, nil
+        EM.add_timer(0.2) do
+          stats = EM.admission_stats(server)
+          EM.stop
+        end
+      end
+    end
+    assert_equal 3, accepted.size
+    assert_nil stats[:shedding]
+    assert_equal 1, stats[:sheds]
+  end
+
+  def test_unknown_limit
+    EM.run do
+      server = EM.start_server '127.0.0.1', @port, Server, []
+      assert_raise(ArgumentError) { EM.set_admission_limits server, max_conns: 1 }
+      EM.stop
+    end
+  end
+
+end
@@ -118,6 +118,25 @@ class TestBasic < Test::Unit::TestCase
     EM.error_handler(nil)
   end
 
+  def test_unwinding_unbind_leaves_others_to_unbind
+    unbound = []
+    quiet = Module.new { define_method(:unbind) { unbound << self } }
+    # Unlike an exception, a throw isn't rescued on its way out of unbind.
+    unwinding = Module.new { define_method(:unbind) { throw :unwound } }
+    catch(:unwound) {
+      EM.run {
+        EM.start_server "127.0.0.1", @port
+        # All closed at once, with the one that unwinds first in the list.
+        conns = [EM.connect("127.0.0.1", @port, unwinding)]
+        3.times { conns << EM.connect("127.0.0.1", @port, quiet) }
+        EM.add_timer(0.1) { conns.each(&:close_connection) }
+      }
+      flunk "unbind didn't unwind"
+    }
+    assert_equal 3, unbound.size
+    assert !EM.reactor_running?
+  end
+
   module BrsTestSrv
     def receive_data data
       $received << data
@@ -0,0 +1,271 @@
+require_relative 'em_test_helper'
+
+class TestConnectionPool < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(accepted, close_after = nil, tls = false)
+      @close_after = close_after
+      @tls = tls
+      accepted << self
+    end
+
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE if @tls
+    end
+
+    def receive_data(data)
+      send_data data
+      EM.add_timer(@close_after) { close_connection } if @close_after
+    end
+  end
+
+  module Client
+    attr_reader :received, :reason, :handshakes, :was_reused
+
+    def initialize(on_data)
+      @on_data = on_data
+      @received = ''
+      @handshakes = 0
+    end
+
+    def post_init
+      send_data 'ping'
+    end
+
+    def ssl_handshake_completed
+      @handshakes += 1
+    end
+
+    def receive_data(data)
+      @received << data
+      @was_reused = reused?
+      @on_data.call(self)
+    end
+
+    def unbind(reason = nil)
+      @reason = reason
+    end
+  end
+
+  def setup
+    @port = next_port
+    @accepted = []
+  end
+
+  def teardown
+    EM.set_connection_pool_limits max_per_host: 0, idle_timeout: 30
+  end
+
+  def test_reuses_released_connection
+    first = second = stats = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      first = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { |c|
+        assert c.release
+        EM.next_tick do
+          second = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc {
+            stats = EM.connection_pool_stats
+            EM.stop
+          }
+        end
+      }
+    end
+    assert !first.was_reused
+    assert second.was_reused
+    assert_equal 'ping', first.received
+    assert_equal 'ping', second.received
+    assert_nil first.reason
+    assert_equal 1, @accepted.size
+    assert_equal 1, stats[:created]
+    assert_equal 1, stats[:reused]
+    assert_equal 1, stats[:active]
+    assert_equal 0, stats[:idle]
+  end
+
+  def test_separate_pools_per_host
+    clients = []
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      EM.start_server '127.0.0.1', @port + 1, Server, @accepted
+      EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { |c|
+        c.release
+        EM.next_tick do
+          clients << EM.pooled_connect('127.0.0.1', @port + 1, {}, Client, proc { EM.stop })
+        end
+      }
+    end
+    assert !clients.first.was_reused
+    assert_equal 2, @accepted.size
+  end
+
+  def test_discards_connection_closed_by_server
+    second = stats = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted, 0.05
+      EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { |c|
+        assert c.release
+        EM.add_timer(0.3) do
+          stats = EM.connection_pool_stats
+          second = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { EM.stop }
+        end
+      }
+    end
+    assert_equal 0, stats[:idle]
+    assert_equal 1, stats[:discarded]
+    assert !second.was_reused
+    assert_equal 'ping', second.received
+  end
+
+  def test_idle_timeout
+    EM.set_connection_pool_limits idle_timeout: 0.1
+    stats = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { |c|
+        c.release
+        assert_equal 1, EM.connection_pool_stats[:idle]
+        EM.add_timer(0.5) do
+          stats = EM.connection_pool_stats
+          EM.stop
+        end
+      }
+    end
+    assert_equal 0, stats[:idle]
+    assert_equal 1, stats[:discarded]
+  end
+
+  def test_waiter_gets_released_connection
+    EM.set_connection_pool_limits max_per_host: 1
+    first = second = waiting = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      first = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { |c| c.release }
+      # Its ping is held until it has the first one's connection.
+      second = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { EM.stop }
+      waiting = EM.connection_pool_stats[:waiting]
+    end
+    assert_equal 1, waiting
+    assert second.was_reused
+    assert_equal 'ping', second.received
+    assert_nil second.reason
+    assert_equal 1, @accepted.size
+  end
+
+  def test_waiter_connects_when_one_closes
+    EM.set_connection_pool_limits max_per_host: 1
+    second = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { |c| c.close_connection }
+      second = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc { EM.stop }
+    end
+    assert !second.was_reused
+    assert_equal 'ping', second.received
+    assert_equal 2, @accepted.size
+  end
+
+  def test_waiter_times_out
+    EM.set_connection_pool_limits max_per_host: 1
+    second = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      EM.pooled_connect '127.0.0.1', @port, {}, Client, proc {}
+      second = EM.pooled_connect '127.0.0.1', @port, {}, Client, proc {}
+      second.pending_connect_timeout = 0.2
+      EM.add_timer(0.6) { EM.stop }
+    end
+    assert_equal Errno::ETIMEDOUT, second.reason
+    assert_equal '', second.received
+  end
+
+  def test_release_of_unpooled_connection_closes_it
+    client = nil
+    released = true
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted
+      client = EM.connect '127.0.0.1', @port, Client, proc { |c|
+        released = c.release
+        EM.add_timer(0.1) { EM.stop }
+      }
+    end
+    assert !released
+    assert_nil client.reason
+    assert_equal 0, EM.connection_pool_stats[:idle]
+  end
+
+  def test_reuses_tls_connection
+    omit_unless(EM.ssl?)
+    first = second = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted, nil, true
+      first = EM.pooled_connect '127.0.0.1', @port, { tls: {} }, Client, proc { |c|
+        c.release
+        EM.next_tick do
+          second = EM.pooled_connect '127.0.0.1', @port, { tls: {} }, Client, proc { EM.stop }
+        end
+      }
+    end
+    assert_equal 1, first.handshakes
+    assert second.was_reused
+    assert_equal 0, second.handshakes
+    assert_equal 'ping', second.received
+    assert_equal 1, @accepted.size
+  end
+
+  def test_verified_tls_connection_kept_to_its_handler
+    omit_unless(EM.ssl?)
+    verified = []
+    trusting = Class.new(EM::Connection) { include Client; define_method(:ssl_verify_peer) { |cert| verified << :trusting; true } }
+    picky = Class.new(EM::Connection) { include Client; define_method(:ssl_verify_peer) { |cert| verified << :picky; true } }
+    tls = { verify_peer: true }
+    first = second = third = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted, nil, true
+      first = EM.pooled_connect '127.0.0.1', @port, { tls: tls }, trusting, proc { |c|
+        c.release
+        EM.next_tick do
+          second = EM.pooled_connect '127.0.0.1', @port, { tls: tls }, picky, proc { |c2|
+            c2.release
+            EM.next_tick do
+              third = EM.pooled_connect '127.0.0.1', @port, { tls: tls }, trusting, proc { EM.stop }
+            end
+          }
+        end
+      }
+    end
+    assert !second.was_reused
+    assert_equal 1, second.handshakes
+    assert_equal [:trusting, :picky], verified.uniq
+    assert third.was_reused
+    assert_equal 2, @accepted.size
+  end
+
+  # What it sent while waiting goes out over the TLS it starts once it has a connection.
+  def test_tls_waiter
+    omit_unless(EM.ssl?)
+    EM.set_connection_pool_limits max_per_host: 1
+    second = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted, nil, true
+      EM.pooled_connect '127.0.0.1', @port, { tls: {} }, Client, proc { |c| c.close_connection }
+      second = EM.pooled_connect '127.0.0.1', @port, { tls: {} }, Client, proc { EM.stop }
+    end
+    assert_equal 1, second.handshakes
+    assert_equal 'ping', second.received
+  end
+
+end
@@ -32,4 +32,28 @@ class TestDefer < Test::Unit::TestCase
     assert_equal(callback_parameters.select { |parameter| parameter == callback_parameter }.length, iterations * 0.5)
     assert_equal(errback_parameters.select{ |parameter| parameter == errback_parameter }.length, iterations * 0.5)
   end
+
+  # With worker threads alive, the reactor performs the first read of each
+  # ready connection outside the GVL. The byte stream must come through intact.
+  def test_receive_data_while_deferring
+    port = next_port
+    payload = (0...200_000).map { |i| (i % 251).chr }.join
+    received = ''.b
+
+    server = Module.new do
+      define_method(:receive_data) do |data|
+        received << data
+        EM.stop if received.bytesize >= payload.bytesize
+      end
+    end
+
+    EM.run do
+      setup_timeout
+      EM.defer { sleep 0.01 while EM.reactor_running? }
+      EM.start_server '127.0.0.1', port, server
+      EM.connect('127.0.0.1', port) { |c| c.send_data payload }
+    end
+
+    assert_equal payload.b, received
+  end
 end
@@ -0,0 +1,205 @@
+require_relative 'em_test_helper'
+require 'resolv'
+
+class TestDnsCache < Test::Unit::TestCase
+
+  module Server
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received, :reason
+
+    def initialize(done)
+      @done = done
+      @received = ''
+    end
+
+    def connection_completed
+      send_data 'hello'
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection
+    end
+
+    def unbind(reason = nil)
+      @reason = reason
+      @done.call
+    end
+  end
+
+  # Answers A queries for stub.test, and says missing.test doesn't exist.
+  module StubDNS
+    def initialize(queries)
+      @queries = queries
+    end
+
+    def receive_data(data)
+      query = Resolv::DNS::Message.decode(data)
+      name, type = query.question.first
+      @queries << [name.to_s, type]
+
+      answer = Resolv::DNS::Message.new(query.id)
+      answer.qr = 1
+      answer.rd = query.rd
+      answer.ra = 1
+      answer.add_question(name, type)
+      if name.to_s == 'missing.test'
+        answer.rcode = Resolv::DNS::RCode::NXDomain
+      elsif name.to_s == 'stub.test' && type == Resolv::DNS::Resource::IN::A
+        answer.add_answer(name, 60, Resolv::DNS::Resource::IN::A.new('127.0.0.1'))
+      end
+      port, ip = Socket.unpack_sockaddr_in(get_peername)
+      send_datagram answer.encode, ip, port
+    end
+  end
+
+  def setup
+    EM.set_dns_cache_ttl 60
+    EM.set_dns_negative_ttl 60
+    EM.set_resolver_threads 2
+  end
+
+  def teardown
+    EM.set_dns_cache_ttl 0
+    EM.set_dns_negative_ttl 0
+    EM.set_resolver_threads 0
+  end
+
+  # Needs the system resolver to ask 127.0.0.1, and to be allowed port 53.
+  def stub_dns(queries)
+    nameserver = File.read('/etc/resolv.conf')[/^nameserver\s+(\S+)/, 1] rescue nil
+    omit("The system resolver doesn't use 127.0.0.1") unless nameserver == '127.0.0.1'
+    EM.open_datagram_socket '127.0.0.1', 53, StubDNS, queries
+  rescue RuntimeError
+    EM.stop
+    omit("Can't listen on port 53")
+  end
+
+  # Connects to host once for each reason, one after the other.
+  def connect_in_turn(host, port, clients, times)
+    run = proc do |i|
+      if i == times
+        EM.stop
+      else
+        clients << EM.connect(host, port, Client, proc { EM.next_tick { run.call(i + 1) } })
+      end
+    end
+    run.call(0)
+  end
+
+  def a_queries(queries, name)
+    queries.count { |q| q == [name, Resolv::DNS::Resource::IN::A] }
+  end
+
+  def test_ttls
+    assert_equal 60, EM.dns_cache_ttl
+    assert_equal 60, EM.dns_negative_ttl
+  end
+
+  def test_storing_bad_address
+    assert_raises(ArgumentError) { EM.dns_cache_store 'bad.test', ['127.0.0.1', 'nowhere'], 60 }
+    assert_raises(TypeError) { EM.dns_cache_store 'bad.test', ['127.0.0.1', nil], 60 }
+    assert_nil EM.dns_cache_lookup('bad.test')
+
+    EM.dns_cache_store 'bad.test', ['127.0.0.1', '::1'], 60
+    assert_equal ['127.0.0.1', '::1'], EM.dns_cache_lookup('bad.test')
+  end
+
+  def test_turning_off_empties_cache
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      connect_in_turn 'localhost', port, [], 1
+    end
+    assert_operator EM.dns_cache_stats[:size], :>=, 1
+    EM.set_dns_cache_ttl 0
+    assert_equal 0, EM.dns_cache_stats[:size]
+  end
+
+  def test_hits_and_misses
+    clients, before = [], EM.dns_cache_stats
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      connect_in_turn 'localhost', port, clients, 3
+    end
+    stats = EM.dns_cache_stats
+    assert_equal ['hello'] * 3, clients.map(&:received)
+    assert_equal 1, stats[:misses] - before[:misses]
+    assert_equal 2, stats[:hits] - before[:hits]
+  end
+
+  def test_second_connect_doesnt_ask
+    clients, queries = [], []
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      connect_in_turn 'stub.test', port, clients, 2
+    end
+    assert_equal ['hello'] * 2, clients.map(&:received)
+    assert_equal 1, a_queries(queries, 'stub.test')
+  end
+
+  def test_negative_caching
+    clients, queries, before = [], [], EM.dns_cache_stats
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      connect_in_turn 'missing.test', next_port, clients, 2
+    end
+    assert_equal [Errno::EHOSTUNREACH] * 2, clients.map(&:reason)
+    assert_equal 1, a_queries(queries, 'missing.test')
+    assert_equal 1, EM.dns_cache_stats[:negative_hits] - before[:negative_hits]
+  end
+
+  def test_resolver_shares_cache
+    clients, queries, addrs, errors = [], [], nil, []
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      EM::DNS::Resolver.resolve('stub.test').callback do |a|
+        addrs = a
+        connect_in_turn 'stub.test', port, clients, 1
+      end
+    end
+    assert_equal ['127.0.0.1'], addrs
+    assert_equal ['hello'], clients.map(&:received)
+    assert_equal 1, a_queries(queries, 'stub.test')
+
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      EM::DNS::Resolver.resolve('stub.test').callback { |a| addrs = a }
+      EM::DNS::Resolver.resolve('missing.test').errback { |e| errors << e; EM.stop }
+    end
+    assert_equal ['127.0.0.1'], addrs
+    assert_equal 1, a_queries(queries, 'stub.test')
+    assert_equal 1, errors.size
+  end
+
+  def test_resolver_shares_requests
+    queries = []
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      first = EM::DNS::Resolver.resolve('stub.test')
+      assert_same first, EM::DNS::Resolver.resolve('stub.test')
+      first.callback do
+        EM::DNS::Resolver.resolve('stub.test').callback { EM.stop }
+      end
+    end
+    assert_equal 1, a_queries(queries, 'stub.test')
+  end
+
+end
@@ -0,0 +1,95 @@
+require_relative 'em_test_helper'
+require 'socket'
+
+class TestFastOpenConnect < Test::Unit::TestCase
+
+  # TCP_FASTOPEN_CONNECT, from linux/tcp.h
+  TCP_FASTOPEN_CONNECT = 30
+
+  module Server
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  # Sends before the connect completes, which is what rides on the SYN.
+  module Client
+    attr_reader :received, :reason, :fast_open
+
+    def initialize(done)
+      @done = done
+      @received = ''
+    end
+
+    def post_init
+      @fast_open = get_sock_opt(Socket::IPPROTO_TCP, TCP_FASTOPEN_CONNECT).unpack('i').first rescue nil
+      send_data 'hello'
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection
+    end
+
+    def unbind(reason = nil)
+      @reason = reason
+      @done.call
+    end
+  end
+
+  def setup
+    @port = next_port
+  end
+
+  def test_sends_queued_data
+    clients = []
+    EM.run do
+      setup_timeout 5
+      EM.start_server_with_options '127.0.0.1', @port, { fastopen: 16 }, Server
+      # The second connect may have the server's cookie.
+      connect = proc do |i|
+        if i == 2
+          EM.stop
+        else
+          clients << EM.connect_fast_open('127.0.0.1', @port, Client, proc { EM.next_tick { connect.call(i + 1) } })
+        end
+      end
+      connect.call(0)
+    end
+    assert_equal ['hello'] * 2, clients.map(&:received)
+  end
+
+  def test_asks_for_fast_open
+    omit_unless(RUBY_PLATFORM =~ /linux/, "TCP_FASTOPEN_CONNECT is Linux's")
+    client = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server
+      client = EM.connect_fast_open '127.0.0.1', @port, Client, proc { EM.stop }
+    end
+    omit("The kernel has no TCP_FASTOPEN_CONNECT") if client.fast_open.nil?
+    assert_equal 1, client.fast_open
+  end
+
+  def test_not_asked_for_by_connect
+    omit_unless(RUBY_PLATFORM =~ /linux/, "TCP_FASTOPEN_CONNECT is Linux's")
+    client = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server
+      client = EM.connect '127.0.0.1', @port, Client, proc { EM.stop }
+    end
+    assert_not_equal 1, client.fast_open
+  end
+
+  def test_refused
+    client = nil
+    EM.run do
+      setup_timeout 5
+      client = EM.connect_fast_open '127.0.0.1', @port, Client, proc { EM.stop }
+    end
+    assert_equal '', client.received
+    assert_equal Errno::ECONNREFUSED, client.reason
+  end
+
+end
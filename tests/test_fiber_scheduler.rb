@@ -0,0 +1,143 @@
+require_relative 'em_test_helper'
+
+class TestFiberScheduler < Test::Unit::TestCase
+  if defined?(EM::FiberScheduler)
+
+    def setup
+      @port = next_port
+    end
+
+    def teardown
+      assert(!EM.reactor_running?)
+    end
+
+    def run_scheduled(&block)
+      EM.run do
+        setup_timeout 2
+        Fiber.set_scheduler EM::FiberScheduler.new
+        block.call
+      end
+    ensure
+      Fiber.set_scheduler nil
+    end
+
+    def test_sleep_runs_concurrently
+      order = []
+      started = Time.now
+
+      run_scheduled do
+        Fiber.schedule { sleep 0.2; order << :slow }
+        Fiber.schedule { sleep 0.1; order << :fast }
+        EM.add_timer(0.3) { EM.stop }
+      end
+
+      assert_equal [:fast, :slow], order
+      assert_in_delta 0.3, Time.now - started, 0.2
+    end
+
+    def test_io_wait_on_pipe
+      data = nil
+
+      run_scheduled do
+        r, w = IO.pipe
+        Fiber.schedule do
+          data = r.read(5)
+          r.close
+          EM.stop
+        end
+        EM.add_timer(0.05) { w.write 'hello'; w.close }
+      end
+
+      assert_equal 'hello', data
+    end
+
+    def test_io_wait_timeout
+      result = :unset
+
+      run_scheduled do
+        r, w = IO.pipe
+        Fiber.schedule do
+          result = r.wait_readable(0.05)
+          r.close; w.close
+          EM.stop
+        end
+      end
+
+      assert_nil result
+    end
+
+    def test_blocking_client_against_em_server
+      reply = nil
+
+      server = Module.new do
+        def receive_data(data)
+          send_data data.upcase
+          close_connection_after_writing
+        end
+      end
+
+      run_scheduled do
+        EM.start_server '127.0.0.1', @port, server
+        Fiber.schedule do
+          sock = TCPSocket.new('127.0.0.1', @port)
+          sock.write 'ping'
+          reply = sock.read
+          sock.close
+          EM.stop
+        end
+      end
+
+      assert_equal 'PING', reply
+    end
+
+    def test_queue_block_and_unblock
+      queue = Thread::Queue.new
+      popped = nil
+
+      run_scheduled do
+        Fiber.schedule { popped = queue.pop; EM.stop }
+        Thread.new { sleep 0.05; queue << :item }
+      end
+
+      assert_equal :item, popped
+    end
+
+    def test_timeout_after
+      error = nil
+
+      run_scheduled do
+        Fiber.schedule do
+          begin
+            Fiber.scheduler.timeout_after(0.05, RuntimeError, 'too slow') { sleep 1 }
+          rescue RuntimeError => e
+            error = e
+          end
+          EM.stop
+        end
+      end
+
+      assert_equal 'too slow', error.message
+    end
+
+    def test_address_resolve_from_hosts_file
+      addrs = nil
+
+      run_scheduled do
+        Fiber.schedule do
+          addrs = Fiber.scheduler.address_resolve('localhost')
+          EM.stop
+        end
+      end
+
+      assert_kind_of Array, addrs
+      assert !addrs.empty?
+    end
+
+  else
+    warn "Fiber::Scheduler not available, skipping tests in #{__FILE__}"
+
+    def test_em_fiber_scheduler_unavailable
+      assert !defined?(EM::FiberScheduler)
+    end
+  end
+end
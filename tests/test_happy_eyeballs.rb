@@ -0,0 +1,142 @@
+require_relative 'em_test_helper'
+require 'socket'
+
+class TestHappyEyeballs < Test::Unit::TestCase
+
+  module Server
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received, :reason, :completed
+
+    def initialize
+      @received = ''
+      @completed = 0
+    end
+
+    def connection_completed
+      @completed += 1
+      send_data 'hello'
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection
+    end
+
+    def unbind(reason = nil)
+      @reason = reason
+      EM.stop
+    end
+  end
+
+  HOST = 'race.test'
+
+  def setup
+    # The addresses race.test has come from the DNS cache.
+    EM.set_dns_cache_ttl 60
+    EM.set_connection_attempt_delay 0.1
+    @port = next_port
+    @sockets = []
+  end
+
+  def teardown
+    @sockets.each(&:close)
+    EM.set_dns_cache_ttl 0
+    EM.set_connection_attempt_delay 0
+    EM.set_resolver_threads 0
+  end
+
+  # Listens on ip without accepting, and fills the backlog, so that
+  # connects to it go unanswered.
+  def unresponsive(ip)
+    server = Socket.new(:INET, :STREAM)
+    @sockets << server
+    server.bind(Addrinfo.tcp(ip, @port))
+    server.listen(0)
+    3.times do
+      filler = Socket.new(:INET, :STREAM)
+      @sockets << filler
+      filler.connect_nonblock(Addrinfo.tcp(ip, @port), exception: false)
+    end
+
+    probe = Socket.new(:INET, :STREAM)
+    @sockets << probe
+    probe.connect_nonblock(Addrinfo.tcp(ip, @port), exception: false)
+    omit("Can't make #{ip} unresponsive") if IO.select(nil, [probe], nil, 0.2)
+  end
+
+  def race(addrs)
+    client, started, elapsed = nil, nil, nil
+    EM.run do
+      setup_timeout 5
+      EM.dns_cache_store HOST, addrs, 60
+      EM.start_server '127.0.0.1', @port, Server
+      started = Time.now
+      client = EM.connect HOST, @port, Client
+      yield client if block_given?
+    end
+    [client, Time.now - started]
+  end
+
+  def test_connection_attempt_delay
+    assert_in_delta 0.1, EM.connection_attempt_delay, 0.001
+  end
+
+  def test_races_past_unresponsive_address
+    unresponsive '127.0.0.2'
+    client, elapsed = race(['127.0.0.2', '127.0.0.1'])
+
+    assert_equal 'hello', client.received
+    assert_equal 1, client.completed
+    assert_operator elapsed, :>=, 0.1
+    assert_operator elapsed, :<, 1
+  end
+
+  def test_races_on_resolver_threads
+    EM.set_resolver_threads 2
+    unresponsive '127.0.0.2'
+    client, elapsed = race(['127.0.0.2', '127.0.0.1'])
+
+    assert_equal 'hello', client.received
+    assert_equal 1, client.completed
+    assert_operator elapsed, :<, 1
+  end
+
+  def test_failed_attempt_starts_next_at_once
+    EM.set_connection_attempt_delay 2
+    client, elapsed = race(['127.0.0.3', '127.0.0.1'])
+
+    assert_equal 'hello', client.received
+    assert_operator elapsed, :<, 1
+  end
+
+  def test_all_attempts_fail
+    client, _ = race(['127.0.0.3', '127.0.0.4'])
+
+    assert_equal 0, client.completed
+    assert_equal Errno::ECONNREFUSED, client.reason
+  end
+
+  def test_pending_connect_timeout_covers_race
+    unresponsive '127.0.0.2'
+    client, elapsed = race(['127.0.0.2', '127.0.0.2']) { |c| c.pending_connect_timeout = 0.5 }
+
+    assert_equal 0, client.completed
+    assert_equal Errno::ETIMEDOUT, client.reason
+    assert_in_delta 0.5, elapsed, 0.4
+  end
+
+  def test_first_address_only_without_delay
+    EM.set_connection_attempt_delay 0
+    unresponsive '127.0.0.2'
+    client, _ = race(['127.0.0.2', '127.0.0.1']) { |c| c.pending_connect_timeout = 0.5 }
+
+    assert_equal 0, client.completed
+    assert_equal Errno::ETIMEDOUT, client.reason
+  end
+
+end
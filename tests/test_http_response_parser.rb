@@ -0,0 +1,102 @@
+require_relative 'em_test_helper'
+
+class TestHttpResponseParser < Test::Unit::TestCase
+
+  PARSERS = [EM::PureRubyHttpResponseParser]
+  PARSERS << EM::HttpResponseParser unless EM::HttpResponseParser == EM::PureRubyHttpResponseParser
+
+  def each_parser(*args)
+    PARSERS.each { |klass| yield klass.new(*args), klass.name }
+  end
+
+  def test_content_length_byte_by_byte
+    response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 5\r\n\r\nhello"
+
+    each_parser do |parser, name|
+      responses = response.each_char.map { |c| parser.parse(c) }.flatten
+      assert_equal 1, responses.size, name
+
+      r = responses.first
+      assert_equal ['1.1', 200, 'OK', 'hello', true], [r.version, r.status, r.reason, r.content, r.keep_alive], name
+      assert_equal [['Content-Type', 'text/plain'], ['Content-Length', '5']], r.headers, name
+      assert_equal ['5'], r.header('content-length'), name
+      assert_nil parser.finish, name
+    end
+  end
+
+  def test_chunked_with_extensions_and_trailer
+    response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" \
+               "5;name=value\r\nhello\r\n7\r\n, world\r\n0\r\nX-Checksum: abc\r\n\r\n"
+
+    each_parser do |parser, name|
+      assert_equal [], parser.parse(response[0, 60]), name
+      r, = parser.parse(response[60..-1])
+      assert_equal 'hello, world', r.content, name
+      assert_equal ['abc'], r.header('x-checksum'), name
+    end
+  end
+
+  def test_pipelined_responses
+    responses = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\none" \
+                "HTTP/1.1 204 No Content\r\n\r\n" \
+                "HTTP/1.1 404 Not Found\r\nTransfer-Encoding: chunked\r\n\r\n3\r\ntwo\r\n0\r\n\r\n" \
+                "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nthr"
+
+    each_parser do |parser, name|
+      got = parser.parse(responses)
+      assert_equal [[200, 'one'], [204, ''], [404, 'two']], got.map { |r| [r.status, r.content] }, name
+
+      last, = parser.parse("ee")
+      assert_equal 'three', last.content, name
+    end
+  end
+
+  def test_head_and_interim_responses
+    each_parser do |parser, name|
+      parser.request_sent 'HEAD'
+      parser.request_sent 'GET'
+
+      got = parser.parse("HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n" \
+                         "HTTP/1.1 100 Continue\r\n\r\n" \
+                         "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok")
+      assert_equal [[200, ''], [200, 'ok']], got.map { |r| [r.status, r.content] }, name
+    end
+  end
+
+  def test_body_until_close
+    each_parser do |parser, name|
+      assert_equal [], parser.parse("HTTP/1.0 200 OK\r\nConnection: keep-alive\r\n\r\npart one, "), name
+      assert_equal [], parser.parse("part two"), name
+
+      r = parser.finish
+      assert_equal 'part one, part two', r.content, name
+      assert_equal false, r.keep_alive, name
+    end
+  end
+
+  def test_keep_alive
+    each_parser do |parser, name|
+      got = parser.parse("HTTP/1.0 200 OK\r\nContent-Length: 0\r\n\r\n" \
+                         "HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\nContent-Length: 0\r\n\r\n" \
+                         "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 0\r\n\r\n")
+      assert_equal [false, true, false], got.map(&:keep_alive), name
+    end
+  end
+
+  def test_errors
+    each_parser do |parser, name|
+      assert_raise(EM::HttpParseError, name) { parser.parse("SMTP/1.1 200 OK\r\n\r\n") }
+      assert_raise(EM::HttpParseError, name) { parser.parse("HTTP/1.1 200 OK\r\n\r\n") }
+      parser.reset
+      assert_raise(EM::HttpParseError, name) { parser.parse("HTTP/1.1 200 OK\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n") }
+      parser.reset
+      assert_equal [], parser.parse("HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc"), name
+      assert_raise(EM::HttpParseError, name) { parser.finish }
+    end
+
+    each_parser(64) do |parser, name|
+      assert_raise(EM::HttpParseError, name) { parser.parse("HTTP/1.1 200 OK\r\nX-Padding: #{'x' * 64}") }
+    end
+  end
+
+end
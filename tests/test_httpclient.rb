@@ -233,6 +233,33 @@ class TestHttpClient < Test::Unit::TestCase
     assert ok
   end
 
-end
+  #-----------------------------------------
+
+  # Two responses and the start of a third, all in one write.
+  #
+  class ExtraResponses < EventMachine::Connection
+    def receive_data data
+      send_data "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nfirst" +
+                "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nsecond" +
+                "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nth"
+      close_connection_after_writing
+    end
+  end
 
+  def test_only_first_response_dispatched
+    events = []
+    c = nil
+    EM.run {
+      EM.start_server "127.0.0.1", @port, ExtraResponses
+      c = silent { EM::P::HttpClient.request :host => "127.0.0.1", :port => @port }
+      c.callback {|result| events << result[:content] }
+      c.errback {|result| events << :failed }
+      EM.add_timer(0.5) { EM.stop }
+    }
+    # The request stays answered once the connection is gone.
+    c.callback {|result| events << result[:content] }
+    c.errback {|result| events << :failed }
+    assert_equal ["first", "first"], events
+  end
 
+end
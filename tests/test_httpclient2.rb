@@ -105,6 +105,27 @@ class TestHttpClient2 < Test::Unit::TestCase
     assert(headers2)
   end
 
+  class PipelineServer < EM::Connection
+    def receive_data data
+      (@requests ||= '') << data
+      return unless @requests.scan("\r\n\r\n").size == 2
+      send_data "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\none" \
+                "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\ntwo\r\n0\r\n\r\n"
+    end
+  end
+
+  def test_get_pipeline_local
+    contents = []
+    EM.run {
+      setup_timeout TIMEOUT
+      EM.start_server '127.0.0.1', @port, PipelineServer
+      http = silent { EM::P::HttpClient2.connect '127.0.0.1', @port }
+      http.get("/one").callback {|r| contents << r.content }
+      http.get("/two").callback {|r| contents << r.content; EM.stop }
+    }
+    assert_equal %w[one two], contents
+  end
+
   def test_authheader
     EM.run {
       setup_timeout TIMEOUT
@@ -0,0 +1,144 @@
+require_relative 'em_test_helper'
+
+class TestLengthFraming < Test::Unit::TestCase
+  unless [:pure_ruby, :java].include? EM.library_type
+
+    def setup
+      @port = next_port
+    end
+
+    def teardown
+      assert(!EM.reactor_running?)
+    end
+
+    module FrameServer
+      def initialize(opts, stop_after)
+        @opts, @stop_after = opts, stop_after
+      end
+
+      def post_init
+        set_length_framing @opts
+      end
+
+      def receive_frame(frame)
+        $frames << frame
+        EM.stop if $frames.size == @stop_after
+      end
+
+      def receive_data(data)
+        $raw << data
+        EM.stop
+      end
+
+      def unbind(reason)
+        $reason = reason
+        EM.stop
+      end
+    end
+
+    def run_server(opts, stop_after, *chunks)
+      $frames, $raw, $reason = [], '', nil
+      EM.run do
+        setup_timeout
+        EM.start_server '127.0.0.1', @port, FrameServer, opts, stop_after
+        EM.connect('127.0.0.1', @port) do |c|
+          chunks.each_with_index do |chunk, i|
+            EM.add_timer(0.02 * i) { c.send_data chunk }
+          end
+        end
+      end
+    end
+
+    def test_big_endian_prefix_split_across_reads
+      payload = 'x' * 100_000
+      message = [payload.bytesize].pack('N') + payload
+      run_server({:strip => 4}, 2, message[0, 2], message[2, 50_000], message[50_002..-1] + [3].pack('N') + 'abc')
+
+      assert_equal [payload, 'abc'], $frames
+    end
+
+    def test_little_endian_prefix_with_header
+      run_server({:width => 2, :big_endian => false}, 2, "\x03\x00one\x00\x00")
+
+      assert_equal ["\x03\x00one", "\x00\x00"], $frames
+    end
+
+    def test_offset_and_adjustment
+      # type byte, then an int32 length that counts itself
+      message = 'Q' + [4 + 5].pack('N') + 'hello' + 'Z' + [4].pack('N')
+      run_server({:offset => 1, :adjustment => -4}, 2, message)
+
+      assert_equal ['Q' + [9].pack('N') + 'hello', 'Z' + [4].pack('N')], $frames
+    end
+
+    def test_max_frame_size
+      run_server({:max_frame_size => 16}, 1, [100].pack('N') + 'x' * 100)
+
+      assert_equal [], $frames
+      assert_equal Errno::EMSGSIZE, $reason
+    end
+
+    def test_negative_max_frame_size
+      EM.run do
+        EM.start_server '127.0.0.1', @port
+        EM.connect('127.0.0.1', @port) do |c|
+          assert_raises(ArgumentError) { c.set_length_framing max_frame_size: -1 }
+          EM.stop
+        end
+      end
+    end
+
+    def test_huge_frame_rejected_by_default
+      run_server({}, 1, [0xfffffff0].pack('N') + 'x' * 100)
+
+      assert_equal [], $frames
+      assert_equal Errno::EMSGSIZE, $reason
+    end
+
+    # With no limit, a header alone mustn't get the announced size allocated.
+    def test_huge_frame_without_limit
+      $frames, $raw, $reason = [], '', nil
+      EM.run do
+        setup_timeout
+        EM.start_server '127.0.0.1', @port, FrameServer, {:width => 8, :max_frame_size => 0}, 1
+        EM.connect('127.0.0.1', @port) { |c| c.send_data [1 << 40].pack('Q>') + 'x' * 100 }
+        EM.add_timer(0.2) { EM.stop }
+      end
+
+      assert_equal [], $frames
+      assert_nil $reason
+    end
+
+    module SwitchingServer
+      def post_init
+        set_line_framing "\n"
+      end
+
+      def receive_line(line)
+        $frames << line
+        set_length_framing(:width => 1, :strip => 1) if line == 'frames'
+      end
+
+      def receive_frame(frame)
+        $frames << frame
+        set_length_framing nil if frame == 'raw'
+      end
+
+      def receive_data(data)
+        $frames << data
+        EM.stop
+      end
+    end
+
+    def test_switching_modes_keeps_buffered_data
+      $frames = []
+      EM.run do
+        setup_timeout
+        EM.start_server '127.0.0.1', @port, SwitchingServer
+        EM.connect('127.0.0.1', @port) { |c| c.send_data "line\nframes\n\x02ab\x03rawtail" }
+      end
+
+      assert_equal ['line', 'frames', 'ab', 'raw', 'tail'], $frames
+    end
+  end
+end
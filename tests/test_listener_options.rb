@@ -0,0 +1,111 @@
+require_relative 'em_test_helper'
+require 'socket'
+
+class TestListenerOptions < Test::Unit::TestCase
+
+  module Server
+    def initialize(accepted)
+      @accepted = accepted
+    end
+
+    # Records TCP_NODELAY and SO_KEEPALIVE of each accepted connection.
+    def post_init
+      @accepted << [sock_opt(Socket::IPPROTO_TCP, Socket::TCP_NODELAY),
+                    sock_opt(Socket::SOL_SOCKET, Socket::SO_KEEPALIVE)]
+    end
+
+    def sock_opt(level, option)
+      get_sock_opt(level, option).unpack('i').first == 0 ? 0 : 1
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received
+
+    def initialize
+      @received = ''
+    end
+
+    def connection_completed
+      send_data 'hello'
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection
+    end
+
+    def unbind
+      EM.stop
+    end
+  end
+
+  def setup
+    @port = next_port
+  end
+
+  def echo(options)
+    accepted, client = [], nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server_with_options '127.0.0.1', @port, options, Server, accepted
+      client = EM.connect '127.0.0.1', @port, Client
+    end
+    [client, accepted]
+  end
+
+  def test_backlog
+    client, accepted = echo(backlog: 1024)
+    assert_equal 'hello', client.received
+    assert_equal 1, accepted.size
+  end
+
+  def test_defer_accept
+    omit_unless(Socket.const_defined?(:TCP_DEFER_ACCEPT))
+    client, _ = echo(defer_accept: 5)
+    assert_equal 'hello', client.received
+  end
+
+  def test_accepted_connections_inherit_options
+    _, accepted = echo(keepalive: true)
+    assert_equal [[1, 1]], accepted
+  end
+
+  def test_nodelay_by_default
+    _, accepted = echo({})
+    assert_equal [[1, 0]], accepted
+  end
+
+  def test_nodelay_off
+    _, accepted = echo(nodelay: false)
+    assert_equal [[0, 0]], accepted
+  end
+
+  def test_reuseport
+    omit_unless(Socket.const_defined?(:SO_REUSEPORT))
+    client = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server_with_options '127.0.0.1', @port, { reuseport: true }, Server, []
+      assert_nothing_raised do
+        EM.start_server_with_options '127.0.0.1', @port, { reuseport: true }, Server, []
+      end
+      client = EM.connect '127.0.0.1', @port, Client
+    end
+    assert_equal 'hello', client.received
+  end
+
+  def test_unknown_option
+    EM.run do
+      assert_raise(ArgumentError) do
+        EM.start_server_with_options '127.0.0.1', @port, { backlogg: 10 }, Server, []
+      end
+      EM.stop
+    end
+  end
+
+end
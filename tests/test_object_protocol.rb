@@ -20,6 +20,13 @@ class TestObjectProtocol < Test::Unit::TestCase
     end
   end
 
+  module NativeClient
+    include Client
+    def post_init
+      set_length_framing :strip => 4
+    end
+  end
+
   def setup
     @port = next_port
   end
@@ -33,4 +40,16 @@ class TestObjectProtocol < Test::Unit::TestCase
     assert($client == {:hello=>'world'})
     assert($server == {'you_said'=>{:hello=>'world'}})
   end
+
+  def test_send_receive_with_length_framing
+    omit_unless(EM.respond_to?(:set_length_framing))
+
+    EM.run{
+      EM.start_server "127.0.0.1", @port, Server
+      EM.connect "127.0.0.1", @port, NativeClient
+    }
+
+    assert($client == {:hello=>'world'})
+    assert($server == {'you_said'=>{:hello=>'world'}})
+  end
 end
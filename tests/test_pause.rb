@@ -96,6 +96,31 @@ class TestPause < Test::Unit::TestCase
       assert incoming[0].bytesize > buf.bytesize
       assert incoming[0].bytesize < buf.bytesize * 128
     end
+
+    def test_pause_server
+      accepted = 0
+      test_server = Module.new do
+        define_method(:post_init) { accepted += 1 }
+      end
+
+      EM.run do
+        server = EM.start_server "127.0.0.1", @port, test_server
+        EM.pause_connection server
+        assert EM.connection_paused?(server)
+        EM.connect "127.0.0.1", @port
+
+        EM.add_timer(0.1) do
+          assert_equal 0, accepted
+          EM.resume_connection server
+          assert !EM.connection_paused?(server)
+
+          EM.add_timer(0.1) do
+            assert_equal 1, accepted
+            EM.stop
+          end
+        end
+      end
+    end
   else
     warn "EM.pause_connection not implemented, skipping tests in #{__FILE__}"
 
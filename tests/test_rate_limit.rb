@@ -0,0 +1,125 @@
+require_relative 'em_test_helper'
+
+class TestRateLimit < Test::Unit::TestCase
+
+  SIZE = 20_000
+
+  # Counts what it's sent, and stops the reactor once it has +expected+ bytes in all.
+  module Sink
+    def initialize(received, expected, limits = nil)
+      @received = received
+      @expected = expected
+      @limits = limits
+    end
+
+    def post_init
+      set_rate_limits @limits if @limits
+    end
+
+    def receive_data(data)
+      @received << data
+      EM.stop if @received.inject(0) { |n, d| n + d.size } >= @expected
+    end
+  end
+
+  module Source
+    def initialize(size, limits = nil)
+      @size = size
+      @limits = limits
+    end
+
+    def post_init
+      set_rate_limits @limits if @limits
+      send_data 'x' * @size
+    end
+  end
+
+  def setup
+    @port = next_port
+    @received = []
+  end
+
+  def timed
+    started = Time.now
+    yield
+    Time.now - started
+  end
+
+  def bytes
+    @received.join
+  end
+
+  def test_read_limit
+    elapsed = timed do
+      EM.run do
+        setup_timeout 5
+        EM.start_server '127.0.0.1', @port, Sink, @received, SIZE, read: 40_000, burst: 4_000
+        EM.connect '127.0.0.1', @port, Source, SIZE
+      end
+    end
+    assert_equal 'x' * SIZE, bytes
+    # 4000 at once, then the other 16000 at 40000 a second.
+    assert_operator elapsed, :>=, 0.35
+  end
+
+  def test_write_limit
+    elapsed = timed do
+      EM.run do
+        setup_timeout 5
+        EM.start_server '127.0.0.1', @port, Source, SIZE, write: 40_000, burst: 4_000
+        EM.connect '127.0.0.1', @port, Sink, @received, SIZE
+      end
+    end
+    assert_equal 'x' * SIZE, bytes
+    assert_operator elapsed, :>=, 0.35
+  end
+
+  def test_unlimited_is_not_slowed
+    elapsed = timed do
+      EM.run do
+        setup_timeout 5
+        EM.start_server '127.0.0.1', @port, Sink, @received, SIZE
+        EM.connect '127.0.0.1', @port, Source, SIZE
+      end
+    end
+    assert_equal SIZE, bytes.size
+    assert_operator elapsed, :<, 0.3
+  end
+
+  def test_server_limit_is_shared
+    elapsed = timed do
+      EM.run do
+        setup_timeout 5
+        server = EM.start_server '127.0.0.1', @port, Sink, @received, SIZE
+        EM.set_rate_limits server, read: 40_000, burst: 4_000
+        2.times { EM.connect '127.0.0.1', @port, Source, SIZE / 2 }
+      end
+    end
+    assert_equal SIZE, bytes.size
+    # Each alone would be done in 0.15s.
+    assert_operator elapsed, :>=, 0.35
+  end
+
+  def test_lifting_limit
+    elapsed = timed do
+      EM.run do
+        setup_timeout 5
+        sink = nil
+        EM.start_server('127.0.0.1', @port, Sink, @received, SIZE, read: 1_000, burst: 1_000) { |c| sink = c }
+        EM.connect '127.0.0.1', @port, Source, SIZE
+        EM.add_timer(0.2) { sink.set_rate_limits nil }
+      end
+    end
+    assert_equal SIZE, bytes.size
+    assert_operator elapsed, :<, 1
+  end
+
+  def test_unknown_limit
+    EM.run do
+      server = EM.start_server '127.0.0.1', @port, Sink, @received, SIZE
+      assert_raises(ArgumentError) { EM.set_rate_limits server, reads: 1 }
+      EM.stop
+    end
+  end
+
+end
@@ -0,0 +1,168 @@
+require_relative 'em_test_helper'
+
+class TestReconnectPolicy < Test::Unit::TestCase
+
+  module Server
+    def initialize(accepted, close_after = nil)
+      @close_after = close_after
+      accepted << self
+    end
+
+    def post_init
+      EM.add_timer(@close_after) { close_connection } if @close_after
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :completed, :reconnects, :reason, :attempts
+
+    def initialize(on_completed = nil, on_reconnecting = nil)
+      @on_completed = on_completed
+      @on_reconnecting = on_reconnecting
+      @completed = 0
+      @reconnects = []
+      @attempts = []
+    end
+
+    def connection_completed
+      @completed += 1
+      @on_completed.call(self) if @on_completed
+    end
+
+    def reconnecting(reason)
+      @reconnects << reason
+      @attempts << reconnect_attempts
+      @on_reconnecting.call(self) if @on_reconnecting
+    end
+
+    def unbind(reason = nil)
+      @reason = reason
+    end
+  end
+
+  def setup
+    omit_if(windows?)
+    @port = next_port
+    @accepted = []
+  end
+
+  def teardown
+    EM.set_reconnect_policy({})
+  end
+
+  def test_reconnects_until_server_is_up
+    EM.set_reconnect_policy base_delay: 0.05, jitter: 0
+    client = nil
+    EM.run do
+      setup_timeout 5
+      client = EM.connect_with_retry '127.0.0.1', @port, Client, proc { EM.stop }
+      EM.add_timer(0.2) { EM.start_server '127.0.0.1', @port, Server, @accepted }
+    end
+    assert_equal 1, client.completed
+    assert client.reconnects.size >= 2
+    assert client.reconnects.all? { |r| r == Errno::ECONNREFUSED }
+    assert_nil client.reason
+    assert_equal 1, @accepted.size
+  end
+
+  def test_gives_up_after_max_attempts
+    EM.set_reconnect_policy base_delay: 0.01, jitter: 0, max_attempts: 3
+    client = nil
+    EM.run do
+      setup_timeout 5
+      client = EM.connect_with_retry '127.0.0.1', @port, Client
+      client.define_singleton_method(:unbind) { |reason| super(reason); EM.stop }
+    end
+    assert_equal 3, client.reconnects.size
+    assert_equal [1, 2, 3], client.attempts
+    assert_equal Errno::ECONNREFUSED, client.reason
+    assert_equal 0, client.completed
+  end
+
+  def test_reconnects_when_dropped
+    EM.set_reconnect_policy base_delay: 0.01, jitter: 0
+    client = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', @port, Server, @accepted, 0.05
+      client = EM.connect_with_retry '127.0.0.1', @port, Client, proc { |c| EM.stop if c.completed == 2 }
+    end
+    assert_equal 2, client.completed
+    assert_equal [nil], client.reconnects
+    assert_equal 2, @accepted.size
+  end
+
+  def test_breaker_fails_fast
+    EM.set_reconnect_policy base_delay: 0.01, jitter: 0, breaker_threshold: 2, breaker_timeout: 10
+    first = second = nil
+    port, accepted = @port, @accepted
+    EM.run do
+      setup_timeout 5
+      first = EM.connect_with_retry '127.0.0.1', port, Client
+      first.define_singleton_method(:unbind) do |reason|
+        super(reason)
+        # Up now, but the breaker is open, so it isn't tried.
+        EM.start_server '127.0.0.1', port, Server, accepted
+        second = EM.connect_with_retry '127.0.0.1', port, Client
+        second.define_singleton_method(:unbind) { |r| super(r); EM.add_timer(0.1) { EM.stop } }
+      end
+    end
+    assert_equal 2, first.reconnects.size
+    assert_equal Errno::ECONNREFUSED, first.reason
+    assert_equal [], second.reconnects
+    assert_equal Errno::ECONNREFUSED, second.reason
+    assert_equal 0, second.completed
+    assert_equal 0, @accepted.size
+  end
+
+  def test_close_while_reconnecting_stops_it
+    EM.set_reconnect_policy base_delay: 0.01, jitter: 0
+    client = nil
+    EM.run do
+      setup_timeout 5
+      client = EM.connect_with_retry '127.0.0.1', @port, Client, nil, proc { |c| c.close_connection }
+      client.define_singleton_method(:unbind) { |reason| super(reason); EM.add_timer(0.1) { EM.stop } }
+    end
+    assert_equal [Errno::ECONNREFUSED], client.reconnects
+    assert_nil client.reason
+  end
+
+  def test_raising_in_reconnecting
+    EM.set_reconnect_policy base_delay: 0.01, jitter: 0
+    assert_raises(RuntimeError) do
+      EM.run do
+        setup_timeout 5
+        # One that goes and one that stays, ahead of it in the list.
+        EM.connect '127.0.0.1', @port, Client
+        EM.start_server '127.0.0.1', next_port, Server, @accepted
+        EM.connect_with_retry '127.0.0.1', @port, Client, nil, proc { raise 'boom' }
+      end
+    end
+    # The reactor was left in a state it can run again from.
+    ran = false
+    EM.run { EM.next_tick { ran = true; EM.stop } }
+    assert ran
+  end
+
+  def test_backoff_grows
+    EM.set_reconnect_policy base_delay: 0.02, jitter: 0, max_attempts: 3
+    times = []
+    EM.run do
+      setup_timeout 5
+      client = EM.connect_with_retry '127.0.0.1', @port, Client, nil, proc { times << Time.now }
+      client.define_singleton_method(:unbind) { |reason| super(reason); times << Time.now; EM.stop }
+    end
+    gaps = times.each_cons(2).map { |a, b| b - a }
+    # 0.02, 0.04 then 0.08 between the failures.
+    assert_equal 3, gaps.size
+    assert_operator gaps[0], :>=, 0.015
+    assert_operator gaps[1], :>=, 0.035
+    assert_operator gaps[2], :>=, 0.075
+    assert_operator gaps[2], :>, gaps[0]
+  end
+
+end
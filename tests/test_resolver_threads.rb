@@ -0,0 +1,147 @@
+require_relative 'em_test_helper'
+require 'resolv'
+
+class TestResolverThreads < Test::Unit::TestCase
+
+  module Server
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received, :reason
+
+    def initialize(started = nil)
+      @started = started
+      @received = ''
+    end
+
+    def connection_completed
+      send_data 'hello'
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection
+    end
+
+    def unbind(reason = nil)
+      @reason = reason
+      EM.stop
+    end
+  end
+
+  # Answers A queries for stub.test after DELAY, and ignores everything
+  # asked about slow.test.
+  module StubDNS
+    DELAY = 0.3
+
+    def initialize(queries)
+      @queries = queries
+    end
+
+    def receive_data(data)
+      query = Resolv::DNS::Message.decode(data)
+      name, type = query.question.first
+      @queries << [name.to_s, type]
+      return if name.to_s == 'slow.test'
+
+      answer = Resolv::DNS::Message.new(query.id)
+      answer.qr = 1
+      answer.rd = query.rd
+      answer.ra = 1
+      answer.add_question(name, type)
+      if name.to_s == 'stub.test' && type == Resolv::DNS::Resource::IN::A
+        answer.add_answer(name, 60, Resolv::DNS::Resource::IN::A.new('127.0.0.1'))
+      end
+      port, ip = Socket.unpack_sockaddr_in(get_peername)
+      packet = answer.encode
+      EM.add_timer(DELAY) { send_datagram packet, ip, port }
+    end
+  end
+
+  def setup
+    EM.set_resolver_threads 2
+  end
+
+  def teardown
+    EM.set_resolver_threads 0
+  end
+
+  def test_resolver_threads
+    assert_equal 2, EM.resolver_threads
+  end
+
+  def test_connect_to_hostname
+    client = nil
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server 'localhost', port, Server
+      client = EM.connect 'localhost', port, Client
+    end
+    assert_equal 'hello', client.received
+  end
+
+  def test_connect_to_address
+    client = nil
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      client = EM.connect '127.0.0.1', port, Client
+    end
+    assert_equal 'hello', client.received
+  end
+
+  def test_unresolvable_hostname
+    client = nil
+    EM.run do
+      setup_timeout 10
+      assert_nothing_raised { client = EM.connect 'invalid.invalid', 80, Client }
+    end
+    assert_equal '', client.received
+    assert_equal Errno::EHOSTUNREACH, client.reason
+  end
+
+  # Needs the system resolver to ask 127.0.0.1, and to be allowed port 53.
+  def stub_dns(queries)
+    nameserver = File.read('/etc/resolv.conf')[/^nameserver\s+(\S+)/, 1] rescue nil
+    omit("The system resolver doesn't use 127.0.0.1") unless nameserver == '127.0.0.1'
+    EM.open_datagram_socket '127.0.0.1', 53, StubDNS, queries
+  rescue RuntimeError
+    EM.stop
+    omit("Can't listen on port 53")
+  end
+
+  def test_reactor_runs_during_lookup
+    client, queries, ticks = nil, [], 0
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      EM.add_periodic_timer(0.05) { ticks += 1 }
+      client = EM.connect 'stub.test', port, Client
+    end
+    assert_equal 'hello', client.received
+    assert_include queries, ['stub.test', Resolv::DNS::Resource::IN::A]
+    assert_operator ticks, :>=, StubDNS::DELAY / 0.05 - 1
+  end
+
+  def test_pending_connect_timeout_covers_lookup
+    client, queries, started = nil, [], nil
+    EM.run do
+      setup_timeout 5
+      stub_dns queries
+      started = Time.now
+      client = EM.connect 'slow.test', next_port, Client
+      client.pending_connect_timeout = 0.5
+    end
+    assert_equal Errno::ETIMEDOUT, client.reason
+    assert_in_delta 0.5, Time.now - started, 0.4
+    assert_include queries.map(&:first), 'slow.test'
+  end
+
+end
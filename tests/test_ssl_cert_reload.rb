@@ -0,0 +1,158 @@
+require_relative 'em_test_helper'
+require 'fileutils'
+require 'tmpdir'
+
+class TestSSLCertReload < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(tls)
+      @tls = tls
+    end
+
+    def post_init
+      start_tls @tls
+    end
+  end
+
+  module Client
+    def initialize(certs, done)
+      @certs, @done = certs, done
+    end
+
+    def post_init
+      start_tls
+    end
+
+    def ssl_handshake_completed
+      @certs << get_peer_cert
+      close_connection
+    end
+
+    def unbind
+      @done.call
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+    require 'openssl'
+    @dir = Dir.mktmpdir
+    @tls = { private_key_file: "#{@dir}/server.key", cert_chain_file: "#{@dir}/server.crt" }
+    FileUtils.cp PRIVATE_KEY_FILE, @tls[:private_key_file]
+    FileUtils.cp CERT_FILE, @tls[:cert_chain_file]
+  end
+
+  def teardown
+    FileUtils.rm_rf @dir if @dir
+  end
+
+  def new_cert
+    key = OpenSSL::PKey::RSA.new(2048)
+    cert = OpenSSL::X509::Certificate.new
+    cert.version = 2
+    cert.serial = 2
+    cert.subject = cert.issuer = OpenSSL::X509::Name.parse('/CN=reloaded')
+    cert.public_key = key.public_key
+    cert.not_before = Time.now - 60
+    cert.not_after = Time.now + 3600
+    cert.sign(key, OpenSSL::Digest::SHA256.new)
+    [key.to_pem, cert.to_pem]
+  end
+
+  # Handshakes once for each step, and runs the step's block after it.
+  def handshakes(steps, wait = 0)
+    certs = []
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      yield
+      EM.start_server '127.0.0.1', port, Server, @tls
+      run = proc do |i|
+        if i == steps.size
+          EM.stop
+        else
+          EM.connect '127.0.0.1', port, Client, certs, proc {
+            steps[i].call
+            EM.add_timer(wait) { run.call(i + 1) }
+          }
+        end
+      end
+      run.call(0)
+    end
+    certs
+  end
+
+  def subject(pem)
+    OpenSSL::X509::Certificate.new(pem).subject.to_s
+  end
+
+  def test_reload
+    key, cert = new_cert
+    results = []
+    certs = handshakes([
+      proc {
+        File.write @tls[:private_key_file], key
+        File.write @tls[:cert_chain_file], cert
+        results << EM.reload_tls_file(@tls[:cert_chain_file])
+      },
+      proc {},
+    ]) { EM.preload_tls @tls }
+
+    assert_equal [1], results
+    assert_equal 2, certs.size
+    assert_not_equal '/CN=reloaded', subject(certs[0])
+    assert_equal '/CN=reloaded', subject(certs[1])
+  end
+
+  def test_mismatched_files_keep_old_context
+    key, cert = new_cert
+    results = []
+    certs = handshakes([
+      proc {
+        File.write @tls[:cert_chain_file], cert
+        results << EM.reload_tls_file(@tls[:cert_chain_file])
+        File.write @tls[:private_key_file], 'not a key'
+        results << EM.reload_tls_file(@tls[:private_key_file])
+      },
+      proc {
+        File.write @tls[:private_key_file], key
+        results << EM.reload_tls_file(@tls[:private_key_file])
+      },
+      proc {},
+    ]) { EM.preload_tls @tls }
+
+    assert_equal [false, false, 1], results
+    assert_equal 3, certs.size
+    assert_equal subject(certs[0]), subject(certs[1])
+    assert_equal '/CN=reloaded', subject(certs[2])
+  end
+
+  def test_watch_replaced_files
+    key, cert = new_cert
+    certs = handshakes([
+      proc {
+        File.write "#{@dir}/new.key", key
+        File.write "#{@dir}/new.crt", cert
+        File.rename "#{@dir}/new.key", @tls[:private_key_file]
+        File.rename "#{@dir}/new.crt", @tls[:cert_chain_file]
+      },
+      proc {},
+    ], 0.5) { EM.preload_tls @tls, true }
+
+    assert_equal 2, certs.size
+    assert_equal '/CN=reloaded', subject(certs[1])
+  end
+
+  def test_preload_bad_files
+    File.write @tls[:private_key_file], 'not a key'
+    EM.run do
+      assert_raise(EM::InvalidPrivateKey) { EM.preload_tls @tls }
+      assert_raise(EM::FileNotFoundException) { EM.preload_tls private_key_file: "#{@dir}/none", cert_chain_file: "#{@dir}/none" }
+      EM.stop
+    end
+  end
+
+end
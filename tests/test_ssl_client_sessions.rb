@@ -0,0 +1,111 @@
+require_relative 'em_test_helper'
+
+class TestSSLClientSessions < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(ssl_version)
+      @ssl_version = ssl_version
+    end
+
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE, ssl_version: @ssl_version
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    def initialize(tls, verified, after)
+      @tls, @verified, @after = tls, verified, after
+    end
+
+    # Started before the connect completes, as many clients do.
+    def post_init
+      start_tls @tls
+    end
+
+    def ssl_verify_peer(cert)
+      @verified << cert
+      true
+    end
+
+    # TLS 1.3 tickets arrive after the handshake, so wait for an echo.
+    def ssl_handshake_completed
+      send_data 'x'
+    end
+
+    def receive_data(data)
+      close_connection
+    end
+
+    def unbind
+      @after.call
+    end
+  end
+
+  # Makes the connections one after the other and returns the TLS stats,
+  # which count the handshakes of both ends.
+  def run_clients(ssl_version, connects)
+    port = next_port
+    stats = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', port, Server, [ssl_version]
+
+      connect_next = proc do
+        if args = connects.shift
+          EM.connect '127.0.0.1', port, Client, *args, connect_next
+        else
+          stats = EM.tls_stats
+          EM.stop
+        end
+      end
+      connect_next.call
+    end
+    stats
+  end
+
+  def test_sessions_reused_per_peer
+    omit("No SSL") unless EM.ssl?
+
+    stats = run_clients('TLSv1_2', [
+      [{}, []],
+      [{}, []],
+      [{ sni_hostname: 'one.example' }, []],
+      [{ sni_hostname: 'one.example' }, []],
+      [{}, []],
+    ])
+
+    # Two peers (by SNI hostname), each with one full handshake.
+    assert_equal 4, stats[:full_handshakes]
+    assert_equal 6, stats[:resumed_handshakes]
+  end
+
+  def test_tls13_tickets
+    omit("No SSL") unless EM.ssl?
+    omit("TLSv1_3 is unavailable") unless EM.const_defined? :EM_PROTO_TLSv1_3
+
+    stats = run_clients('TLSv1_3', Array.new(4) { [{}, []] })
+
+    assert_equal 2, stats[:full_handshakes]
+    assert_equal 6, stats[:resumed_handshakes]
+  end
+
+  def test_resumed_peer_still_verified
+    omit("No SSL") unless EM.ssl?
+
+    verified = Array.new(3) { [] }
+    stats = run_clients('TLSv1_2', verified.map { |v| [{ verify_peer: true }, v] })
+
+    assert_equal 4, stats[:resumed_handshakes]
+    verified.each do |certs|
+      assert_equal File.read(CERT_FILE).strip, certs.last.strip
+    end
+  end
+
+end
@@ -0,0 +1,68 @@
+require_relative 'em_test_helper'
+
+class TestSSLContextCache < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(ssl_version)
+      @ssl_version = ssl_version
+    end
+
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE, ssl_version: @ssl_version
+    end
+  end
+
+  module Client
+    def initialize(results, after)
+      @results, @after = results, after
+    end
+
+    def connection_completed
+      start_tls
+    end
+
+    def ssl_handshake_completed
+      @results << get_cipher_protocol
+      close_connection
+    end
+
+    def unbind
+      @after.call
+    end
+  end
+
+  def test_contexts_shared_by_parameters
+    omit("No SSL") unless EM.ssl?
+    omit("TLSv1_3 is unavailable") unless EM.const_defined? :EM_PROTO_TLSv1_3
+
+    results = []
+    stats = nil
+    tls12, tls13 = next_port, next_port
+    connects = [tls12, tls13] * 3
+
+    EM.run do
+      setup_timeout 3
+      EM.start_server '127.0.0.1', tls12, Server, %w(TLSv1_2)
+      EM.start_server '127.0.0.1', tls13, Server, %w(TLSv1_3)
+
+      # One connection at a time, alternating between the two servers.
+      connect_next = proc do
+        if port = connects.shift
+          EM.connect '127.0.0.1', port, Client, results, connect_next
+        else
+          EM.add_timer(0.1) { stats = EM.tls_stats; EM.stop }
+        end
+      end
+      connect_next.call
+    end
+
+    assert_equal %w(TLSv1.2 TLSv1.3) * 3, results
+    # One context for the clients and one for each server, out of twelve connections.
+    assert_equal 3, stats[:contexts_created]
+    assert_equal 9, stats[:contexts_reused]
+  end
+
+end
@@ -0,0 +1,135 @@
+require_relative 'em_test_helper'
+
+class TestSSLDynamicRecords < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  PAYLOAD = Random.new(4).bytes(2 * 1024 * 1024)
+
+  # Sends PAYLOAD, and with a pause, sends it again after the pause.
+  module Server
+    def initialize(tls, pause)
+      @tls, @pause = tls, pause
+    end
+
+    def post_init
+      start_tls @tls.merge(private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE, ssl_version: %w(TLSv1_2))
+    end
+
+    def ssl_handshake_completed
+      send_data PAYLOAD
+      EM.add_timer(@pause) { send_data PAYLOAD } if @pause
+    end
+  end
+
+  # Passes the bytes between the client and the server unchanged, and notes
+  # the size of each application data record from the server.
+  module Relay
+    def initialize(port, records)
+      @records = records
+      @buffer = ''.b
+      @server = EM.connect '127.0.0.1', port, RelayUpstream, self
+    end
+
+    def receive_data(data)
+      @server.send_data data
+    end
+
+    def from_server(data)
+      send_data data
+      @buffer << data
+      while @buffer.bytesize >= 5
+        type, _, length = @buffer.unpack('Cnn')
+        break if @buffer.bytesize < 5 + length
+        @records << length if type == 23
+        @buffer.slice!(0, 5 + length)
+      end
+    end
+
+    def unbind
+      @server.close_connection_after_writing
+    end
+  end
+
+  module RelayUpstream
+    def initialize(relay)
+      @relay = relay
+    end
+
+    def receive_data(data)
+      @relay.from_server data
+    end
+
+    def unbind
+      @relay.close_connection_after_writing
+    end
+  end
+
+  module Client
+    attr_reader :received
+
+    def initialize(expected)
+      @expected = expected
+      @received = ''.b
+    end
+
+    def post_init
+      start_tls
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection if @received.bytesize >= @expected
+    end
+
+    def unbind
+      EM.stop
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+  end
+
+  def transfer(tls, pause = nil)
+    client, records = nil, []
+    EM.run do
+      setup_timeout 5
+      port, relay_port = next_port, next_port
+      EM.start_server '127.0.0.1', port, Server, tls, pause
+      EM.start_server '127.0.0.1', relay_port, Relay, port, records
+      client = EM.connect '127.0.0.1', relay_port, Client, PAYLOAD.bytesize * (pause ? 2 : 1)
+    end
+    [client.received, records]
+  end
+
+  # Record lengths include the MAC and padding, so allow some overhead.
+  def small?(length)
+    length < 1400 + 100
+  end
+
+  def test_small_records_then_full_size
+    received, records = transfer(dynamic_records: true)
+    assert PAYLOAD == received
+
+    small = records.take_while { |length| small?(length) }
+    assert_in_delta 1024 * 1024 / 1400, small.size, 2
+    assert records.drop(small.size).first(10).all? { |length| length > 16 * 1024 }
+  end
+
+  def test_full_size_records_by_default
+    received, records = transfer({})
+    assert PAYLOAD == received
+    assert records.first > 16 * 1024
+  end
+
+  def test_small_records_again_after_idle
+    received, records = transfer({ dynamic_records: true }, 1.2)
+    assert PAYLOAD + PAYLOAD == received
+
+    small = records.count { |length| small?(length) }
+    assert_in_delta 2 * (1024 * 1024 / 1400), small, 4
+  end
+
+end
@@ -0,0 +1,166 @@
+require_relative 'em_test_helper'
+
+class TestSSLHandshakeThreads < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(tls, protocols)
+      @tls, @protocols = tls, protocols
+    end
+
+    def post_init
+      start_tls @tls.merge(private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE)
+    end
+
+    def ssl_handshake_completed
+      @protocols << get_cipher_protocol
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received, :handshake
+
+    def initialize(tls, payload, done)
+      @tls, @payload, @done = tls, payload, done
+      @received = ''.b
+    end
+
+    # The payload waits behind the handshake.
+    def post_init
+      start_tls @tls
+      send_data @payload
+    end
+
+    def ssl_handshake_completed
+      @handshake = true
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection if @received.bytesize >= @payload.bytesize
+    end
+
+    def unbind
+      @done.call
+    end
+  end
+
+  # Greets and hangs up while its handshake is still queued for a thread.
+  module GreetingServer
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE
+      EM.add_timer(0.01) do
+        send_data 'hello'
+        $sizes << get_outbound_data_size
+        close_connection_after_writing
+      end
+    end
+  end
+
+  module GreetedClient
+    attr_reader :handshake, :data
+
+    def initialize(done)
+      @done = done
+      @data = ''
+    end
+
+    def connection_completed
+      start_tls
+    end
+
+    def ssl_handshake_completed
+      @handshake = true
+    end
+
+    def receive_data(data)
+      @data << data
+    end
+
+    def unbind
+      @done.call
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+    EM.set_tls_handshake_threads 2
+  end
+
+  def teardown
+    EM.set_tls_handshake_threads 0 if EM.ssl?
+  end
+
+  def run_clients(count, server_tls = {}, client_tls = {})
+    clients, protocols, stats = [], [], nil
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server, server_tls, protocols
+      remaining = count
+      done = proc do
+        remaining -= 1
+        if remaining == 0
+          stats = EM.tls_stats
+          EM.stop
+        end
+      end
+      count.times do |i|
+        clients << EM.connect('127.0.0.1', port, Client, client_tls, "payload #{i} " * 1000, done)
+      end
+    end
+    [clients, protocols, stats]
+  end
+
+  def test_concurrent_handshakes
+    assert_equal 2, EM.tls_handshake_threads
+    clients, protocols, stats = run_clients(20)
+
+    clients.each_with_index do |client, i|
+      assert client.handshake
+      assert_equal "payload #{i} " * 1000, client.received
+    end
+    assert_equal 20, protocols.compact.size
+    assert_equal 40, stats[:full_handshakes]
+  end
+
+  def test_close_after_writing_during_handshake
+    # One thread for many clients, so most handshakes wait their turn.
+    EM.set_tls_handshake_threads 1
+    $sizes = []
+    clients = []
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      remaining = 30
+      done = proc { EM.stop if (remaining -= 1) == 0 }
+      EM.start_server '127.0.0.1', port, GreetingServer
+      30.times { clients << EM.connect('127.0.0.1', port, GreetedClient, done) }
+    end
+
+    # What's held for the handshake counts as unsent, and holds the close back.
+    assert_equal 30, $sizes.size
+    assert $sizes.all? { |size| size > 0 }
+    assert clients.all?(&:handshake)
+    assert clients.all? { |client| client.data == 'hello' }
+  end
+
+  def test_failed_handshake
+    omit("TLSv1_3 is unavailable") unless EM.const_defined? :EM_PROTO_TLSv1_3
+
+    clients, protocols, _ = run_clients(3, { ssl_version: %w(TLSv1_2) }, { ssl_version: %w(TLSv1_3) })
+
+    clients.each do |client|
+      assert_nil client.handshake
+      assert_equal '', client.received
+    end
+    assert_equal [], protocols
+  end
+
+end
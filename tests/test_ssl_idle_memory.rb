@@ -0,0 +1,99 @@
+require_relative 'em_test_helper'
+
+class TestSSLIdleMemory < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(sizes)
+      @sizes = sizes
+    end
+
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE
+      @sizes << tls_memory
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  # Says hello, waits for the echo, then does it again after a pause.
+  module Client
+    attr_reader :received, :sizes, :shrunk
+
+    def initialize(pause)
+      @pause = pause
+      @received = ''.b
+      @sizes = [tls_memory]
+      @shrunk = []
+    end
+
+    def post_init
+      start_tls
+    end
+
+    def ssl_handshake_completed
+      send_data 'hello'
+    end
+
+    def receive_data(data)
+      @received << data
+      @sizes << tls_memory
+      @shrunk << tls_shrunk?
+      if @received == 'hello'
+        EM.add_timer(@pause) do
+          @shrunk << tls_shrunk?
+          send_data 'again'
+        end
+      else
+        close_connection
+      end
+    end
+
+    def unbind
+      EM.stop
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+  end
+
+  def teardown
+    EM.set_tls_idle_shrink 0 if EM.ssl?
+  end
+
+  def exchange(pause)
+    client, server_sizes = nil, []
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server, server_sizes
+      client = EM.connect '127.0.0.1', port, Client, pause
+    end
+    [client, server_sizes]
+  end
+
+  def test_tls_memory
+    client, server_sizes = exchange(0)
+
+    assert_equal 'helloagain', client.received
+    assert_nil client.sizes.first
+    assert_equal [false, false, false], client.shrunk
+    (client.sizes.drop(1) + server_sizes).each { |size| assert_operator size, :<, 4096 }
+  end
+
+  def test_idle_shrink
+    EM.set_tls_idle_shrink 0.1
+    assert_in_delta 0.1, EM.tls_idle_shrink, 0.001
+
+    client, _ = exchange(0.5)
+    assert_equal 'helloagain', client.received
+    # Shrunk while waiting to say it again, and grown back to say it.
+    assert_equal [false, true, false], client.shrunk
+  end
+
+end
@@ -0,0 +1,108 @@
+require_relative 'em_test_helper'
+
+# Without the kernel's tls module (or an OpenSSL built without kTLS) these
+# connections fall back to userspace TLS on the socket, which is what most
+# of this exercises; #ktls_status tells which one ran.
+class TestSSLKtls < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module EchoServer
+    def initialize(tls)
+      @tls = tls
+    end
+
+    def post_init
+      start_tls @tls.merge(private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE)
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received, :handshake, :ktls, :verified
+
+    def initialize(tls, payload)
+      @tls, @payload = tls, payload
+      @received = ''.b
+      @verified = []
+    end
+
+    # Started before the connect completes, with data queued behind the
+    # handshake.
+    def post_init
+      start_tls @tls
+      send_data @payload
+    end
+
+    def ssl_verify_peer(cert)
+      @verified << cert
+      true
+    end
+
+    def ssl_handshake_completed
+      @handshake = get_cipher_protocol
+      @ktls = ktls_status
+    end
+
+    def receive_data(data)
+      @received << data
+      close_connection if @received.bytesize >= @payload.bytesize
+    end
+
+    def unbind
+      EM.stop
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+  end
+
+  def exchange(server_tls, client_tls, payload)
+    client = nil
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, EchoServer, server_tls
+      client = EM.connect '127.0.0.1', port, Client, client_tls, payload
+    end
+    client
+  end
+
+  def test_echo_large_payload
+    payload = Random.new(1).bytes(1024 * 1024)
+    client = exchange({ ktls: true }, { ktls: true }, payload)
+
+    assert_equal payload.bytesize, client.received.bytesize
+    assert payload == client.received
+    assert_kind_of Array, client.ktls
+    assert_equal [], client.ktls - [:send, :recv]
+  end
+
+  def test_tls12_with_memory_bio_peer
+    payload = 'x' * 100_000
+
+    client = exchange({ ktls: true, ssl_version: %w(TLSv1_2) }, {}, payload)
+    assert_equal 'TLSv1.2', client.handshake
+    assert payload == client.received
+    assert_nil client.ktls.first
+
+    client = exchange({ ssl_version: %w(TLSv1_2) }, { ktls: true, verify_peer: true }, payload)
+    assert_equal 'TLSv1.2', client.handshake
+    assert payload == client.received
+    assert_equal File.read(CERT_FILE).strip, client.verified.last.strip
+  end
+
+  def test_failed_handshake
+    omit("TLSv1_3 is unavailable") unless EM.const_defined? :EM_PROTO_TLSv1_3
+
+    client = exchange({ ktls: true, ssl_version: %w(TLSv1_2) }, { ktls: true, ssl_version: %w(TLSv1_3) }, 'x')
+    assert_nil client.handshake
+    assert_equal '', client.received
+  end
+
+end
@@ -0,0 +1,81 @@
+require_relative 'em_test_helper'
+
+class TestSSLLargeTransfer < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  PAYLOAD = Random.new(2).bytes(1024 * 1024)
+
+  module Server
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE
+    end
+
+    def ssl_handshake_completed
+      send_data PAYLOAD
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    attr_reader :received, :chunks
+
+    def initialize(upload)
+      @upload = upload
+      @received = ''.b
+      @chunks = 0
+    end
+
+    def post_init
+      start_tls
+      send_data @upload if @upload
+    end
+
+    # Whatever was sent comes back after the server's own payload.
+    def receive_data(data)
+      @chunks += 1
+      @received << data
+      close_connection if @received.bytesize >= PAYLOAD.bytesize + @upload.to_s.bytesize
+    end
+
+    def unbind
+      EM.stop
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+  end
+
+  def transfer(upload = nil)
+    client = nil
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server
+      client = EM.connect '127.0.0.1', port, Client, upload
+    end
+    client
+  end
+
+  # Plaintext used to arrive 2 KB at a time, so this took over 500 calls.
+  def test_download_in_large_chunks
+    client = transfer
+
+    assert PAYLOAD == client.received
+    assert client.chunks <= 64, "#{client.chunks} receive_data calls"
+  end
+
+  def test_upload_echoed_intact
+    upload = Random.new(3).bytes(3 * 1024 * 1024 + 17)
+    client = transfer(upload)
+
+    assert_equal PAYLOAD.bytesize + upload.bytesize, client.received.bytesize
+    assert PAYLOAD + upload == client.received
+  end
+
+end
@@ -0,0 +1,231 @@
+require_relative 'em_test_helper'
+
+class TestSSLSessionResumption < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module EchoServer
+    def initialize(ssl_version)
+      @ssl_version = ssl_version
+    end
+
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE, ssl_version: @ssl_version
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  # Logs who it is when it's asked to verify its peer and when its
+  # handshake completes.
+  module VerifyingServer
+    def initialize(name, log, tls, verdict)
+      @name, @log, @tls, @verdict = name, log, tls, verdict
+    end
+
+    def post_init
+      start_tls @tls.merge(private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE)
+    end
+
+    def ssl_verify_peer(cert)
+      @log << [@name, :verify]
+      @verdict
+    end
+
+    def ssl_handshake_completed
+      @log << [@name, :handshake]
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+  end
+
+  def teardown
+    EM.set_tls_ticket_keys if EM.ssl?
+  end
+
+  # Connects with Ruby's OpenSSL client, offering +session+ if given, and
+  # returns whether it was resumed along with the session to offer next.
+  # A byte is echoed so that TLS 1.3 tickets, sent after the handshake,
+  # have arrived before the session is taken.
+  def connect(port, ssl_version, session)
+    ctx = OpenSSL::SSL::SSLContext.new
+    ctx.min_version = ctx.max_version = ssl_version
+    socket = TCPSocket.new('127.0.0.1', port)
+    ssl = OpenSSL::SSL::SSLSocket.new(socket, ctx)
+    ssl.session = session if session
+    ssl.connect
+    ssl.write 'x'
+    ssl.read 1
+    [ssl.session_reused?, ssl.session]
+  ensure
+    ssl.close if ssl
+    socket.close if socket
+  end
+
+  # Runs +client+ on a thread against an echo server; it is passed a proc
+  # that runs a block on the reactor thread.
+  def with_server(ssl_version, &client)
+    port = next_port
+    stats = nil
+    EM.run do
+      setup_timeout 5
+      EM.start_server '127.0.0.1', port, EchoServer, [ssl_version.to_s.sub('1', 'v1')]
+      on_reactor = proc do |&blk|
+        q = Queue.new
+        EM.schedule { q << blk.call }
+        q.pop
+      end
+      EM.defer(proc { client.call(port, on_reactor) }, proc { stats = EM.tls_stats; EM.stop })
+    end
+    stats
+  end
+
+  # Like with_server, with a VerifyingServer listening for each of +listeners+,
+  # a hash of their TLS options and verdicts by name. The client gets their ports.
+  def with_listeners(log, listeners, &client)
+    ports = {}
+    EM.run do
+      setup_timeout 5
+      listeners.each do |name, (tls, verdict)|
+        ports[name] = next_port
+        EM.start_server '127.0.0.1', ports[name], VerifyingServer, name, log, tls, verdict
+      end
+      EM.defer(proc { client.call(ports) }, proc { EM.stop })
+    end
+  end
+
+  # Connects over TLS 1.2, with the client certificate if +cert+, and
+  # returns whether the session was resumed along with the session, or
+  # with the error if the server turned the client away.
+  def connect_with_cert(port, session, cert)
+    ctx = OpenSSL::SSL::SSLContext.new
+    ctx.min_version = ctx.max_version = :TLS1_2
+    if cert
+      ctx.cert = OpenSSL::X509::Certificate.new(File.read(CERT_FILE))
+      ctx.key = OpenSSL::PKey.read(File.read(PRIVATE_KEY_FILE))
+    end
+    socket = TCPSocket.new('127.0.0.1', port)
+    ssl = OpenSSL::SSL::SSLSocket.new(socket, ctx)
+    ssl.session = session if session
+    ssl.connect
+    # A resumed handshake the server turns away is over for the client.
+    reused = ssl.session_reused?
+    ssl.write 'x'
+    ssl.read 1
+    [reused, ssl.session]
+  rescue OpenSSL::SSL::SSLError, SystemCallError => e
+    [reused, e]
+  ensure
+    ssl.close if ssl rescue nil
+    socket.close if socket
+  end
+
+  def test_no_resuming_past_a_required_cert
+    log, results = [], []
+    listeners = { open: [{}, true], strict: [{ verify_peer: true, fail_if_no_peer_cert: true }, true] }
+    with_listeners(log, listeners) do |ports|
+      reused, session = connect_with_cert(ports[:open], nil, false)
+      results << reused
+      results << connect_with_cert(ports[:strict], session, false)
+    end
+
+    assert_equal false, results[0]
+    assert_not_equal true, results[1][0]
+    assert_kind_of Exception, results[1][1]
+    assert_equal [[:open, :handshake]], log
+  end
+
+  def test_resumed_peer_is_verified_by_each_listener
+    log, results = [], []
+    listeners = { trusting: [{ verify_peer: true }, true], wary: [{ verify_peer: true }, false] }
+    with_listeners(log, listeners) do |ports|
+      reused, session = connect_with_cert(ports[:trusting], nil, true)
+      results << reused
+      results << connect_with_cert(ports[:wary], session, true)
+    end
+
+    assert_equal false, results[0]
+    # The wary listener resumed the session, and still turned it away.
+    assert_equal true, results[1][0]
+    assert_kind_of Exception, results[1][1]
+    assert_equal [[:trusting, :verify], [:trusting, :handshake], [:wary, :verify]], log.uniq
+  end
+
+  def test_session_resumed
+    results = []
+    stats = with_server(:TLS1_2) do |port|
+      session = nil
+      3.times do
+        reused, session = connect(port, :TLS1_2, session)
+        results << reused
+      end
+    end
+
+    assert_equal [false, true, true], results
+    assert_equal 1, stats[:full_handshakes]
+    assert_equal 2, stats[:resumed_handshakes]
+  end
+
+  def test_ticket_key_rotation
+    omit("TLSv1_3 is unavailable") unless EM.const_defined? :EM_PROTO_TLSv1_3
+
+    old_key, new_key, other_key = Array.new(3) { OpenSSL::Random.random_bytes(48) }
+    assert_raise(ArgumentError) { EM.set_tls_ticket_keys('too short') }
+    EM.set_tls_ticket_keys old_key
+
+    results = []
+    with_server(:TLS1_3) do |port, on_reactor|
+      reused, session = connect(port, :TLS1_3, nil)
+      results << reused
+
+      on_reactor.call { EM.set_tls_ticket_keys new_key, old_key }
+      reused, = connect(port, :TLS1_3, session)
+      results << reused
+
+      on_reactor.call { EM.set_tls_ticket_keys other_key }
+      reused, = connect(port, :TLS1_3, session)
+      results << reused
+    end
+
+    assert_equal [false, true, false], results
+  end
+
+  # The name of the key the session's ticket was issued under.
+  def ticket_key_name(session)
+    ticket = OpenSSL::ASN1.decode(session.to_der).value.find { |v| v.tag_class == :CONTEXT_SPECIFIC && v.tag == 10 }
+    ticket && ticket.value[0].value[0, 16]
+  end
+
+  def test_ticket_keys_reach_retired_contexts
+    key = OpenSSL::Random.random_bytes(48)
+    reloaded = name = nil
+    with_server(:TLS1_2) do |port, on_reactor|
+      count = on_reactor.call { EM.connection_count }
+      socket = TCPSocket.new('127.0.0.1', port)
+      # Until the server has started TLS on it, with the context about to be retired.
+      sleep 0.01 until on_reactor.call { EM.connection_count } > count
+      reloaded = on_reactor.call { n = EM.reload_tls_file(CERT_FILE); EM.set_tls_ticket_keys key; n }
+
+      ctx = OpenSSL::SSL::SSLContext.new
+      ctx.min_version = ctx.max_version = :TLS1_2
+      ssl = OpenSSL::SSL::SSLSocket.new(socket, ctx)
+      ssl.connect
+      name = ticket_key_name(ssl.session)
+      ssl.close
+      socket.close
+    end
+
+    assert_equal 1, reloaded
+    assert_equal key[0, 16], name
+  end
+
+end
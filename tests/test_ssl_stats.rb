@@ -0,0 +1,98 @@
+require_relative 'em_test_helper'
+
+class TestSSLStats < Test::Unit::TestCase
+
+  CERT_FILE = "#{__dir__}/client.crt"
+  PRIVATE_KEY_FILE = "#{__dir__}/client.key"
+
+  module Server
+    def initialize(ssl_version)
+      @ssl_version = ssl_version
+    end
+
+    def post_init
+      start_tls private_key_file: PRIVATE_KEY_FILE, cert_chain_file: CERT_FILE, ssl_version: @ssl_version
+    end
+
+    def receive_data(data)
+      send_data data
+    end
+  end
+
+  module Client
+    def initialize(tls, payload, done)
+      @tls, @payload, @done = tls, payload, done
+      @received = 0
+    end
+
+    def post_init
+      start_tls @tls
+    end
+
+    def ssl_handshake_completed
+      send_data @payload
+    end
+
+    def receive_data(data)
+      @received += data.bytesize
+      close_connection if @received >= @payload.bytesize
+    end
+
+    def unbind
+      @done.call
+    end
+  end
+
+  def setup
+    omit("No SSL") unless EM.ssl?
+  end
+
+  def run_clients(server_version, clients)
+    stats = nil
+    EM.run do
+      setup_timeout 5
+      port = next_port
+      EM.start_server '127.0.0.1', port, Server, server_version
+      remaining = clients.size
+      done = proc do
+        remaining -= 1
+        EM.next_tick { stats = EM.tls_stats; EM.stop } if remaining == 0
+      end
+      clients.each { |tls, payload| EM.connect '127.0.0.1', port, Client, tls, payload, done }
+    end
+    stats
+  end
+
+  def test_counts_and_times
+    payload = 'x' * 100_000
+    stats = run_clients(%w(TLSv1_2), [[{}, payload], [{}, payload]])
+
+    assert_equal 4, stats[:started_handshakes]
+    assert_equal 4, stats[:full_handshakes] + stats[:resumed_handshakes]
+    assert_equal 0, stats[:failed_handshakes]
+    assert_equal 12, stats[:handshake_times].size
+    assert_equal 4, stats[:handshake_times].sum
+
+    # Each payload goes out from the client and back from the server.
+    assert_equal 4 * payload.bytesize, stats[:bytes_encrypted]
+    assert_equal 4 * payload.bytesize, stats[:bytes_decrypted]
+    assert_operator stats[:records_sent], :>=, 4 * (payload.bytesize / 16384 + 1)
+    assert_equal stats[:records_sent], stats[:records_received]
+
+    [:read_time, :write_time, :handshake_time].each do |key|
+      assert_operator stats[key], :>, 0
+      assert_operator stats[key], :<, 5
+    end
+  end
+
+  def test_failed_handshakes
+    omit("TLSv1_3 is unavailable") unless EM.const_defined? :EM_PROTO_TLSv1_3
+
+    stats = run_clients(%w(TLSv1_2), [[{ ssl_version: %w(TLSv1_3) }, 'x']])
+
+    assert_equal 2, stats[:started_handshakes]
+    assert_equal 2, stats[:failed_handshakes]
+    assert_equal 0, stats[:handshake_times].sum
+  end
+
+end
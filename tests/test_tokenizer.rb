@@ -0,0 +1,142 @@
+require_relative 'em_test_helper'
+
+class TestTokenizer < Test::Unit::TestCase
+
+  TOKENIZERS = [EM::PureRubyTokenizer]
+  TOKENIZERS << EM::Tokenizer if defined?(EM::Tokenizer)
+
+  def each_tokenizer(*args)
+    TOKENIZERS.each { |klass| yield klass.new(*args), klass.name }
+  end
+
+  def test_default_delimiter
+    each_tokenizer do |t, name|
+      assert_equal [], t.extract("abc"), name
+      assert_equal ["abcdef", "gh"], t.extract("def\ngh\nij"), name
+      assert_equal "ij", t.flush, name
+      assert t.empty?, name
+    end
+  end
+
+  def test_multibyte_delimiter_split_across_chunks
+    each_tokenizer("\r\n") do |t, name|
+      assert_equal [], t.extract("one\r"), name
+      assert_equal ["one", ""], t.extract("\n\r\ntwo"), name
+      assert_equal ["two\rthree"], t.extract("\rthree\r\n"), name
+      assert_equal "", t.flush, name
+    end
+  end
+
+  def test_size_limit
+    each_tokenizer("\n", 8) do |t, name|
+      assert_equal ["12345678"], t.extract("12345678\n1234"), name
+      assert_raise(RuntimeError, name) { t.extract("56789") }
+      assert_equal [], t.extract("ok"), name
+    end
+  end
+
+  def test_flush_keeps_encoding
+    each_tokenizer do |t, name|
+      t.extract "caf\u00e9\nna\u00efve".encode('UTF-8')
+      rest = t.flush
+      assert_equal Encoding::UTF_8, rest.encoding, name
+      assert_equal "na\u00efve", rest, name
+    end
+  end
+
+  def test_buffered_tokenizer_is_native
+    if defined?(EM::Tokenizer)
+      assert BufferedTokenizer.ancestors.include?(EM::Tokenizer)
+    else
+      assert BufferedTokenizer.ancestors.include?(EM::PureRubyTokenizer)
+    end
+  end
+
+  if [:pure_ruby, :java].include? EM.library_type
+    def test_line_framing_unsupported
+      port = next_port
+      EM.run do
+        EM.start_server '127.0.0.1', port
+        EM.connect('127.0.0.1', port) do |c|
+          assert_raises(EM::Unsupported) { c.set_line_framing "\n" }
+          c.set_line_framing nil
+          EM.stop
+        end
+      end
+    end
+  else
+    module LineServer
+      def post_init
+        set_line_framing "\r\n"
+      end
+
+      def receive_line(line)
+        $lines << line
+        set_line_framing nil if line == 'raw'
+      end
+
+      def receive_data(data)
+        $raw << data
+        EM.stop
+      end
+    end
+
+    def test_line_framing
+      $lines, $raw = [], ''
+      port = next_port
+
+      EM.run do
+        setup_timeout
+        EM.start_server '127.0.0.1', port, LineServer
+        EM.connect('127.0.0.1', port) do |c|
+          c.send_data "first\r\nsec"
+          EM.add_timer(0.05) { c.send_data "ond\r\n\r\nraw\r\nrest\r\nof it" }
+        end
+      end
+
+      assert_equal ['first', 'second', '', 'raw'], $lines
+      assert_equal "rest\r\nof it", $raw
+    end
+
+    module LimitedServer
+      def post_init
+        set_line_framing "\n", 16
+      end
+
+      def receive_line(line)
+        $lines << line
+      end
+
+      def unbind(reason)
+        $reason = reason
+        EM.stop
+      end
+    end
+
+    def test_line_framing_max_length
+      $lines, $reason = [], nil
+      port = next_port
+
+      EM.run do
+        setup_timeout
+        EM.start_server '127.0.0.1', port, LimitedServer
+        EM.connect('127.0.0.1', port) { |c| c.send_data "short\n" + ('x' * 64) }
+      end
+
+      assert_equal ['short'], $lines
+      assert_equal Errno::EMSGSIZE, $reason
+    end
+
+    def test_line_framing_max_length_range
+      port = next_port
+      EM.run do
+        EM.start_server '127.0.0.1', port
+        EM.connect('127.0.0.1', port) do |c|
+          assert_raises(ArgumentError) { c.set_line_framing "\n", -1 }
+          c.set_line_framing "\n", 2**32
+          EM.stop
+        end
+      end
+    end
+  end
+end